@@ -0,0 +1,112 @@
+#!/usr/bin/env bash
+#
+# Boots every protocol's stub kernel under qemu and collects how long it
+# took to get to the kernel into a csv.
+#
+# usage: bench.sh <BOOTX64.EFI> <build dir>
+#
+# The stubs are expected in the build dir (see the bench target of the
+# Makefile), the rest comes from the environment. With a PROFILE=1 build
+# of the loader the firmware call totals are collected as well.
+#
+#   OVMF                the firmware to boot with
+#   QEMU, QEMU_ACCEL    the qemu binary and the acceleration to use
+#   BENCH_MODULE_SIZE   bytes of the module/initrd given to each kernel
+#   BENCH_RUNS          how many times each protocol is booted
+#   BENCH_DISK          the controller of the disk, ahci (the q35 default) or virtio
+#   BENCH_BLOCK_READS   yes to read the files from the disk (the default), no
+#                       to read them through the firmware's fat driver
+#
+set -euo pipefail
+
+EFI=$1
+OUT=$2
+
+QEMU=${QEMU:-qemu-system-x86_64}
+QEMU_ACCEL=${QEMU_ACCEL:-}
+BENCH_MODULE_SIZE=${BENCH_MODULE_SIZE:-16777216}
+BENCH_RUNS=${BENCH_RUNS:-5}
+BENCH_DISK=${BENCH_DISK:-ahci}
+BENCH_BLOCK_READS=${BENCH_BLOCK_READS:-yes}
+
+case "$BENCH_DISK" in
+    ahci) DISK_ARGS=(-drive "if=none,id=disk,format=raw,file=fat:%s" -device ahci,id=ahci -device ide-hd,drive=disk,bus=ahci.0) ;;
+    virtio) DISK_ARGS=(-drive "if=virtio,format=raw,file=fat:%s") ;;
+    *) echo "bench: unknown disk $BENCH_DISK, use ahci or virtio" >&2; exit 1 ;;
+esac
+
+if [ -z "${OVMF:-}" ] || [ ! -f "$OVMF" ]; then
+    echo "bench: no OVMF firmware, give one with OVMF=<path>" >&2
+    exit 1
+fi
+
+# the same module for everyone, random so it does not compress
+head -c "$BENCH_MODULE_SIZE" /dev/urandom > "$OUT/module"
+
+RESULTS=$OUT/results.csv
+echo "protocol,run,module_bytes,loader_start_tsc,load_start_tsc,kernel_tsc,loader_cycles,load_cycles,wall_ms,firmware_calls,firmware_cycles,disk,block_reads" > "$RESULTS"
+
+# protocol, kernel and the key the module is passed with
+BENCHES=(
+    "mb2 mb2.elf MODULE_PATH"
+    "stivale stivale.elf MODULE_PATH"
+    "stivale2 stivale.elf MODULE_PATH"
+    "linux bzImage INITRD_PATH"
+)
+
+for bench in "${BENCHES[@]}"; do
+    read -r protocol kernel module_key <<< "$bench"
+
+    # a partition per protocol, so the entry to boot is always the first one
+    image=$OUT/image-$protocol
+    rm -rf "$image"
+    mkdir -p "$image/EFI/BOOT"
+    cp "$EFI" "$image/EFI/BOOT/BOOTX64.EFI"
+    cp "$OUT/$kernel" "$image/kernel"
+    cp "$OUT/module" "$image/module"
+    printf 'TIMEOUT=0\r\nVERBOSE=debugcon\r\nBLOCK_READS=%s\r\n:bench\r\nPROTOCOL=%s\r\nPATH=kernel\r\n%s=module\r\n' \
+        "$BENCH_BLOCK_READS" "$protocol" "$module_key" > "$image/tomatboot.cfg"
+
+    disk=()
+    for arg in "${DISK_ARGS[@]}"; do
+        disk+=("${arg//%s/$image}")
+    done
+
+    for run in $(seq 1 "$BENCH_RUNS"); do
+        serial=$OUT/$protocol-$run.serial
+        debugcon=$OUT/$protocol-$run.debugcon
+
+        # the stub exits with 0, which isa-debug-exit turns into 1
+        start=$(date +%s%N)
+        status=0
+        timeout 60 "$QEMU" $QEMU_ACCEL \
+            -machine q35 -m 1G -smp 4 \
+            -display none -no-reboot \
+            -bios "$OVMF" \
+            "${disk[@]}" \
+            -serial "file:$serial" \
+            -debugcon "file:$debugcon" \
+            -device isa-debug-exit,iobase=0xf4,iosize=0x04 || status=$?
+        end=$(date +%s%N)
+
+        kernel_tsc=$(grep -ao 'KERNEL_TSC=[0-9a-f]*' "$debugcon" | cut -d= -f2 || true)
+        loader=$(grep -ao 'TomatBoot started at TSC [0-9]*, loading at TSC [0-9]*' "$debugcon" | tail -n1 || true)
+        if [ "$status" -ne 1 ] || [ -z "$kernel_tsc" ] || [ -z "$loader" ]; then
+            echo "bench: $protocol run $run did not reach the kernel (qemu exited with $status), see $serial" >&2
+            exit 1
+        fi
+
+        loader_start_tsc=$(echo "$loader" | awk '{ print $5 }' | tr -d ,)
+        load_start_tsc=$(echo "$loader" | awk '{ print $9 }')
+        kernel_tsc=$((16#$kernel_tsc))
+
+        # only there when the loader was built with PROFILE=1
+        firmware_calls=$(grep -a '^total ' "$debugcon" | awk '{ print $2 }' || true)
+        firmware_cycles=$(grep -a '^total ' "$debugcon" | awk '{ print $3 }' || true)
+
+        echo "$protocol,$run,$BENCH_MODULE_SIZE,$loader_start_tsc,$load_start_tsc,$kernel_tsc,$((kernel_tsc - loader_start_tsc)),$((kernel_tsc - load_start_tsc)),$(((end - start) / 1000000)),$firmware_calls,$firmware_cycles,$BENCH_DISK,$BENCH_BLOCK_READS" >> "$RESULTS"
+        echo "$protocol #$run: $((kernel_tsc - loader_start_tsc)) cycles in the loader"
+    done
+done
+
+echo "Results written to $RESULTS"
@@ -0,0 +1,421 @@
+/**
+ * Builds a boot bundle (see src/loaders/bundle/bundle.h) out of a stivale2
+ * kernel and its modules, so the loader only has to put the parts where
+ * they go instead of parsing the kernel and opening every module.
+ *
+ * The kernel is placed where it is linked to, relocatable kernels are
+ * relocated to their link address here.
+ */
+#include <elf.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef uint8_t UINT8;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef char CHAR8;
+
+#include "../src/loaders/bundle/bundle.h"
+
+#define PAGE_SIZE 4096ull
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((UINT64)(a) - 1))
+
+#define HIGHER_HALF 0xffffffff80000000ull
+
+// must match STIVALE2_HEADER
+#define STIVALE2_HEADER_SIZE 32
+#define STIVALE2_HEADER_FLAG_KASLR 1
+
+#define MAX_MODULES 1024
+
+typedef struct _BUFFER {
+    UINT8* Data;
+    UINT64 Size;
+} BUFFER;
+
+typedef struct _INPUT_MODULE {
+    const char* Path;
+    const char* String;
+    BUFFER File;
+} INPUT_MODULE;
+
+static void Fail(const char* Format, ...) __attribute__((noreturn, format(printf, 1, 2)));
+
+static void Fail(const char* Format, ...) {
+    va_list Args;
+    va_start(Args, Format);
+    fprintf(stderr, "mkbundle: ");
+    vfprintf(stderr, Format, Args);
+    fprintf(stderr, "\n");
+    va_end(Args);
+    exit(1);
+}
+
+static BUFFER ReadFile(const char* Path) {
+    BUFFER Buffer = { 0 };
+    FILE* File = fopen(Path, "rb");
+    if (File == NULL) {
+        Fail("could not open `%s`: %s", Path, strerror(errno));
+    }
+
+    if (fseek(File, 0, SEEK_END) != 0 || (long long)(Buffer.Size = ftell(File)) < 0 || fseek(File, 0, SEEK_SET) != 0) {
+        Fail("could not get the size of `%s`", Path);
+    }
+
+    Buffer.Data = malloc(Buffer.Size + 1);
+    if (Buffer.Data == NULL || fread(Buffer.Data, 1, Buffer.Size, File) != Buffer.Size) {
+        Fail("could not read `%s`", Path);
+    }
+
+    fclose(File);
+    return Buffer;
+}
+
+/**
+ * Check that a part of the kernel file is inside of it and get it
+ */
+static void* KernelAt(BUFFER* Kernel, UINT64 Offset, UINT64 Size) {
+    if (Offset > Kernel->Size || Size > Kernel->Size - Offset) {
+        Fail("the kernel is truncated");
+    }
+    return Kernel->Data + Offset;
+}
+
+typedef struct _KERNEL {
+    Elf64_Ehdr* Ehdr;
+    Elf64_Phdr* Phdrs;
+
+    UINT8 Header[STIVALE2_HEADER_SIZE];
+    UINT64 HeaderAddress;
+    UINT64 VirtualOffset;
+    UINT64 Entry;
+
+    // the loaded image, from the lowest segment to the end of the highest
+    UINT64 Low;
+    UINT64 High;
+    UINT8* Image;
+} KERNEL;
+
+static UINT64 SegmentAddress(KERNEL* Kernel, Elf64_Phdr* Phdr) {
+    return Kernel->VirtualOffset ? Phdr->p_vaddr - Kernel->VirtualOffset : Phdr->p_paddr;
+}
+
+/**
+ * Get the image memory of a kernel address, like the loader sees it
+ */
+static void* ImageAt(KERNEL* Kernel, UINT64 Address, UINT64 Size) {
+    UINT64 Physical = Kernel->VirtualOffset ? Address - Kernel->VirtualOffset : Address;
+    if (Physical < Kernel->Low || Physical > Kernel->High || Size > Kernel->High - Physical) {
+        Fail("address %#llx is outside of the kernel", (unsigned long long)Address);
+    }
+    return Kernel->Image + (Physical - Kernel->Low);
+}
+
+/**
+ * Find the stivale2 header and decide on the higher half the way the loader does
+ */
+static void ParseHeader(BUFFER* File, KERNEL* Kernel) {
+    Elf64_Ehdr* Ehdr = Kernel->Ehdr;
+    if (Ehdr->e_shentsize != sizeof(Elf64_Shdr) || Ehdr->e_shstrndx >= Ehdr->e_shnum) {
+        Fail("the kernel has no section names");
+    }
+
+    Elf64_Shdr* Shdrs = KernelAt(File, Ehdr->e_shoff, (UINT64)Ehdr->e_shnum * sizeof(Elf64_Shdr));
+    Elf64_Shdr* Names = &Shdrs[Ehdr->e_shstrndx];
+    const char* Strings = KernelAt(File, Names->sh_offset, Names->sh_size);
+
+    Elf64_Shdr* Found = NULL;
+    for (int i = 0; i < Ehdr->e_shnum && Found == NULL; i++) {
+        if (Shdrs[i].sh_name < Names->sh_size && strncmp(Strings + Shdrs[i].sh_name, ".stivale2hdr", Names->sh_size - Shdrs[i].sh_name) == 0) {
+            Found = &Shdrs[i];
+        }
+    }
+    if (Found == NULL) {
+        Fail("the kernel has no .stivale2hdr section");
+    }
+    if (Found->sh_size != STIVALE2_HEADER_SIZE) {
+        Fail("the .stivale2hdr section is %llu bytes", (unsigned long long)Found->sh_size);
+    }
+    memcpy(Kernel->Header, KernelAt(File, Found->sh_offset, STIVALE2_HEADER_SIZE), STIVALE2_HEADER_SIZE);
+    Kernel->HeaderAddress = Found->sh_addr;
+
+    UINT64 EntryPoint;
+    memcpy(&EntryPoint, Kernel->Header, sizeof(EntryPoint));
+    Kernel->VirtualOffset = (EntryPoint != 0 ? EntryPoint : Ehdr->e_entry) > HIGHER_HALF ? HIGHER_HALF : 0;
+}
+
+/**
+ * Apply the relative relocations with no slide, like the loader would
+ * if the kernel was not moved
+ */
+static void Relocate(KERNEL* Kernel, Elf64_Phdr* Dynamic) {
+    UINT64 Rela = 0;
+    UINT64 RelaSize = 0;
+    UINT64 RelaEnt = sizeof(Elf64_Rela);
+
+    for (UINT64 Offset = 0; ; Offset += sizeof(Elf64_Dyn)) {
+        Elf64_Dyn* Dyn = ImageAt(Kernel, Dynamic->p_vaddr + Offset, sizeof(Elf64_Dyn));
+        if (Dyn->d_tag == DT_NULL) {
+            break;
+        }
+
+        switch (Dyn->d_tag) {
+            case DT_RELA: Rela = Dyn->d_un.d_ptr; break;
+            case DT_RELASZ: RelaSize = Dyn->d_un.d_val; break;
+            case DT_RELAENT: RelaEnt = Dyn->d_un.d_val; break;
+            case DT_REL: Fail("the kernel has relocations without addends"); break;
+            default: break;
+        }
+    }
+
+    if (Rela == 0) {
+        return;
+    }
+    if (RelaEnt < sizeof(Elf64_Rela)) {
+        Fail("invalid relocation entry size %llu", (unsigned long long)RelaEnt);
+    }
+
+    UINT8* Table = ImageAt(Kernel, Rela, RelaSize);
+    for (UINT64 Offset = 0; Offset + sizeof(Elf64_Rela) <= RelaSize; Offset += RelaEnt) {
+        Elf64_Rela Reloc;
+        memcpy(&Reloc, Table + Offset, sizeof(Reloc));
+        switch (ELF64_R_TYPE(Reloc.r_info)) {
+            case R_X86_64_NONE:
+                break;
+
+            case R_X86_64_RELATIVE: {
+                UINT64 Value = Reloc.r_addend;
+                memcpy(ImageAt(Kernel, Reloc.r_offset, sizeof(Value)), &Value, sizeof(Value));
+                break;
+            }
+
+            default:
+                Fail("unsupported relocation type %llu", (unsigned long long)ELF64_R_TYPE(Reloc.r_info));
+        }
+    }
+}
+
+static void LoadKernel(BUFFER* File, KERNEL* Kernel) {
+    Kernel->Ehdr = KernelAt(File, 0, sizeof(Elf64_Ehdr));
+    Elf64_Ehdr* Ehdr = Kernel->Ehdr;
+    if (memcmp(Ehdr->e_ident, ELFMAG, SELFMAG) != 0 || Ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+        Ehdr->e_ident[EI_DATA] != ELFDATA2LSB || Ehdr->e_ident[EI_VERSION] != EV_CURRENT) {
+        Fail("the kernel is not a 64bit little endian ELF");
+    }
+    if (Ehdr->e_type != ET_EXEC && Ehdr->e_type != ET_DYN) {
+        Fail("the kernel is not an executable");
+    }
+    if (Ehdr->e_phentsize != sizeof(Elf64_Phdr)) {
+        Fail("the kernel has no program headers");
+    }
+    Kernel->Phdrs = KernelAt(File, Ehdr->e_phoff, (UINT64)Ehdr->e_phnum * sizeof(Elf64_Phdr));
+
+    ParseHeader(File, Kernel);
+
+    UINT64 Flags;
+    memcpy(&Flags, Kernel->Header + 16, sizeof(Flags));
+    if (Flags & STIVALE2_HEADER_FLAG_KASLR) {
+        fprintf(stderr, "mkbundle: note: the kernel asks for kaslr, it is loaded at its link address instead\n");
+    }
+
+    // lay the image out in memory
+    Kernel->Low = UINT64_MAX;
+    Kernel->High = 0;
+    for (int i = 0; i < Ehdr->e_phnum; i++) {
+        Elf64_Phdr* Phdr = &Kernel->Phdrs[i];
+        if (Phdr->p_type != PT_LOAD || Phdr->p_memsz == 0) continue;
+        if (Phdr->p_filesz > Phdr->p_memsz) {
+            Fail("segment %d is bigger in the file than in memory", i);
+        }
+        UINT64 Address = SegmentAddress(Kernel, Phdr);
+        if (Phdr->p_memsz > UINT64_MAX - Address) {
+            Fail("segment %d wraps around", i);
+        }
+        Kernel->Low = Address < Kernel->Low ? Address : Kernel->Low;
+        Kernel->High = Address + Phdr->p_memsz > Kernel->High ? Address + Phdr->p_memsz : Kernel->High;
+    }
+    if (Kernel->Low >= Kernel->High) {
+        Fail("the kernel has nothing to load");
+    }
+    if (Kernel->High - Kernel->Low > (1ull << 32)) {
+        Fail("the kernel spans more than 4GB");
+    }
+
+    Kernel->Image = calloc(1, Kernel->High - Kernel->Low);
+    if (Kernel->Image == NULL) {
+        Fail("out of memory");
+    }
+
+    Elf64_Phdr* Dynamic = NULL;
+    for (int i = 0; i < Ehdr->e_phnum; i++) {
+        Elf64_Phdr* Phdr = &Kernel->Phdrs[i];
+        if (Phdr->p_type == PT_DYNAMIC) {
+            Dynamic = Phdr;
+        }
+        if (Phdr->p_type != PT_LOAD || Phdr->p_memsz == 0) continue;
+        memcpy(Kernel->Image + (SegmentAddress(Kernel, Phdr) - Kernel->Low), KernelAt(File, Phdr->p_offset, Phdr->p_filesz), Phdr->p_filesz);
+    }
+
+    // the header got relocated with the kernel, take the final values
+    if (Ehdr->e_type == ET_DYN && Dynamic != NULL) {
+        Relocate(Kernel, Dynamic);
+        memcpy(Kernel->Header, ImageAt(Kernel, Kernel->HeaderAddress, STIVALE2_HEADER_SIZE), STIVALE2_HEADER_SIZE);
+    }
+
+    UINT64 EntryPoint;
+    memcpy(&EntryPoint, Kernel->Header, sizeof(EntryPoint));
+    Kernel->Entry = EntryPoint != 0 ? EntryPoint : Ehdr->e_entry;
+}
+
+static void Usage(const char* Name) {
+    fprintf(stderr,
+            "usage: %s -o OUTPUT [-c CMDLINE] KERNEL [-m MODULE [-s STRING]]...\n"
+            "\n"
+            "Build a bundle for PROTOCOL=bundle out of a stivale2 kernel and its\n"
+            "modules, each -s is the string of the module before it.\n"
+            "\n"
+            "The bundle may be compressed afterwards (gzip, lz4 or zstd), it is\n"
+            "then decompressed as a whole before it is loaded.\n",
+            Name);
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    const char* Output = NULL;
+    const char* Cmdline = "";
+    const char* KernelPath = NULL;
+    INPUT_MODULE Modules[MAX_MODULES];
+    UINT32 ModuleCount = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            Output = argv[++i];
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            Cmdline = argv[++i];
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            if (ModuleCount == MAX_MODULES) {
+                Fail("too many modules");
+            }
+            Modules[ModuleCount].Path = argv[++i];
+            Modules[ModuleCount].String = "";
+            ModuleCount++;
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            if (ModuleCount == 0) {
+                Fail("-s must come after the -m it is for");
+            }
+            Modules[ModuleCount - 1].String = argv[++i];
+        } else if (argv[i][0] != '-' && KernelPath == NULL) {
+            KernelPath = argv[i];
+        } else {
+            Usage(argv[0]);
+        }
+    }
+    if (Output == NULL || KernelPath == NULL) {
+        Usage(argv[0]);
+    }
+
+    BUFFER KernelFile = ReadFile(KernelPath);
+    KERNEL Kernel = { 0 };
+    LoadKernel(&KernelFile, &Kernel);
+
+    UINT32 SegmentCount = 0;
+    for (int i = 0; i < Kernel.Ehdr->e_phnum; i++) {
+        if (Kernel.Phdrs[i].p_type == PT_LOAD && Kernel.Phdrs[i].p_memsz != 0) {
+            SegmentCount++;
+        }
+    }
+
+    for (UINT32 i = 0; i < ModuleCount; i++) {
+        Modules[i].File = ReadFile(Modules[i].Path);
+        if (strlen(Modules[i].String) >= sizeof(((BUNDLE_MODULE*)0)->String)) {
+            Fail("the string of `%s` is too long", Modules[i].Path);
+        }
+    }
+
+    // the header and the tables
+    UINT64 Offset = sizeof(BUNDLE_HEADER) + SegmentCount * sizeof(BUNDLE_SEGMENT) + ModuleCount * sizeof(BUNDLE_MODULE);
+    UINT64 CmdlineOffset = Offset;
+    UINT64 CmdlineSize = strlen(Cmdline) + 1;
+    Offset += CmdlineSize;
+    UINT64 ProtocolHeaderOffset = ALIGN_UP(Offset, 8);
+    Offset = ProtocolHeaderOffset + STIVALE2_HEADER_SIZE;
+    UINT64 HeaderSize = Offset;
+
+    // the segments, at the same place in the page as in memory so they
+    // can be read straight to it, the bss is not stored
+    BUNDLE_SEGMENT* Segments = calloc(SegmentCount, sizeof(BUNDLE_SEGMENT));
+    Offset = ALIGN_UP(Offset, PAGE_SIZE);
+    for (int i = 0, j = 0; i < Kernel.Ehdr->e_phnum; i++) {
+        Elf64_Phdr* Phdr = &Kernel.Phdrs[i];
+        if (Phdr->p_type != PT_LOAD || Phdr->p_memsz == 0) continue;
+        BUNDLE_SEGMENT* Segment = &Segments[j++];
+        Segment->Address = SegmentAddress(&Kernel, Phdr);
+        Segment->FileSize = Phdr->p_filesz;
+        Segment->MemorySize = Phdr->p_memsz;
+        Segment->Offset = ALIGN_UP(Offset - Segment->Address % PAGE_SIZE, PAGE_SIZE) + Segment->Address % PAGE_SIZE;
+        Offset = Segment->Offset + Segment->FileSize;
+    }
+
+    // the modules, each page aligned
+    BUNDLE_MODULE* BundleModules = calloc(ModuleCount ? ModuleCount : 1, sizeof(BUNDLE_MODULE));
+    UINT64 ModulesOffset = ALIGN_UP(Offset, PAGE_SIZE);
+    UINT64 ModulesSize = 0;
+    for (UINT32 i = 0; i < ModuleCount; i++) {
+        BundleModules[i].Offset = ALIGN_UP(ModulesSize, PAGE_SIZE);
+        BundleModules[i].Size = Modules[i].File.Size;
+        strcpy(BundleModules[i].String, Modules[i].String);
+        ModulesSize = BundleModules[i].Offset + BundleModules[i].Size;
+    }
+    UINT64 Size = ModuleCount != 0 ? ModulesOffset + ModulesSize : Offset;
+
+    BUNDLE_HEADER Header = {
+        .Magic = BUNDLE_MAGIC,
+        .Version = BUNDLE_VERSION,
+        .Protocol = BUNDLE_PROTOCOL_STIVALE2,
+        .Size = Size,
+        .HeaderSize = HeaderSize,
+        .SegmentCount = SegmentCount,
+        .ModuleCount = ModuleCount,
+        .VirtualOffset = Kernel.VirtualOffset,
+        .Entry = Kernel.Entry,
+        .ModulesOffset = ModuleCount != 0 ? ModulesOffset : 0,
+        .ModulesSize = ModulesSize,
+        .CmdlineOffset = CmdlineOffset,
+        .CmdlineSize = CmdlineSize,
+        .ProtocolHeaderOffset = ProtocolHeaderOffset,
+        .ProtocolHeaderSize = STIVALE2_HEADER_SIZE,
+    };
+
+    // put it all together
+    UINT8* Bundle = calloc(1, Size);
+    if (Bundle == NULL || Segments == NULL || BundleModules == NULL) {
+        Fail("out of memory");
+    }
+    memcpy(Bundle, &Header, sizeof(Header));
+    memcpy(Bundle + sizeof(Header), Segments, SegmentCount * sizeof(BUNDLE_SEGMENT));
+    memcpy(Bundle + sizeof(Header) + SegmentCount * sizeof(BUNDLE_SEGMENT), BundleModules, ModuleCount * sizeof(BUNDLE_MODULE));
+    memcpy(Bundle + CmdlineOffset, Cmdline, CmdlineSize);
+
+    memcpy(Bundle + ProtocolHeaderOffset, Kernel.Header, STIVALE2_HEADER_SIZE);
+
+    for (UINT32 i = 0; i < SegmentCount; i++) {
+        memcpy(Bundle + Segments[i].Offset, Kernel.Image + (Segments[i].Address - Kernel.Low), Segments[i].FileSize);
+    }
+    for (UINT32 i = 0; i < ModuleCount; i++) {
+        memcpy(Bundle + ModulesOffset + BundleModules[i].Offset, Modules[i].File.Data, Modules[i].File.Size);
+    }
+
+    FILE* File = fopen(Output, "wb");
+    if (File == NULL || fwrite(Bundle, 1, Size, File) != Size || fclose(File) != 0) {
+        Fail("could not write `%s`: %s", Output, strerror(errno));
+    }
+
+    printf("%s: %u segments at %#llx - %#llx, %u modules, %llu bytes\n", Output, SegmentCount,
+           (unsigned long long)Kernel.Low, (unsigned long long)Kernel.High, ModuleCount, (unsigned long long)Size);
+    return 0;
+}
@@ -0,0 +1,92 @@
+#ifndef __HOST_HOST_H__
+#define __HOST_HOST_H__
+
+/**
+ * The boundary between the mock firmware, which is built like the rest
+ * of the loader against the UEFI headers, and the host operating system,
+ * which is built against the libc. Only plain C types cross it.
+ */
+
+typedef struct _HOST_OPTIONS {
+    // the directories that are exposed as file systems
+    const char** Volumes;
+    int VolumeCount;
+
+    // the entry to boot, -1 to only list the entries
+    int Entry;
+
+    // the amount of ram the firmware pretends to have
+    unsigned long long MemorySize;
+
+    // write the boot log to the console as it is made
+    int Verbose;
+
+    // stivale2 tags the boot info must have, the run fails without them
+    unsigned long long ExpectedTags[16];
+    int ExpectedTagCount;
+} HOST_OPTIONS;
+
+/**
+ * The entry of the mock firmware, called from the host main
+ */
+int HostEfiMain(HOST_OPTIONS* Options);
+
+/**
+ * Reserve a range of the address space with no access, the
+ * range must be free in the host process
+ */
+int HostReserve(unsigned long long Base, unsigned long long Size);
+
+/**
+ * Make a reserved range accessible
+ */
+int HostCommit(unsigned long long Base, unsigned long long Size);
+
+/**
+ * Throw away the content of a range and make it inaccessible again
+ */
+void HostDecommit(unsigned long long Base, unsigned long long Size);
+
+void* HostAlloc(unsigned long long Size);
+void HostFree(void* Ptr);
+
+/**
+ * Get information about a host file, returns 0 on success
+ */
+int HostStat(const char* Path, int* IsDirectory, unsigned long long* Size, long long* ModificationTime);
+
+/**
+ * Open a host file for reading, returns -1 on failure
+ */
+int HostOpen(const char* Path);
+long long HostRead(int Fd, void* Buffer, unsigned long long Size, unsigned long long Offset);
+void HostClose(int Fd);
+
+/**
+ * Iterate a host directory, the name is set to the next entry and 0
+ * is returned, 1 when there are no more entries.
+ */
+void* HostOpenDir(const char* Path);
+int HostReadDir(void* Dir, char* Name, unsigned long long NameSize);
+void HostRewindDir(void* Dir);
+void HostCloseDir(void* Dir);
+
+/**
+ * Write utf8 text to the standard output
+ */
+void HostWrite(const char* Text, unsigned long long Length);
+
+/**
+ * A monotonic clock in nanoseconds
+ */
+unsigned long long HostNanoseconds();
+void HostSleep(unsigned long long Microseconds);
+
+/**
+ * Get the local time, as year, month, day, hour, minute and second
+ */
+void HostLocalTime(int Time[6]);
+
+void __attribute__((noreturn)) HostExit(int Code);
+
+#endif //__HOST_HOST_H__
@@ -0,0 +1,219 @@
+#include "Mock.h"
+
+#include <Protocol/LoadedImage.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/PrintLib.h>
+#include <Library/UefiLib.h>
+
+#include <config/BootConfig.h>
+#include <config/BootEntries.h>
+#include <loaders/Loaders.h>
+#include <loaders/mb2/multiboot2.h>
+#include <loaders/stivale2/stivale2.h>
+#include <util/Except.h>
+#include <util/LogUtils.h>
+#include <util/ProfileUtils.h>
+#include <util/fs/Ext4FileSystem.h>
+
+// the same constructors main calls
+extern EFI_STATUS EFIAPI UefiBootServicesTableLibConstructor(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE* SystemTable);
+extern EFI_STATUS EFIAPI DxeDebugLibConstructor(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE* SystemTable);
+extern EFI_STATUS EFIAPI UefiRuntimeServicesTableLibConstructor (IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE* SystemTable);
+
+static EFI_SYSTEM_TABLE mSystemTable;
+static EFI_LOADED_IMAGE_PROTOCOL mLoadedImage;
+static HOST_OPTIONS* mOptions;
+
+static CHAR8* mProtocolNames[] = {
+    [BOOT_INVALID] = "invalid",
+    [BOOT_LINUX] = "linux",
+    [BOOT_MB2] = "mb2",
+    [BOOT_STIVALE] = "stivale",
+    [BOOT_STIVALE2] = "stivale2",
+    [BOOT_BUNDLE] = "bundle",
+};
+
+void MockFatal(CHAR8* Format, ...) {
+    CHAR8 Buffer[512];
+    VA_LIST Marker;
+
+    VA_START(Marker, Format);
+    UINTN Length = AsciiVSPrint(Buffer, sizeof(Buffer), Format, Marker);
+    VA_END(Marker);
+
+    HostWrite("fatal: ", 7);
+    HostWrite(Buffer, Length);
+    HostExit(1);
+}
+
+/**
+ * The boot services are gone by now, so no Print
+ */
+static void HandoffPrint(CHAR8* Format, ...) {
+    CHAR8 Buffer[128];
+    VA_LIST Marker;
+
+    VA_START(Marker, Format);
+    UINTN Length = AsciiVSPrint(Buffer, sizeof(Buffer), Format, Marker);
+    VA_END(Marker);
+
+    HostWrite(Buffer, Length);
+}
+
+void MockHandoff(CHAR8* Protocol, void* Entry, void* Params) {
+    HandoffPrint("\nJumping to the %a kernel at %p, boot info at %p\n", Protocol, Entry, Params);
+
+    // the kernel must get the system table the firmware left
+    UINT32 Crc = mSystemTable.Hdr.CRC32;
+    mSystemTable.Hdr.CRC32 = 0;
+    if (mSystemTable.BootServices != NULL || CalculateCrc32(&mSystemTable, mSystemTable.Hdr.HeaderSize) != Crc) {
+        HandoffPrint("the system table was changed after ExitBootServices\n");
+        HostExit(1);
+    }
+    mSystemTable.Hdr.CRC32 = Crc;
+
+    if (AsciiStrCmp(Protocol, "multiboot2") == 0) {
+        struct multiboot_tag* Tag = (struct multiboot_tag*)((UINT8*)Params + 8);
+        while (Tag->type != MULTIBOOT_TAG_TYPE_END) {
+            HandoffPrint("    tag %x (%d bytes)\n", Tag->type, Tag->size);
+            Tag = (struct multiboot_tag*)((UINT8*)Tag + ALIGN_VALUE(Tag->size, MULTIBOOT_TAG_ALIGN));
+        }
+    } else if (AsciiStrCmp(Protocol, "stivale2") == 0) {
+        STIVALE2_STRUCT* Struct = Params;
+        for (UINT64* Tag = Struct->Tags; Tag != NULL; Tag = (UINT64*)Tag[1]) {
+            HandoffPrint("    tag %016lx\n", Tag[0]);
+        }
+    }
+
+    // walk the chain again for every tag that must be in it
+    int Missing = 0;
+    for (int i = 0; i < mOptions->ExpectedTagCount; i++) {
+        UINT64* Tag = NULL;
+        if (AsciiStrCmp(Protocol, "stivale2") == 0) {
+            for (Tag = ((STIVALE2_STRUCT*)Params)->Tags; Tag != NULL && Tag[0] != mOptions->ExpectedTags[i]; Tag = (UINT64*)Tag[1]);
+        }
+        if (Tag == NULL) {
+            HandoffPrint("missing tag %016lx\n", mOptions->ExpectedTags[i]);
+            Missing = 1;
+        }
+    }
+
+    HostExit(Missing);
+}
+
+/**
+ * A volume is a directory, optionally followed by `,image` for the disk
+ * image the same files are on, which is then the block device under it.
+ * An image on its own is a block device the loader has to read itself.
+ */
+static EFI_STATUS MockVolumeInit(const char* Volume) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_HANDLE Handle = NULL;
+    CHAR8 Directory[1024];
+    int IsDirectory = 0;
+    unsigned long long Size = 0;
+    long long ModificationTime = 0;
+
+    if (HostStat(Volume, &IsDirectory, &Size, &ModificationTime) == 0 && !IsDirectory) {
+        Status = MockBlockIoInit(Volume, &Handle);
+        CHECK_TRACE(!EFI_ERROR(Status), "Could not use `%a` as a disk image (%r)", Volume, Status);
+        goto cleanup;
+    }
+
+    CHAR8* Image = AsciiStrStr((CHAR8*)Volume, ",");
+    UINTN Length = Image != NULL ? (UINTN)(Image - Volume) : AsciiStrLen(Volume);
+    CHECK_TRACE(Length < sizeof(Directory), "The volume `%a` is too long", Volume);
+    CopyMem(Directory, Volume, Length);
+    Directory[Length] = '\0';
+
+    Status = MockFileSystemInit(Directory, &Handle);
+    CHECK_TRACE(!EFI_ERROR(Status), "Could not use `%a` as a volume (%r)", Directory, Status);
+
+    if (Image != NULL) {
+        Status = MockBlockIoInit(Image + 1, &Handle);
+        CHECK_TRACE(!EFI_ERROR(Status), "Could not use `%a` as a disk image (%r)", Image + 1, Status);
+    }
+
+cleanup:
+    return Status;
+}
+
+static EFI_STATUS MockFirmwareInit(HOST_OPTIONS* Options, EFI_HANDLE* ImageHandle) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    mSystemTable.Hdr.Signature = EFI_SYSTEM_TABLE_SIGNATURE;
+    mSystemTable.Hdr.Revision = EFI_SYSTEM_TABLE_REVISION;
+    mSystemTable.Hdr.HeaderSize = sizeof(EFI_SYSTEM_TABLE);
+    mSystemTable.FirmwareVendor = L"TomatBoot host";
+    mSystemTable.ConOut = MockConOutInit();
+    mSystemTable.StdErr = mSystemTable.ConOut;
+    mSystemTable.RuntimeServices = MockRuntimeServicesInit();
+    mSystemTable.BootServices = MockBootServicesInit(Options->MemorySize);
+    if (mSystemTable.BootServices == NULL) {
+        MockFatal("Could not reserve the memory of the mock firmware\n");
+    }
+
+    // the image we are pretending to be
+    mLoadedImage.Revision = EFI_LOADED_IMAGE_PROTOCOL_REVISION;
+    mLoadedImage.SystemTable = &mSystemTable;
+    EFI_CHECK(MockInstallProtocol(ImageHandle, &gEfiLoadedImageProtocolGuid, &mLoadedImage));
+
+    // Call constructors
+    EFI_CHECK(DxeDebugLibConstructor(*ImageHandle, &mSystemTable));
+    EFI_CHECK(UefiBootServicesTableLibConstructor(*ImageHandle, &mSystemTable));
+    EFI_CHECK(UefiRuntimeServicesTableLibConstructor(*ImageHandle, &mSystemTable));
+
+    // the rest needs the boot services
+    mSystemTable.ConIn = MockConInInit();
+    CHECK(mSystemTable.ConIn != NULL);
+    mSystemTable.Hdr.CRC32 = CalculateCrc32(&mSystemTable, mSystemTable.Hdr.HeaderSize);
+    CHECK_AND_RETHROW(MockCpuInit());
+    CHECK_AND_RETHROW(MockGraphicsInit());
+    for (int i = 0; i < Options->VolumeCount; i++) {
+        CHECK_AND_RETHROW(MockVolumeInit(Options->Volumes[i]));
+    }
+
+cleanup:
+    return Status;
+}
+
+int HostEfiMain(HOST_OPTIONS* Options) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_HANDLE ImageHandle = NULL;
+
+    gLoaderStartTsc = AsmReadTsc();
+    mOptions = Options;
+    CHECK_AND_RETHROW(MockFirmwareInit(Options, &ImageHandle));
+    ProfileInit();
+    CHECK_AND_RETHROW(Ext4MountVolumes());
+
+    // Load the boot configs, same as main
+    BOOT_CONFIG config;
+    LoadBootConfig(&config);
+    CHECK_AND_RETHROW(GetBootEntries(&gBootEntries));
+
+    // after the config, so it wins over VERBOSE
+    if (Options->Verbose) {
+        LogSetOutput(LOG_OUTPUT_CONSOLE);
+    }
+
+    int Index = 0;
+    for (LIST_ENTRY* Link = gBootEntries.ForwardLink; Link != &gBootEntries; Link = Link->ForwardLink, Index++) {
+        BOOT_ENTRY* Entry = BASE_CR(Link, BOOT_ENTRY, Link);
+        Print(L"%d: %s (%a, %s)\n", Index, Entry->Name, mProtocolNames[Entry->Protocol], Entry->Path);
+    }
+
+    if (Options->Entry < 0) {
+        goto cleanup;
+    }
+
+    BOOT_ENTRY* Entry = GetBootEntryAt(Options->Entry);
+    CHECK_TRACE(Entry != NULL, "There is no entry %d", Options->Entry);
+
+    // only returns if it failed
+    CHECK_AND_RETHROW(LoadKernel(Entry));
+
+cleanup:
+    return EFI_ERROR(Status) ? 1 : 0;
+}
@@ -0,0 +1,202 @@
+/**
+ * The host side of the mock firmware, this is the only file that
+ * is built against the libc
+ */
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Host.h"
+
+int HostReserve(unsigned long long Base, unsigned long long Size) {
+    void* Ptr = mmap((void*)Base, Size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+    if (Ptr == MAP_FAILED) {
+        return -1;
+    }
+
+    // old kernels ignore MAP_FIXED_NOREPLACE and take it as a hint
+    if (Ptr != (void*)Base) {
+        munmap(Ptr, Size);
+        return -1;
+    }
+
+    return 0;
+}
+
+int HostCommit(unsigned long long Base, unsigned long long Size) {
+    return mprotect((void*)Base, Size, PROT_READ | PROT_WRITE | PROT_EXEC);
+}
+
+void HostDecommit(unsigned long long Base, unsigned long long Size) {
+    madvise((void*)Base, Size, MADV_DONTNEED);
+    mprotect((void*)Base, Size, PROT_NONE);
+}
+
+void* HostAlloc(unsigned long long Size) {
+    return malloc(Size);
+}
+
+void HostFree(void* Ptr) {
+    free(Ptr);
+}
+
+int HostStat(const char* Path, int* IsDirectory, unsigned long long* Size, long long* ModificationTime) {
+    struct stat St;
+    if (stat(Path, &St) != 0) {
+        return -1;
+    }
+
+    *IsDirectory = S_ISDIR(St.st_mode);
+    *Size = St.st_size;
+    *ModificationTime = St.st_mtime;
+    return 0;
+}
+
+int HostOpen(const char* Path) {
+    return open(Path, O_RDONLY | O_CLOEXEC);
+}
+
+long long HostRead(int Fd, void* Buffer, unsigned long long Size, unsigned long long Offset) {
+    unsigned long long Done = 0;
+    while (Done < Size) {
+        ssize_t Read = pread(Fd, (char*)Buffer + Done, Size - Done, Offset + Done);
+        if (Read < 0) {
+            return -1;
+        }
+        if (Read == 0) {
+            break;
+        }
+        Done += Read;
+    }
+    return Done;
+}
+
+void HostClose(int Fd) {
+    close(Fd);
+}
+
+void* HostOpenDir(const char* Path) {
+    return opendir(Path);
+}
+
+int HostReadDir(void* Dir, char* Name, unsigned long long NameSize) {
+    struct dirent* Entry;
+    do {
+        Entry = readdir(Dir);
+        if (Entry == NULL) {
+            return 1;
+        }
+    } while (strcmp(Entry->d_name, ".") == 0 || strcmp(Entry->d_name, "..") == 0);
+
+    snprintf(Name, NameSize, "%s", Entry->d_name);
+    return 0;
+}
+
+void HostRewindDir(void* Dir) {
+    rewinddir(Dir);
+}
+
+void HostCloseDir(void* Dir) {
+    closedir(Dir);
+}
+
+void HostWrite(const char* Text, unsigned long long Length) {
+    fwrite(Text, 1, Length, stdout);
+}
+
+unsigned long long HostNanoseconds() {
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return Now.tv_sec * 1000000000ull + Now.tv_nsec;
+}
+
+void HostSleep(unsigned long long Microseconds) {
+    struct timespec Time = {
+        .tv_sec = Microseconds / 1000000,
+        .tv_nsec = (Microseconds % 1000000) * 1000
+    };
+    nanosleep(&Time, NULL);
+}
+
+void HostLocalTime(int Time[6]) {
+    time_t Now = time(NULL);
+    struct tm Local;
+    localtime_r(&Now, &Local);
+    Time[0] = Local.tm_year + 1900;
+    Time[1] = Local.tm_mon + 1;
+    Time[2] = Local.tm_mday;
+    Time[3] = Local.tm_hour;
+    Time[4] = Local.tm_min;
+    Time[5] = Local.tm_sec;
+}
+
+void HostExit(int Code) {
+    fflush(stdout);
+    exit(Code);
+}
+
+static void Usage(const char* Name) {
+    fprintf(stderr,
+        "usage: %s [-l] [-v] [-e entry] [-m megabytes] [-t tag]... <volume directory[,disk image]|disk image>...\n"
+        "\n"
+        "Runs the loader on top of a mock firmware, every directory is a file system.\n"
+        "A disk image of the same files after the directory is the block device under it.\n"
+        "A disk image on its own is a block device with no file system, like an ext4 /boot.\n"
+        "\n"
+        "  -l            only parse the config and list the entries\n"
+        "  -v            write the boot log as it is made, like VERBOSE=yes\n"
+        "  -e entry      the index of the entry to boot (default 0)\n"
+        "  -m megabytes  the amount of ram of the mock firmware (default 1024)\n"
+        "  -t tag        fail unless the stivale2 boot info has this tag (hex identifier)\n",
+        Name);
+}
+
+int main(int argc, char** argv) {
+    HOST_OPTIONS Options = {
+        .Entry = 0,
+        .MemorySize = 1024ull << 20
+    };
+
+    int Opt;
+    while ((Opt = getopt(argc, argv, "lve:m:t:h")) != -1) {
+        switch (Opt) {
+            case 'l': Options.Entry = -1; break;
+            case 'v': Options.Verbose = 1; break;
+            case 'e': Options.Entry = atoi(optarg); break;
+            case 'm': Options.MemorySize = strtoull(optarg, NULL, 0) << 20; break;
+            case 't':
+                if (Options.ExpectedTagCount == sizeof(Options.ExpectedTags) / sizeof(Options.ExpectedTags[0])) {
+                    fprintf(stderr, "too many tags\n");
+                    return 2;
+                }
+                Options.ExpectedTags[Options.ExpectedTagCount++] = strtoull(optarg, NULL, 16);
+                break;
+            default:
+                Usage(argv[0]);
+                return Opt == 'h' ? 0 : 2;
+        }
+    }
+
+    if (optind >= argc) {
+        Usage(argv[0]);
+        return 2;
+    }
+
+    Options.Volumes = (const char**)&argv[optind];
+    Options.VolumeCount = argc - optind;
+
+    // the loader prints a lot, don't flush on every line
+    setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+
+    int Result = HostEfiMain(&Options);
+    fflush(stdout);
+    return Result;
+}
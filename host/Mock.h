@@ -0,0 +1,60 @@
+#ifndef __HOST_MOCK_H__
+#define __HOST_MOCK_H__
+
+#include <Uefi.h>
+
+#include "Host.h"
+
+/**
+ * Setup the boot services, the memory map starts with the low memory
+ * and the given amount of ram above 1MB as free memory, all of it is
+ * backed by the same addresses in the host process.
+ */
+EFI_BOOT_SERVICES* MockBootServicesInit(UINT64 MemorySize);
+
+/**
+ * Install a protocol on a handle, a new handle is created if the
+ * given one is NULL
+ */
+EFI_STATUS MockInstallProtocol(EFI_HANDLE* Handle, EFI_GUID* Guid, void* Interface);
+
+EFI_RUNTIME_SERVICES* MockRuntimeServicesInit();
+
+EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* MockConOutInit();
+EFI_SIMPLE_TEXT_INPUT_PROTOCOL* MockConInInit();
+
+/**
+ * Install a graphics output protocol, the framebuffer is plain memory
+ */
+EFI_STATUS MockGraphicsInit();
+
+/**
+ * Install a read only file system backed by a host directory, a new
+ * handle is created if the given one is NULL
+ */
+EFI_STATUS MockFileSystemInit(const char* Path, EFI_HANDLE* Handle);
+
+/**
+ * Install a read only block device (with the block io 2 protocol as well)
+ * backed by a host file, a new handle is created if the given one is NULL
+ */
+EFI_STATUS MockBlockIoInit(const char* Path, EFI_HANDLE* Handle);
+
+/**
+ * Setup the registers the loaders look at, like an identity mapped page table in cr3
+ */
+EFI_STATUS MockCpuInit();
+
+/**
+ * Called instead of jumping to the kernel, describes what the
+ * kernel would have been given and ends the run.
+ */
+void NORETURN MockHandoff(CHAR8* Protocol, void* Entry, void* Params);
+
+/**
+ * Print the error and end the run, for things the firmware would
+ * not survive either
+ */
+void NORETURN MockFatal(CHAR8* Format, ...);
+
+#endif //__HOST_MOCK_H__
@@ -0,0 +1,129 @@
+#include "Mock.h"
+
+#include <Protocol/BlockIo.h>
+#include <Protocol/BlockIo2.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#define MOCK_BLOCK_SIZE 512
+
+typedef struct _MOCK_BLOCK_DEVICE {
+    EFI_BLOCK_IO_PROTOCOL BlockIo;
+    EFI_BLOCK_IO2_PROTOCOL BlockIo2;
+    EFI_BLOCK_IO_MEDIA Media;
+    int Fd;
+} MOCK_BLOCK_DEVICE;
+
+static EFI_STATUS ReadBlocks(MOCK_BLOCK_DEVICE* Device, UINT32 MediaId, EFI_LBA Lba, UINTN BufferSize, void* Buffer) {
+    if (MediaId != Device->Media.MediaId) {
+        return EFI_MEDIA_CHANGED;
+    }
+    if (Buffer == NULL || (BufferSize % MOCK_BLOCK_SIZE) != 0) {
+        return EFI_BAD_BUFFER_SIZE;
+    }
+    if (Lba > Device->Media.LastBlock || BufferSize / MOCK_BLOCK_SIZE > Device->Media.LastBlock + 1 - Lba) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if (HostRead(Device->Fd, Buffer, BufferSize, Lba * MOCK_BLOCK_SIZE) != (long long)BufferSize) {
+        return EFI_DEVICE_ERROR;
+    }
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockBlockReset(EFI_BLOCK_IO_PROTOCOL* This, BOOLEAN ExtendedVerification) {
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockReadBlocks(EFI_BLOCK_IO_PROTOCOL* This, UINT32 MediaId, EFI_LBA Lba, UINTN BufferSize, void* Buffer) {
+    return ReadBlocks(BASE_CR(This, MOCK_BLOCK_DEVICE, BlockIo), MediaId, Lba, BufferSize, Buffer);
+}
+
+static EFI_STATUS EFIAPI MockWriteBlocks(EFI_BLOCK_IO_PROTOCOL* This, UINT32 MediaId, EFI_LBA Lba, UINTN BufferSize, void* Buffer) {
+    return EFI_WRITE_PROTECTED;
+}
+
+static EFI_STATUS EFIAPI MockFlushBlocks(EFI_BLOCK_IO_PROTOCOL* This) {
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockBlockResetEx(EFI_BLOCK_IO2_PROTOCOL* This, BOOLEAN ExtendedVerification) {
+    return EFI_SUCCESS;
+}
+
+/**
+ * The read is done right away, the caller still has to go through the event
+ */
+static EFI_STATUS EFIAPI MockReadBlocksEx(EFI_BLOCK_IO2_PROTOCOL* This, UINT32 MediaId, EFI_LBA Lba, EFI_BLOCK_IO2_TOKEN* Token, UINTN BufferSize, void* Buffer) {
+    EFI_STATUS Status = ReadBlocks(BASE_CR(This, MOCK_BLOCK_DEVICE, BlockIo2), MediaId, Lba, BufferSize, Buffer);
+    if (Token == NULL || Token->Event == NULL || EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    Token->TransactionStatus = Status;
+    return gBS->SignalEvent(Token->Event);
+}
+
+static EFI_STATUS EFIAPI MockWriteBlocksEx(EFI_BLOCK_IO2_PROTOCOL* This, UINT32 MediaId, EFI_LBA Lba, EFI_BLOCK_IO2_TOKEN* Token, UINTN BufferSize, void* Buffer) {
+    return EFI_WRITE_PROTECTED;
+}
+
+static EFI_STATUS EFIAPI MockFlushBlocksEx(EFI_BLOCK_IO2_PROTOCOL* This, EFI_BLOCK_IO2_TOKEN* Token) {
+    if (Token != NULL && Token->Event != NULL) {
+        Token->TransactionStatus = EFI_SUCCESS;
+        return gBS->SignalEvent(Token->Event);
+    }
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS MockBlockIoInit(const char* Path, EFI_HANDLE* Handle) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    int IsDirectory = 0;
+    unsigned long long Size = 0;
+    long long ModificationTime = 0;
+
+    if (HostStat(Path, &IsDirectory, &Size, &ModificationTime) != 0 || IsDirectory || Size < MOCK_BLOCK_SIZE) {
+        return EFI_NOT_FOUND;
+    }
+
+    MOCK_BLOCK_DEVICE* Device = HostAlloc(sizeof(MOCK_BLOCK_DEVICE));
+    if (Device == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    SetMem(Device, sizeof(MOCK_BLOCK_DEVICE), 0);
+
+    Device->Fd = HostOpen(Path);
+    if (Device->Fd < 0) {
+        HostFree(Device);
+        return EFI_NOT_FOUND;
+    }
+
+    // a whole disk of 512 byte sectors, anything after the last one is ignored
+    Device->Media.MediaId = 1;
+    Device->Media.MediaPresent = TRUE;
+    Device->Media.ReadOnly = TRUE;
+    Device->Media.LogicalPartition = TRUE;
+    Device->Media.BlockSize = MOCK_BLOCK_SIZE;
+    Device->Media.IoAlign = 0;
+    Device->Media.LastBlock = Size / MOCK_BLOCK_SIZE - 1;
+
+    Device->BlockIo.Revision = EFI_BLOCK_IO_PROTOCOL_REVISION;
+    Device->BlockIo.Media = &Device->Media;
+    Device->BlockIo.Reset = MockBlockReset;
+    Device->BlockIo.ReadBlocks = MockReadBlocks;
+    Device->BlockIo.WriteBlocks = MockWriteBlocks;
+    Device->BlockIo.FlushBlocks = MockFlushBlocks;
+
+    Device->BlockIo2.Media = &Device->Media;
+    Device->BlockIo2.Reset = MockBlockResetEx;
+    Device->BlockIo2.ReadBlocksEx = MockReadBlocksEx;
+    Device->BlockIo2.WriteBlocksEx = MockWriteBlocksEx;
+    Device->BlockIo2.FlushBlocksEx = MockFlushBlocksEx;
+
+    Status = MockInstallProtocol(Handle, &gEfiBlockIoProtocolGuid, &Device->BlockIo);
+    if (!EFI_ERROR(Status)) {
+        Status = MockInstallProtocol(Handle, &gEfiBlockIo2ProtocolGuid, &Device->BlockIo2);
+    }
+    return Status;
+}
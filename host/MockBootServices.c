@@ -0,0 +1,622 @@
+#include "Mock.h"
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+// like edk2 the descriptors are bigger than the struct, so
+// code that doesn't use the descriptor size breaks here too
+#define MOCK_DESCRIPTOR_SIZE (sizeof(EFI_MEMORY_DESCRIPTOR) + sizeof(UINT64))
+#define MOCK_MAX_DESCRIPTORS 1024
+
+#define MOCK_MAX_PROTOCOLS 64
+
+// the low memory, up to where the ebda usually starts
+#define MOCK_LOW_MEMORY_START BASE_64KB
+#define MOCK_LOW_MEMORY_END   0x9F000
+
+typedef struct _MOCK_EVENT {
+    UINT32 Type;
+    EFI_EVENT_NOTIFY NotifyFunction;
+    void* NotifyContext;
+    BOOLEAN Signaled;
+
+    // in nanoseconds, zero when there is no timer
+    UINT64 TimerDeadline;
+    UINT64 TimerPeriod;
+} MOCK_EVENT;
+
+typedef struct _MOCK_PROTOCOL {
+    EFI_HANDLE Handle;
+    EFI_GUID* Guid;
+    void* Interface;
+} MOCK_PROTOCOL;
+
+static EFI_BOOT_SERVICES mBootServices;
+
+static EFI_MEMORY_DESCRIPTOR mMemoryMap[MOCK_MAX_DESCRIPTORS];
+static UINTN mMemoryMapCount = 0;
+static UINTN mMapKey = 1;
+static BOOLEAN mExitedBootServices = FALSE;
+
+static EFI_TPL mCurrentTpl = TPL_APPLICATION;
+
+static MOCK_PROTOCOL mProtocols[MOCK_MAX_PROTOCOLS];
+static UINTN mProtocolCount = 0;
+
+// the handles are only used for their address
+static UINT8 mHandles[MOCK_MAX_PROTOCOLS];
+static UINTN mHandleCount = 0;
+
+static void CheckBootServices(CHAR8* Name) {
+    if (mExitedBootServices) {
+        MockFatal("%a called after ExitBootServices\n", Name);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Memory
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static UINT64 DescriptorEnd(EFI_MEMORY_DESCRIPTOR* Desc) {
+    return Desc->PhysicalStart + EFI_PAGES_TO_SIZE(Desc->NumberOfPages);
+}
+
+static void MergeDescriptors() {
+    UINTN Count = 0;
+    for (UINTN i = 0; i < mMemoryMapCount; i++) {
+        if (Count != 0 &&
+            mMemoryMap[Count - 1].Type == mMemoryMap[i].Type &&
+            DescriptorEnd(&mMemoryMap[Count - 1]) == mMemoryMap[i].PhysicalStart) {
+            mMemoryMap[Count - 1].NumberOfPages += mMemoryMap[i].NumberOfPages;
+        } else {
+            mMemoryMap[Count++] = mMemoryMap[i];
+        }
+    }
+    mMemoryMapCount = Count;
+}
+
+/**
+ * Change the type of a range, allocating takes free memory and
+ * freeing takes allocated memory, the range must be inside of a
+ * single descriptor
+ */
+static EFI_STATUS ConvertPages(EFI_PHYSICAL_ADDRESS Start, UINTN Pages, EFI_MEMORY_TYPE NewType) {
+    UINT64 End = Start + EFI_PAGES_TO_SIZE(Pages);
+
+    UINTN Index = 0;
+    while (Index < mMemoryMapCount && !(Start >= mMemoryMap[Index].PhysicalStart && End <= DescriptorEnd(&mMemoryMap[Index]))) {
+        Index++;
+    }
+    if (Index == mMemoryMapCount) {
+        return EFI_NOT_FOUND;
+    }
+
+    EFI_MEMORY_DESCRIPTOR Old = mMemoryMap[Index];
+    if ((NewType == EfiConventionalMemory) == (Old.Type == EfiConventionalMemory)) {
+        return EFI_NOT_FOUND;
+    }
+    if (mMemoryMapCount + 2 > MOCK_MAX_DESCRIPTORS) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    // split it to before, the range itself and after
+    EFI_MEMORY_DESCRIPTOR Parts[3];
+    UINTN PartCount = 0;
+    if (Start > Old.PhysicalStart) {
+        Parts[PartCount] = Old;
+        Parts[PartCount++].NumberOfPages = EFI_SIZE_TO_PAGES(Start - Old.PhysicalStart);
+    }
+    Parts[PartCount] = Old;
+    Parts[PartCount].Type = NewType;
+    Parts[PartCount].PhysicalStart = Start;
+    Parts[PartCount++].NumberOfPages = Pages;
+    if (End < DescriptorEnd(&Old)) {
+        Parts[PartCount] = Old;
+        Parts[PartCount].PhysicalStart = End;
+        Parts[PartCount++].NumberOfPages = EFI_SIZE_TO_PAGES(DescriptorEnd(&Old) - End);
+    }
+
+    CopyMem(&mMemoryMap[Index + PartCount], &mMemoryMap[Index + 1], (mMemoryMapCount - Index - 1) * sizeof(EFI_MEMORY_DESCRIPTOR));
+    CopyMem(&mMemoryMap[Index], Parts, PartCount * sizeof(EFI_MEMORY_DESCRIPTOR));
+    mMemoryMapCount += PartCount - 1;
+    MergeDescriptors();
+    mMapKey++;
+
+    if (NewType == EfiConventionalMemory) {
+        HostDecommit(Start, End - Start);
+    } else if (HostCommit(Start, End - Start) != 0) {
+        MockFatal("Could not commit %lx-%lx\n", Start, End);
+    }
+
+    return EFI_SUCCESS;
+}
+
+static BOOLEAN IsValidMemoryType(EFI_MEMORY_TYPE Type) {
+    // the reserved range between the spec types and the oem types
+    return Type != EfiConventionalMemory && (Type < EfiMaxMemoryType || Type >= 0x70000000);
+}
+
+static EFI_STATUS EFIAPI MockAllocatePages(EFI_ALLOCATE_TYPE Type, EFI_MEMORY_TYPE MemoryType, UINTN Pages, EFI_PHYSICAL_ADDRESS* Memory) {
+    CheckBootServices("AllocatePages");
+
+    if (Memory == NULL || Pages == 0 || !IsValidMemoryType(MemoryType)) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if (Type == AllocateAddress) {
+        if ((*Memory & EFI_PAGE_MASK) != 0) {
+            return EFI_NOT_FOUND;
+        }
+        return ConvertPages(*Memory, Pages, MemoryType);
+    }
+
+    // the max address is inclusive
+    UINT64 Limit = MAX_UINT64;
+    if (Type == AllocateMaxAddress && *Memory != MAX_UINT64) {
+        Limit = *Memory + 1;
+    } else if (Type != AllocateAnyPages && Type != AllocateMaxAddress) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    // top down, like edk2
+    UINT64 Size = EFI_PAGES_TO_SIZE(Pages);
+    for (UINTN i = mMemoryMapCount; i-- > 0;) {
+        EFI_MEMORY_DESCRIPTOR* Desc = &mMemoryMap[i];
+        if (Desc->Type != EfiConventionalMemory) {
+            continue;
+        }
+
+        UINT64 End = MIN(DescriptorEnd(Desc), Limit);
+        if (End < Desc->PhysicalStart + Size) {
+            continue;
+        }
+
+        UINT64 Candidate = (End - Size) & ~(UINT64)EFI_PAGE_MASK;
+        if (Candidate >= Desc->PhysicalStart) {
+            *Memory = Candidate;
+            return ConvertPages(Candidate, Pages, MemoryType);
+        }
+    }
+
+    return EFI_OUT_OF_RESOURCES;
+}
+
+static EFI_STATUS EFIAPI MockFreePages(EFI_PHYSICAL_ADDRESS Memory, UINTN Pages) {
+    CheckBootServices("FreePages");
+
+    if ((Memory & EFI_PAGE_MASK) != 0 || Pages == 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    return ConvertPages(Memory, Pages, EfiConventionalMemory);
+}
+
+static EFI_STATUS EFIAPI MockGetMemoryMap(UINTN* MemoryMapSize, EFI_MEMORY_DESCRIPTOR* MemoryMap, UINTN* MapKey, UINTN* DescriptorSize, UINT32* DescriptorVersion) {
+    CheckBootServices("GetMemoryMap");
+
+    if (MemoryMapSize == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if (DescriptorSize != NULL) {
+        *DescriptorSize = MOCK_DESCRIPTOR_SIZE;
+    }
+    if (DescriptorVersion != NULL) {
+        *DescriptorVersion = EFI_MEMORY_DESCRIPTOR_VERSION;
+    }
+
+    UINTN Size = mMemoryMapCount * MOCK_DESCRIPTOR_SIZE;
+    if (*MemoryMapSize < Size) {
+        *MemoryMapSize = Size;
+        return EFI_BUFFER_TOO_SMALL;
+    }
+
+    if (MemoryMap == NULL || MapKey == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    SetMem(MemoryMap, Size, 0);
+    for (UINTN i = 0; i < mMemoryMapCount; i++) {
+        CopyMem((UINT8*)MemoryMap + i * MOCK_DESCRIPTOR_SIZE, &mMemoryMap[i], sizeof(EFI_MEMORY_DESCRIPTOR));
+    }
+    *MemoryMapSize = Size;
+    *MapKey = mMapKey;
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Pool memory comes from the host heap, it is not part of the memory map
+ */
+static EFI_STATUS EFIAPI MockAllocatePool(EFI_MEMORY_TYPE PoolType, UINTN Size, void** Buffer) {
+    CheckBootServices("AllocatePool");
+
+    if (Buffer == NULL || !IsValidMemoryType(PoolType)) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    *Buffer = HostAlloc(MAX(Size, 1));
+    return *Buffer == NULL ? EFI_OUT_OF_RESOURCES : EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockFreePool(void* Buffer) {
+    CheckBootServices("FreePool");
+
+    if (Buffer == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    HostFree(Buffer);
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockExitBootServices(EFI_HANDLE ImageHandle, UINTN MapKey) {
+    if (MapKey != mMapKey) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    // like edk2, the boot time parts of the system table are gone
+    gST->ConsoleInHandle = NULL;
+    gST->ConIn = NULL;
+    gST->ConsoleOutHandle = NULL;
+    gST->ConOut = NULL;
+    gST->StandardErrorHandle = NULL;
+    gST->StdErr = NULL;
+    gST->BootServices = NULL;
+    gST->Hdr.CRC32 = 0;
+    gST->Hdr.CRC32 = CalculateCrc32(gST, gST->Hdr.HeaderSize);
+
+    mExitedBootServices = TRUE;
+    return EFI_SUCCESS;
+}
+
+static void EFIAPI MockCopyMem(void* Destination, void* Source, UINTN Length) {
+    CopyMem(Destination, Source, Length);
+}
+
+static void EFIAPI MockSetMem(void* Buffer, UINTN Size, UINT8 Value) {
+    SetMem(Buffer, Size, Value);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Events and timers
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static EFI_TPL EFIAPI MockRaiseTPL(EFI_TPL NewTpl) {
+    EFI_TPL Old = mCurrentTpl;
+    mCurrentTpl = NewTpl;
+    return Old;
+}
+
+static void EFIAPI MockRestoreTPL(EFI_TPL OldTpl) {
+    mCurrentTpl = OldTpl;
+}
+
+static EFI_STATUS EFIAPI MockCreateEvent(UINT32 Type, EFI_TPL NotifyTpl, EFI_EVENT_NOTIFY NotifyFunction, void* NotifyContext, EFI_EVENT* Event) {
+    if (Event == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    MOCK_EVENT* New = HostAlloc(sizeof(MOCK_EVENT));
+    if (New == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    SetMem(New, sizeof(MOCK_EVENT), 0);
+    New->Type = Type;
+    New->NotifyFunction = NotifyFunction;
+    New->NotifyContext = NotifyContext;
+
+    *Event = New;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockCreateEventEx(UINT32 Type, EFI_TPL NotifyTpl, EFI_EVENT_NOTIFY NotifyFunction, const void* NotifyContext, const EFI_GUID* EventGroup, EFI_EVENT* Event) {
+    // there is nothing that would signal a group
+    return MockCreateEvent(Type, NotifyTpl, NotifyFunction, (void*)NotifyContext, Event);
+}
+
+static EFI_STATUS EFIAPI MockCloseEvent(EFI_EVENT Event) {
+    if (Event == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    HostFree(Event);
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockSignalEvent(EFI_EVENT Event) {
+    MOCK_EVENT* Mock = Event;
+    if (Mock == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if ((Mock->Type & EVT_NOTIFY_SIGNAL) && Mock->NotifyFunction != NULL) {
+        Mock->NotifyFunction(Event, Mock->NotifyContext);
+    } else {
+        Mock->Signaled = TRUE;
+    }
+
+    return EFI_SUCCESS;
+}
+
+static void UpdateTimer(MOCK_EVENT* Event) {
+    if (Event->TimerDeadline != 0 && HostNanoseconds() >= Event->TimerDeadline) {
+        Event->TimerDeadline = Event->TimerPeriod != 0 ? Event->TimerDeadline + Event->TimerPeriod : 0;
+        MockSignalEvent(Event);
+    }
+}
+
+static EFI_STATUS EFIAPI MockSetTimer(EFI_EVENT Event, EFI_TIMER_DELAY Type, UINT64 TriggerTime) {
+    MOCK_EVENT* Mock = Event;
+    if (Mock == NULL || !(Mock->Type & EVT_TIMER)) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    // the trigger time is in 100ns units
+    UINT64 Delay = MultU64x32(MAX(TriggerTime, 1), 100);
+    switch (Type) {
+        case TimerCancel:
+            Mock->TimerDeadline = 0;
+            Mock->TimerPeriod = 0;
+            break;
+
+        case TimerPeriodic:
+            Mock->TimerDeadline = HostNanoseconds() + Delay;
+            Mock->TimerPeriod = Delay;
+            break;
+
+        case TimerRelative:
+            Mock->TimerDeadline = HostNanoseconds() + Delay;
+            Mock->TimerPeriod = 0;
+            break;
+
+        default:
+            return EFI_INVALID_PARAMETER;
+    }
+
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockCheckEvent(EFI_EVENT Event) {
+    MOCK_EVENT* Mock = Event;
+    if (Mock == NULL || (Mock->Type & EVT_NOTIFY_SIGNAL)) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    UpdateTimer(Mock);
+    if (Mock->Signaled) {
+        Mock->Signaled = FALSE;
+        return EFI_SUCCESS;
+    }
+
+    return EFI_NOT_READY;
+}
+
+static EFI_STATUS EFIAPI MockWaitForEvent(UINTN NumberOfEvents, EFI_EVENT* Event, UINTN* Index) {
+    if (NumberOfEvents == 0 || Event == NULL || Index == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    while (TRUE) {
+        UINT64 NextDeadline = MAX_UINT64;
+        for (UINTN i = 0; i < NumberOfEvents; i++) {
+            EFI_STATUS Status = MockCheckEvent(Event[i]);
+            if (Status != EFI_NOT_READY) {
+                *Index = i;
+                return Status;
+            }
+
+            MOCK_EVENT* Mock = Event[i];
+            if (Mock->TimerDeadline != 0) {
+                NextDeadline = MIN(NextDeadline, Mock->TimerDeadline);
+            }
+        }
+
+        // nothing on the host can signal the event, we would hang forever
+        if (NextDeadline == MAX_UINT64) {
+            MockFatal("WaitForEvent on events that are never signaled\n");
+        }
+
+        UINT64 Now = HostNanoseconds();
+        if (NextDeadline > Now) {
+            HostSleep(DivU64x32(NextDeadline - Now + 999, 1000));
+        }
+    }
+}
+
+static EFI_STATUS EFIAPI MockStall(UINTN Microseconds) {
+    HostSleep(Microseconds);
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockSetWatchdogTimer(UINTN Timeout, UINT64 WatchdogCode, UINTN DataSize, CHAR16* WatchdogData) {
+    return EFI_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Protocols
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+EFI_STATUS MockInstallProtocol(EFI_HANDLE* Handle, EFI_GUID* Guid, void* Interface) {
+    if (Handle == NULL || Guid == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if (mProtocolCount == MOCK_MAX_PROTOCOLS) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    if (*Handle == NULL) {
+        *Handle = &mHandles[mHandleCount++];
+    }
+
+    for (UINTN i = 0; i < mProtocolCount; i++) {
+        if (mProtocols[i].Handle == *Handle && CompareGuid(mProtocols[i].Guid, Guid)) {
+            return EFI_INVALID_PARAMETER;
+        }
+    }
+
+    mProtocols[mProtocolCount].Handle = *Handle;
+    mProtocols[mProtocolCount].Guid = Guid;
+    mProtocols[mProtocolCount].Interface = Interface;
+    mProtocolCount++;
+
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockInstallProtocolInterface(EFI_HANDLE* Handle, EFI_GUID* Protocol, EFI_INTERFACE_TYPE InterfaceType, void* Interface) {
+    return MockInstallProtocol(Handle, Protocol, Interface);
+}
+
+static EFI_STATUS EFIAPI MockHandleProtocol(EFI_HANDLE Handle, EFI_GUID* Protocol, void** Interface) {
+    if (Protocol == NULL || Interface == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    for (UINTN i = 0; i < mProtocolCount; i++) {
+        if (mProtocols[i].Handle == Handle && CompareGuid(mProtocols[i].Guid, Protocol)) {
+            *Interface = mProtocols[i].Interface;
+            return EFI_SUCCESS;
+        }
+    }
+
+    *Interface = NULL;
+    return EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS EFIAPI MockOpenProtocol(EFI_HANDLE Handle, EFI_GUID* Protocol, void** Interface, EFI_HANDLE AgentHandle, EFI_HANDLE ControllerHandle, UINT32 Attributes) {
+    void* Ignored = NULL;
+    return MockHandleProtocol(Handle, Protocol, Interface != NULL ? Interface : &Ignored);
+}
+
+static EFI_STATUS EFIAPI MockCloseProtocol(EFI_HANDLE Handle, EFI_GUID* Protocol, EFI_HANDLE AgentHandle, EFI_HANDLE ControllerHandle) {
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockLocateProtocol(EFI_GUID* Protocol, void* Registration, void** Interface) {
+    if (Protocol == NULL || Interface == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    for (UINTN i = 0; i < mProtocolCount; i++) {
+        if (CompareGuid(mProtocols[i].Guid, Protocol)) {
+            *Interface = mProtocols[i].Interface;
+            return EFI_SUCCESS;
+        }
+    }
+
+    *Interface = NULL;
+    return EFI_NOT_FOUND;
+}
+
+static EFI_STATUS EFIAPI MockLocateHandle(EFI_LOCATE_SEARCH_TYPE SearchType, EFI_GUID* Protocol, void* SearchKey, UINTN* BufferSize, EFI_HANDLE* Buffer) {
+    if (BufferSize == NULL || (SearchType == ByProtocol && Protocol == NULL)) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (SearchType != ByProtocol && SearchType != AllHandles) {
+        return EFI_UNSUPPORTED;
+    }
+
+    // every handle has at least one protocol, so this finds all of them
+    UINTN Count = 0;
+    for (UINTN i = 0; i < mHandleCount; i++) {
+        EFI_HANDLE Handle = &mHandles[i];
+        void* Interface = NULL;
+        if (SearchType == AllHandles || !EFI_ERROR(MockHandleProtocol(Handle, Protocol, &Interface))) {
+            if ((Count + 1) * sizeof(EFI_HANDLE) <= *BufferSize) {
+                Buffer[Count] = Handle;
+            }
+            Count++;
+        }
+    }
+
+    if (Count == 0) {
+        return EFI_NOT_FOUND;
+    }
+
+    UINTN Needed = Count * sizeof(EFI_HANDLE);
+    BOOLEAN Fits = Needed <= *BufferSize;
+    *BufferSize = Needed;
+    return Fits ? EFI_SUCCESS : EFI_BUFFER_TOO_SMALL;
+}
+
+static EFI_STATUS EFIAPI MockLocateHandleBuffer(EFI_LOCATE_SEARCH_TYPE SearchType, EFI_GUID* Protocol, void* SearchKey, UINTN* NoHandles, EFI_HANDLE** Buffer) {
+    if (NoHandles == NULL || Buffer == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    UINTN Size = 0;
+    EFI_STATUS Status = MockLocateHandle(SearchType, Protocol, SearchKey, &Size, NULL);
+    if (Status != EFI_BUFFER_TOO_SMALL) {
+        return Status;
+    }
+
+    Status = MockAllocatePool(EfiBootServicesData, Size, (void**)Buffer);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    *NoHandles = Size / sizeof(EFI_HANDLE);
+    return MockLocateHandle(SearchType, Protocol, SearchKey, &Size, *Buffer);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Setup
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOLEAN AddFreeMemory(UINT64 Start, UINT64 End) {
+    if (HostReserve(Start, End - Start) != 0) {
+        return FALSE;
+    }
+
+    EFI_MEMORY_DESCRIPTOR* Desc = &mMemoryMap[mMemoryMapCount++];
+    Desc->Type = EfiConventionalMemory;
+    Desc->PhysicalStart = Start;
+    Desc->VirtualStart = 0;
+    Desc->NumberOfPages = EFI_SIZE_TO_PAGES(End - Start);
+    Desc->Attribute = EFI_MEMORY_WB;
+    return TRUE;
+}
+
+EFI_BOOT_SERVICES* MockBootServicesInit(UINT64 MemorySize) {
+    // the ram is at the same addresses in the host, so it
+    // must be free in the process
+    if (!AddFreeMemory(MOCK_LOW_MEMORY_START, MOCK_LOW_MEMORY_END) ||
+        !AddFreeMemory(BASE_1MB, BASE_1MB + ALIGN_VALUE(MemorySize, EFI_PAGE_SIZE))) {
+        return NULL;
+    }
+
+    mBootServices.Hdr.Signature = EFI_BOOT_SERVICES_SIGNATURE;
+    mBootServices.Hdr.Revision = EFI_BOOT_SERVICES_REVISION;
+    mBootServices.Hdr.HeaderSize = sizeof(EFI_BOOT_SERVICES);
+
+    mBootServices.RaiseTPL = MockRaiseTPL;
+    mBootServices.RestoreTPL = MockRestoreTPL;
+    mBootServices.AllocatePages = MockAllocatePages;
+    mBootServices.FreePages = MockFreePages;
+    mBootServices.GetMemoryMap = MockGetMemoryMap;
+    mBootServices.AllocatePool = MockAllocatePool;
+    mBootServices.FreePool = MockFreePool;
+    mBootServices.CreateEvent = MockCreateEvent;
+    mBootServices.SetTimer = MockSetTimer;
+    mBootServices.WaitForEvent = MockWaitForEvent;
+    mBootServices.SignalEvent = MockSignalEvent;
+    mBootServices.CloseEvent = MockCloseEvent;
+    mBootServices.CheckEvent = MockCheckEvent;
+    mBootServices.InstallProtocolInterface = MockInstallProtocolInterface;
+    mBootServices.HandleProtocol = MockHandleProtocol;
+    mBootServices.LocateHandle = MockLocateHandle;
+    mBootServices.ExitBootServices = MockExitBootServices;
+    mBootServices.Stall = MockStall;
+    mBootServices.SetWatchdogTimer = MockSetWatchdogTimer;
+    mBootServices.OpenProtocol = MockOpenProtocol;
+    mBootServices.CloseProtocol = MockCloseProtocol;
+    mBootServices.LocateHandleBuffer = MockLocateHandleBuffer;
+    mBootServices.LocateProtocol = MockLocateProtocol;
+    mBootServices.CopyMem = MockCopyMem;
+    mBootServices.SetMem = MockSetMem;
+    mBootServices.CreateEventEx = MockCreateEventEx;
+
+    return &mBootServices;
+}
@@ -0,0 +1,198 @@
+#include "Mock.h"
+
+#include <Protocol/GraphicsOutput.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+static EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL mConOut;
+static EFI_SIMPLE_TEXT_OUTPUT_MODE mConOutMode;
+static EFI_SIMPLE_TEXT_INPUT_PROTOCOL mConIn;
+
+static EFI_GRAPHICS_OUTPUT_PROTOCOL mGraphicsOutput;
+static EFI_GRAPHICS_OUTPUT_PROTOCOL_MODE mGraphicsMode;
+
+static EFI_GRAPHICS_OUTPUT_MODE_INFORMATION mGraphicsModes[] = {
+    { .HorizontalResolution = 1024, .VerticalResolution = 768, .PixelFormat = PixelBlueGreenRedReserved8BitPerColor, .PixelsPerScanLine = 1024 },
+    { .HorizontalResolution = 1280, .VerticalResolution = 720, .PixelFormat = PixelBlueGreenRedReserved8BitPerColor, .PixelsPerScanLine = 1280 },
+    { .HorizontalResolution = 1920, .VerticalResolution = 1080, .PixelFormat = PixelBlueGreenRedReserved8BitPerColor, .PixelsPerScanLine = 1920 },
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Text output, to the standard output
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static EFI_STATUS EFIAPI MockOutputString(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, CHAR16* String) {
+    CHAR8 Buffer[256];
+    UINTN Length = 0;
+
+    // the loader only prints ucs2, so no surrogates
+    for (CHAR16* c = String; *c != L'\0'; c++) {
+        if (Length + 3 > sizeof(Buffer)) {
+            HostWrite(Buffer, Length);
+            Length = 0;
+        }
+
+        if (*c == L'\r') {
+            continue;
+        } else if (*c < 0x80) {
+            Buffer[Length++] = (CHAR8)*c;
+        } else if (*c < 0x800) {
+            Buffer[Length++] = (CHAR8)(0xC0 | (*c >> 6));
+            Buffer[Length++] = (CHAR8)(0x80 | (*c & 0x3F));
+        } else {
+            Buffer[Length++] = (CHAR8)(0xE0 | (*c >> 12));
+            Buffer[Length++] = (CHAR8)(0x80 | ((*c >> 6) & 0x3F));
+            Buffer[Length++] = (CHAR8)(0x80 | (*c & 0x3F));
+        }
+    }
+    HostWrite(Buffer, Length);
+
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockTextReset(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, BOOLEAN ExtendedVerification) {
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockTestString(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, CHAR16* String) {
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockQueryMode(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, UINTN ModeNumber, UINTN* Columns, UINTN* Rows) {
+    if (ModeNumber != 0) {
+        return EFI_UNSUPPORTED;
+    }
+
+    *Columns = 80;
+    *Rows = 25;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockSetMode(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, UINTN ModeNumber) {
+    return ModeNumber == 0 ? EFI_SUCCESS : EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS EFIAPI MockSetAttribute(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, UINTN Attribute) {
+    mConOutMode.Attribute = (INT32)Attribute;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockClearScreen(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This) {
+    mConOutMode.CursorColumn = 0;
+    mConOutMode.CursorRow = 0;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockSetCursorPosition(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, UINTN Column, UINTN Row) {
+    mConOutMode.CursorColumn = (INT32)Column;
+    mConOutMode.CursorRow = (INT32)Row;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockEnableCursor(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, BOOLEAN Visible) {
+    mConOutMode.CursorVisible = Visible;
+    return EFI_SUCCESS;
+}
+
+EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* MockConOutInit() {
+    mConOutMode.MaxMode = 1;
+    mConOutMode.Mode = 0;
+    mConOutMode.Attribute = EFI_TEXT_ATTR(EFI_LIGHTGRAY, EFI_BLACK);
+
+    mConOut.Reset = MockTextReset;
+    mConOut.OutputString = MockOutputString;
+    mConOut.TestString = MockTestString;
+    mConOut.QueryMode = MockQueryMode;
+    mConOut.SetMode = MockSetMode;
+    mConOut.SetAttribute = MockSetAttribute;
+    mConOut.ClearScreen = MockClearScreen;
+    mConOut.SetCursorPosition = MockSetCursorPosition;
+    mConOut.EnableCursor = MockEnableCursor;
+    mConOut.Mode = &mConOutMode;
+
+    return &mConOut;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Text input, there are never any keys
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static EFI_STATUS EFIAPI MockInputReset(EFI_SIMPLE_TEXT_INPUT_PROTOCOL* This, BOOLEAN ExtendedVerification) {
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockReadKeyStroke(EFI_SIMPLE_TEXT_INPUT_PROTOCOL* This, EFI_INPUT_KEY* Key) {
+    return EFI_NOT_READY;
+}
+
+EFI_SIMPLE_TEXT_INPUT_PROTOCOL* MockConInInit() {
+    mConIn.Reset = MockInputReset;
+    mConIn.ReadKeyStroke = MockReadKeyStroke;
+    if (EFI_ERROR(gBS->CreateEvent(0, TPL_NOTIFY, NULL, NULL, &mConIn.WaitForKey))) {
+        return NULL;
+    }
+
+    return &mConIn;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Graphics output, the framebuffer is reserved memory
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static EFI_STATUS EFIAPI MockGraphicsQueryMode(EFI_GRAPHICS_OUTPUT_PROTOCOL* This, UINT32 ModeNumber, UINTN* SizeOfInfo, EFI_GRAPHICS_OUTPUT_MODE_INFORMATION** Info) {
+    if (ModeNumber >= ARRAY_SIZE(mGraphicsModes) || SizeOfInfo == NULL || Info == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    *SizeOfInfo = sizeof(EFI_GRAPHICS_OUTPUT_MODE_INFORMATION);
+    *Info = &mGraphicsModes[ModeNumber];
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockGraphicsSetMode(EFI_GRAPHICS_OUTPUT_PROTOCOL* This, UINT32 ModeNumber) {
+    if (ModeNumber >= ARRAY_SIZE(mGraphicsModes)) {
+        return EFI_UNSUPPORTED;
+    }
+
+    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION* Info = &mGraphicsModes[ModeNumber];
+    mGraphicsMode.Mode = ModeNumber;
+    mGraphicsMode.Info = Info;
+    mGraphicsMode.FrameBufferSize = Info->PixelsPerScanLine * Info->VerticalResolution * sizeof(UINT32);
+    SetMem((void*)mGraphicsMode.FrameBufferBase, mGraphicsMode.FrameBufferSize, 0);
+
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockGraphicsBlt(EFI_GRAPHICS_OUTPUT_PROTOCOL* This, EFI_GRAPHICS_OUTPUT_BLT_PIXEL* BltBuffer, EFI_GRAPHICS_OUTPUT_BLT_OPERATION BltOperation,
+                                         UINTN SourceX, UINTN SourceY, UINTN DestinationX, UINTN DestinationY, UINTN Width, UINTN Height, UINTN Delta) {
+    return EFI_UNSUPPORTED;
+}
+
+EFI_STATUS MockGraphicsInit() {
+    EFI_HANDLE Handle = NULL;
+
+    // big enough for all the modes
+    UINTN FrameBufferSize = 0;
+    for (UINTN i = 0; i < ARRAY_SIZE(mGraphicsModes); i++) {
+        FrameBufferSize = MAX(FrameBufferSize, mGraphicsModes[i].PixelsPerScanLine * mGraphicsModes[i].VerticalResolution * sizeof(UINT32));
+    }
+
+    EFI_PHYSICAL_ADDRESS FrameBuffer = 0;
+    EFI_STATUS Status = gBS->AllocatePages(AllocateAnyPages, EfiReservedMemoryType, EFI_SIZE_TO_PAGES(FrameBufferSize), &FrameBuffer);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    mGraphicsMode.MaxMode = ARRAY_SIZE(mGraphicsModes);
+    mGraphicsMode.SizeOfInfo = sizeof(EFI_GRAPHICS_OUTPUT_MODE_INFORMATION);
+    mGraphicsMode.FrameBufferBase = FrameBuffer;
+
+    mGraphicsOutput.QueryMode = MockGraphicsQueryMode;
+    mGraphicsOutput.SetMode = MockGraphicsSetMode;
+    mGraphicsOutput.Blt = MockGraphicsBlt;
+    mGraphicsOutput.Mode = &mGraphicsMode;
+    MockGraphicsSetMode(&mGraphicsOutput, 0);
+
+    return MockInstallProtocol(&Handle, &gEfiGraphicsOutputProtocolGuid, &mGraphicsOutput);
+}
@@ -0,0 +1,204 @@
+/**
+ * The parts of the loader that are written in assembly or that need
+ * ring 0, on the host the registers the loaders touch are emulated and
+ * jumping to a kernel ends the run.
+ */
+#include "Mock.h"
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/CpuLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#define MSR_IA32_APIC_BASE  0x1B
+#define MSR_IA32_EFER       0xC0000080
+
+typedef struct _MOCK_MSR {
+    UINT32 Index;
+    UINT64 Value;
+} MOCK_MSR;
+
+// paging, write protect and protected mode
+static UINTN mCr0 = 0x80010033;
+static UINTN mCr3 = 0;
+
+static MOCK_MSR mMsrs[16] = {
+    // enabled xapic at the default base, we are the bsp
+    { MSR_IA32_APIC_BASE, 0xFEE00900 },
+    // syscall, long mode and nx
+    { MSR_IA32_EFER, 0xD01 },
+};
+
+EFI_STATUS MockCpuInit() {
+    EFI_PHYSICAL_ADDRESS Tables = BASE_4GB - 1;
+
+    // the firmware identity maps everything with 1GB pages, the loaders
+    // edit the page table in place so it must be in the memory map
+    EFI_STATUS Status = gBS->AllocatePages(AllocateMaxAddress, EfiBootServicesData, 2, &Tables);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    UINT64* Pml4 = (UINT64*)Tables;
+    UINT64* Pml3 = (UINT64*)(Tables + EFI_PAGE_SIZE);
+    SetMem(Pml4, EFI_PAGE_SIZE, 0);
+    for (UINTN i = 0; i < 512; i++) {
+        Pml3[i] = LShiftU64(i, 30) | 0x83;
+    }
+    Pml4[0] = (UINT64)Pml3 | 0x3;
+    mCr3 = (UINTN)Pml4;
+
+    return EFI_SUCCESS;
+}
+
+UINT32 EFIAPI AsmCpuidEx(UINT32 Index, UINT32 SubIndex, UINT32* Eax, UINT32* Ebx, UINT32* Ecx, UINT32* Edx) {
+    UINT32 a, b, c, d;
+    __asm__ volatile ("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(Index), "c"(SubIndex));
+    if (Eax != NULL) *Eax = a;
+    if (Ebx != NULL) *Ebx = b;
+    if (Ecx != NULL) *Ecx = c;
+    if (Edx != NULL) *Edx = d;
+    return Index;
+}
+
+UINT32 EFIAPI AsmCpuid(UINT32 Index, UINT32* Eax, UINT32* Ebx, UINT32* Ecx, UINT32* Edx) {
+    return AsmCpuidEx(Index, 0, Eax, Ebx, Ecx, Edx);
+}
+
+UINT64 EFIAPI AsmReadTsc() {
+    UINT32 Low, High;
+    __asm__ volatile ("rdtsc" : "=a"(Low), "=d"(High));
+    return LShiftU64(High, 32) | Low;
+}
+
+BOOLEAN EFIAPI InternalX86RdRand64(UINT64* Rand) {
+    UINT8 Ok;
+    __asm__ volatile ("rdrand %0; setc %1" : "=r"(*Rand), "=qm"(Ok));
+    return Ok;
+}
+
+BOOLEAN EFIAPI InternalX86RdRand32(UINT32* Rand) {
+    UINT8 Ok;
+    __asm__ volatile ("rdrand %0; setc %1" : "=r"(*Rand), "=qm"(Ok));
+    return Ok;
+}
+
+BOOLEAN EFIAPI InternalX86RdRand16(UINT16* Rand) {
+    UINT8 Ok;
+    __asm__ volatile ("rdrand %0; setc %1" : "=r"(*Rand), "=qm"(Ok));
+    return Ok;
+}
+
+void EFIAPI CpuPause() {
+    __asm__ volatile ("pause");
+}
+
+void EFIAPI MemoryFence() {
+    __asm__ volatile ("mfence" ::: "memory");
+}
+
+void EFIAPI CpuBreakpoint() {
+    __asm__ volatile ("int $3");
+}
+
+/**
+ * The loader only sleeps when it has nothing left to do
+ */
+void EFIAPI CpuSleep() {
+    MockFatal("The loader went to sleep\n");
+}
+
+void EFIAPI DisableInterrupts() {
+}
+
+void EFIAPI InternalX86WriteGdtr(CONST IA32_DESCRIPTOR* Gdtr) {
+}
+
+void EFIAPI InternalX86WriteIdtr(CONST IA32_DESCRIPTOR* Idtr) {
+}
+
+UINTN EFIAPI AsmReadCr0() {
+    return mCr0;
+}
+
+UINTN EFIAPI AsmWriteCr0(UINTN Cr0) {
+    mCr0 = Cr0;
+    return Cr0;
+}
+
+UINTN EFIAPI AsmReadCr3() {
+    return mCr3;
+}
+
+static MOCK_MSR* FindMsr(UINT32 Index) {
+    for (UINTN i = 0; i < ARRAY_SIZE(mMsrs); i++) {
+        if (mMsrs[i].Index == Index || (mMsrs[i].Index == 0 && mMsrs[i].Value == 0)) {
+            mMsrs[i].Index = Index;
+            return &mMsrs[i];
+        }
+    }
+    MockFatal("Too many msrs\n");
+}
+
+UINT64 EFIAPI AsmReadMsr64(UINT32 Index) {
+    return FindMsr(Index)->Value;
+}
+
+UINT64 EFIAPI AsmWriteMsr64(UINT32 Index, UINT64 Value) {
+    FindMsr(Index)->Value = Value;
+    return Value;
+}
+
+/**
+ * The debugcon is the standard output
+ */
+void DebugconWrite(CONST CHAR8* Buffer, UINTN Size) {
+    HostWrite(Buffer, Size);
+}
+
+void FastZeroMem(void* Buffer, UINTN Size) {
+    __asm__ volatile ("rep stosb" : "+D"(Buffer), "+c"(Size) : "a"(0) : "memory");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Jumping to the kernel
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void EFIAPI JumpToKernel(void* KernelStart, void* KernelBootParams) {
+    MockHandoff("linux", KernelStart, KernelBootParams);
+}
+
+void EFIAPI JumpToUefiKernel(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE* SystemTable, void* KernelBootParams, void* KernelStart) {
+    MockHandoff("linux (efi handover)", KernelStart, KernelBootParams);
+}
+
+void JumpToMB2Kernel(void* KernelStart, void* KernelParams) {
+    MockHandoff("multiboot2", KernelStart, KernelParams);
+}
+
+void JumpToStivaleKernel(void* Struct, UINT64 Stack, void* KernelEntry, BOOLEAN Level5) {
+    MockHandoff("stivale", KernelEntry, Struct);
+}
+
+void JumpToStivale2Kernel(void* Struct, UINT64 Stack, void* KernelEntry, BOOLEAN Level5) {
+    MockHandoff("stivale2", KernelEntry, Struct);
+}
+
+// the APs are never started on the host, only the layout of the trampoline matters
+__asm__(
+    ".data\n"
+    ".balign 16\n"
+    ".globl SmpTrampolineStart\n"
+    "SmpTrampolineStart:\n"
+    ".globl SmpTrampolineProtectedMode\n"
+    "SmpTrampolineProtectedMode:\n"
+    ".globl SmpTrampolineLongMode\n"
+    "SmpTrampolineLongMode:\n"
+    ".balign 16\n"
+    ".globl SmpTrampolineData\n"
+    "SmpTrampolineData:\n"
+    ".skip 256\n"
+    ".globl SmpTrampolineEnd\n"
+    "SmpTrampolineEnd:\n"
+    ".text\n"
+);
@@ -0,0 +1,442 @@
+#include "Mock.h"
+
+#include <Guid/FileInfo.h>
+#include <Guid/FileSystemInfo.h>
+#include <Protocol/SimpleFileSystem.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/PrintLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#define MOCK_PATH_SIZE 1024
+
+typedef struct _MOCK_VOLUME {
+    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL Protocol;
+    CHAR8 Root[MOCK_PATH_SIZE];
+} MOCK_VOLUME;
+
+typedef struct _MOCK_FILE {
+    EFI_FILE_PROTOCOL Protocol;
+    MOCK_VOLUME* Volume;
+
+    // relative to the root of the volume, without a leading separator
+    CHAR8 Path[MOCK_PATH_SIZE];
+
+    BOOLEAN Directory;
+    UINT64 Size;
+    INT64 ModificationTime;
+
+    // for files
+    int Fd;
+    UINT64 Position;
+
+    // for directories, an entry that did not fit the last read
+    void* Dir;
+    CHAR8 PendingName[256];
+    BOOLEAN HasPending;
+} MOCK_FILE;
+
+static EFI_FILE_PROTOCOL mFileTemplate;
+
+static void HostPath(MOCK_VOLUME* Volume, CHAR8* Path, CHAR8* Buffer) {
+    AsciiSPrint(Buffer, MOCK_PATH_SIZE, "%a/%a", Volume->Root, Path);
+}
+
+/**
+ * Resolve a uefi path relative to a directory, both separators are
+ * accepted since the configs use forward slashes
+ */
+static EFI_STATUS ResolvePath(MOCK_FILE* Parent, CHAR16* FileName, CHAR8* Path) {
+    UINTN Length = 0;
+    if (FileName[0] != L'\\' && FileName[0] != L'/') {
+        Length = AsciiStrLen(Parent->Path);
+        CopyMem(Path, Parent->Path, Length);
+    }
+
+    CHAR16* Component = FileName;
+    while (*Component != L'\0') {
+        // find the end of the component
+        CHAR16* End = Component;
+        while (*End != L'\0' && *End != L'\\' && *End != L'/') {
+            End++;
+        }
+        UINTN ComponentLength = End - Component;
+
+        if (ComponentLength == 0 || (ComponentLength == 1 && Component[0] == L'.')) {
+            // nothing to do
+        } else if (ComponentLength == 2 && Component[0] == L'.' && Component[1] == L'.') {
+            // go up, but never above the root
+            while (Length > 0 && Path[Length - 1] != '/') {
+                Length--;
+            }
+            if (Length > 0) {
+                Length--;
+            }
+        } else {
+            if (Length + 1 + ComponentLength + 1 > MOCK_PATH_SIZE) {
+                return EFI_NOT_FOUND;
+            }
+            if (Length > 0) {
+                Path[Length++] = '/';
+            }
+            for (UINTN i = 0; i < ComponentLength; i++) {
+                if (Component[i] >= 0x80) {
+                    return EFI_NOT_FOUND;
+                }
+                Path[Length++] = (CHAR8)Component[i];
+            }
+        }
+
+        Component = *End == L'\0' ? End : End + 1;
+    }
+
+    Path[Length] = '\0';
+    return EFI_SUCCESS;
+}
+
+/**
+ * Seconds since the epoch to an EFI_TIME
+ */
+static void EpochToTime(INT64 Seconds, EFI_TIME* Time) {
+    SetMem(Time, sizeof(EFI_TIME), 0);
+    if (Seconds < 0) {
+        Seconds = 0;
+    }
+
+    INT64 Days = Seconds / 86400;
+    INT64 Rest = Seconds % 86400;
+    Time->Hour = (UINT8)(Rest / 3600);
+    Time->Minute = (UINT8)((Rest % 3600) / 60);
+    Time->Second = (UINT8)(Rest % 60);
+
+    // days to a civil date
+    Days += 719468;
+    INT64 Era = Days / 146097;
+    INT64 DayOfEra = Days - Era * 146097;
+    INT64 YearOfEra = (DayOfEra - DayOfEra / 1460 + DayOfEra / 36524 - DayOfEra / 146096) / 365;
+    INT64 DayOfYear = DayOfEra - (365 * YearOfEra + YearOfEra / 4 - YearOfEra / 100);
+    INT64 MonthIndex = (5 * DayOfYear + 2) / 153;
+    Time->Day = (UINT8)(DayOfYear - (153 * MonthIndex + 2) / 5 + 1);
+    Time->Month = (UINT8)(MonthIndex < 10 ? MonthIndex + 3 : MonthIndex - 9);
+    Time->Year = (UINT16)(YearOfEra + Era * 400 + (Time->Month <= 2));
+    Time->TimeZone = EFI_UNSPECIFIED_TIMEZONE;
+}
+
+static EFI_STATUS FillFileInfo(CHAR8* Name, BOOLEAN Directory, UINT64 Size, INT64 ModificationTime, UINTN* BufferSize, void* Buffer) {
+    UINTN NameLength = AsciiStrLen(Name);
+    UINTN Needed = SIZE_OF_EFI_FILE_INFO + (NameLength + 1) * sizeof(CHAR16);
+    if (*BufferSize < Needed || Buffer == NULL) {
+        *BufferSize = Needed;
+        return EFI_BUFFER_TOO_SMALL;
+    }
+
+    EFI_FILE_INFO* Info = Buffer;
+    SetMem(Info, Needed, 0);
+    Info->Size = Needed;
+    Info->FileSize = Directory ? 0 : Size;
+    Info->PhysicalSize = Directory ? 0 : ALIGN_VALUE(Size, 512);
+    EpochToTime(ModificationTime, &Info->CreateTime);
+    EpochToTime(ModificationTime, &Info->LastAccessTime);
+    EpochToTime(ModificationTime, &Info->ModificationTime);
+    Info->Attribute = EFI_FILE_READ_ONLY | (Directory ? EFI_FILE_DIRECTORY : 0);
+    for (UINTN i = 0; i < NameLength; i++) {
+        Info->FileName[i] = (UINT8)Name[i];
+    }
+
+    *BufferSize = Needed;
+    return EFI_SUCCESS;
+}
+
+static MOCK_FILE* CreateFile(MOCK_VOLUME* Volume, CHAR8* Path) {
+    CHAR8 Full[MOCK_PATH_SIZE];
+    int IsDirectory = 0;
+    unsigned long long Size = 0;
+    long long ModificationTime = 0;
+
+    HostPath(Volume, Path, Full);
+    if (HostStat(Full, &IsDirectory, &Size, &ModificationTime) != 0) {
+        return NULL;
+    }
+
+    MOCK_FILE* File = HostAlloc(sizeof(MOCK_FILE));
+    if (File == NULL) {
+        return NULL;
+    }
+    SetMem(File, sizeof(MOCK_FILE), 0);
+    CopyMem(&File->Protocol, &mFileTemplate, sizeof(EFI_FILE_PROTOCOL));
+    File->Volume = Volume;
+    AsciiStrCpyS(File->Path, MOCK_PATH_SIZE, Path);
+    File->Directory = IsDirectory != 0;
+    File->Size = Size;
+    File->ModificationTime = ModificationTime;
+    File->Fd = -1;
+
+    if (File->Directory) {
+        File->Dir = HostOpenDir(Full);
+        if (File->Dir == NULL) {
+            HostFree(File);
+            return NULL;
+        }
+    } else {
+        File->Fd = HostOpen(Full);
+        if (File->Fd < 0) {
+            HostFree(File);
+            return NULL;
+        }
+    }
+
+    return File;
+}
+
+static EFI_STATUS EFIAPI MockFileOpen(EFI_FILE_PROTOCOL* This, EFI_FILE_PROTOCOL** NewHandle, CHAR16* FileName, UINT64 OpenMode, UINT64 Attributes) {
+    MOCK_FILE* Parent = BASE_CR(This, MOCK_FILE, Protocol);
+    CHAR8 Path[MOCK_PATH_SIZE];
+
+    if (NewHandle == NULL || FileName == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if (OpenMode != EFI_FILE_MODE_READ) {
+        return EFI_WRITE_PROTECTED;
+    }
+
+    EFI_STATUS Status = ResolvePath(Parent, FileName, Path);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    MOCK_FILE* File = CreateFile(Parent->Volume, Path);
+    if (File == NULL) {
+        return EFI_NOT_FOUND;
+    }
+
+    *NewHandle = &File->Protocol;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockFileClose(EFI_FILE_PROTOCOL* This) {
+    MOCK_FILE* File = BASE_CR(This, MOCK_FILE, Protocol);
+
+    if (File->Fd >= 0) {
+        HostClose(File->Fd);
+    }
+    if (File->Dir != NULL) {
+        HostCloseDir(File->Dir);
+    }
+    HostFree(File);
+
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockFileDelete(EFI_FILE_PROTOCOL* This) {
+    MockFileClose(This);
+    return EFI_WARN_DELETE_FAILURE;
+}
+
+static EFI_STATUS ReadDirectory(MOCK_FILE* File, UINTN* BufferSize, void* Buffer) {
+    CHAR8 Path[MOCK_PATH_SIZE];
+    CHAR8 Full[MOCK_PATH_SIZE];
+
+    while (TRUE) {
+        if (!File->HasPending) {
+            if (HostReadDir(File->Dir, File->PendingName, sizeof(File->PendingName)) != 0) {
+                *BufferSize = 0;
+                return EFI_SUCCESS;
+            }
+            File->HasPending = TRUE;
+        }
+
+        AsciiSPrint(Path, sizeof(Path), File->Path[0] == '\0' ? "%a%a" : "%a/%a", File->Path, File->PendingName);
+        HostPath(File->Volume, Path, Full);
+
+        // skip anything that went away or we can't describe
+        int IsDirectory = 0;
+        unsigned long long Size = 0;
+        long long ModificationTime = 0;
+        if (HostStat(Full, &IsDirectory, &Size, &ModificationTime) != 0) {
+            File->HasPending = FALSE;
+            continue;
+        }
+
+        // keep the entry for the next read if it does not fit
+        EFI_STATUS Status = FillFileInfo(File->PendingName, IsDirectory != 0, Size, ModificationTime, BufferSize, Buffer);
+        if (!EFI_ERROR(Status)) {
+            File->HasPending = FALSE;
+        }
+        return Status;
+    }
+}
+
+static EFI_STATUS EFIAPI MockFileRead(EFI_FILE_PROTOCOL* This, UINTN* BufferSize, void* Buffer) {
+    MOCK_FILE* File = BASE_CR(This, MOCK_FILE, Protocol);
+
+    if (BufferSize == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if (File->Directory) {
+        return ReadDirectory(File, BufferSize, Buffer);
+    }
+
+    if (File->Position >= File->Size) {
+        *BufferSize = 0;
+        return File->Position > File->Size ? EFI_DEVICE_ERROR : EFI_SUCCESS;
+    }
+
+    UINT64 Size = MIN(*BufferSize, File->Size - File->Position);
+    long long Read = HostRead(File->Fd, Buffer, Size, File->Position);
+    if (Read < 0) {
+        return EFI_DEVICE_ERROR;
+    }
+
+    File->Position += Read;
+    *BufferSize = Read;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockFileWrite(EFI_FILE_PROTOCOL* This, UINTN* BufferSize, void* Buffer) {
+    return EFI_ACCESS_DENIED;
+}
+
+static EFI_STATUS EFIAPI MockFileGetPosition(EFI_FILE_PROTOCOL* This, UINT64* Position) {
+    MOCK_FILE* File = BASE_CR(This, MOCK_FILE, Protocol);
+
+    if (File->Directory) {
+        return EFI_UNSUPPORTED;
+    }
+
+    *Position = File->Position;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockFileSetPosition(EFI_FILE_PROTOCOL* This, UINT64 Position) {
+    MOCK_FILE* File = BASE_CR(This, MOCK_FILE, Protocol);
+
+    // directories can only be rewound
+    if (File->Directory) {
+        if (Position != 0) {
+            return EFI_UNSUPPORTED;
+        }
+        HostRewindDir(File->Dir);
+        File->HasPending = FALSE;
+        return EFI_SUCCESS;
+    }
+
+    File->Position = Position == MAX_UINT64 ? File->Size : Position;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockFileGetInfo(EFI_FILE_PROTOCOL* This, EFI_GUID* InformationType, UINTN* BufferSize, void* Buffer) {
+    MOCK_FILE* File = BASE_CR(This, MOCK_FILE, Protocol);
+
+    if (InformationType == NULL || BufferSize == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if (CompareGuid(InformationType, &gEfiFileInfoGuid)) {
+        // the name of the file itself, the root has no name
+        CHAR8* Name = File->Path + AsciiStrLen(File->Path);
+        while (Name > File->Path && Name[-1] != '/') {
+            Name--;
+        }
+        return FillFileInfo(Name, File->Directory, File->Size, File->ModificationTime, BufferSize, Buffer);
+    }
+
+    if (CompareGuid(InformationType, &gEfiFileSystemInfoGuid)) {
+        UINTN Needed = SIZE_OF_EFI_FILE_SYSTEM_INFO + sizeof(L"MOCK");
+        if (*BufferSize < Needed || Buffer == NULL) {
+            *BufferSize = Needed;
+            return EFI_BUFFER_TOO_SMALL;
+        }
+
+        EFI_FILE_SYSTEM_INFO* Info = Buffer;
+        SetMem(Info, Needed, 0);
+        Info->Size = Needed;
+        Info->ReadOnly = TRUE;
+        Info->BlockSize = 512;
+        CopyMem(Info->VolumeLabel, L"MOCK", sizeof(L"MOCK"));
+        *BufferSize = Needed;
+        return EFI_SUCCESS;
+    }
+
+    return EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS EFIAPI MockFileSetInfo(EFI_FILE_PROTOCOL* This, EFI_GUID* InformationType, UINTN BufferSize, void* Buffer) {
+    return EFI_WRITE_PROTECTED;
+}
+
+static EFI_STATUS EFIAPI MockFileFlush(EFI_FILE_PROTOCOL* This) {
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockFileOpenEx(EFI_FILE_PROTOCOL* This, EFI_FILE_PROTOCOL** NewHandle, CHAR16* FileName, UINT64 OpenMode, UINT64 Attributes, EFI_FILE_IO_TOKEN* Token) {
+    Token->Status = MockFileOpen(This, NewHandle, FileName, OpenMode, Attributes);
+    return gBS->SignalEvent(Token->Event);
+}
+
+/**
+ * The read is done right away, the caller still has to go through the event
+ */
+static EFI_STATUS EFIAPI MockFileReadEx(EFI_FILE_PROTOCOL* This, EFI_FILE_IO_TOKEN* Token) {
+    Token->Status = MockFileRead(This, &Token->BufferSize, Token->Buffer);
+    return gBS->SignalEvent(Token->Event);
+}
+
+static EFI_STATUS EFIAPI MockFileWriteEx(EFI_FILE_PROTOCOL* This, EFI_FILE_IO_TOKEN* Token) {
+    return EFI_ACCESS_DENIED;
+}
+
+static EFI_STATUS EFIAPI MockFileFlushEx(EFI_FILE_PROTOCOL* This, EFI_FILE_IO_TOKEN* Token) {
+    Token->Status = EFI_SUCCESS;
+    return gBS->SignalEvent(Token->Event);
+}
+
+static EFI_STATUS EFIAPI MockOpenVolume(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* This, EFI_FILE_PROTOCOL** Root) {
+    MOCK_VOLUME* Volume = BASE_CR(This, MOCK_VOLUME, Protocol);
+
+    MOCK_FILE* File = CreateFile(Volume, "");
+    if (File == NULL) {
+        return EFI_DEVICE_ERROR;
+    }
+
+    *Root = &File->Protocol;
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS MockFileSystemInit(const char* Path, EFI_HANDLE* Handle) {
+    int IsDirectory = 0;
+    unsigned long long Size = 0;
+    long long ModificationTime = 0;
+
+    if (HostStat(Path, &IsDirectory, &Size, &ModificationTime) != 0 || !IsDirectory) {
+        return EFI_NOT_FOUND;
+    }
+
+    mFileTemplate.Revision = EFI_FILE_PROTOCOL_REVISION2;
+    mFileTemplate.Open = MockFileOpen;
+    mFileTemplate.Close = MockFileClose;
+    mFileTemplate.Delete = MockFileDelete;
+    mFileTemplate.Read = MockFileRead;
+    mFileTemplate.Write = MockFileWrite;
+    mFileTemplate.GetPosition = MockFileGetPosition;
+    mFileTemplate.SetPosition = MockFileSetPosition;
+    mFileTemplate.GetInfo = MockFileGetInfo;
+    mFileTemplate.SetInfo = MockFileSetInfo;
+    mFileTemplate.Flush = MockFileFlush;
+    mFileTemplate.OpenEx = MockFileOpenEx;
+    mFileTemplate.ReadEx = MockFileReadEx;
+    mFileTemplate.WriteEx = MockFileWriteEx;
+    mFileTemplate.FlushEx = MockFileFlushEx;
+
+    MOCK_VOLUME* Volume = HostAlloc(sizeof(MOCK_VOLUME));
+    if (Volume == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    SetMem(Volume, sizeof(MOCK_VOLUME), 0);
+    Volume->Protocol.Revision = EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_REVISION;
+    Volume->Protocol.OpenVolume = MockOpenVolume;
+    AsciiStrCpyS(Volume->Root, MOCK_PATH_SIZE, Path);
+
+    return MockInstallProtocol(Handle, &gEfiSimpleFileSystemProtocolGuid, &Volume->Protocol);
+}
@@ -0,0 +1,132 @@
+#include "Mock.h"
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+/**
+ * Variables only live as long as the run
+ */
+typedef struct _MOCK_VARIABLE {
+    struct _MOCK_VARIABLE* Next;
+    CHAR16* Name;
+    EFI_GUID Guid;
+    UINT32 Attributes;
+    UINTN Size;
+    UINT8 Data[];
+} MOCK_VARIABLE;
+
+static EFI_RUNTIME_SERVICES mRuntimeServices;
+static MOCK_VARIABLE* mVariables = NULL;
+
+static EFI_STATUS EFIAPI MockGetTime(EFI_TIME* Time, EFI_TIME_CAPABILITIES* Capabilities) {
+    if (Time == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    int Local[6];
+    HostLocalTime(Local);
+    SetMem(Time, sizeof(EFI_TIME), 0);
+    Time->Year = Local[0];
+    Time->Month = Local[1];
+    Time->Day = Local[2];
+    Time->Hour = Local[3];
+    Time->Minute = Local[4];
+    Time->Second = Local[5];
+    Time->TimeZone = EFI_UNSPECIFIED_TIMEZONE;
+
+    if (Capabilities != NULL) {
+        Capabilities->Resolution = 1;
+        Capabilities->Accuracy = 50000000;
+        Capabilities->SetsToZero = FALSE;
+    }
+
+    return EFI_SUCCESS;
+}
+
+static MOCK_VARIABLE** FindVariable(CHAR16* Name, EFI_GUID* Guid) {
+    MOCK_VARIABLE** Link = &mVariables;
+    while (*Link != NULL && !(StrCmp((*Link)->Name, Name) == 0 && CompareGuid(&(*Link)->Guid, Guid))) {
+        Link = &(*Link)->Next;
+    }
+    return Link;
+}
+
+static EFI_STATUS EFIAPI MockGetVariable(CHAR16* VariableName, EFI_GUID* VendorGuid, UINT32* Attributes, UINTN* DataSize, void* Data) {
+    if (VariableName == NULL || VendorGuid == NULL || DataSize == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    MOCK_VARIABLE* Variable = *FindVariable(VariableName, VendorGuid);
+    if (Variable == NULL) {
+        return EFI_NOT_FOUND;
+    }
+
+    if (Attributes != NULL) {
+        *Attributes = Variable->Attributes;
+    }
+
+    if (*DataSize < Variable->Size) {
+        *DataSize = Variable->Size;
+        return EFI_BUFFER_TOO_SMALL;
+    }
+
+    CopyMem(Data, Variable->Data, Variable->Size);
+    *DataSize = Variable->Size;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MockSetVariable(CHAR16* VariableName, EFI_GUID* VendorGuid, UINT32 Attributes, UINTN DataSize, void* Data) {
+    if (VariableName == NULL || VendorGuid == NULL || (DataSize != 0 && Data == NULL)) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    // setting a variable replaces it, and an empty one deletes it
+    MOCK_VARIABLE** Link = FindVariable(VariableName, VendorGuid);
+    if (*Link != NULL) {
+        MOCK_VARIABLE* Old = *Link;
+        *Link = Old->Next;
+        HostFree(Old->Name);
+        HostFree(Old);
+    }
+
+    if (DataSize == 0) {
+        return EFI_SUCCESS;
+    }
+
+    MOCK_VARIABLE* Variable = HostAlloc(sizeof(MOCK_VARIABLE) + DataSize);
+    UINTN NameSize = StrSize(VariableName);
+    CHAR16* Name = HostAlloc(NameSize);
+    if (Variable == NULL || Name == NULL) {
+        HostFree(Variable);
+        HostFree(Name);
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    CopyMem(Name, VariableName, NameSize);
+    Variable->Next = mVariables;
+    Variable->Name = Name;
+    CopyGuid(&Variable->Guid, VendorGuid);
+    Variable->Attributes = Attributes;
+    Variable->Size = DataSize;
+    CopyMem(Variable->Data, Data, DataSize);
+    mVariables = Variable;
+
+    return EFI_SUCCESS;
+}
+
+static void EFIAPI MockResetSystem(EFI_RESET_TYPE ResetType, EFI_STATUS ResetStatus, UINTN DataSize, void* ResetData) {
+    MockFatal("ResetSystem(%d, %r)\n", ResetType, ResetStatus);
+}
+
+EFI_RUNTIME_SERVICES* MockRuntimeServicesInit() {
+    mRuntimeServices.Hdr.Signature = EFI_RUNTIME_SERVICES_SIGNATURE;
+    mRuntimeServices.Hdr.Revision = EFI_RUNTIME_SERVICES_REVISION;
+    mRuntimeServices.Hdr.HeaderSize = sizeof(EFI_RUNTIME_SERVICES);
+
+    mRuntimeServices.GetTime = MockGetTime;
+    mRuntimeServices.GetVariable = MockGetVariable;
+    mRuntimeServices.SetVariable = MockSetVariable;
+    mRuntimeServices.ResetSystem = MockResetSystem;
+
+    return &mRuntimeServices;
+}
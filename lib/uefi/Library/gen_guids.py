@@ -42,7 +42,8 @@ if __name__ == '__main__':
             'EFI_UNICODE_COLLATION2_PROTOCOL_GUID': 'EFI_UNICODE_COLLATION_PROTOCOL2_GUID',
             'EFI_DEBUG_PORT_PROTOCOL_GUID': 'EFI_DEBUGPORT_PROTOCOL_GUID',
             'EFI_DEBUG_PORT_VARIABLE_GUID': 'EFI_DEBUGPORT_VARIABLE_GUID',
-            'EFI_DEBUG_PORT_DEVICE_PATH_GUID': 'DEVICE_PATH_MESSAGING_DEBUGPORT'
+            'EFI_DEBUG_PORT_DEVICE_PATH_GUID': 'DEVICE_PATH_MESSAGING_DEBUGPORT',
+            'EFI_MP_SERVICE_PROTOCOL_GUID': 'EFI_MP_SERVICES_PROTOCOL_GUID'
         }
 
         # Go over all the files in the include folder
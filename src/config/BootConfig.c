@@ -35,6 +35,10 @@ void LoadBootConfig(BOOT_CONFIG* config) {
     }
 }
 
+UINTN GetBootDelay(BOOT_CONFIG* config) {
+    return gBootDelayOverride >= 0 ? gBootDelayOverride : config->BootDelay;
+}
+
 void SaveBootConfig(BOOT_CONFIG* config) {
     ASSERT_EFI_ERROR(gRT->SetVariable(gTomatBootConfigName, &gTomatBootConfigGuid,
             EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS, sizeof(BOOT_CONFIG), config));
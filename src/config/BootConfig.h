@@ -22,6 +22,11 @@ extern INT32 gBootDelayOverride;
  */
 void LoadBootConfig(BOOT_CONFIG* config);
 
+/**
+ * The boot delay to use, the override or the one of the config
+ */
+UINTN GetBootDelay(BOOT_CONFIG* config);
+
 /**
  * Save the boot configurations to the disk
  */
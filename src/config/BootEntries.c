@@ -2,8 +2,14 @@
 #include "BootConfig.h"
 
 #include <util/Except.h>
+#include <util/LogUtils.h>
+#include <util/HashUtils.h>
+#include <util/MeasureUtils.h>
+#include <util/decompress/Decompress.h>
+#include <util/fs/BlockRead.h>
 
 #include <Uefi.h>
+#include <Guid/FileInfo.h>
 #include <Protocol/SimpleFileSystem.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/FileHandleLib.h>
@@ -34,10 +40,177 @@ static CHAR16* CopyString(CHAR16* String) {
     return AllocateCopyPool((1 + StrLen(String)) * sizeof(CHAR16), String);
 }
 
+/**
+ * Hash a line of the config as ascii with its newline, for a normal
+ * config this is the same as hashing the file
+ */
+static void HashLine(SHA256_CONTEXT* Hash, CHAR16* Line) {
+    for (CHAR16* c = Line; *c != L'\0'; c++) {
+        UINT8 Byte = (UINT8)*c;
+        Sha256Update(Hash, &Byte, 1);
+    }
+    Sha256Update(Hash, "\n", 1);
+}
+
+/**
+ * Match a file name against a pattern with `*` and `?`, case
+ * insensitive like FAT is
+ */
+static BOOLEAN GlobMatch(CHAR16* Pattern, CHAR16* Name) {
+    if (*Pattern == L'*') {
+        // try every length for the star
+        for (CHAR16* Rest = Name; ; Rest++) {
+            if (GlobMatch(Pattern + 1, Rest)) {
+                return TRUE;
+            }
+            if (*Rest == L'\0') {
+                return FALSE;
+            }
+        }
+    }
+
+    if (*Pattern == L'\0' || *Name == L'\0') {
+        return *Pattern == *Name;
+    }
+
+    if (*Pattern != L'?' && CharToUpper(*Pattern) != CharToUpper(*Name)) {
+        return FALSE;
+    }
+
+    return GlobMatch(Pattern + 1, Name + 1);
+}
+
+static void FreeModule(BOOT_MODULE* Module) {
+    if (Module->Path != NULL) {
+        FreePool(Module->Path);
+    }
+    if (Module->Tag != NULL) {
+        FreePool(Module->Tag);
+    }
+    FreePool(Module);
+}
+
+/**
+ * Add a module for every file of the directory which matches the pattern at the end
+ * of the path, if there is one. They are sorted by name, so the order does not depend
+ * on the directory, and laid out in one batch using the sizes the directory lists.
+ */
+static EFI_STATUS AddModuleDirectory(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FS, EFI_FILE_PROTOCOL* Root, BOOT_ENTRY* Entry, CHAR16* Value, BOOT_MODULE** First) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_FILE_PROTOCOL* directory = NULL;
+    EFI_FILE_INFO* info = NULL;
+    CHAR16* pattern = NULL;
+    LIST_ENTRY modules = INITIALIZE_LIST_HEAD_VARIABLE(modules);
+
+    CHAR16* path = CopyString(Value);
+    CHECK_ERROR(path != NULL, EFI_OUT_OF_RESOURCES);
+
+    // the last part is a pattern if it has any wildcards
+    CHAR16* last = path;
+    for (CHAR16* c = path; *c != L'\0'; c++) {
+        if (*c == L'\\' || *c == L'/') {
+            last = c + 1;
+        }
+    }
+    if (StrStr(last, L"*") != NULL || StrStr(last, L"?") != NULL) {
+        pattern = CopyString(last);
+        CHECK_ERROR(pattern != NULL, EFI_OUT_OF_RESOURCES);
+        *last = L'\0';
+    }
+
+    // no trailing separators, an empty path is the root
+    UINTN pathLength = StrLen(path);
+    while (pathLength > 0 && (path[pathLength - 1] == L'\\' || path[pathLength - 1] == L'/')) {
+        path[--pathLength] = L'\0';
+    }
+    EFI_CHECK(Root->Open(Root, &directory, pathLength != 0 ? path : L"\\", EFI_FILE_MODE_READ, 0));
+
+    // the listing already has the sizes, the files are only opened when they are loaded
+    BOOLEAN noFile = FALSE;
+    EFI_CHECK(FileHandleFindFirstFile(directory, &info));
+    while (!noFile) {
+        if (!(info->Attribute & EFI_FILE_DIRECTORY) && (pattern == NULL || GlobMatch(pattern, info->FileName))) {
+            BOOT_MODULE* Module = AllocateZeroPool(sizeof(BOOT_MODULE));
+            CHECK_ERROR(Module != NULL, EFI_OUT_OF_RESOURCES);
+            InsertTailList(&modules, &Module->Link);
+
+            UINTN PathSize = pathLength + 1 + StrLen(info->FileName) + 1;
+            Module->Path = AllocateZeroPool(PathSize * sizeof(CHAR16));
+            Module->Tag = CopyString(info->FileName);
+            CHECK_ERROR(Module->Path != NULL && Module->Tag != NULL, EFI_OUT_OF_RESOURCES);
+            if (pathLength != 0) {
+                StrCpyS(Module->Path, PathSize, path);
+                StrCatS(Module->Path, PathSize, L"\\");
+            }
+            StrCatS(Module->Path, PathSize, info->FileName);
+            Module->Fs = FS;
+            Module->BatchSize = info->FileSize;
+
+            // keep it sorted
+            RemoveEntryList(&Module->Link);
+            LIST_ENTRY* Link = modules.ForwardLink;
+            while (Link != &modules && StrCmp(BASE_CR(Link, BOOT_MODULE, Link)->Tag, Module->Tag) < 0) {
+                Link = Link->ForwardLink;
+            }
+            InsertTailList(Link, &Module->Link);
+        }
+
+        // frees the info once there are no more files
+        EFI_CHECK(FileHandleFindNextFile(directory, info, &noFile));
+    }
+    info = NULL;
+
+    CHECK_ERROR_TRACE(!IsListEmpty(&modules), EFI_NOT_FOUND, "No files match MODULE_DIR `%s`", Value);
+
+    MODULE_BATCH* Batch = AllocateZeroPool(sizeof(MODULE_BATCH));
+    CHECK_ERROR(Batch != NULL, EFI_OUT_OF_RESOURCES);
+    Batch->First = BASE_CR(modules.ForwardLink, BOOT_MODULE, Link);
+    *First = Batch->First;
+
+    // lay them out page aligned one after another, and move them to the entry
+    while (!IsListEmpty(&modules)) {
+        BOOT_MODULE* Module = BASE_CR(modules.ForwardLink, BOOT_MODULE, Link);
+        Module->Batch = Batch;
+        Module->BatchOffset = Batch->Size;
+        Batch->Size += ALIGN_VALUE(Module->BatchSize, EFI_PAGE_SIZE);
+        Batch->Count++;
+
+        RemoveEntryList(&Module->Link);
+        InsertTailList(&Entry->BootModules, &Module->Link);
+    }
+
+cleanup:
+    while (!IsListEmpty(&modules)) {
+        BOOT_MODULE* Module = BASE_CR(modules.ForwardLink, BOOT_MODULE, Link);
+        RemoveEntryList(&Module->Link);
+        FreeModule(Module);
+    }
+
+    if (info != NULL) {
+        FreePool(info);
+    }
+
+    if (directory != NULL) {
+        FileHandleClose(directory);
+    }
+
+    if (pattern != NULL) {
+        FreePool(pattern);
+    }
+
+    if (path != NULL) {
+        FreePool(path);
+    }
+
+    return Status;
+}
+
 static EFI_STATUS LoadBootEntries(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FS, LIST_ENTRY* Head) {
     EFI_STATUS Status = EFI_SUCCESS;
     EFI_FILE_PROTOCOL* root = NULL;
     EFI_FILE_PROTOCOL* file = NULL;
+    CHAR16* configPath = NULL;
+    SHA256_CONTEXT hash;
 
     // open the configurations
     CHECK(FS != NULL);
@@ -45,6 +218,7 @@ static EFI_STATUS LoadBootEntries(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FS, LIST_ENTR
 
     for (int i = 0; i < ARRAY_SIZE(ConfigPaths); i++) {
         if (!EFI_ERROR(root->Open(root, &file, ConfigPaths[i], EFI_FILE_MODE_READ, 0))) {
+            configPath = ConfigPaths[i];
             break;
         }
 
@@ -62,6 +236,15 @@ static EFI_STATUS LoadBootEntries(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FS, LIST_ENTR
     BOOT_ENTRY* CurrentEntry = NULL;
     BOOT_MODULE* CurrentModuleString = NULL;
 
+    // hashed as it is read, it is measured once we are done with it
+    Sha256Init(&hash);
+
+    // the digest of the last file that was given (kernel or module)
+    UINT8** CurrentSha256 = NULL;
+
+    // the last module that was given, NULL if the last file was the kernel
+    BOOT_MODULE* CurrentModule = NULL;
+
     // now do the actual processing of everything
     while(TRUE) {
         CHAR16 Line[255] = {0};
@@ -72,7 +255,8 @@ static EFI_STATUS LoadBootEntries(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FS, LIST_ENTR
             break;
         }
         EFI_CHECK(FileHandleReadLine(file, Line, &LineSize, FALSE, &Ascii));
-        Print(L"\t`%s`\n", Line);
+        HashLine(&hash, Line);
+        LOG_DEBUG("\t`%s`\n", Line);
 
         //------------------------------------------
         // New entry
@@ -89,8 +273,10 @@ static EFI_STATUS LoadBootEntries(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FS, LIST_ENTR
             CurrentEntry->BootModules = (LIST_ENTRY) INITIALIZE_LIST_HEAD_VARIABLE(CurrentEntry->BootModules);
             InsertTailList(Head, &CurrentEntry->Link);
             CurrentModuleString = NULL;
+            CurrentSha256 = NULL;
+            CurrentModule = NULL;
 
-            Print(L"Adding %s\n", CurrentEntry->Name);
+            LOG_INFO("Adding %s\n", CurrentEntry->Name);
 
         //------------------------------------------
         // Global keys
@@ -98,6 +284,21 @@ static EFI_STATUS LoadBootEntries(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FS, LIST_ENTR
         } else if (CurrentEntry == NULL) {
             if (CHECK_OPTION(L"TIMEOUT")) {
                 gBootDelayOverride = (INT32)StrDecimalToUintn(StrStr(Line, L"=") + 1);
+            } else if (CHECK_OPTION(L"PARALLEL_DECOMPRESS")) {
+                gParallelDecompress = StrCmp(StrStr(Line, L"=") + 1, L"yes") == 0;
+            } else if (CHECK_OPTION(L"MEASURED_BOOT")) {
+                gMeasuredBoot = StrCmp(StrStr(Line, L"=") + 1, L"yes") == 0;
+            } else if (CHECK_OPTION(L"BLOCK_READS")) {
+                gBlockReads = StrCmp(StrStr(Line, L"=") + 1, L"no") != 0;
+            } else if (CHECK_OPTION(L"VERBOSE")) {
+                CHAR16* Verbose = StrStr(Line, L"=") + 1;
+                if (StrCmp(Verbose, L"yes") == 0) {
+                    LogSetOutput(LOG_OUTPUT_CONSOLE);
+                } else if (StrCmp(Verbose, L"debugcon") == 0) {
+                    LogSetOutput(LOG_OUTPUT_DEBUGCON);
+                } else {
+                    LogSetOutput(LOG_OUTPUT_NONE);
+                }
             }
 
         //------------------------------------------
@@ -110,6 +311,8 @@ static EFI_STATUS LoadBootEntries(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FS, LIST_ENTR
             //------------------------------------------
             if(CHECK_OPTION(L"PATH") || CHECK_OPTION(L"KERNEL_PATH")) {
                 CurrentEntry->Path = CopyString(StrStr(Line, L"=") + 1);
+                CurrentSha256 = &CurrentEntry->Sha256;
+                CurrentModule = NULL;
 
             //------------------------------------------
             // command line arguments
@@ -130,8 +333,10 @@ static EFI_STATUS LoadBootEntries(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FS, LIST_ENTR
                     CurrentEntry->Protocol = BOOT_STIVALE;
                 } else if (StrCmp(Protocol, L"stivale2") == 0) {
                     CurrentEntry->Protocol = BOOT_STIVALE2;
+                } else if (StrCmp(Protocol, L"bundle") == 0) {
+                    CurrentEntry->Protocol = BOOT_BUNDLE;
                 } else {
-                    Print(L"Unknown protocol `%s` for option `%s`\n", Protocol, CurrentEntry->Name);
+                    LOG_WARN("Unknown protocol `%s` for option `%s`\n", Protocol, CurrentEntry->Name);
                     CHECK(FALSE);
                 }
 
@@ -147,46 +352,109 @@ static EFI_STATUS LoadBootEntries(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FS, LIST_ENTR
                 Module->Path = CopyString(StrStr(Line, L"=") + 1);
                 Module->Fs = FS;
                 InsertTailList(&CurrentEntry->BootModules, &Module->Link);
+                CurrentSha256 = &Module->Sha256;
+                CurrentModule = Module;
 
             } else if (CHECK_OPTION(L"MODULE_PATH")) {
                 CHECK_TRACE(
                         CurrentEntry->Protocol == BOOT_MB2 ||
                         CurrentEntry->Protocol == BOOT_STIVALE ||
-                        CurrentEntry->Protocol == BOOT_STIVALE2,
-                        "`MODULE_PATH` is only available for mb2 and stivale{,2} (%d)", CurrentEntry->Protocol);
+                        CurrentEntry->Protocol == BOOT_STIVALE2 ||
+                        CurrentEntry->Protocol == BOOT_BUNDLE,
+                        "`MODULE_PATH` is only available for mb2, stivale{,2} and bundles (%d)", CurrentEntry->Protocol);
 
                 BOOT_MODULE* Module = AllocateZeroPool(sizeof(BOOT_MODULE));
                 Module->Path = CopyString(StrStr(Line, L"=") + 1);
-                CurrentModuleString->Tag = L"";
+                Module->Tag = L"";
                 Module->Fs = FS;
                 InsertTailList(&CurrentEntry->BootModules, &Module->Link);
+                CurrentSha256 = &Module->Sha256;
+                CurrentModule = Module;
 
                 // this is the next one which will need a string
                 if (CurrentModuleString == NULL) {
                     CurrentModuleString = Module;
                 }
 
+            } else if (CHECK_OPTION(L"MODULE_DIR")) {
+                CHECK_TRACE(
+                        CurrentEntry->Protocol == BOOT_MB2 ||
+                        CurrentEntry->Protocol == BOOT_STIVALE ||
+                        CurrentEntry->Protocol == BOOT_STIVALE2 ||
+                        CurrentEntry->Protocol == BOOT_BUNDLE,
+                        "`MODULE_DIR` is only available for mb2, stivale{,2} and bundles (%d)", CurrentEntry->Protocol);
+
+                // the module options that follow are for the whole directory,
+                // the files are not pinned by digests
+                CHECK_AND_RETHROW(AddModuleDirectory(FS, root, CurrentEntry, StrStr(Line, L"=") + 1, &CurrentModule));
+                CurrentSha256 = NULL;
+
             } else if (CHECK_OPTION(L"MODULE_STRING")) {
                 CHECK_TRACE(
                         CurrentEntry->Protocol == BOOT_MB2 ||
                         CurrentEntry->Protocol == BOOT_STIVALE ||
-                        CurrentEntry->Protocol == BOOT_STIVALE2,
-                        "`MODULE_STRING` is only available for mb2 and stivale{,2} (%d)", CurrentEntry->Protocol);
+                        CurrentEntry->Protocol == BOOT_STIVALE2 ||
+                        CurrentEntry->Protocol == BOOT_BUNDLE,
+                        "`MODULE_STRING` is only available for mb2, stivale{,2} and bundles (%d)", CurrentEntry->Protocol);
                 CHECK_TRACE(CurrentModuleString != NULL, "MODULE_STRING must only appear after a MODULE_PATH");
 
                 // set the tag
                 CurrentModuleString->Tag = CopyString(StrStr(Line, L"=") + 1);
 
-                // next
-                if (IsNodeAtEnd(&CurrentEntry->BootModules, &CurrentModuleString->Link)) {
-                    CurrentModuleString = NULL;
+                // next, the modules of directories are named after their files
+                do {
+                    if (IsNodeAtEnd(&CurrentEntry->BootModules, &CurrentModuleString->Link)) {
+                        CurrentModuleString = NULL;
+                    } else {
+                        CurrentModuleString = BASE_CR(GetNextNode(&CurrentEntry->BootModules, &CurrentModuleString->Link), BOOT_MODULE, Link);
+                    }
+                } while (CurrentModuleString != NULL && CurrentModuleString->Batch != NULL);
+
+            //------------------------------------------
+            // digest of the last kernel or module path
+            //------------------------------------------
+            } else if (CHECK_OPTION(L"SHA256")) {
+                CHECK_TRACE(CurrentSha256 != NULL, "`SHA256` must come after the path it is for");
+
+                *CurrentSha256 = AllocatePool(SHA256_DIGEST_SIZE);
+                CHECK_ERROR(*CurrentSha256 != NULL, EFI_OUT_OF_RESOURCES);
+                CHECK_TRACE(ParseSha256(StrStr(Line, L"=") + 1, *CurrentSha256), "Invalid SHA256 `%S`", StrStr(Line, L"=") + 1);
+
+            //------------------------------------------
+            // memory and placement of the last module path
+            //------------------------------------------
+            } else if (CHECK_OPTION(L"MODULE_MEMORY")) {
+                CHECK_TRACE(CurrentModule != NULL, "`MODULE_MEMORY` must come after the module it is for");
+
+                CHAR16* Memory = StrStr(Line, L"=") + 1;
+                if (StrCmp(Memory, L"module") == 0) {
+                    CurrentModule->Memory = MODULE_MEMORY_MODULE;
+                } else if (StrCmp(Memory, L"reclaimable") == 0) {
+                    CurrentModule->Memory = MODULE_MEMORY_RECLAIMABLE;
+                } else if (StrCmp(Memory, L"reserved") == 0) {
+                    CurrentModule->Memory = MODULE_MEMORY_RESERVED;
                 } else {
-                    CurrentModuleString = BASE_CR(GetNextNode(&CurrentEntry->BootModules, &CurrentModuleString->Link), BOOT_MODULE, Link);
+                    CHECK_FAIL_TRACE("Invalid MODULE_MEMORY `%s`", Memory);
                 }
+
+            } else if (CHECK_OPTION(L"MODULE_ALIGN")) {
+                CHECK_TRACE(CurrentModule != NULL, "`MODULE_ALIGN` must come after the module it is for");
+
+                UINTN Alignment = StrDecimalToUintn(StrStr(Line, L"=") + 1);
+                CHECK_TRACE(Alignment != 0 && (Alignment & (Alignment - 1)) == 0, "MODULE_ALIGN must be a power of two (%d)", Alignment);
+                CurrentModule->Alignment = Alignment;
+
+            } else if (CHECK_OPTION(L"MODULE_LOW")) {
+                CHECK_TRACE(CurrentModule != NULL, "`MODULE_LOW` must come after the module it is for");
+                CurrentModule->Low = StrCmp(StrStr(Line, L"=") + 1, L"yes") == 0;
             }
         }
     }
 
+    UINT8 digest[SHA256_DIGEST_SIZE];
+    Sha256Final(&hash, digest);
+    CHECK_AND_RETHROW(MeasureFile(MEASURE_PCR_STRINGS, configPath, digest));
+
 cleanup:
     if (file != NULL) {
         FileHandleClose(file);
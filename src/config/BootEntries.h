@@ -10,13 +10,61 @@ typedef enum _BOOT_PROTOCOL {
     BOOT_MB2,
     BOOT_STIVALE,
     BOOT_STIVALE2,
+    BOOT_BUNDLE,
 } BOOT_PROTOCOL;
 
+typedef enum _MODULE_MEMORY {
+    // what the protocol uses for modules
+    MODULE_MEMORY_DEFAULT,
+    // a memory type of its own, reported as kernel and modules
+    MODULE_MEMORY_MODULE,
+    // boot services data, reported as bootloader reclaimable
+    MODULE_MEMORY_RECLAIMABLE,
+    // runtime services data, reported as reserved so the kernel never reuses it
+    MODULE_MEMORY_RESERVED,
+} MODULE_MEMORY;
+
+struct _BOOT_MODULE;
+
+/**
+ * The modules of a MODULE_DIR, they are loaded together into one
+ * region, one after another
+ */
+typedef struct _MODULE_BATCH {
+    // the first module of the batch, its options are used for all of them
+    struct _BOOT_MODULE* First;
+    UINTN Count;
+
+    // the size of the region, every module in it is page aligned
+    UINTN Size;
+
+    // where the batch was loaded, 0 until the first of its modules is loaded
+    EFI_PHYSICAL_ADDRESS Base;
+} MODULE_BATCH;
+
 typedef struct _BOOT_MODULE {
     LIST_ENTRY Link;
     EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs;
     CHAR16* Path;
     CHAR16* Tag;
+
+    // the digest the file must have, NULL if not pinned
+    UINT8* Sha256;
+
+    // the memory the module is loaded to
+    MODULE_MEMORY Memory;
+
+    // the alignment of the module, 0 for the protocol's
+    UINTN Alignment;
+
+    // load it below 4GB even if the kernel can reach higher
+    BOOLEAN Low;
+
+    // set for the modules of a MODULE_DIR, with the place of the
+    // module in the batch and the size the directory listed for it
+    MODULE_BATCH* Batch;
+    UINTN BatchOffset;
+    UINTN BatchSize;
 } BOOT_MODULE;
 
 typedef struct _BOOT_ENTRY {
@@ -25,6 +73,7 @@ typedef struct _BOOT_ENTRY {
     EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs;
     CHAR16* Path;
     CHAR16* Cmdline;
+    UINT8* Sha256;
     LIST_ENTRY BootModules;
     LIST_ENTRY Link;
 } BOOT_ENTRY;
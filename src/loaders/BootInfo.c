@@ -0,0 +1,59 @@
+#include "BootInfo.h"
+
+#include <util/Except.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#define BOOT_INFO_ALIGNMENT 16
+
+static EFI_PHYSICAL_ADDRESS mArenaBase = 0;
+static UINTN mArenaPages = 0;
+static UINTN mArenaUsed = 0;
+
+EFI_STATUS BootInfoInit() {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    if (mArenaPages != 0) {
+        gBS->FreePages(mArenaBase, mArenaPages);
+        mArenaPages = 0;
+    }
+
+    // the kernels only have the first 4GB mapped when they start
+    mArenaBase = BASE_4GB - 1;
+    EFI_CHECK(gBS->AllocatePages(AllocateMaxAddress, BOOT_INFO_MEMORY_TYPE, EFI_SIZE_TO_PAGES(BOOT_INFO_ARENA_SIZE), &mArenaBase));
+    mArenaPages = EFI_SIZE_TO_PAGES(BOOT_INFO_ARENA_SIZE);
+    mArenaUsed = 0;
+
+cleanup:
+    return Status;
+}
+
+void* BootInfoAllocate(UINTN Size) {
+    UINTN Offset = ALIGN_VALUE(mArenaUsed, BOOT_INFO_ALIGNMENT);
+    if (Offset + Size > EFI_PAGES_TO_SIZE(mArenaPages)) {
+        return NULL;
+    }
+
+    void* Buffer = (void*)(UINTN)(mArenaBase + Offset);
+    mArenaUsed = Offset + Size;
+    ZeroMem(Buffer, Size);
+    return Buffer;
+}
+
+void* BootInfoCopy(UINTN Size, CONST void* Buffer) {
+    void* Copy = BootInfoAllocate(Size);
+    if (Copy != NULL) {
+        CopyMem(Copy, Buffer, Size);
+    }
+    return Copy;
+}
+
+void BootInfoTrim() {
+    UINTN UsedPages = EFI_SIZE_TO_PAGES(mArenaUsed);
+    if (UsedPages < mArenaPages) {
+        gBS->FreePages(mArenaBase + EFI_PAGES_TO_SIZE(UsedPages), mArenaPages - UsedPages);
+        mArenaPages = UsedPages;
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef __LOADERS_BOOTINFO_H__
+#define __LOADERS_BOOTINFO_H__
+
+#include <Uefi.h>
+
+/**
+ * The boot info arena, a single run of pages all the structs and tags given to
+ * stivale and stivale2 kernels are carved from, so the kernel gets them in one
+ * place and can reclaim them as a single range once it parsed them.
+ */
+
+// the memory type of the arena, from the range the spec leaves to os loaders,
+// it is reported to the kernel as bootloader reclaimable
+#define BOOT_INFO_MEMORY_TYPE ((EFI_MEMORY_TYPE)0x80000001)
+
+// reserved up front, what is not used is freed before the final memory map
+#define BOOT_INFO_ARENA_SIZE SIZE_1MB
+
+/**
+ * Allocate the arena, any previous one is freed
+ */
+EFI_STATUS BootInfoInit();
+
+/**
+ * Carve a zeroed, 16 byte aligned buffer from the arena, returns NULL if the
+ * arena is full so callers with a size that is not fixed must check it
+ */
+void* BootInfoAllocate(UINTN Size);
+
+/**
+ * Same as BootInfoAllocate, with the contents of the buffer
+ */
+void* BootInfoCopy(UINTN Size, CONST void* Buffer);
+
+/**
+ * Free the pages of the arena that were not used, must be called after the last
+ * allocation and before getting the memory map that is given to the kernel
+ */
+void BootInfoTrim();
+
+#endif //__LOADERS_BOOTINFO_H__
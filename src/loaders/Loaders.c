@@ -1,38 +1,251 @@
 #include <util/FileUtils.h>
+#include <util/LogUtils.h>
+#include <util/MeasureUtils.h>
+#include <util/MemUtils.h>
+#include <util/decompress/Decompress.h>
+#include <util/fs/BlockRead.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
 #include <Library/FileHandleLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include "Loaders.h"
 
-EFI_STATUS LoadBootModule(BOOT_MODULE* Module, UINTN* Base, UINTN* Size) {
+UINT64 gLoaderStartTsc = 0;
+
+static EFI_MEMORY_TYPE mModuleMemoryTypes[] = {
+    [MODULE_MEMORY_MODULE] = MODULE_MEMORY_EFI_TYPE,
+    [MODULE_MEMORY_RECLAIMABLE] = EfiBootServicesData,
+    [MODULE_MEMORY_RESERVED] = EfiRuntimeServicesData,
+};
+
+/**
+ * Allocate the pages of a module right after the last one if that is free,
+ * otherwise at the lowest free range that fits, above PreferAbove if there
+ * is room there
+ */
+static EFI_STATUS AllocateModulePages(MODULE_PLACEMENT* Placement, EFI_MEMORY_TYPE MemoryType, UINT64 MaxAddress, UINTN Alignment, UINTN Pages, EFI_PHYSICAL_ADDRESS* Base) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT64 Size = EFI_PAGES_TO_SIZE(Pages);
+
+    BOOLEAN Packed = FALSE;
+    if (Placement->Next != 0) {
+        *Base = ALIGN_VALUE(Placement->Next, Alignment);
+        Packed = *Base + Size <= MaxAddress && !EFI_ERROR(gBS->AllocatePages(AllocateAddress, MemoryType, Pages, Base));
+    }
+
+    if (!Packed) {
+        if (Placement->PreferAbove >= MaxAddress ||
+            EFI_ERROR(FindFreeRange(Pages, Placement->PreferAbove, MaxAddress, Alignment, FALSE, Base))) {
+            CHECK_ERROR_TRACE(!EFI_ERROR(FindFreeRange(Pages, BASE_1MB, MaxAddress, Alignment, FALSE, Base)), EFI_OUT_OF_RESOURCES,
+                              "No room for %d pages aligned to %p below %p", Pages, Alignment, MaxAddress);
+        }
+        EFI_CHECK(gBS->AllocatePages(AllocateAddress, MemoryType, Pages, Base));
+    }
+
+    Placement->Next = *Base + Size;
+
+cleanup:
+    if (EFI_ERROR(Status)) {
+        *Base = 0;
+    }
+    return Status;
+}
+
+/**
+ * The pages of a compressed module, allocated like any other module so
+ * it is decompressed right where it is going to stay
+ */
+typedef struct _MODULE_PAGES {
+    MODULE_PLACEMENT* Placement;
+    EFI_MEMORY_TYPE MemoryType;
+    UINT64 MaxAddress;
+    UINTN Alignment;
+} MODULE_PAGES;
+
+static EFI_STATUS AllocateDecompressedModule(void* Context, UINTN Pages, EFI_PHYSICAL_ADDRESS* Base) {
+    MODULE_PAGES* Module = Context;
+    return AllocateModulePages(Module->Placement, Module->MemoryType, Module->MaxAddress, Module->Alignment, Pages, Base);
+}
+
+/**
+ * The memory, limit and alignment the module asks for, or those of the placement
+ */
+static void GetModulePlacement(BOOT_MODULE* Module, MODULE_PLACEMENT* Placement, EFI_MEMORY_TYPE* MemoryType, UINT64* MaxAddress, UINTN* Alignment) {
+    *MemoryType = mModuleMemoryTypes[Module->Memory != MODULE_MEMORY_DEFAULT ? Module->Memory : Placement->Memory];
+    *MaxAddress = Module->Low ? MIN(Placement->MaxAddress, BASE_4GB) : Placement->MaxAddress;
+    *Alignment = MAX(Module->Alignment != 0 ? Module->Alignment : Placement->Alignment, EFI_PAGE_SIZE);
+}
+
+EFI_STATUS AllocateModuleBatch(MODULE_BATCH* Batch, MODULE_PLACEMENT* Placement, EFI_PHYSICAL_ADDRESS* Base) {
+    EFI_MEMORY_TYPE MemoryType;
+    UINT64 MaxAddress;
+    UINTN Alignment;
+    GetModulePlacement(Batch->First, Placement, &MemoryType, &MaxAddress, &Alignment);
+    return AllocateModulePages(Placement, MemoryType, MaxAddress, Alignment, EFI_SIZE_TO_PAGES(MAX(Batch->Size, 1)), Base);
+}
+
+/**
+ * Load all the modules of a directory into one region, the next file is
+ * already being read while the last one is measured. The files are loaded
+ * as they are, they are not decompressed.
+ */
+static EFI_STATUS LoadModuleBatch(MODULE_BATCH* Batch, MODULE_PLACEMENT* Placement) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_FILE_PROTOCOL* files[2] = { NULL, NULL };
+    FILE_ASYNC_READ reads[2] = { 0 };
+    EFI_PHYSICAL_ADDRESS base = 0;
+
+    LOG_INFO("Loading %d modules from `%s`\n", Batch->Count, Batch->First->Path);
+    CHECK_AND_RETHROW(AllocateModuleBatch(Batch, Placement, &base));
+
+    BOOT_MODULE* Module = Batch->First;
+    BOOT_MODULE* Previous = NULL;
+    for (UINTN i = 0; i <= Batch->Count; i++) {
+        // start reading the next one
+        if (i < Batch->Count) {
+            UINT64 FileSize = 0;
+            CHECK_AND_RETHROW(FileOpenCached(Module->Fs, Module->Path, &files[i % 2]));
+            EFI_CHECK(FileHandleGetSize(files[i % 2], &FileSize));
+            CHECK_TRACE(FileSize == Module->BatchSize, "`%s` changed since it was listed", Module->Path);
+
+            // the block reads are queued on the disk already, so only
+            // the file protocol reads are overlapped with the hashing
+            Status = BlockReadFile(Module->Fs, Module->Path, (void*)(base + Module->BatchOffset), Module->BatchSize);
+            if (Status == EFI_UNSUPPORTED) {
+                CHECK_AND_RETHROW(FileReadAsync(files[i % 2], (void*)(base + Module->BatchOffset), Module->BatchSize, 0, &reads[i % 2]));
+            } else {
+                CHECK_AND_RETHROW(Status);
+            }
+        }
+
+        // and finish the last one
+        if (Previous != NULL) {
+            CHECK_AND_RETHROW(FileReadWait(&reads[(i - 1) % 2]));
+            FileHandleClose(files[(i - 1) % 2]);
+            files[(i - 1) % 2] = NULL;
+
+            if (MeasureEnabled()) {
+                SHA256_CONTEXT hash;
+                UINT8 digest[SHA256_DIGEST_SIZE];
+                Sha256Init(&hash);
+                Sha256Update(&hash, (void*)(base + Previous->BatchOffset), Previous->BatchSize);
+                Sha256Final(&hash, digest);
+                CHECK_AND_RETHROW(MeasureFile(MEASURE_PCR_FILES, Previous->Path, digest));
+            }
+        }
+
+        Previous = Module;
+        if (i + 1 < Batch->Count) {
+            Module = BASE_CR(Module->Link.ForwardLink, BOOT_MODULE, Link);
+        }
+    }
+
+    Batch->Base = base;
+    base = 0;
+
+cleanup:
+    for (int i = 0; i < ARRAY_SIZE(files); i++) {
+        FileReadWait(&reads[i]);
+        if (files[i] != NULL) {
+            FileHandleClose(files[i]);
+        }
+    }
+
+    if (base != 0) {
+        gBS->FreePages(base, EFI_SIZE_TO_PAGES(MAX(Batch->Size, 1)));
+    }
+
+    return Status;
+}
+
+EFI_STATUS LoadBootModule(BOOT_MODULE* Module, MODULE_PLACEMENT* Placement, UINTN* Base, UINTN* Size) {
     EFI_STATUS Status = EFI_SUCCESS;
-    EFI_FILE_PROTOCOL* root = NULL;
     EFI_FILE_PROTOCOL* moduleImage = NULL;
+    SHA256_CONTEXT hash;
+    SHA256_CONTEXT* hashContext = NULL;
 
+    CHECK(Base != NULL && Size != NULL);
+    *Base = 0;
     CHECK(Module != NULL);
     CHECK(Module->Fs != NULL);
+    CHECK(Placement != NULL);
+    CHECK(Placement->Memory != MODULE_MEMORY_DEFAULT);
+
+    // the modules of a directory are all loaded with the first one
+    if (Module->Batch != NULL) {
+        if (Module->Batch->Base == 0) {
+            CHECK_AND_RETHROW(LoadModuleBatch(Module->Batch, Placement));
+        }
+        *Base = Module->Batch->Base + Module->BatchOffset;
+        *Size = Module->BatchSize;
+        goto cleanup;
+    }
+
+    EFI_MEMORY_TYPE MemoryType;
+    UINT64 MaxAddress;
+    UINTN Alignment;
+    GetModulePlacement(Module, Placement, &MemoryType, &MaxAddress, &Alignment);
 
     // open the executable file
-    EFI_CHECK(Module->Fs->OpenVolume(Module->Fs, &root));
-    EFI_CHECK(root->Open(root, &moduleImage, Module->Path, EFI_FILE_MODE_READ, 0));
+    CHECK_AND_RETHROW(FileOpenCached(Module->Fs, Module->Path, &moduleImage));
 
-    // read it all
-    *Base = BASE_4GB;
+    // check if it is compressed
+    UINT8 magic[COMPRESSION_MAGIC_SIZE] = {0};
     EFI_CHECK(FileHandleGetSize(moduleImage, Size));
-    EFI_CHECK(gBS->AllocatePages(AllocateMaxAddress, EfiRuntimeServicesData, EFI_SIZE_TO_PAGES(*Size), Base));
-    CHECK_AND_RETHROW(FileRead(moduleImage, (void*)*Base, *Size, 0));
+    if (*Size >= sizeof(magic)) {
+        CHECK_AND_RETHROW(FileRead(moduleImage, magic, sizeof(magic), 0));
+    }
+    COMPRESSION_FORMAT format = DetectCompression(magic, MIN(*Size, sizeof(magic)));
 
-cleanup:
-    if (root != NULL) {
-        FileHandleClose(root);
+    // the file is hashed as it is read
+    if (Module->Sha256 != NULL || MeasureEnabled()) {
+        hashContext = &hash;
+        Sha256Init(hashContext);
+    }
+
+    if (format != COMPRESSION_NONE) {
+        // decompress it straight into the module memory, placed and aligned like
+        // the other modules, it is only returned on success so there is nothing to free
+        LOG_INFO("Decompressing module `%s` (%s)\n", Module->Path, CompressionName(format));
+        MODULE_PAGES ModulePages = { Placement, MemoryType, MaxAddress, Alignment };
+        DECOMPRESS_OUTPUT Pages = { .Allocate = AllocateDecompressedModule, .Context = &ModulePages };
+        CHECK_AND_RETHROW(DecompressFile(moduleImage, format, &Pages, Base, Size, hashContext));
+
+        // the pages that were not used are free again, pack the next module right after it
+        Placement->Next = *Base + EFI_PAGES_TO_SIZE(EFI_SIZE_TO_PAGES(MAX(*Size, 1)));
+    } else {
+        // read it all, straight from the disk if we can
+        CHECK_AND_RETHROW(AllocateModulePages(Placement, MemoryType, MaxAddress, Alignment, EFI_SIZE_TO_PAGES(MAX(*Size, 1)), Base));
+        Status = BlockReadFile(Module->Fs, Module->Path, (void*)*Base, *Size);
+        if (Status != EFI_UNSUPPORTED) {
+            CHECK_AND_RETHROW(Status);
+            if (hashContext != NULL) {
+                Sha256Update(hashContext, (void*)*Base, *Size);
+            }
+        } else if (hashContext != NULL) {
+            CHECK_AND_RETHROW(FileReadHashed(moduleImage, (void*)*Base, *Size, hashContext));
+        } else {
+            CHECK_AND_RETHROW(FileRead(moduleImage, (void*)*Base, *Size, 0));
+        }
     }
 
+    if (hashContext != NULL) {
+        UINT8 digest[SHA256_DIGEST_SIZE];
+        Sha256Final(hashContext, digest);
+        if (Module->Sha256 != NULL) {
+            CHECK_AND_RETHROW(Sha256Check(digest, Module->Sha256, Module->Path));
+        }
+        CHECK_AND_RETHROW(MeasureFile(MEASURE_PCR_FILES, Module->Path, digest));
+    }
+
+cleanup:
     if (moduleImage != NULL) {
         FileHandleClose(moduleImage);
     }
 
-    if (EFI_ERROR(Status) && Base != NULL && Size != NULL) {
-        gBS->FreePages(*Base, EFI_SIZE_TO_PAGES(*Size));
+    if (EFI_ERROR(Status) && Base != NULL && Size != NULL && *Base != 0) {
+        gBS->FreePages(*Base, EFI_SIZE_TO_PAGES(MAX(*Size, 1)));
     }
 
     return Status;
@@ -41,8 +254,10 @@ cleanup:
 EFI_STATUS LoadKernel(BOOT_ENTRY* Entry) {
     EFI_STATUS Status = EFI_SUCCESS;
 
-    gST->ConOut->ClearScreen(gST->ConOut);
-    gST->ConOut->SetCursorPosition(gST->ConOut, 0, 0);
+    LOG_INFO("TomatBoot started at TSC %ld, loading at TSC %ld\n", gLoaderStartTsc, AsmReadTsc());
+
+    // the files are measured as they are loaded
+    CHECK_AND_RETHROW(MeasureString(MEASURE_PCR_STRINGS, Entry->Cmdline));
 
     switch (Entry->Protocol) {
         case BOOT_MB2:
@@ -61,10 +276,16 @@ EFI_STATUS LoadKernel(BOOT_ENTRY* Entry) {
             CHECK_AND_RETHROW(LoadStivale2Kernel(Entry));
             break;
 
+        case BOOT_BUNDLE:
+            CHECK_AND_RETHROW(LoadBundleKernel(Entry));
+            break;
+
         default:
             CHECK_FAIL_TRACE("Unknown boot protocol!");
     }
 
 cleanup:
+    // only returns if the boot failed
+    FileCloseCached();
     return Status;
 }
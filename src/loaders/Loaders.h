@@ -7,12 +7,55 @@
 #include <Uefi.h>
 #include <Protocol/SimpleFileSystem.h>
 
-EFI_STATUS LoadBootModule(BOOT_MODULE* Module, UINTN* Base, UINTN* Size);
+/**
+ * The TSC when the loader was started, printed when loading a kernel
+ * so the time spent in the loader can be measured
+ */
+extern UINT64 gLoaderStartTsc;
+
+// the memory type of MODULE_MEMORY_MODULE, from the range the spec leaves
+// to os loaders, it keeps the modules apart from the loader's own data
+#define MODULE_MEMORY_EFI_TYPE ((EFI_MEMORY_TYPE)0x80000002)
+
+/**
+ * Where the modules of a kernel are placed, set up by the protocol and
+ * shared by all of its modules so they can be packed one after another
+ */
+typedef struct _MODULE_PLACEMENT {
+    // the memory of modules which don't ask for any
+    MODULE_MEMORY Memory;
+
+    // modules must end below this
+    EFI_PHYSICAL_ADDRESS MaxAddress;
+
+    // modules are placed above this if there is room, so they
+    // don't take the low memory when the kernel can reach higher
+    EFI_PHYSICAL_ADDRESS PreferAbove;
+
+    // the alignment of modules which don't ask for one, they are always page aligned
+    UINTN Alignment;
+
+    // the end of the last module, the next one is placed right after it
+    EFI_PHYSICAL_ADDRESS Next;
+} MODULE_PLACEMENT;
+
+/**
+ * Load a module to the memory, limits and alignment the module asks
+ * for, or those of the placement if it does not ask for any
+ */
+EFI_STATUS LoadBootModule(BOOT_MODULE* Module, MODULE_PLACEMENT* Placement, UINTN* Base, UINTN* Size);
+
+/**
+ * Allocate the region of a batch of modules, with the memory and limits of
+ * its first module, the caller reads the modules into it
+ */
+EFI_STATUS AllocateModuleBatch(MODULE_BATCH* Batch, MODULE_PLACEMENT* Placement, EFI_PHYSICAL_ADDRESS* Base);
 
 EFI_STATUS LoadLinuxKernel(BOOT_ENTRY* Entry);
 EFI_STATUS LoadMB2Kernel(BOOT_ENTRY* Entry);
 EFI_STATUS LoadStivaleKernel(BOOT_ENTRY* Entry);
 EFI_STATUS LoadStivale2Kernel(BOOT_ENTRY* Entry);
+EFI_STATUS LoadBundleKernel(BOOT_ENTRY* Entry);
 
 EFI_STATUS LoadKernel(BOOT_ENTRY* Entry);
 
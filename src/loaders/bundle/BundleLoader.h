@@ -0,0 +1,40 @@
+#ifndef __LOADERS_BUNDLE_BUNDLELOADER_H__
+#define __LOADERS_BUNDLE_BUNDLELOADER_H__
+
+#include <Uefi.h>
+#include <Protocol/SimpleFileSystem.h>
+
+#include <loaders/Loaders.h>
+
+#include "bundle.h"
+
+typedef struct _BUNDLE {
+    // the header and its tables, as they are in the file
+    BUNDLE_HEADER* Header;
+    BUNDLE_SEGMENT* Segments;
+    BUNDLE_MODULE* Modules;
+    void* ProtocolHeader;
+
+    // set when the file is not compressed and has nothing to check, the
+    // segments and the modules are then read straight to their place
+    BOOLEAN Direct;
+    EFI_FILE_PROTOCOL* File;
+
+    // the modules, they are added to the entry before its own ones
+    MODULE_BATCH Batch;
+    BOOT_MODULE* BootModules;
+
+    // the command line of the entry when the one of the bundle is used
+    // instead, put back if the boot fails
+    CHAR16* EntryCmdline;
+} BUNDLE;
+
+/**
+ * Load the segments and the modules of the bundle with one pass over the
+ * file, the modules are placed like the protocol places its modules.
+ */
+EFI_STATUS BundleLoad(BOOT_ENTRY* Entry, BUNDLE* Bundle, MODULE_PLACEMENT* Placement);
+
+EFI_STATUS LoadStivale2Bundle(BOOT_ENTRY* Entry, BUNDLE* Bundle);
+
+#endif //__LOADERS_BUNDLE_BUNDLELOADER_H__
@@ -0,0 +1,299 @@
+#include "BundleLoader.h"
+
+#include <util/Except.h>
+#include <util/FileUtils.h>
+#include <util/LogUtils.h>
+#include <util/MeasureUtils.h>
+#include <util/MemUtils.h>
+#include <util/decompress/Decompress.h>
+#include <util/fs/BlockRead.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/FileHandleLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+// the tables are read in one go, this keeps a bad bundle from asking for too much
+#define BUNDLE_MAX_HEADER_SIZE SIZE_1MB
+
+/**
+ * Check that a part of a file of the given size is inside of it
+ */
+static BOOLEAN InFile(UINT64 Offset, UINT64 Size, UINT64 FileSize) {
+    return Offset <= FileSize && Size <= FileSize - Offset;
+}
+
+/**
+ * Check that the tables make sense, so nothing after has to
+ */
+static EFI_STATUS BundleValidate(BUNDLE* Bundle, UINT64 FileSize) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    BUNDLE_HEADER* Header = Bundle->Header;
+
+    if (Header->CmdlineSize != 0) {
+        CHECK(InFile(Header->CmdlineOffset, Header->CmdlineSize, Header->HeaderSize));
+        CHECK(((CHAR8*)Header)[Header->CmdlineOffset + Header->CmdlineSize - 1] == '\0');
+    }
+    CHECK(InFile(Header->ProtocolHeaderOffset, Header->ProtocolHeaderSize, Header->HeaderSize));
+
+    for (UINTN i = 0; i < Header->SegmentCount; i++) {
+        BUNDLE_SEGMENT* Segment = &Bundle->Segments[i];
+        CHECK(Segment->FileSize <= Segment->MemorySize);
+        CHECK(Segment->MemorySize <= MAX_UINT64 - Segment->Address);
+        CHECK(Segment->Offset >= Header->HeaderSize && InFile(Segment->Offset, Segment->FileSize, FileSize));
+    }
+
+    if (Header->ModuleCount != 0) {
+        CHECK(Header->ModulesOffset >= Header->HeaderSize && InFile(Header->ModulesOffset, Header->ModulesSize, FileSize));
+    }
+    for (UINTN i = 0; i < Header->ModuleCount; i++) {
+        BUNDLE_MODULE* Module = &Bundle->Modules[i];
+        CHECK((Module->Offset & EFI_PAGE_MASK) == 0 && InFile(Module->Offset, Module->Size, Header->ModulesSize));
+        CHECK(AsciiStrnLenS(Module->String, sizeof(Module->String)) < sizeof(Module->String));
+    }
+
+cleanup:
+    return Status;
+}
+
+/**
+ * Open the bundle and read its tables, the modules of the bundle are added
+ * to the entry. If the entry pins the bundle it is checked before anything
+ * is taken from it.
+ */
+static EFI_STATUS BundleOpen(BOOT_ENTRY* Entry, BUNDLE* Bundle) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_FILE_PROTOCOL* File = NULL;
+    UINT64 FileSize = 0;
+
+    LOG_INFO("Loading bundle `%s`\n", Entry->Path);
+
+    // with nothing to decompress or check the parts can be read straight to their place
+    UINT8 Magic[COMPRESSION_MAGIC_SIZE] = {0};
+    CHECK_AND_RETHROW(FileOpenCached(Entry->Fs, Entry->Path, &File));
+    EFI_CHECK(FileHandleGetSize(File, &FileSize));
+    if (FileSize >= sizeof(Magic)) {
+        CHECK_AND_RETHROW(FileRead(File, Magic, sizeof(Magic), 0));
+    }
+    if (DetectCompression(Magic, MIN(FileSize, sizeof(Magic))) == COMPRESSION_NONE && Entry->Sha256 == NULL && !MeasureEnabled()) {
+        Bundle->Direct = TRUE;
+        Bundle->File = File;
+        File = NULL;
+    } else {
+        CHECK_AND_RETHROW(OpenMaybeCompressed(Entry->Fs, Entry->Path, Entry->Sha256, &Bundle->File));
+        EFI_CHECK(FileHandleGetSize(Bundle->File, &FileSize));
+    }
+
+    // get the size of the tables and read them all
+    BUNDLE_HEADER Header;
+    CHECK_TRACE(FileSize >= sizeof(Header), "`%s` is not a bundle", Entry->Path);
+    CHECK_AND_RETHROW(FileRead(Bundle->File, &Header, sizeof(Header), 0));
+    CHECK_TRACE(Header.Magic == BUNDLE_MAGIC, "`%s` is not a bundle", Entry->Path);
+    CHECK_TRACE(Header.Version == BUNDLE_VERSION, "Unsupported bundle version %d", Header.Version);
+    CHECK_TRACE(Header.Size == FileSize, "`%s` is truncated", Entry->Path);
+    CHECK(Header.HeaderSize <= MIN(FileSize, BUNDLE_MAX_HEADER_SIZE));
+    CHECK(sizeof(BUNDLE_HEADER) + Header.SegmentCount * sizeof(BUNDLE_SEGMENT) + Header.ModuleCount * sizeof(BUNDLE_MODULE) <= Header.HeaderSize);
+
+    Bundle->Header = AllocatePool(Header.HeaderSize);
+    CHECK_ERROR(Bundle->Header != NULL, EFI_OUT_OF_RESOURCES);
+    CHECK_AND_RETHROW(FileRead(Bundle->File, Bundle->Header, Header.HeaderSize, 0));
+    CHECK(CompareMem(Bundle->Header, &Header, sizeof(Header)) == 0);
+    Bundle->Segments = (BUNDLE_SEGMENT*)(Bundle->Header + 1);
+    Bundle->Modules = (BUNDLE_MODULE*)(Bundle->Segments + Header.SegmentCount);
+    Bundle->ProtocolHeader = (UINT8*)Bundle->Header + Header.ProtocolHeaderOffset;
+    CHECK_AND_RETHROW(BundleValidate(Bundle, FileSize));
+
+    // the command line of the config takes over the one of the bundle
+    if (Entry->Cmdline[0] == L'\0' && Header.CmdlineSize > 1) {
+        CHAR16* Cmdline = AllocatePool(Header.CmdlineSize * sizeof(CHAR16));
+        CHECK_ERROR(Cmdline != NULL, EFI_OUT_OF_RESOURCES);
+        AsciiStrToUnicodeStrS((CHAR8*)Bundle->Header + Header.CmdlineOffset, Cmdline, Header.CmdlineSize);
+        Bundle->EntryCmdline = Entry->Cmdline;
+        Entry->Cmdline = Cmdline;
+    }
+
+    // the modules are a batch that is already listed, they come before the ones of the config
+    if (Header.ModuleCount != 0) {
+        Bundle->BootModules = AllocateZeroPool(Header.ModuleCount * sizeof(BOOT_MODULE));
+        CHECK_ERROR(Bundle->BootModules != NULL, EFI_OUT_OF_RESOURCES);
+        Bundle->Batch.First = &Bundle->BootModules[0];
+        Bundle->Batch.Count = Header.ModuleCount;
+        Bundle->Batch.Size = Header.ModulesSize;
+
+        LIST_ENTRY* Previous = &Entry->BootModules;
+        for (UINTN i = 0; i < Header.ModuleCount; i++) {
+            BOOT_MODULE* Module = &Bundle->BootModules[i];
+            Module->Tag = AllocateZeroPool(sizeof(Bundle->Modules[i].String) * sizeof(CHAR16));
+            CHECK_ERROR(Module->Tag != NULL, EFI_OUT_OF_RESOURCES);
+            AsciiStrToUnicodeStrS(Bundle->Modules[i].String, Module->Tag, sizeof(Bundle->Modules[i].String));
+            Module->Fs = Entry->Fs;
+            Module->Path = Entry->Path;
+            Module->Batch = &Bundle->Batch;
+            Module->BatchOffset = Bundle->Modules[i].Offset;
+            Module->BatchSize = Bundle->Modules[i].Size;
+            InsertHeadList(Previous, &Module->Link);
+            Previous = &Module->Link;
+        }
+    }
+
+cleanup:
+    if (File != NULL) {
+        FileHandleClose(File);
+    }
+
+    return Status;
+}
+
+/**
+ * Take the bundle out of the entry and free it
+ */
+static void BundleClose(BOOT_ENTRY* Entry, BUNDLE* Bundle) {
+    if (Bundle->BootModules != NULL) {
+        for (UINTN i = 0; i < Bundle->Batch.Count; i++) {
+            BOOT_MODULE* Module = &Bundle->BootModules[i];
+            if (Module->Link.ForwardLink != NULL) {
+                RemoveEntryList(&Module->Link);
+            }
+            if (Module->Tag != NULL) {
+                FreePool(Module->Tag);
+            }
+        }
+        FreePool(Bundle->BootModules);
+    }
+
+    if (Bundle->EntryCmdline != NULL) {
+        FreePool(Entry->Cmdline);
+        Entry->Cmdline = Bundle->EntryCmdline;
+    }
+
+    if (Bundle->File != NULL) {
+        FileHandleClose(Bundle->File);
+    }
+
+    if (Bundle->Header != NULL) {
+        FreePool(Bundle->Header);
+    }
+
+    FreePool(Bundle);
+}
+
+EFI_STATUS BundleLoad(BOOT_ENTRY* Entry, BUNDLE* Bundle, MODULE_PLACEMENT* Placement) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    BUNDLE_HEADER* Header = Bundle->Header;
+    BLOCK_READ_RANGE* Ranges = NULL;
+    UINTN RangeCount = 0;
+    EFI_PHYSICAL_ADDRESS ImageBase = 0;
+    UINTN ImagePages = 0;
+    EFI_PHYSICAL_ADDRESS ModulesBase = 0;
+
+    // allocate the whole image at once, segments that share
+    // a page would fail if each was allocated on its own
+    UINT64 Low = MAX_UINT64;
+    UINT64 High = 0;
+    for (UINTN i = 0; i < Header->SegmentCount; i++) {
+        if (Bundle->Segments[i].MemorySize == 0) continue;
+        Low = MIN(Low, Bundle->Segments[i].Address);
+        High = MAX(High, Bundle->Segments[i].Address + Bundle->Segments[i].MemorySize);
+    }
+    CHECK_TRACE(Low < High, "The bundle has no kernel");
+    CHECK(High <= MAX_UINT64 - EFI_PAGE_SIZE);
+
+    EFI_PHYSICAL_ADDRESS Base = Low & ~(UINT64)EFI_PAGE_MASK;
+    UINTN Pages = EFI_SIZE_TO_PAGES(ALIGN_VALUE(High, EFI_PAGE_SIZE) - Base);
+    CHECK_ERROR_TRACE(!EFI_ERROR(gBS->AllocatePages(AllocateAddress, EfiLoaderCode, Pages, &Base)), EFI_OUT_OF_RESOURCES,
+                      "The memory of the kernel (%p, %d pages) is in use", Base, Pages);
+    ImageBase = Base;
+    ImagePages = Pages;
+    LOG_DEBUG("    IMAGE BASE = %p, PAGES = %d\n", ImageBase, ImagePages);
+
+    if (Header->ModuleCount != 0) {
+        CHECK_AND_RETHROW(AllocateModuleBatch(&Bundle->Batch, Placement, &ModulesBase));
+    }
+
+    // everything that is in the file, in the order it is in the file
+    Ranges = AllocatePool((Header->SegmentCount + 1) * sizeof(BLOCK_READ_RANGE));
+    CHECK_ERROR(Ranges != NULL, EFI_OUT_OF_RESOURCES);
+    for (UINTN i = 0; i < Header->SegmentCount; i++) {
+        BUNDLE_SEGMENT* Segment = &Bundle->Segments[i];
+        if (Segment->FileSize != 0) {
+            Ranges[RangeCount].Offset = Segment->Offset;
+            Ranges[RangeCount].Buffer = (void*)Segment->Address;
+            Ranges[RangeCount].Size = Segment->FileSize;
+            RangeCount++;
+        }
+    }
+    if (Header->ModulesSize != 0) {
+        Ranges[RangeCount].Offset = Header->ModulesOffset;
+        Ranges[RangeCount].Buffer = (void*)ModulesBase;
+        Ranges[RangeCount].Size = Header->ModulesSize;
+        RangeCount++;
+    }
+
+    // one pass over the file, straight from the disk if we can
+    Status = EFI_UNSUPPORTED;
+    if (Bundle->Direct) {
+        Status = BlockReadFileRanges(Entry->Fs, Entry->Path, Ranges, RangeCount);
+    }
+    if (Status == EFI_UNSUPPORTED) {
+        Status = EFI_SUCCESS;
+        for (UINTN i = 0; i < RangeCount; i++) {
+            CHECK_AND_RETHROW(FileRead(Bundle->File, Ranges[i].Buffer, Ranges[i].Size, Ranges[i].Offset));
+        }
+    }
+    CHECK_AND_RETHROW(Status);
+
+    for (UINTN i = 0; i < Header->SegmentCount; i++) {
+        BUNDLE_SEGMENT* Segment = &Bundle->Segments[i];
+        FastZeroMem((void*)(Segment->Address + Segment->FileSize), Segment->MemorySize - Segment->FileSize);
+    }
+
+    LOG_INFO("    Loaded %d segments at %p and %d modules at %p\n", Header->SegmentCount, ImageBase, Header->ModuleCount, ModulesBase);
+    Bundle->Batch.Base = ModulesBase;
+    ImageBase = 0;
+    ModulesBase = 0;
+
+    // nothing else is read from it
+    FileHandleClose(Bundle->File);
+    Bundle->File = NULL;
+
+cleanup:
+    if (Ranges != NULL) {
+        FreePool(Ranges);
+    }
+
+    if (ImageBase != 0) {
+        gBS->FreePages(ImageBase, ImagePages);
+    }
+
+    if (ModulesBase != 0) {
+        gBS->FreePages(ModulesBase, EFI_SIZE_TO_PAGES(MAX(Bundle->Batch.Size, 1)));
+    }
+
+    return Status;
+}
+
+EFI_STATUS LoadBundleKernel(BOOT_ENTRY* Entry) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    BUNDLE* Bundle = AllocateZeroPool(sizeof(BUNDLE));
+    CHECK_ERROR(Bundle != NULL, EFI_OUT_OF_RESOURCES);
+    CHECK_AND_RETHROW(BundleOpen(Entry, Bundle));
+
+    switch (Bundle->Header->Protocol) {
+        case BUNDLE_PROTOCOL_STIVALE2:
+            CHECK_AND_RETHROW(LoadStivale2Bundle(Entry, Bundle));
+            break;
+
+        default:
+            CHECK_FAIL_TRACE("Unknown bundle protocol %d", Bundle->Header->Protocol);
+    }
+
+cleanup:
+    // only returns if the boot failed
+    if (Bundle != NULL) {
+        BundleClose(Entry, Bundle);
+    }
+
+    return Status;
+}
@@ -0,0 +1,72 @@
+#ifndef __LOADERS_BUNDLE_BUNDLE_H__
+#define __LOADERS_BUNDLE_BUNDLE_H__
+
+/*
+ * The boot bundle, a kernel and its modules laid out the way they are going
+ * to be loaded, built ahead of time by bundle/mkbundle.c.
+ *
+ * The file starts with the header, followed by the segment table and the
+ * module table, the command line and the header of the protocol. After that
+ * come the segments, each at an offset that has the same place in the page
+ * as the address it is loaded to, and then the modules, each page aligned,
+ * in one region that is loaded as it is.
+ *
+ * The builder is built against the libc, so nothing is included here and
+ * only the fixed size types are used.
+ */
+
+// "TOMATBND"
+#define BUNDLE_MAGIC 0x444e4254414d4f54ull
+#define BUNDLE_VERSION 1
+
+// the protocol the kernel is booted with
+#define BUNDLE_PROTOCOL_STIVALE2 1
+
+typedef struct _BUNDLE_HEADER {
+    UINT64 Magic;
+    UINT32 Version;
+    UINT32 Protocol;
+
+    // the size of the whole file
+    UINT64 Size;
+
+    // the size of the header and everything that comes with it, the
+    // tables start right after this struct
+    UINT64 HeaderSize;
+    UINT32 SegmentCount;
+    UINT32 ModuleCount;
+
+    // subtracted from the addresses of the kernel for the physical ones
+    UINT64 VirtualOffset;
+    UINT64 Entry;
+
+    // the region of the modules, the offsets of the modules are from its start
+    UINT64 ModulesOffset;
+    UINT64 ModulesSize;
+
+    // nul terminated
+    UINT64 CmdlineOffset;
+    UINT64 CmdlineSize;
+
+    // as the kernel has it, for stivale2 this is the .stivale2hdr section
+    UINT64 ProtocolHeaderOffset;
+    UINT64 ProtocolHeaderSize;
+} BUNDLE_HEADER;
+
+typedef struct _BUNDLE_SEGMENT {
+    // the physical address
+    UINT64 Address;
+    UINT64 Offset;
+    UINT64 FileSize;
+
+    // the rest is zeroed
+    UINT64 MemorySize;
+} BUNDLE_SEGMENT;
+
+typedef struct _BUNDLE_MODULE {
+    UINT64 Offset;
+    UINT64 Size;
+    CHAR8 String[128];
+} BUNDLE_MODULE;
+
+#endif //__LOADERS_BUNDLE_BUNDLE_H__
@@ -0,0 +1,112 @@
+#include "ElfLoader.h"
+
+#include <util/Except.h>
+#include <util/LogUtils.h>
+#include <util/FileUtils.h>
+#include <util/decompress/Decompress.h>
+#include <util/MemUtils.h>
+#include <util/fs/BlockRead.h>
+
+#include <Uefi.h>
+#include <Library/FileHandleLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include "ElfPlacement.h"
+#include "elf32.h"
+#include "elf64.h"
+
+/**
+ * Get the physical address an address of the image is loaded at
+ */
+static UINT64 ToPhysical(ELF_INFO* info, UINT64 addr) {
+    return (info->VirtualOffset ? addr - info->VirtualOffset : addr) + info->Slide;
+}
+
+// instantiate the loader for both classes
+
+#define ELF_BITS            32
+#define ELF_R_TYPE          ELF32_R_TYPE
+#define ELF_R_NONE          R_386_NONE
+#define ELF_R_RELATIVE      R_386_RELATIVE
+#include "ElfLoaderTemplate.h"
+#undef ELF_R_RELATIVE
+#undef ELF_R_NONE
+#undef ELF_R_TYPE
+#undef ELF_BITS
+
+#define ELF_BITS            64
+#define ELF_R_TYPE          ELF64_R_TYPE
+#define ELF_R_NONE          R_X86_64_NONE
+#define ELF_R_RELATIVE      R_X86_64_RELATIVE
+#include "ElfLoaderTemplate.h"
+#undef ELF_R_RELATIVE
+#undef ELF_R_NONE
+#undef ELF_R_TYPE
+#undef ELF_BITS
+
+/**
+ * Open the file, read the header once and dispatch on its class
+ *
+ * @param RequiredClass     ELFCLASSNONE to accept any class
+ */
+static EFI_STATUS LoadElfOfClass(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* fs, CHAR16* file, ELF_INFO* info, UINT8 RequiredClass) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_FILE_PROTOCOL* elfFile = NULL;
+
+    // open the executable file
+    CHECK_AND_RETHROW(OpenMaybeCompressed(fs, file, info->Sha256, &elfFile));
+
+    // read the header, the 64bit one is the bigger one so the
+    // 32bit header is going to be fully read as well
+    union {
+        Elf32_Ehdr ehdr32;
+        Elf64_Ehdr ehdr64;
+    } ehdr;
+    CHECK_AND_RETHROW(FileRead(elfFile, &ehdr, sizeof(Elf64_Ehdr), 0));
+
+    // verify is an elf
+    CHECK(IS_ELF(ehdr.ehdr32));
+
+    // verify the elf type
+    UINT8* ident = ehdr.ehdr32.e_ident;
+    CHECK(ident[EI_VERSION] == EV_CURRENT);
+    CHECK(ident[EI_DATA] == ELFDATA2LSB);
+    CHECK_TRACE(RequiredClass == ELFCLASSNONE || ident[EI_CLASS] == RequiredClass, "Invalid ELF class %d", ident[EI_CLASS]);
+
+    // the real file can be read from the disk, a decompressed or verified one is in memory already
+    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* directFs = IsMemoryFile(elfFile) ? NULL : fs;
+
+    switch (ident[EI_CLASS]) {
+        case ELFCLASS32:
+            CHECK_AND_RETHROW(LoadImage32(directFs, file, elfFile, &ehdr.ehdr32, info));
+            break;
+
+        case ELFCLASS64:
+            CHECK_AND_RETHROW(LoadImage64(directFs, file, elfFile, &ehdr.ehdr64, info));
+            break;
+
+        default:
+            CHECK_FAIL_TRACE("Invalid ELF class %d", ident[EI_CLASS]);
+    }
+
+cleanup:
+    if (elfFile != NULL) {
+        FileHandleClose(elfFile);
+    }
+
+    return Status;
+}
+
+EFI_STATUS LoadElf(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* fs, CHAR16* file, ELF_INFO* info) {
+    return LoadElfOfClass(fs, file, info, ELFCLASSNONE);
+}
+
+EFI_STATUS LoadElf32(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* fs, CHAR16* file, ELF_INFO* info) {
+    return LoadElfOfClass(fs, file, info, ELFCLASS32);
+}
+
+EFI_STATUS LoadElf64(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* fs, CHAR16* file, ELF_INFO* info) {
+    return LoadElfOfClass(fs, file, info, ELFCLASS64);
+}
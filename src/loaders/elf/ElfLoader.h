@@ -9,6 +9,36 @@ typedef struct _ELF_INFO {
     // if zero then physical address is used
     UINT64 VirtualOffset;
 
+    // randomize the load address, only used
+    // for relocatable images
+    BOOLEAN Kaslr;
+
+    // the image can be moved even though it is not
+    // ET_DYN, the kernel takes care of its own relocations
+    // (multiboot2 relocatable tag)
+    BOOLEAN PositionIndependent;
+
+    // where a relocatable image may be placed if it can not
+    // be loaded at its link address, zero for the defaults
+    UINT64 MinAddress;
+    UINT64 MaxAddress;
+    UINT64 Alignment;
+    BOOLEAN PreferHigh;
+
+    // the digest the file must have, NULL to not check it
+    UINT8* Sha256;
+
+    // the amount the image was moved from its link
+    // address, both virtually and physically
+    UINT64 Slide;
+
+    // set if the image is relocatable, in which case
+    // the relocations were applied
+    BOOLEAN Relocatable;
+
+    // the lowest physical address the image was loaded at
+    UINT64 LoadBase;
+
     // The entry of the image
     UINTN Entry;
 
@@ -19,6 +49,11 @@ typedef struct _ELF_INFO {
     UINTN StringSectionIndex;
 } ELF_INFO;
 
+/**
+ * Load an ELF of any class, the header is only parsed once
+ */
+EFI_STATUS LoadElf(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* fs, CHAR16* file, ELF_INFO* info);
+
 EFI_STATUS LoadElf32(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* fs, CHAR16* file, ELF_INFO* info);
 
 EFI_STATUS LoadElf64(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* fs, CHAR16* file, ELF_INFO* info);
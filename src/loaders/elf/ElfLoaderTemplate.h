@@ -0,0 +1,218 @@
+/*
+ * The ELF loader itself, included once per ELF class by ElfLoader.c.
+ *
+ * Before including this the includer defines ELF_BITS (32 or 64) and the
+ * relocation types of the class, everything that depends on the class is
+ * expressed with the ElfN/ELF_FN macros below. There is no include guard
+ * on purpose.
+ */
+
+#ifndef ELF_BITS
+    #error "ELF_BITS must be defined before including the ELF loader template"
+#endif
+
+#define ELF_PASTE3_(a, b, c) a##b##c
+#define ELF_PASTE3(a, b, c) ELF_PASTE3_(a, b, c)
+
+// ElfN(Phdr) -> Elf64_Phdr, ELF_FN(LoadImage) -> LoadImage64
+#define ElfN(type) ELF_PASTE3(Elf, ELF_BITS, _##type)
+#define ELF_FN(name) ELF_PASTE3(name, ELF_BITS, )
+
+// with COMPACT_ERRORS each copy has its own id in bin/errors.txt, set by the
+// Makefile, otherwise the errors here would point at the lines of ElfLoader.c
+#ifndef TOMATBOOT_ELF32_FILE_ID
+    #define TOMATBOOT_ELF32_FILE_ID 0
+#endif
+#ifndef TOMATBOOT_ELF64_FILE_ID
+    #define TOMATBOOT_ELF64_FILE_ID 0
+#endif
+#pragma push_macro("TOMATBOOT_FILE_ID")
+#undef TOMATBOOT_FILE_ID
+#define TOMATBOOT_FILE_ID ELF_PASTE3(TOMATBOOT_ELF, ELF_BITS, _FILE_ID)
+
+/**
+ * Apply the relative relocations of the image, this is a single
+ * linear pass over the relocation table
+ */
+static EFI_STATUS ELF_FN(ApplyRelocations)(ElfN(Phdr)* dynamic, ELF_INFO* info) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8* rel = NULL;
+    UINTN relSize = 0;
+    UINTN relEnt = 0;
+    BOOLEAN hasAddend = FALSE;
+
+    // the dynamic section is loaded already, parse it in place
+    for (ElfN(Dyn)* dyn = (ElfN(Dyn)*)ToPhysical(info, dynamic->p_vaddr); dyn->d_tag != DT_NULL; dyn++) {
+        switch (dyn->d_tag) {
+            case DT_RELA: rel = (UINT8*)ToPhysical(info, dyn->d_un.d_ptr); hasAddend = TRUE; break;
+            case DT_RELASZ: relSize = dyn->d_un.d_val; break;
+            case DT_RELAENT: relEnt = dyn->d_un.d_val; break;
+            case DT_REL: rel = (UINT8*)ToPhysical(info, dyn->d_un.d_ptr); break;
+            case DT_RELSZ: relSize = dyn->d_un.d_val; break;
+            case DT_RELENT: relEnt = dyn->d_un.d_val; break;
+            default: break;
+        }
+    }
+
+    // nothing to relocate
+    if (rel == NULL) {
+        goto cleanup;
+    }
+    CHECK(relEnt >= (hasAddend ? sizeof(ElfN(Rela)) : sizeof(ElfN(Rel))));
+
+    for (UINT8* ptr = rel; ptr < rel + relSize; ptr += relEnt) {
+        ElfN(Rela)* reloc = (ElfN(Rela)*)ptr;
+        ElfN(Addr)* target = (ElfN(Addr)*)ToPhysical(info, reloc->r_offset);
+        switch (ELF_R_TYPE(reloc->r_info)) {
+            case ELF_R_NONE:
+                break;
+
+            case ELF_R_RELATIVE:
+                // without an addend it is stored in the target
+                *target = (ElfN(Addr))(info->Slide + (hasAddend ? reloc->r_addend : *target));
+                break;
+
+            default:
+                CHECK_FAIL_TRACE("Unsupported relocation type %d", ELF_R_TYPE(reloc->r_info));
+        }
+    }
+
+cleanup:
+    return Status;
+}
+
+/**
+ * Load the image from an already opened file, the header was
+ * already read and its identity verified
+ *
+ * @param fs    the file system of the file if the segments can be read
+ *              straight from the disk, NULL otherwise
+ */
+static EFI_STATUS ELF_FN(LoadImage)(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* fs, CHAR16* file, EFI_FILE_PROTOCOL* elfFile, ElfN(Ehdr)* ehdr, ELF_INFO* info) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    ElfN(Phdr)* phdrs = NULL;
+    BLOCK_READ_RANGE* ranges = NULL;
+    BOOLEAN blockRead = FALSE;
+
+    CHECK(ehdr->e_phentsize == sizeof(ElfN(Phdr)));
+
+    // read all the program headers
+    phdrs = AllocatePool(sizeof(ElfN(Phdr)) * ehdr->e_phnum);
+    CHECK_ERROR(phdrs != NULL, EFI_OUT_OF_RESOURCES);
+    CHECK_AND_RETHROW(FileRead(elfFile, phdrs, sizeof(ElfN(Phdr)) * ehdr->e_phnum, ehdr->e_phoff));
+
+    // get the physical range the image is linked at
+    UINT64 low = MAX_UINT64;
+    UINT64 high = 0;
+    UINT64 align = 0;
+    for (int i = 0; i < ehdr->e_phnum; i++) {
+        if (phdrs[i].p_type != PT_LOAD || phdrs[i].p_memsz == 0) continue;
+        UINT64 base = info->VirtualOffset ? phdrs[i].p_vaddr - info->VirtualOffset : phdrs[i].p_paddr;
+        low = MIN(low, base);
+        high = MAX(high, base + phdrs[i].p_memsz);
+        align = MAX(align, phdrs[i].p_align);
+    }
+
+    // choose where to load the image
+    info->Relocatable = ehdr->e_type == ET_DYN;
+    CHECK_AND_RETHROW(ElfPlaceImage(low, high, align, info->Relocatable || info->PositionIndependent, info));
+    LOG_DEBUG("    IMAGE BASE = %p, SLIDE = %p\n", info->LoadBase, info->Slide);
+
+    // allocate the whole image at once, segments that share a page
+    // would fail if each was allocated on its own
+    EFI_PHYSICAL_ADDRESS imageBase = info->LoadBase;
+    UINTN imagePages = EFI_SIZE_TO_PAGES(ALIGN_VALUE(high, EFI_PAGE_SIZE) - (low & ~(UINT64)(EFI_PAGE_SIZE - 1)));
+    EFI_CHECK(gBS->AllocatePages(AllocateAddress, EfiLoaderCode, imagePages, &imageBase));
+
+    // read all the segments from the disk in one go if we can
+    if (fs != NULL) {
+        ranges = AllocatePool(sizeof(BLOCK_READ_RANGE) * ehdr->e_phnum);
+        CHECK_ERROR(ranges != NULL, EFI_OUT_OF_RESOURCES);
+
+        UINTN rangeCount = 0;
+        for (int i = 0; i < ehdr->e_phnum; i++) {
+            ElfN(Phdr)* phdr = &phdrs[i];
+            if (phdr->p_type != PT_LOAD || phdr->p_memsz == 0) continue;
+            CHECK(phdr->p_filesz <= phdr->p_memsz);
+            ranges[rangeCount].Offset = phdr->p_offset;
+            ranges[rangeCount].Buffer = (void*)((info->VirtualOffset ? phdr->p_vaddr - info->VirtualOffset : phdr->p_paddr) + info->Slide);
+            ranges[rangeCount].Size = phdr->p_filesz;
+            rangeCount++;
+        }
+
+        Status = BlockReadFileRanges(fs, file, ranges, rangeCount);
+        if (Status == EFI_UNSUPPORTED) {
+            Status = EFI_SUCCESS;
+        } else {
+            CHECK_AND_RETHROW(Status);
+            blockRead = TRUE;
+        }
+    }
+
+    // Load from section headers
+    ElfN(Phdr)* dynamic = NULL;
+    for (int i = 0; i < ehdr->e_phnum; i++) {
+        ElfN(Phdr)* phdr = &phdrs[i];
+
+        switch (phdr->p_type) {
+            // normal section
+            case PT_LOAD:
+                // ignore empty sections
+                if (phdr->p_memsz == 0) continue;
+
+                // read it into the image, the bss is cleared while it is being read
+                EFI_PHYSICAL_ADDRESS base = (info->VirtualOffset ? phdr->p_vaddr - info->VirtualOffset : phdr->p_paddr) + info->Slide;
+                LOG_DEBUG("    BASE = %p, SIZE = %p\n", base, phdr->p_memsz);
+                CHECK(phdr->p_filesz <= phdr->p_memsz);
+                FILE_ASYNC_READ read = {0};
+                if (!blockRead) {
+                    CHECK_AND_RETHROW(FileReadAsync(elfFile, (void*)base, phdr->p_filesz, phdr->p_offset, &read));
+                }
+                FastZeroMem((void*)(base + phdr->p_filesz), phdr->p_memsz - phdr->p_filesz);
+                CHECK_AND_RETHROW(FileReadWait(&read));
+                break;
+
+            // relocations info
+            case PT_DYNAMIC:
+                dynamic = phdr;
+                break;
+
+            // ignore entry
+            default:
+                break;
+        }
+    }
+
+    // relocate the image
+    if (info->Relocatable && dynamic != NULL) {
+        CHECK_AND_RETHROW(ELF_FN(ApplyRelocations)(dynamic, info));
+    }
+
+    // copy the section headers
+    info->SectionHeadersSize = ehdr->e_shnum * ehdr->e_shentsize;
+    info->SectionHeaders = AllocatePool(info->SectionHeadersSize); // TODO: Delete if error
+    info->SectionEntrySize = ehdr->e_shentsize;
+    info->StringSectionIndex = ehdr->e_shstrndx;
+    CHECK_AND_RETHROW(FileRead(elfFile, info->SectionHeaders, info->SectionHeadersSize, ehdr->e_shoff));
+
+    // copy the entry
+    info->Entry = (ElfN(Addr))(ehdr->e_entry + info->Slide);
+
+cleanup:
+    if (ranges != NULL) {
+        FreePool(ranges);
+    }
+
+    if (phdrs != NULL) {
+        FreePool(phdrs);
+    }
+
+    return Status;
+}
+
+#pragma pop_macro("TOMATBOOT_FILE_ID")
+
+#undef ELF_FN
+#undef ElfN
+#undef ELF_PASTE3
+#undef ELF_PASTE3_
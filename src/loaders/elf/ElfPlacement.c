@@ -0,0 +1,97 @@
+#include "ElfPlacement.h"
+
+#include <util/Except.h>
+#include <util/LogUtils.h>
+#include <util/MemUtils.h>
+#include <util/RandUtils.h>
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+
+// keep relocated images out of the real mode area
+#define RELOCATION_MIN_ADDRESS  BASE_1MB
+
+// images that are moved try to keep 2MB alignment so they can be mapped with large pages
+#define HUGE_PAGE_ALIGNMENT     SIZE_2MB
+
+// kaslr slides are multiples of 2MB, so the kernel keeps the large
+// page alignment it was linked with
+#define KASLR_ALIGNMENT         SIZE_2MB
+#define KASLR_ATTEMPTS          16
+
+/**
+ * Choose a random free base for the image inside of the limits, the base
+ * is the link address moved by a multiple of the alignment
+ */
+static BOOLEAN PickKaslrBase(UINT64 Low, UINT64 Size, UINT64 Min, UINT64 Max, UINT64 Alignment, EFI_PHYSICAL_ADDRESS* Base) {
+    Alignment = MAX(Alignment, KASLR_ALIGNMENT);
+
+    // the lowest base that is at least Min and at the same place in the
+    // alignment as the link address, this works below Min as well
+    Min += (Low - Min) & (Alignment - 1);
+    if (Max < Min || Max - Min < Size) {
+        return FALSE;
+    }
+
+    UINT64 Slots = (Max - Min - Size) / Alignment + 1;
+    for (int i = 0; i < KASLR_ATTEMPTS; i++) {
+        UINT64 Rand = 0;
+        BOOLEAN Hardware = GetRandom64(&Rand);
+        WARN(Hardware || i != 0, "No RDRAND, KASLR slide is weak");
+
+        *Base = Min + (Rand % Slots) * Alignment;
+        if (IsRangeFree(*Base, EFI_SIZE_TO_PAGES(Size))) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+EFI_STATUS ElfPlaceImage(UINT64 Low, UINT64 High, UINT64 Alignment, BOOLEAN Movable, ELF_INFO* info) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    Low = Low & ~(UINT64)(EFI_PAGE_SIZE - 1);
+    High = ALIGN_VALUE(High, EFI_PAGE_SIZE);
+    CHECK(Low < High);
+
+    UINT64 Size = High - Low;
+    EFI_PHYSICAL_ADDRESS Base = Low;
+
+    info->Slide = 0;
+    info->LoadBase = Low;
+
+    if (!Movable) {
+        WARN(!info->Kaslr, "Image is not relocatable, ignoring KASLR");
+        goto cleanup;
+    }
+
+    // the higher half only maps the first 2GB
+    UINT64 Limit = info->VirtualOffset ? SIZE_2GB : BASE_4GB;
+    UINT64 Min = info->MinAddress ? info->MinAddress : RELOCATION_MIN_ADDRESS;
+    UINT64 Max = info->MaxAddress ? MIN(info->MaxAddress, Limit) : Limit;
+    Alignment = MAX(MAX(Alignment, info->Alignment), EFI_PAGE_SIZE);
+    CHECK_TRACE((Alignment & (Alignment - 1)) == 0, "Invalid image alignment %p", Alignment);
+
+    BOOLEAN Placed = FALSE;
+    if (info->Kaslr) {
+        Placed = PickKaslrBase(Low, Size, Min, Max, Alignment, &Base);
+        WARN(Placed, "Could not find a free range for KASLR, trying the link address");
+    }
+
+    // only move the image if we have to
+    if (!Placed && !IsRangeFree(Low, EFI_SIZE_TO_PAGES(Size))) {
+        LOG_INFO("    Link address %p is in use, relocating\n", Low);
+        if ((Low & (HUGE_PAGE_ALIGNMENT - 1)) != 0 ||
+            EFI_ERROR(FindFreeRange(EFI_SIZE_TO_PAGES(Size), Min, Max, MAX(Alignment, HUGE_PAGE_ALIGNMENT), info->PreferHigh, &Base))) {
+            CHECK_ERROR_TRACE(!EFI_ERROR(FindFreeRange(EFI_SIZE_TO_PAGES(Size), Min, Max, Alignment, info->PreferHigh, &Base)), EFI_OUT_OF_RESOURCES,
+                              "No room to relocate the kernel");
+        }
+    }
+
+    info->Slide = Base - Low;
+    info->LoadBase = Base;
+
+cleanup:
+    return Status;
+}
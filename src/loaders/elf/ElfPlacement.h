@@ -0,0 +1,21 @@
+#ifndef __LOADERS_ELF_ELFPLACEMENT_H__
+#define __LOADERS_ELF_ELFPLACEMENT_H__
+
+#include "ElfLoader.h"
+
+/**
+ * Decide where the image is going to be loaded, takes the physical range
+ * the image is linked at and the biggest segment alignment.
+ *
+ * A movable image is moved by a random multiple of 2MB when kaslr is requested,
+ * otherwise it is only moved if its link address is in use, in which case
+ * it is placed inside of the limits given in the info.
+ *
+ * An image that is linked at a 2MB aligned address keeps that alignment
+ * when it is moved, if possible.
+ *
+ * Sets the Slide and LoadBase of the info, nothing is allocated.
+ */
+EFI_STATUS ElfPlaceImage(UINT64 Low, UINT64 High, UINT64 Alignment, BOOLEAN Movable, ELF_INFO* info);
+
+#endif //__LOADERS_ELF_ELFPLACEMENT_H__
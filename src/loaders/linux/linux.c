@@ -1,5 +1,7 @@
 
 #include <util/Except.h>
+#include <util/FileUtils.h>
+#include <util/LogUtils.h>
 #include <loaders/Loaders.h>
 #include <config/BootEntries.h>
 
@@ -18,12 +20,21 @@ EFI_STATUS LoadLinuxKernel(BOOT_ENTRY* Entry) {
     UINTN KernelSize = 0;
     UINT8* KernelImage = NULL;
 
-    Print(L"Loading kernel image\n");
+    // the files are only staged, LoadLinuxLib copies them to where linux
+    // wants them, so they can be anywhere and keep out of the low memory
+    MODULE_PLACEMENT Placement = {
+        .Memory = MODULE_MEMORY_RECLAIMABLE,
+        .MaxAddress = MAX_UINT64,
+        .PreferAbove = BASE_4GB,
+    };
+
+    LOG_INFO("Loading kernel image\n");
     BOOT_MODULE Module = {
         .Path = Entry->Path,
         .Fs = Entry->Fs,
+        .Sha256 = Entry->Sha256,
     };
-    CHECK_AND_RETHROW(LoadBootModule(&Module, (UINTN*)&KernelImage, &KernelSize));
+    CHECK_AND_RETHROW(LoadBootModule(&Module, &Placement, (UINTN*)&KernelImage, &KernelSize));
 
     // get the setup size
     UINTN SetupSize = KernelImage[0x1f1];
@@ -33,7 +44,7 @@ EFI_STATUS LoadLinuxKernel(BOOT_ENTRY* Entry) {
     SetupSize  = (SetupSize + 1) * 512;
     CHECK(SetupSize < KernelSize);
     KernelSize -= SetupSize;
-    Print(L"Setup Size: 0x%x\n", SetupSize);
+    LOG_DEBUG("Setup Size: 0x%x\n", SetupSize);
 
     // load the setup
     UINT8* SetupBuf = LoadLinuxAllocateKernelSetupPages(EFI_SIZE_TO_PAGES(SetupSize));
@@ -49,7 +60,7 @@ EFI_STATUS LoadLinuxKernel(BOOT_ENTRY* Entry) {
     // load the kernel
     UINT64 KernelInitialSize  = LoadLinuxGetKernelSize(SetupBuf, KernelSize);
     CHECK(KernelInitialSize  != 0);
-    Print(L"Kernel size: 0x%x\n", KernelSize);
+    LOG_DEBUG("Kernel size: 0x%x\n", KernelSize);
     UINT8* KernelBuf = LoadLinuxAllocateKernelPages(SetupBuf, EFI_SIZE_TO_PAGES(KernelInitialSize));
     CHECK(KernelBuf != NULL);
     CopyMem(KernelBuf, KernelImage + SetupSize, KernelSize);
@@ -61,7 +72,7 @@ EFI_STATUS LoadLinuxKernel(BOOT_ENTRY* Entry) {
     // load the command line arguments, if any
     CHAR8* CommandLineBuf = NULL;
     if(Entry->Cmdline) {
-        Print(L"Command line: `%s`\n", Entry->Cmdline);
+        LOG_DEBUG("Command line: `%s`\n", Entry->Cmdline);
         UINTN CommandLineSize = StrLen(Entry->Cmdline) + 1;
         CommandLineBuf = LoadLinuxAllocateCommandLinePages(EFI_SIZE_TO_PAGES(CommandLineSize));
         CHECK(CommandLineBuf != NULL);
@@ -69,6 +80,8 @@ EFI_STATUS LoadLinuxKernel(BOOT_ENTRY* Entry) {
     }
     EFI_CHECK(LoadLinuxSetCommandLine(SetupBuf, CommandLineBuf));
 
+    // the file is only staged, LoadLinuxLib copies it to loader data, which
+    // linux reclaims once it is done with the initrd, same as the kernel image
     // TODO: don't assume the first module is the initrd
     // load the initrd, if any
     UINTN InitrdSize = 0;
@@ -76,13 +89,13 @@ EFI_STATUS LoadLinuxKernel(BOOT_ENTRY* Entry) {
     if(!IsListEmpty(&Entry->BootModules)) {
         BOOT_MODULE* InitrdModule = BASE_CR(Entry->BootModules.ForwardLink, BOOT_MODULE, Link);
 
-        UINT8* InitrdBase;
-        LoadBootModule(InitrdModule, (UINTN*)&InitrdBase, &InitrdSize);
-        Print(L"Initrd size: 0x%x\n", InitrdSize);
+        UINT8* InitrdBase = NULL;
+        CHECK_AND_RETHROW(LoadBootModule(InitrdModule, &Placement, (UINTN*)&InitrdBase, &InitrdSize));
+        LOG_DEBUG("Initrd size: 0x%x\n", InitrdSize);
 
         InitrdBuf = LoadLinuxAllocateInitrdPages(SetupBuf, EFI_SIZE_TO_PAGES(InitrdSize));
         CHECK(InitrdBuf != NULL);
-        Print(L"Initrd Buf: 0x%p\n", InitrdBuf);
+        LOG_DEBUG("Initrd Buf: 0x%p\n", InitrdBuf);
         CopyMem(InitrdBuf, InitrdBase, InitrdSize);
 
         // can free the initrd now
@@ -90,12 +103,13 @@ EFI_STATUS LoadLinuxKernel(BOOT_ENTRY* Entry) {
         InitrdBase = NULL;
     }
 
-    Print(L"Loading Initrd...");
+    LOG_DEBUG("Loading Initrd...");
     EFI_CHECK(LoadLinuxSetInitrd(SetupBuf, InitrdBuf, InitrdSize));
-    Print(L" Dones\n");
+    LOG_DEBUG(" Dones\n");
 
     // call the kernel
-    Print(L"Calling linux");
+    FileCloseCached();
+    LOG_INFO("Calling linux");
     EFI_CHECK(LoadLinux(KernelBuf, SetupBuf));
 
 cleanup:
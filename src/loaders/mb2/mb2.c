@@ -11,7 +11,10 @@
 
 #include <config/BootEntries.h>
 #include <util/FileUtils.h>
+#include <util/decompress/Decompress.h>
 #include <util/Except.h>
+#include <util/LogUtils.h>
+#include <util/TscUtils.h>
 #include <config/BootConfig.h>
 #include <loaders/Loaders.h>
 #include <Guid/Acpi.h>
@@ -19,6 +22,7 @@
 #include <Library/UefiRuntimeLib.h>
 #include <Library/CpuLib.h>
 #include <util/DrawUtils.h>
+#include <util/MeasureUtils.h>
 
 static UINT8* mBootParamsBuffer = NULL;
 static UINTN mBootParamsSize = 0;
@@ -57,6 +61,17 @@ static void* PushBootParams(void* data, UINTN size) {
     return base;
 }
 
+static void PushSha256(UINT8* digest, UINTN start, UINTN end) {
+    struct multiboot_tag_tomatboot_sha256 tag = {
+        .type = MULTIBOOT_TAG_TYPE_TOMATBOOT_SHA256,
+        .size = sizeof(struct multiboot_tag_tomatboot_sha256),
+        .mod_start = start,
+        .mod_end = end
+    };
+    CopyMem(tag.digest, digest, sizeof(tag.digest));
+    PushBootParams(&tag, sizeof(tag));
+}
+
 static multiboot_uint32_t EfiTypeToMB2Type[] = {
     [EfiReservedMemoryType] = MULTIBOOT_MEMORY_RESERVED,
     [EfiRuntimeServicesCode] = MULTIBOOT_MEMORY_RESERVED,
@@ -74,18 +89,25 @@ static multiboot_uint32_t EfiTypeToMB2Type[] = {
     [EfiACPIMemoryNVS] = MULTIBOOT_MEMORY_NVS
 };
 
-static struct multiboot_header* LoadMB2Header(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* fs, CHAR16* file, UINTN* headerOff) {
+static multiboot_uint32_t GetMB2Type(EFI_MEMORY_TYPE Type) {
+    if (Type == MODULE_MEMORY_EFI_TYPE) {
+        return MULTIBOOT_MEMORY_AVAILABLE;
+    } else if (Type >= ARRAY_SIZE(EfiTypeToMB2Type)) {
+        return MULTIBOOT_MEMORY_RESERVED;
+    }
+    return EfiTypeToMB2Type[Type];
+}
+
+static struct multiboot_header* LoadMB2Header(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* fs, CHAR16* file, UINT8* sha256, UINTN* headerOff) {
     EFI_STATUS Status = EFI_SUCCESS;
-    EFI_FILE_PROTOCOL* root = NULL;
     EFI_FILE_PROTOCOL* mb2image = NULL;
     struct multiboot_header* ptr = NULL;
 
     // open the executable file
-    Print(L"Loading image `%s`\n", file);
-    EFI_CHECK(fs->OpenVolume(fs, &root));
-    EFI_CHECK(root->Open(root, &mb2image, file, EFI_FILE_MODE_READ, 0));
+    LOG_INFO("Loading image `%s`\n", file);
+    CHECK_AND_RETHROW(OpenMaybeCompressed(fs, file, sha256, &mb2image));
 
-    Print(L"Searching for mb2 header\n");
+    LOG_DEBUG("Searching for mb2 header\n");
     struct multiboot_header header;
     for (int i = 0; i < MULTIBOOT_SEARCH; i += MULTIBOOT_HEADER_ALIGN) {
         CHECK_AND_RETHROW(FileRead(mb2image, &header, sizeof(header), i));
@@ -106,10 +128,6 @@ static struct multiboot_header* LoadMB2Header(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* f
     }
 
 cleanup:
-    if (root != NULL) {
-        FileHandleClose(root);
-    }
-
     if (mb2image != NULL) {
         FileHandleClose(mb2image);
     }
@@ -134,15 +152,22 @@ EFI_STATUS LoadMB2Kernel(BOOT_ENTRY* Entry) {
     ASSERT_EFI_ERROR(gop->SetMode(gop, (UINT32) config.GfxMode));
 
     // get the header
-    struct multiboot_header* header = LoadMB2Header(Entry->Fs, Entry->Path, &HeaderOffset);
+    struct multiboot_header* header = LoadMB2Header(Entry->Fs, Entry->Path, Entry->Sha256, &HeaderOffset);
     CHECK_ERROR_TRACE(header != NULL, EFI_NOT_FOUND, "Could not find a valid multiboot2 header!");
-    Print(L"Found header at offset %d\n", HeaderOffset);
+    LOG_DEBUG("Found header at offset %d\n", HeaderOffset);
 
     // some info we extract
     UINTN EntryAddressOverride = 0;
     BOOLEAN MustHaveOldAcpi = FALSE;
     BOOLEAN MustHaveNewAcpi = FALSE;
     BOOLEAN NotElf = FALSE;
+    ELF_INFO elf_info = {0};
+
+    // mod_start and mod_end are 32bit, so the modules must stay below 4GB
+    MODULE_PLACEMENT Placement = {
+        .Memory = MODULE_MEMORY_MODULE,
+        .MaxAddress = BASE_4GB,
+    };
 
     // push the size and something else
     mBootParamsSize = 8;
@@ -170,6 +195,7 @@ EFI_STATUS LoadMB2Kernel(BOOT_ENTRY* Entry) {
                         case MULTIBOOT_TAG_TYPE_EFI_MMAP:
                         case MULTIBOOT_TAG_TYPE_FRAMEBUFFER:
                         case MULTIBOOT_TAG_TYPE_ELF_SECTIONS:
+                        case MULTIBOOT_TAG_TYPE_LOAD_BASE_ADDR:
                             break;
 
                         // stuff that we might not have so fail if doesn't have
@@ -208,8 +234,10 @@ EFI_STATUS LoadMB2Kernel(BOOT_ENTRY* Entry) {
 
             case MULTIBOOT_HEADER_TAG_MODULE_ALIGN: {
                 /*
-                 * We always align modules
+                 * The modules must be page aligned, which is
+                 * the least we place them at anyways
                  */
+                Placement.Alignment = EFI_PAGE_SIZE;
             } break;
 
             case MULTIBOOT_HEADER_TAG_EFI_BS: {
@@ -231,10 +259,14 @@ EFI_STATUS LoadMB2Kernel(BOOT_ENTRY* Entry) {
             } break;
 
             case MULTIBOOT_HEADER_TAG_RELOCATABLE: {
-                if (!(tag->flags & MULTIBOOT_HEADER_TAG_OPTIONAL)) {
-                    // TODO: we probably wanna support this
-                    CHECK_FAIL_TRACE("We do not support ELF relocations");
-                }
+                // the kernel can be loaded anywhere inside of these limits
+                struct multiboot_header_tag_relocatable* relocatable = (void*)tag;
+                CHECK_TRACE(relocatable->min_addr < relocatable->max_addr, "Invalid relocatable limits");
+                elf_info.PositionIndependent = TRUE;
+                elf_info.MinAddress = relocatable->min_addr;
+                elf_info.MaxAddress = relocatable->max_addr;
+                elf_info.Alignment = relocatable->align;
+                elf_info.PreferHigh = relocatable->preference == MULTIBOOT_LOAD_PREFERENCE_HIGH;
             } break;
 
             default:
@@ -244,7 +276,7 @@ EFI_STATUS LoadMB2Kernel(BOOT_ENTRY* Entry) {
 
     // push the command line
     {
-        Print(L"Pushing cmdline\n");
+        LOG_DEBUG("Pushing cmdline\n");
         UINTN size = StrLen(Entry->Cmdline) + 1 + OFFSET_OF(struct multiboot_tag_string, string);
         struct multiboot_tag_string* string = PushBootParams(NULL, size);
         string->type = MULTIBOOT_TAG_TYPE_CMDLINE;
@@ -254,7 +286,7 @@ EFI_STATUS LoadMB2Kernel(BOOT_ENTRY* Entry) {
 
     // push the bootloader name
     {
-        Print(L"Pushing bootloader name\n");
+        LOG_DEBUG("Pushing bootloader name\n");
         UINTN size = sizeof("TomatBoot v2 UEFI") + OFFSET_OF(struct multiboot_tag_string, string);
         struct multiboot_tag_string* string = PushBootParams(NULL, size);
         string->type = MULTIBOOT_TAG_TYPE_BOOT_LOADER_NAME;
@@ -263,12 +295,12 @@ EFI_STATUS LoadMB2Kernel(BOOT_ENTRY* Entry) {
     }
 
     // push the modules
-    Print(L"Pushing modules\n");
+    LOG_DEBUG("Pushing modules\n");
     for (LIST_ENTRY* Link = Entry->BootModules.ForwardLink; Link != &Entry->BootModules; Link = Link->ForwardLink) {
         BOOT_MODULE* Module = BASE_CR(Link, BOOT_MODULE, Link);
         UINTN Start = 0;
         UINTN Size = 0;
-        CHECK_AND_RETHROW(LoadBootModule(Module, &Start, &Size));
+        CHECK_AND_RETHROW(LoadBootModule(Module, &Placement, &Start, &Size));
 
         UINTN TotalTagSize = OFFSET_OF(struct multiboot_tag_module, cmdline) + StrLen(Module->Tag) + 1;
         struct multiboot_tag_module* mod = PushBootParams(NULL, TotalTagSize);
@@ -278,11 +310,15 @@ EFI_STATUS LoadMB2Kernel(BOOT_ENTRY* Entry) {
         mod->mod_end = Start + Size;
         UnicodeStrToAsciiStr(Module->Tag, mod->cmdline);
 
-        Print(L"    Added %s (%s) -> %p - %p\n", Module->Tag, Module->Path, mod->mod_start, mod->mod_end);
+        LOG_INFO("    Added %s (%s) -> %p - %p\n", Module->Tag, Module->Path, mod->mod_start, mod->mod_end);
+
+        if (Module->Sha256 != NULL) {
+            PushSha256(Module->Sha256, Start, Start + Size);
+        }
     }
 
     // push framebuffer info
-    Print(L"Pushing framebuffer info\n");
+    LOG_DEBUG("Pushing framebuffer info\n");
     struct multiboot_tag_framebuffer framebuffer = {
         .common = {
             .type = MULTIBOOT_TAG_TYPE_FRAMEBUFFER,
@@ -307,7 +343,7 @@ EFI_STATUS LoadMB2Kernel(BOOT_ENTRY* Entry) {
     void* acpi10table;
     if (!EFI_ERROR(EfiGetSystemConfigurationTable(&gEfiAcpi10TableGuid, &acpi10table))) {
         // RSDP is 20 bytes long
-        Print(L"Pushing old ACPI info\n");
+        LOG_DEBUG("Pushing old ACPI info\n");
         struct multiboot_tag_old_acpi* old_acpi = PushBootParams(NULL, 20 + OFFSET_OF(struct multiboot_tag_old_acpi, rsdp));
         old_acpi->size = 20 + OFFSET_OF(struct multiboot_tag_old_acpi, rsdp);
         old_acpi->type = MULTIBOOT_TAG_TYPE_ACPI_OLD;
@@ -320,7 +356,7 @@ EFI_STATUS LoadMB2Kernel(BOOT_ENTRY* Entry) {
     void* acpi20table;
     if (!EFI_ERROR(EfiGetSystemConfigurationTable(&gEfiAcpi20TableGuid, &acpi20table))) {
         // XSDP is 36 bytes long
-        Print(L"Pushing new ACPI info\n");
+        LOG_DEBUG("Pushing new ACPI info\n");
         struct multiboot_tag_new_acpi* new_acpi = PushBootParams(NULL, 36 + OFFSET_OF(struct multiboot_tag_new_acpi, rsdp));
         new_acpi->size = 36 + OFFSET_OF(struct multiboot_tag_new_acpi, rsdp);
         new_acpi->type = MULTIBOOT_TAG_TYPE_ACPI_NEW;
@@ -329,23 +365,30 @@ EFI_STATUS LoadMB2Kernel(BOOT_ENTRY* Entry) {
         CHECK_FAIL_TRACE("New ACPI Table is not present");
     }
 
+    // push the tsc frequency
+    LOG_DEBUG("Pushing TSC frequency\n");
+    struct multiboot_tag_tomatboot_tsc tsc = {
+        .type = MULTIBOOT_TAG_TYPE_TOMATBOOT_TSC,
+        .size = sizeof(struct multiboot_tag_tomatboot_tsc),
+    };
+    tsc.frequency = GetTscFrequency(&tsc.flags);
+    PushBootParams(&tsc, sizeof(tsc));
+
     // load the elf
     if (NotElf) {
         // TODO: Load raw image
         CHECK_FAIL_TRACE("Raw image is not supported yet");
     } else {
-        ELF_INFO elf_info;
-
-        // try with 32bit elf
-        Print(L"Trying to load ELF32\n");
-        if (EFI_ERROR(LoadElf32(Entry->Fs, Entry->Path, &elf_info))) {
-            // try with elf64
-            Print(L"Not ELF32, trying ELF64\n");
-            CHECK_AND_RETHROW(LoadElf64(Entry->Fs, Entry->Path, &elf_info));
+        // can be either a 32bit or a 64bit elf
+        LOG_DEBUG("Loading ELF\n");
+        elf_info.Sha256 = Entry->Sha256;
+        CHECK_AND_RETHROW(LoadElf(Entry->Fs, Entry->Path, &elf_info));
+        if (Entry->Sha256 != NULL) {
+            PushSha256(Entry->Sha256, 0, 0);
         }
 
         // push elf info
-        Print(L"Pushing ELF info\n");
+        LOG_DEBUG("Pushing ELF info\n");
         UINTN Size = OFFSET_OF(struct multiboot_tag_elf_sections, sections) + elf_info.SectionHeadersSize;
         struct multiboot_tag_elf_sections* sections = PushBootParams(NULL, Size);
         sections->size = Size;
@@ -357,17 +400,52 @@ EFI_STATUS LoadMB2Kernel(BOOT_ENTRY* Entry) {
 
         if (EntryAddressOverride == 0) {
             EntryAddressOverride = elf_info.Entry;
+        } else {
+            EntryAddressOverride += elf_info.Slide;
         }
+
+        // tell the kernel where it actually got loaded
+        if (elf_info.PositionIndependent || elf_info.Relocatable) {
+            LOG_DEBUG("Pushing load base address\n");
+            struct multiboot_tag_load_base_addr load_base_addr = {
+                .type = MULTIBOOT_TAG_TYPE_LOAD_BASE_ADDR,
+                .size = sizeof(struct multiboot_tag_load_base_addr),
+                .load_base_addr = elf_info.LoadBase
+            };
+            PushBootParams(&load_base_addr, sizeof(load_base_addr));
+        }
+    }
+
+    // everything is loaded, so the log is complete
+    UINTN MeasureLogSize = 0;
+    void* MeasureLog = GetMeasureLog(&MeasureLogSize);
+    if (MeasureLog != NULL) {
+        LOG_DEBUG("Pushing measurement log\n");
+        UINTN Size = OFFSET_OF(struct multiboot_tag_tomatboot_measure_log, log) + MeasureLogSize;
+        struct multiboot_tag_tomatboot_measure_log* log = PushBootParams(NULL, Size);
+        log->type = MULTIBOOT_TAG_TYPE_TOMATBOOT_MEASURE_LOG;
+        log->size = Size;
+        CopyMem(log->log, MeasureLog, MeasureLogSize);
     }
 
     // allocate the needed space for gdt
-    Print(L"Allocating area for GDT\n");
+    LOG_DEBUG("Allocating area for GDT\n");
     InitLinuxDescriptorTables();
 
+    // the log ends here, anything after is only written out on failure
+    UINTN LogTagSize = OFFSET_OF(struct multiboot_tag_tomatboot_log, log) + LogSize();
+    struct multiboot_tag_tomatboot_log* bootLog = PushBootParams(NULL, LogTagSize);
+    bootLog->type = MULTIBOOT_TAG_TYPE_TOMATBOOT_LOG;
+    bootLog->size = LogTagSize;
+    LogCopy((CHAR8*)bootLog->log);
+
     ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
     // No prints from here
     ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+    // nothing is read from the disk anymore
+    FileCloseCached();
+
     // setup the mmap information
     UINT8 TmpMemoryMap[1];
     UINTN MemoryMapSize = sizeof(TmpMemoryMap);
@@ -400,7 +478,7 @@ EFI_STATUS LoadMB2Kernel(BOOT_ENTRY* Entry) {
     for (int i = 0; i < EntryCount; i++) {
         struct multiboot_mmap_entry* entry = &mmap->entries[i];
         EFI_MEMORY_DESCRIPTOR* desc = (EFI_MEMORY_DESCRIPTOR*)((UINTN)MemoryMap + DescriptorSize * i);
-        entry->type = EfiTypeToMB2Type[desc->Type];
+        entry->type = GetMB2Type(desc->Type);
         entry->addr = desc->PhysicalStart;
         entry->len = EFI_PAGES_TO_SIZE(desc->NumberOfPages);
         entry->zero = 0;
@@ -64,6 +64,12 @@
 #define MULTIBOOT_TAG_TYPE_EFI64_IH          20
 #define MULTIBOOT_TAG_TYPE_LOAD_BASE_ADDR    21
 
+/* TomatBoot extension */
+#define MULTIBOOT_TAG_TYPE_TOMATBOOT_SHA256  0x544d0001
+#define MULTIBOOT_TAG_TYPE_TOMATBOOT_MEASURE_LOG  0x544d0002
+#define MULTIBOOT_TAG_TYPE_TOMATBOOT_LOG  0x544d0003
+#define MULTIBOOT_TAG_TYPE_TOMATBOOT_TSC  0x544d0004
+
 #define MULTIBOOT_HEADER_TAG_END  0
 #define MULTIBOOT_HEADER_TAG_INFORMATION_REQUEST  1
 #define MULTIBOOT_HEADER_TAG_ADDRESS  2
@@ -412,6 +418,42 @@ struct multiboot_tag_load_base_addr
     multiboot_uint32_t load_base_addr;
 };
 
+/* the digest of a file that was checked, mod_start and mod_end are zero for the kernel */
+struct multiboot_tag_tomatboot_sha256
+{
+    multiboot_uint32_t type;
+    multiboot_uint32_t size;
+    multiboot_uint32_t mod_start;
+    multiboot_uint32_t mod_end;
+    multiboot_uint8_t digest[32];
+};
+
+/* the measured boot log, a list of MEASURE_EVENT entries (see util/MeasureUtils.h) */
+struct multiboot_tag_tomatboot_measure_log
+{
+    multiboot_uint32_t type;
+    multiboot_uint32_t size;
+    multiboot_uint8_t log[0];
+};
+
+/* the TSC frequency in Hz, flags are the TSC_FLAG_* from util/TscUtils.h */
+struct multiboot_tag_tomatboot_tsc
+{
+    multiboot_uint32_t type;
+    multiboot_uint32_t size;
+    multiboot_uint64_t frequency;
+    multiboot_uint32_t flags;
+    multiboot_uint32_t reserved;
+};
+
+/* the boot log as text (see util/LogUtils.h) */
+struct multiboot_tag_tomatboot_log
+{
+    multiboot_uint32_t type;
+    multiboot_uint32_t size;
+    multiboot_uint8_t log[0];
+};
+
 #endif /*  ! ASM_FILE */
 
 #endif /*  ! MULTIBOOT_HEADER */
\ No newline at end of file
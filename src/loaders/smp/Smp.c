@@ -0,0 +1,266 @@
+#include "Smp.h"
+
+#include <util/Except.h>
+#include <util/TscUtils.h>
+
+#include <Uefi.h>
+#include <Protocol/MpService.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#pragma pack(1)
+
+/**
+ * Must be kept in sync with the DATA_ offsets in SmpTrampoline.nasm
+ */
+typedef struct _SMP_TRAMPOLINE_DATA {
+    UINT64 Cr3;
+    UINT64 Efer;
+    UINT64 InfoArray;
+    UINT64 InfoStride;
+    UINT64 InfoCount;
+    UINT64 ApicIdOffset;
+    UINT64 GotoAddressOffset;
+    UINT64 TargetStackOffset;
+    UINT32 BootedCount;
+    UINT32 X2Apic;
+    UINT16 GdtLimit;
+    UINT32 GdtBase;
+    UINT16 Reserved0;
+    UINT32 Entry32Offset;
+    UINT16 Entry32Selector;
+    UINT16 Reserved1;
+    UINT32 Entry64Offset;
+    UINT16 Entry64Selector;
+    UINT16 Reserved2;
+    UINT64 Gdt[4];
+} SMP_TRAMPOLINE_DATA;
+
+#pragma pack()
+
+extern UINT8 SmpTrampolineStart[];
+extern UINT8 SmpTrampolineProtectedMode[];
+extern UINT8 SmpTrampolineLongMode[];
+extern UINT8 SmpTrampolineData[];
+extern UINT8 SmpTrampolineEnd[];
+
+#define TRAMPOLINE_OFFSET(x) ((UINTN)(x) - (UINTN)SmpTrampolineStart)
+
+#define MSR_IA32_APIC_BASE          0x1B
+#define MSR_IA32_EFER               0xC0000080
+#define MSR_X2APIC_ICR              0x830
+
+#define XAPIC_ICR_LOW               0x300
+#define XAPIC_ICR_HIGH              0x310
+#define XAPIC_ICR_DELIVERY_PENDING  BIT12
+
+#define ICR_INIT                    0x00004500
+#define ICR_STARTUP                 0x00004600
+
+#define EFER_LMA                    BIT10
+
+static SMP_TRAMPOLINE_DATA* mTrampolineData = NULL;
+static UINTN mTrampolineBase = 0;
+static UINT32 mBspApicId = 0;
+static UINT64 mTscPerMicrosecond = 0;
+static BOOLEAN mNeedInitDelay = TRUE;
+
+static UINT32 GetCurrentApicId(BOOLEAN X2Apic) {
+    UINT32 eax, ebx, ecx, edx;
+    if (X2Apic) {
+        AsmCpuidEx(0x0B, 0, &eax, &ebx, &ecx, &edx);
+        return edx;
+    } else {
+        AsmCpuid(0x01, &eax, &ebx, &ecx, &edx);
+        return ebx >> 24u;
+    }
+}
+
+static void MicroDelay(UINT64 Microseconds) {
+    UINT64 Target = AsmReadTsc() + Microseconds * mTscPerMicrosecond;
+    while (AsmReadTsc() < Target) {
+        CpuPause();
+    }
+}
+
+static void SendIpi(UINT32 ApicId, UINT32 Command) {
+    if (mTrampolineData->X2Apic) {
+        AsmWriteMsr64(MSR_X2APIC_ICR, LShiftU64(ApicId, 32) | Command);
+    } else {
+        UINTN ApicBase = AsmReadMsr64(MSR_IA32_APIC_BASE) & ~0xFFFull;
+        volatile UINT32* IcrLow = (volatile UINT32*)(ApicBase + XAPIC_ICR_LOW);
+        volatile UINT32* IcrHigh = (volatile UINT32*)(ApicBase + XAPIC_ICR_HIGH);
+        *IcrHigh = ApicId << 24u;
+        *IcrLow = Command;
+        while (*IcrLow & XAPIC_ICR_DELIVERY_PENDING) {
+            CpuPause();
+        }
+    }
+}
+
+BOOLEAN IsX2ApicSupported() {
+    UINT32 eax, ebx, ecx, edx;
+    AsmCpuid(0x01, &eax, &ebx, &ecx, &edx);
+    return (ecx & BIT21) != 0;
+}
+
+EFI_STATUS GetProcessorApicIds(UINT32** ApicIds, UINTN* Count) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_MP_SERVICES_PROTOCOL* MpServices = NULL;
+    UINTN NumberOfProcessors = 0;
+    UINTN NumberOfEnabledProcessors = 0;
+
+    CHECK(ApicIds != NULL);
+    CHECK(Count != NULL);
+    *ApicIds = NULL;
+    *Count = 0;
+
+    // without mp services we only know about ourselves
+    if (EFI_ERROR(gBS->LocateProtocol(&gEfiMpServiceProtocolGuid, NULL, (void**)&MpServices))) {
+        *ApicIds = AllocatePool(sizeof(UINT32));
+        CHECK_ERROR(*ApicIds != NULL, EFI_OUT_OF_RESOURCES);
+        (*ApicIds)[0] = GetCurrentApicId(FALSE);
+        *Count = 1;
+        goto cleanup;
+    }
+
+    EFI_CHECK(MpServices->GetNumberOfProcessors(MpServices, &NumberOfProcessors, &NumberOfEnabledProcessors));
+    *ApicIds = AllocatePool(NumberOfEnabledProcessors * sizeof(UINT32));
+    CHECK_ERROR(*ApicIds != NULL, EFI_OUT_OF_RESOURCES);
+
+    // the bsp goes first
+    *Count = 1;
+    for (UINTN i = 0; i < NumberOfProcessors; i++) {
+        EFI_PROCESSOR_INFORMATION Info = {0};
+        EFI_CHECK(MpServices->GetProcessorInfo(MpServices, i, &Info));
+
+        if (!(Info.StatusFlag & PROCESSOR_ENABLED_BIT)) {
+            continue;
+        }
+
+        if (Info.StatusFlag & PROCESSOR_AS_BSP_BIT) {
+            (*ApicIds)[0] = (UINT32)Info.ProcessorId;
+        } else {
+            CHECK(*Count < NumberOfEnabledProcessors);
+            (*ApicIds)[(*Count)++] = (UINT32)Info.ProcessorId;
+        }
+    }
+
+cleanup:
+    if (EFI_ERROR(Status) && ApicIds != NULL && *ApicIds != NULL) {
+        FreePool(*ApicIds);
+        *ApicIds = NULL;
+    }
+
+    return Status;
+}
+
+EFI_STATUS PrepareApTrampoline(SMP_PARK_INFO* ParkInfo, BOOLEAN X2Apic) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINTN TrampolineSize = (UINTN)SmpTrampolineEnd - (UINTN)SmpTrampolineStart;
+
+    CHECK(ParkInfo != NULL);
+    CHECK(TrampolineSize <= EFI_PAGE_SIZE);
+
+    // the APs load the page table while still in 32bit mode
+    UINT64 Cr3 = AsmReadCr3();
+    CHECK_TRACE(Cr3 < BASE_4GB, "Page table must be below 4GB for AP startup (%p)", Cr3);
+
+    // the SIPI vector can only point below 1MB
+    EFI_PHYSICAL_ADDRESS Base = BASE_1MB - 1;
+    EFI_CHECK(gBS->AllocatePages(AllocateMaxAddress, EfiLoaderCode, 1, &Base));
+    mTrampolineBase = Base;
+    CopyMem((void*)mTrampolineBase, SmpTrampolineStart, TrampolineSize);
+
+    // setup the data
+    mTrampolineData = (SMP_TRAMPOLINE_DATA*)(mTrampolineBase + TRAMPOLINE_OFFSET(SmpTrampolineData));
+    mTrampolineData->Cr3 = Cr3;
+    mTrampolineData->Efer = AsmReadMsr64(MSR_IA32_EFER) & ~EFER_LMA;
+    mTrampolineData->InfoArray = (UINT64)ParkInfo->InfoArray;
+    mTrampolineData->InfoStride = ParkInfo->InfoStride;
+    mTrampolineData->InfoCount = ParkInfo->InfoCount;
+    mTrampolineData->ApicIdOffset = ParkInfo->ApicIdOffset;
+    mTrampolineData->GotoAddressOffset = ParkInfo->GotoAddressOffset;
+    mTrampolineData->TargetStackOffset = ParkInfo->TargetStackOffset;
+    mTrampolineData->BootedCount = 0;
+    mTrampolineData->X2Apic = X2Apic;
+
+    // null, code32, data, code64
+    mTrampolineData->Gdt[0] = 0;
+    mTrampolineData->Gdt[1] = 0x00CF9A000000FFFF;
+    mTrampolineData->Gdt[2] = 0x00CF92000000FFFF;
+    mTrampolineData->Gdt[3] = 0x00AF9A000000FFFF;
+    mTrampolineData->GdtLimit = sizeof(mTrampolineData->Gdt) - 1;
+    mTrampolineData->GdtBase = (UINT32)(UINTN)mTrampolineData->Gdt;
+
+    mTrampolineData->Entry32Offset = (UINT32)(mTrampolineBase + TRAMPOLINE_OFFSET(SmpTrampolineProtectedMode));
+    mTrampolineData->Entry32Selector = 0x08;
+    mTrampolineData->Entry64Offset = (UINT32)(mTrampolineBase + TRAMPOLINE_OFFSET(SmpTrampolineLongMode));
+    mTrampolineData->Entry64Selector = 0x18;
+
+    // the BSP id, so we don't try to start ourselves
+    mBspApicId = GetCurrentApicId(X2Apic);
+
+    // calibrate the TSC, we can't use the stall service once we start the APs
+    mTscPerMicrosecond = DivU64x32(GetTscFrequency(NULL), 1000000);
+
+    // the 10ms delay after INIT is only needed on old processors, same
+    // as linux we skip it for family 6+ or when running in a hypervisor
+    UINT32 eax, ebx, ecx, edx;
+    AsmCpuid(0x01, &eax, &ebx, &ecx, &edx);
+    if (((eax >> 8u) & 0xFu) >= 6 || (ecx & BIT31)) {
+        mNeedInitDelay = FALSE;
+    }
+
+cleanup:
+    return Status;
+}
+
+UINTN StartAllAps() {
+    if (mTrampolineData == NULL) {
+        return 0;
+    }
+
+    // switch ourselves to x2apic mode so we can send the IPIs with it
+    if (mTrampolineData->X2Apic) {
+        AsmWriteMsr64(MSR_IA32_APIC_BASE, AsmReadMsr64(MSR_IA32_APIC_BASE) | BIT10 | BIT11);
+    }
+
+    // send INIT to everyone at once, and then the SIPIs, this way all the
+    // APs are started in parallel instead of waiting for each one
+    UINTN ApCount = 0;
+    UINT8* Info = (UINT8*)mTrampolineData->InfoArray;
+    for (UINTN i = 0; i < mTrampolineData->InfoCount; i++, Info += mTrampolineData->InfoStride) {
+        UINT32 ApicId = *(UINT32*)(Info + mTrampolineData->ApicIdOffset);
+        if (ApicId != mBspApicId) {
+            SendIpi(ApicId, ICR_INIT);
+            ApCount++;
+        }
+    }
+
+    if (mNeedInitDelay) {
+        MicroDelay(10000);
+    }
+
+    for (int Sipi = 0; Sipi < 2; Sipi++) {
+        Info = (UINT8*)mTrampolineData->InfoArray;
+        for (UINTN i = 0; i < mTrampolineData->InfoCount; i++, Info += mTrampolineData->InfoStride) {
+            UINT32 ApicId = *(UINT32*)(Info + mTrampolineData->ApicIdOffset);
+            if (ApicId != mBspApicId) {
+                SendIpi(ApicId, ICR_STARTUP | (UINT32)(mTrampolineBase >> 12u));
+            }
+        }
+        MicroDelay(200);
+    }
+
+    // wait for everyone to get parked, give up after 100ms
+    volatile UINT32* BootedCount = &mTrampolineData->BootedCount;
+    UINT64 Timeout = AsmReadTsc() + 100000 * mTscPerMicrosecond;
+    while (*BootedCount < ApCount && AsmReadTsc() < Timeout) {
+        CpuPause();
+    }
+
+    return *BootedCount;
+}
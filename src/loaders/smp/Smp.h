@@ -0,0 +1,50 @@
+#ifndef __LOADERS_SMP_SMP_H__
+#define __LOADERS_SMP_SMP_H__
+
+#include <Uefi.h>
+
+/**
+ * Describes where the APs can find their per-cpu info entry, the APs will
+ * search the array for the entry with their apic id and park themselves
+ * spinning on the goto address of that entry.
+ *
+ * Once the goto address is set the AP will jump to it with the target stack
+ * and a pointer to the entry in rdi
+ */
+typedef struct _SMP_PARK_INFO {
+    void* InfoArray;
+    UINTN InfoStride;
+    UINTN InfoCount;
+    UINTN ApicIdOffset;
+    UINTN GotoAddressOffset;
+    UINTN TargetStackOffset;
+} SMP_PARK_INFO;
+
+/**
+ * Get the apic ids of all the enabled processors
+ *
+ * The BSP is always going to be the first entry, the caller needs to free the array
+ */
+EFI_STATUS GetProcessorApicIds(UINT32** ApicIds, UINTN* Count);
+
+/**
+ * Check if we can use x2apic on this cpu
+ */
+BOOLEAN IsX2ApicSupported();
+
+/**
+ * Allocate the trampoline below 1MB and set it up to use the current page
+ * table, must be called before exiting boot services
+ */
+EFI_STATUS PrepareApTrampoline(SMP_PARK_INFO* ParkInfo, BOOLEAN X2Apic);
+
+/**
+ * Start all the APs from the park info and wait for them to be parked, must
+ * be called after exiting boot services since it takes the APs away from
+ * the firmware.
+ *
+ * Returns the amount of APs that got parked
+ */
+UINTN StartAllAps();
+
+#endif //__LOADERS_SMP_SMP_H__
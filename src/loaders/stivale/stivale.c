@@ -5,12 +5,15 @@
 #include <Library/MemoryAllocationLib.h>
 
 #include <util/Except.h>
+#include <util/LogUtils.h>
 #include <config/BootConfig.h>
 #include <config/BootEntries.h>
 #include <loaders/elf/elf64.h>
 #include <loaders/elf/ElfLoader.h>
 #include <util/FileUtils.h>
+#include <util/decompress/Decompress.h>
 #include <loaders/Loaders.h>
+#include <loaders/BootInfo.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/FileHandleLib.h>
 #include <Library/UefiRuntimeServicesTableLib.h>
@@ -37,22 +40,31 @@ static UINT32 EfiTypeToStivaleType[] = {
         [EfiACPIMemoryNVS] = STIVALE_ACPI_NVS
 };
 
+static UINT32 GetStivaleType(EFI_MEMORY_TYPE Type) {
+    if (Type == BOOT_INFO_MEMORY_TYPE) {
+        return STIVALE_BOOTLODAER_RECLAIM;
+    } else if (Type == MODULE_MEMORY_EFI_TYPE) {
+        return STIVALE_KERNEL_MODULES;
+    } else if (Type >= ARRAY_SIZE(EfiTypeToStivaleType)) {
+        return STIVALE_RESERVED;
+    }
+    return EfiTypeToStivaleType[Type];
+}
+
 void NORETURN JumpToStivaleKernel(STIVALE_STRUCT* strct, UINT64 Stack, void* KernelEntry, BOOLEAN level5);
 
 
 
-static EFI_STATUS LoadStivaleHeader(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FS, CHAR16* file, STIVALE_HEADER* header, BOOLEAN* HigherHalf) {
+static EFI_STATUS LoadStivaleHeader(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FS, CHAR16* file, UINT8* Sha256, STIVALE_HEADER* header, UINT64* HeaderAddress, BOOLEAN* HigherHalf) {
     EFI_STATUS Status = EFI_SUCCESS;
-    EFI_FILE_PROTOCOL* root = NULL;
     EFI_FILE_PROTOCOL* image = NULL;
     CHAR8* names = NULL;
     CHECK(HigherHalf != NULL);
     *HigherHalf = FALSE;
 
     // open the executable file
-    Print(L"Loading image `%s`\n", file);
-    EFI_CHECK(FS->OpenVolume(FS, &root));
-    EFI_CHECK(root->Open(root, &image, file, EFI_FILE_MODE_READ, 0));
+    LOG_INFO("Loading image `%s`\n", file);
+    CHECK_AND_RETHROW(OpenMaybeCompressed(FS, file, Sha256, &image));
 
     Elf64_Ehdr ehdr = {0};
     CHECK_AND_RETHROW(FileRead(image, &ehdr, sizeof(ehdr), 0));
@@ -91,6 +103,7 @@ static EFI_STATUS LoadStivaleHeader(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FS, CHAR16*
     // zero and read it
     CHECK(sizeof(*header) == shdr.sh_size);
     CHECK_AND_RETHROW(FileRead(image, header, sizeof(*header), shdr.sh_offset));
+    *HeaderAddress = shdr.sh_addr;
 
     // change the higher half spec if we have a
     // different entry point
@@ -103,10 +116,6 @@ cleanup:
         FreePool(names);
     }
 
-    if (root != NULL) {
-        FileHandleClose(root);
-    }
-
     if (image != NULL) {
         FileHandleClose(image);
     }
@@ -131,7 +140,8 @@ EFI_STATUS LoadStivaleKernel(BOOT_ENTRY* Entry) {
 
     // get the header and decide on higher half
     BOOLEAN HigherHalf = FALSE;
-    CHECK_AND_RETHROW(LoadStivaleHeader(Entry->Fs, Entry->Path, &Header, &HigherHalf));
+    UINT64 HeaderAddress = 0;
+    CHECK_AND_RETHROW(LoadStivaleHeader(Entry->Fs, Entry->Path, Entry->Sha256, &Header, &HeaderAddress, &HigherHalf));
     if (HigherHalf) {
         Elf.VirtualOffset = 0xffffffff80000000;
     }
@@ -145,25 +155,32 @@ EFI_STATUS LoadStivaleKernel(BOOT_ENTRY* Entry) {
         level5Supported = TRUE;
     }
 
-    WARN(!Header.EnableKASLR, "KASLR Is not supported yet! ignoring.");
+    // randomize the kernel location if it allows it
+    Elf.Kaslr = Header.EnableKASLR;
+    Elf.Sha256 = Entry->Sha256;
 
     // fully-load the kernel
     CHECK_AND_RETHROW(LoadElf64(Entry->Fs, Entry->Path, &Elf));
+
+    // the header got relocated with the kernel, take the final values
+    if (Elf.Relocatable && HeaderAddress != 0) {
+        CopyMem(&Header, (void*)(HeaderAddress + Elf.Slide - Elf.VirtualOffset), sizeof(Header));
+    }
     if (Header.EntryPoint != 0) {
         Elf.Entry = Header.EntryPoint;
     }
 
-    // setup the struct
-    STIVALE_STRUCT* Struct = AllocateReservedPool(sizeof(STIVALE_STRUCT));
-    SetMem(Struct, sizeof(STIVALE_STRUCT), 0);
+    // setup the struct, it and everything it points to are in the boot info arena
+    CHECK_AND_RETHROW(BootInfoInit());
+    STIVALE_STRUCT* Struct = BootInfoAllocate(sizeof(STIVALE_STRUCT));
 
     // cmdline
-    Print(L"Setting cmdline\n");
-    Struct->Cmdline = (UINT64)AllocateReservedPool(StrLen(Entry->Cmdline) + 1);
+    LOG_DEBUG("Setting cmdline\n");
+    Struct->Cmdline = (UINT64)BootInfoAllocate(StrLen(Entry->Cmdline) + 1);
     UnicodeStrToAsciiStr(Entry->Cmdline, (CHAR8*)Struct->Cmdline);
 
     // graphics info
-    Print(L"Setting framebuffer info\n");
+    LOG_DEBUG("Setting framebuffer info\n");
     Struct->FramebufferAddr = gop->Mode->FrameBufferBase;
     Struct->FramebufferWidth = gop->Mode->Info->HorizontalResolution;
     Struct->FramebufferHeight = gop->Mode->Info->VerticalResolution;
@@ -173,28 +190,37 @@ EFI_STATUS LoadStivaleKernel(BOOT_ENTRY* Entry) {
     // set the acpi table
     void* acpi_table = NULL;
     if (!EFI_ERROR(EfiGetSystemConfigurationTable(&gEfiAcpi20TableGuid, &acpi_table))) {
-        Struct->Rsdp = (UINT64)AllocateReservedCopyPool(36, acpi_table);
+        Struct->Rsdp = (UINT64)BootInfoCopy(36, acpi_table);
     } else if (!EFI_ERROR(EfiGetSystemConfigurationTable(&gEfiAcpi10TableGuid, &acpi_table))) {
-        Struct->Rsdp = (UINT64)AllocateReservedCopyPool(20, acpi_table);
+        Struct->Rsdp = (UINT64)BootInfoCopy(20, acpi_table);
     } else {
-        Print(L"No ACPI table found, RSDP set to NULL\n");
+        LOG_WARN("No ACPI table found, RSDP set to NULL\n");
     }
 
-    Print(L"Setting epoch\n");
+    LOG_DEBUG("Setting epoch\n");
     EFI_TIME Time = { 0 };
     EFI_CHECK(gRT->GetTime(&Time, NULL));
     Struct->Epoch = GetUnixEpoch(Time.Second, Time.Minute, Time.Hour, Time.Day, Time.Month, Time.Year);
 
     // push the modules
-    Print(L"Loading modules\n");
+    LOG_DEBUG("Loading modules\n");
     STIVALE_MODULE* LastModule = NULL;
+
+    // the kernel only has the first 4GB mapped when it starts, so
+    // the modules stay below that, same as stivale2
+    MODULE_PLACEMENT Placement = {
+        .Memory = MODULE_MEMORY_MODULE,
+        .MaxAddress = BASE_4GB,
+        .Alignment = SIZE_2MB,
+    };
     for (LIST_ENTRY* Link = Entry->BootModules.ForwardLink; Link != &Entry->BootModules; Link = Link->ForwardLink) {
         BOOT_MODULE* Module = BASE_CR(Link, BOOT_MODULE, Link);
         UINTN Start = 0;
         UINTN Size = 0;
-        CHECK_AND_RETHROW(LoadBootModule(Module, &Start, &Size));
+        CHECK_AND_RETHROW(LoadBootModule(Module, &Placement, &Start, &Size));
 
-        STIVALE_MODULE* NewModule = AllocateReservedZeroPool(sizeof(STIVALE_MODULE));
+        STIVALE_MODULE* NewModule = BootInfoAllocate(sizeof(STIVALE_MODULE));
+        CHECK(NewModule != NULL);
         NewModule->Begin = Start;
         NewModule->End = Start + Size;
         UnicodeStrToAsciiStrS(Module->Tag, NewModule->String, sizeof(NewModule->String));
@@ -208,12 +234,12 @@ EFI_STATUS LoadStivaleKernel(BOOT_ENTRY* Entry) {
         Struct->ModuleCount++;
         LastModule = NewModule;
 
-        Print(L"    Added %s (%s) -> %p - %p\n", Module->Tag, Module->Path, Start, Start + Size);
+        LOG_INFO("    Added %s (%s) -> %p - %p\n", Module->Tag, Module->Path, Start, Start + Size);
     }
 
     // setup the page table correctly
     // first disable write protection so we can modify the table
-    Print(L"Preparing higher half\n");
+    LOG_DEBUG("Preparing higher half\n");
     IA32_CR0 Cr0 = { .UintN = AsmReadCr0() };
     Cr0.Bits.WP = 0;
     AsmWriteCr0(Cr0.UintN);
@@ -227,7 +253,7 @@ EFI_STATUS LoadStivaleKernel(BOOT_ENTRY* Entry) {
     // allocate pml3 for 0xffffffff80000000
     UINT64* Pml3High = AllocateReservedPages(1);
     SetMem(Pml3High, EFI_PAGE_SIZE, 0);
-    Print(L"Allocated page %p\n", Pml3High);
+    LOG_DEBUG("Allocated page %p\n", Pml3High);
     Pml4[511] = ((UINT64)Pml3High) | 0x3u;
 
     // map first 2 pages to 0xffffffff80000000
@@ -235,7 +261,7 @@ EFI_STATUS LoadStivaleKernel(BOOT_ENTRY* Entry) {
     Pml3High[510] = Pml3Low[0];
     Pml3High[511] = Pml3Low[1];
 
-    Print(L"Getting memory map\n");
+    LOG_DEBUG("Getting memory map\n");
     ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
     // No prints from here
     ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -254,7 +280,12 @@ EFI_STATUS LoadStivaleKernel(BOOT_ENTRY* Entry) {
     EFI_MEMORY_DESCRIPTOR* MemoryMap = AllocatePool(MemoryMapSize);
 
     // allocate all the space we will need (hopefully)
-    STIVALE_MMAP_ENTRY* StartFrom = AllocateReservedPool((MemoryMapSize / DescriptorSize) * sizeof(STIVALE_MMAP_ENTRY));
+    STIVALE_MMAP_ENTRY* StartFrom = BootInfoAllocate((MemoryMapSize / DescriptorSize) * sizeof(STIVALE_MMAP_ENTRY));
+    CHECK(StartFrom != NULL);
+
+    // that was the last allocation from the arena, and nothing is read from the disk anymore
+    BootInfoTrim();
+    FileCloseCached();
 
     // call it
     EFI_CHECK(gBS->GetMemoryMap(&MemoryMapSize, MemoryMap, &MapKey, &DescriptorSize, &DescriptorVersion));
@@ -270,7 +301,7 @@ EFI_STATUS LoadStivaleKernel(BOOT_ENTRY* Entry) {
     UINTN LastEnd = 0xFFFFFFFFFFFF;
     for (int i = 0; i < EntryCount; i++) {
         EFI_MEMORY_DESCRIPTOR* Desc = (EFI_MEMORY_DESCRIPTOR*)((UINTN)MemoryMap + DescriptorSize * i);
-        int Type = EfiTypeToStivaleType[Desc->Type];
+        int Type = GetStivaleType(Desc->Type);
 
         if (LastType == Type && LastEnd == Desc->PhysicalStart) {
             StartFrom[-1].Length += EFI_PAGES_TO_SIZE(Desc->NumberOfPages);
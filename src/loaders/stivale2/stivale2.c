@@ -5,18 +5,25 @@
 #include <Library/MemoryAllocationLib.h>
 
 #include <util/Except.h>
+#include <util/LogUtils.h>
+#include <util/TscUtils.h>
 #include <config/BootConfig.h>
 #include <config/BootEntries.h>
 #include <loaders/elf/elf64.h>
 #include <loaders/elf/ElfLoader.h>
 #include <util/FileUtils.h>
+#include <util/decompress/Decompress.h>
 #include <loaders/Loaders.h>
+#include <loaders/BootInfo.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/FileHandleLib.h>
 #include <Library/UefiRuntimeServicesTableLib.h>
 #include <loaders/mb2/gdt.h>
 #include <Library/BaseLib.h>
 #include <util/TimeUtils.h>
+#include <util/MeasureUtils.h>
+#include <loaders/smp/Smp.h>
+#include <loaders/bundle/BundleLoader.h>
 
 #include "stivale2.h"
 
@@ -37,20 +44,40 @@ static UINT32 EfiTypeToStivaleType[] = {
         [EfiACPIMemoryNVS] = STIVALE2_ACPI_NVS
 };
 
+static UINT32 GetStivaleType(EFI_MEMORY_TYPE Type) {
+    if (Type == BOOT_INFO_MEMORY_TYPE) {
+        return STIVALE2_BOOTLOADER_RECLAIMABLE;
+    } else if (Type == MODULE_MEMORY_EFI_TYPE) {
+        return STIVALE2_KERNEL_AND_MODULES;
+    } else if (Type >= ARRAY_SIZE(EfiTypeToStivaleType)) {
+        return STIVALE2_RESERVED;
+    }
+    return EfiTypeToStivaleType[Type];
+}
+
 void NORETURN JumpToStivale2Kernel(STIVALE2_STRUCT* strct, UINT64 Stack, void* KernelEntry, BOOLEAN level5);
 
-static EFI_STATUS LoadStivaleHeader(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FS, CHAR16* file, STIVALE2_HEADER* header, BOOLEAN* HigherHalf) {
+/**
+ * Translate a pointer from the kernel's address space to the
+ * physical address we loaded it at
+ */
+static void* KernelToPhysical(ELF_INFO* Elf, void* Address) {
+    if (Address == NULL) {
+        return NULL;
+    }
+    return (void*)((UINTN)Address - Elf->VirtualOffset);
+}
+
+static EFI_STATUS LoadStivaleHeader(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FS, CHAR16* file, UINT8* Sha256, STIVALE2_HEADER* header, UINT64* HeaderAddress, BOOLEAN* HigherHalf) {
     EFI_STATUS Status = EFI_SUCCESS;
-    EFI_FILE_PROTOCOL* root = NULL;
     EFI_FILE_PROTOCOL* image = NULL;
     CHAR8* names = NULL;
     CHECK(HigherHalf != NULL);
     *HigherHalf = FALSE;
 
     // open the executable file
-    Print(L"Loading image `%s`\n", file);
-    EFI_CHECK(FS->OpenVolume(FS, &root));
-    EFI_CHECK(root->Open(root, &image, file, EFI_FILE_MODE_READ, 0));
+    LOG_INFO("Loading image `%s`\n", file);
+    CHECK_AND_RETHROW(OpenMaybeCompressed(FS, file, Sha256, &image));
 
     Elf64_Ehdr ehdr = {0};
     CHECK_AND_RETHROW(FileRead(image, &ehdr, sizeof(ehdr), 0));
@@ -89,6 +116,7 @@ static EFI_STATUS LoadStivaleHeader(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FS, CHAR16*
     // zero and read it
     CHECK(sizeof(*header) == shdr.sh_size);
     CHECK_AND_RETHROW(FileRead(image, header, sizeof(*header), shdr.sh_offset));
+    *HeaderAddress = shdr.sh_addr;
 
     // change the higher half spec if we have a
     // different entry point
@@ -101,10 +129,6 @@ cleanup:
         FreePool(names);
     }
 
-    if (root != NULL) {
-        FileHandleClose(root);
-    }
-
     if (image != NULL) {
         FileHandleClose(image);
     }
@@ -112,32 +136,36 @@ cleanup:
     return Status;
 }
 
-EFI_STATUS LoadStivale2Kernel(BOOT_ENTRY* Entry) {
-    EFI_STATUS Status = EFI_SUCCESS;
-    STIVALE2_HEADER Header = {0};
-    ELF_INFO Elf = {0};
-    BOOLEAN Level5Supported = FALSE;
+// the kernel only has the first 4GB mapped when it starts (and the same in the
+// higher half), so the modules stay below that, 2MB aligned so the kernel can
+// map them with large pages
+static const MODULE_PLACEMENT mModulePlacement = {
+    .Memory = MODULE_MEMORY_MODULE,
+    .MaxAddress = BASE_4GB,
+    .Alignment = SIZE_2MB,
+};
 
-    // load config
+/**
+ * Set the graphics mode of the config, done before anything is
+ * loaded so the kernel gets the framebuffer as it is going to be
+ */
+static EFI_GRAPHICS_OUTPUT_PROTOCOL* SetGraphicsMode() {
     BOOT_CONFIG config;
     LoadBootConfig(&config);
 
-    // set graphics mode right away
     EFI_GRAPHICS_OUTPUT_PROTOCOL* gop = NULL;
     ASSERT_EFI_ERROR(gBS->LocateProtocol(&gEfiGraphicsOutputProtocolGuid, NULL, (VOID**)&gop));
     ASSERT_EFI_ERROR(gop->SetMode(gop, (UINT32) config.GfxMode));
+    return gop;
+}
 
-    // get the header and decide on higher half
-    BOOLEAN HigherHalf = FALSE;
-    CHECK_AND_RETHROW(LoadStivaleHeader(Entry->Fs, Entry->Path, &Header, &HigherHalf));
-    if (HigherHalf) {
-        Elf.VirtualOffset = 0xffffffff80000000;
-    }
-
-    // TODO: iterate the header tags
-    //          - assert on non-framebuffer
-    //          - warn on kaslr
-    //          - warn on smp boot
+/**
+ * Build the struct for a kernel that is already loaded and jump to it, the
+ * modules of the entry that are not loaded yet are loaded here
+ */
+static EFI_STATUS BootKernel(BOOT_ENTRY* Entry, EFI_GRAPHICS_OUTPUT_PROTOCOL* gop, STIVALE2_HEADER* Header, ELF_INFO* Elf, MODULE_PLACEMENT* Placement) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    BOOLEAN Level5Supported = FALSE;
 
     UINT32 eax, ebx, ecx, edx;
     AsmCpuidEx(0x00000007, 0, &eax, &ebx, &ecx, &edx);
@@ -145,28 +173,37 @@ EFI_STATUS LoadStivale2Kernel(BOOT_ENTRY* Entry) {
         Level5Supported = TRUE;
     }
 
-    // fully-load the kernel
-    CHECK_AND_RETHROW(LoadElf64(Entry->Fs, Entry->Path, &Elf));
-    if (Header.EntryPoint != 0) {
-        Elf.Entry = Header.EntryPoint;
+    // iterate the header tags, now that the kernel is loaded we can access them directly
+    // TODO: assert on non-framebuffer
+    STIVALE2_HEADER_TAG_SMP* SmpHeaderTag = NULL;
+    for (STIVALE2_HDR_TAG* Tag = KernelToPhysical(Elf, Header->Tags); Tag != NULL; Tag = KernelToPhysical(Elf, Tag->Next)) {
+        switch (Tag->Identifier) {
+            case STIVALE2_HEADER_TAG_SMP_IDENT:
+                SmpHeaderTag = (STIVALE2_HEADER_TAG_SMP*)Tag;
+                break;
+
+            default:
+                break;
+        }
     }
 
-    // setup the struct
-    STIVALE2_STRUCT* Struct = AllocateZeroPool(sizeof(STIVALE2_STRUCT));
+    // setup the struct, it and all the tags are in the boot info arena
+    CHECK_AND_RETHROW(BootInfoInit());
+    STIVALE2_STRUCT* Struct = BootInfoAllocate(sizeof(STIVALE2_STRUCT));
     AsciiStrnCpy(Struct->BootloaderBrand, "TomatBoot-UEFI", sizeof(Struct->BootloaderBrand));
     AsciiStrnCpy(Struct->BootloaderVersion, "git rev-parse HEAD", sizeof(Struct->BootloaderVersion));
 
     // cmdline
-    Print(L"Setting cmdline\n");
-    STIVALE2_STRUCT_TAG_CMDLINE* Cmdline = AllocateZeroPool(sizeof(STIVALE2_STRUCT_TAG_CMDLINE));
+    LOG_DEBUG("Setting cmdline\n");
+    STIVALE2_STRUCT_TAG_CMDLINE* Cmdline = BootInfoAllocate(sizeof(STIVALE2_STRUCT_TAG_CMDLINE));
     Cmdline->Identifier = STIVALE2_STRUCT_TAG_CMDLINE_IDENT;
-    Cmdline->Cmdline = AllocateReservedPool(StrLen(Entry->Cmdline) + 1);
+    Cmdline->Cmdline = BootInfoAllocate(StrLen(Entry->Cmdline) + 1);
     UnicodeStrToAsciiStr(Entry->Cmdline, (CHAR8*)Cmdline->Cmdline);
     Struct->Tags = Cmdline;
 
     // graphics info
-    Print(L"Setting framebuffer info\n");
-    STIVALE2_STRUCT_TAG_FRAMEBUFFER* Framebuffer = AllocateZeroPool(sizeof(STIVALE2_STRUCT_TAG_FRAMEBUFFER));
+    LOG_DEBUG("Setting framebuffer info\n");
+    STIVALE2_STRUCT_TAG_FRAMEBUFFER* Framebuffer = BootInfoAllocate(sizeof(STIVALE2_STRUCT_TAG_FRAMEBUFFER));
     Framebuffer->Identifier = STIVALE2_STRUCT_TAG_FRAMEBUFFER_IDENT;
     Framebuffer->FramebufferAddr = gop->Mode->FrameBufferBase;
     Framebuffer->FramebufferWidth = gop->Mode->Info->HorizontalResolution;
@@ -179,30 +216,30 @@ EFI_STATUS LoadStivale2Kernel(BOOT_ENTRY* Entry) {
     void** Next = &Framebuffer->Next;
     void* AcpiTable = NULL;
     if (!EFI_ERROR(EfiGetSystemConfigurationTable(&gEfiAcpi20TableGuid, &AcpiTable))) {
-        STIVALE2_STRUCT_TAG_RSDP* Rsdp = AllocateZeroPool(sizeof(STIVALE2_STRUCT_TAG_RSDP));
+        STIVALE2_STRUCT_TAG_RSDP* Rsdp = BootInfoAllocate(sizeof(STIVALE2_STRUCT_TAG_RSDP));
         EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER* ActualRsdp = AcpiTable;
         Rsdp->Identifier = STIVALE2_STRUCT_TAG_RSDP_IDENT;
-        Rsdp->Rsdp = AllocateReservedCopyPool(ActualRsdp->Length, ActualRsdp);
+        Rsdp->Rsdp = BootInfoCopy(ActualRsdp->Length, ActualRsdp);
         *Next = Rsdp;
         Next = &Rsdp->Next;
     } else if (!EFI_ERROR(EfiGetSystemConfigurationTable(&gEfiAcpi10TableGuid, &AcpiTable))) {
-        STIVALE2_STRUCT_TAG_RSDP* Rsdp = AllocateZeroPool(sizeof(STIVALE2_STRUCT_TAG_RSDP));
+        STIVALE2_STRUCT_TAG_RSDP* Rsdp = BootInfoAllocate(sizeof(STIVALE2_STRUCT_TAG_RSDP));
         Rsdp->Identifier = STIVALE2_STRUCT_TAG_RSDP_IDENT;
-        Rsdp->Rsdp = AllocateReservedCopyPool(sizeof(EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_POINTER), AcpiTable);
+        Rsdp->Rsdp = BootInfoCopy(sizeof(EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_POINTER), AcpiTable);
         *Next = Rsdp;
         Next = &Rsdp->Next;
     } else {
-        Print(L"No ACPI table found\n");
+        LOG_WARN("No ACPI table found\n");
     }
 
-    Print(L"Setting firmware\n");
-    STIVALE2_STRUCT_TAG_FIRMWARE* Firmware = AllocateZeroPool(sizeof(STIVALE2_STRUCT_TAG_FIRMWARE));
+    LOG_DEBUG("Setting firmware\n");
+    STIVALE2_STRUCT_TAG_FIRMWARE* Firmware = BootInfoAllocate(sizeof(STIVALE2_STRUCT_TAG_FIRMWARE));
     Firmware->Identifier = STIVALE2_STRUCT_TAG_FIRMWARE_IDENT;
     Firmware->Flags = STIVALE2_STRUCT_TAG_FIRMWARE_FLAG_UEFI;
     *Next = Firmware;
 
-    Print(L"Setting epoch\n");
-    STIVALE2_STRUCT_TAG_EPOCH* Epoch = AllocateZeroPool(sizeof(STIVALE2_STRUCT_TAG_EPOCH));
+    LOG_DEBUG("Setting epoch\n");
+    STIVALE2_STRUCT_TAG_EPOCH* Epoch = BootInfoAllocate(sizeof(STIVALE2_STRUCT_TAG_EPOCH));
     Epoch->Identifier = STIVALE2_STRUCT_TAG_EPOCH_IDENT;
     EFI_TIME Time = { 0 };
     EFI_CHECK(gRT->GetTime(&Time, NULL));
@@ -210,18 +247,46 @@ EFI_STATUS LoadStivale2Kernel(BOOT_ENTRY* Entry) {
     Firmware->Next = Epoch;
     Next = &Epoch->Next;
 
+    LOG_DEBUG("Setting TSC frequency\n");
+    STIVALE2_STRUCT_TAG_TSC* Tsc = BootInfoAllocate(sizeof(STIVALE2_STRUCT_TAG_TSC));
+    Tsc->Identifier = STIVALE2_STRUCT_TAG_TSC_IDENT;
+    UINT32 TscFlags = 0;
+    Tsc->Frequency = GetTscFrequency(&TscFlags);
+    Tsc->Flags = TscFlags;
+    *Next = Tsc;
+    Next = &Tsc->Next;
+
+    // the digests of the files that were checked, the modules are added as they are loaded
+    UINTN DigestCount = Entry->Sha256 != NULL ? 1 : 0;
+    for (LIST_ENTRY* Link = GetFirstNode(&Entry->BootModules); Link != &Entry->BootModules; Link = Link->ForwardLink) {
+        if (BASE_CR(Link, BOOT_MODULE, Link)->Sha256 != NULL) {
+            DigestCount++;
+        }
+    }
+
+    STIVALE2_STRUCT_TAG_SHA256* Digests = NULL;
+    if (DigestCount != 0) {
+        Digests = BootInfoAllocate(sizeof(STIVALE2_STRUCT_TAG_SHA256) + sizeof(STIVALE2_SHA256) * DigestCount);
+        CHECK(Digests != NULL);
+        Digests->Identifier = STIVALE2_STRUCT_TAG_SHA256_IDENT;
+        if (Entry->Sha256 != NULL) {
+            CopyMem(Digests->Digests[Digests->Count++].Digest, Entry->Sha256, SHA256_DIGEST_SIZE);
+        }
+    }
+
     // push the modules
     if (!IsListEmpty(&Entry->BootModules)) {
-        Print(L"Loading modules\n");
+        LOG_DEBUG("Loading modules\n");
         UINTN ModulesCount = 0;
         for (LIST_ENTRY* Link = GetFirstNode(&Entry->BootModules); Link != &Entry->BootModules; Link = Link->ForwardLink) {
             ModulesCount++;
         }
 
-        STIVALE2_STRUCT_TAG_MODULES* Modules = AllocateZeroPool(sizeof(STIVALE2_STRUCT_TAG_MODULES) + sizeof(STIVALE2_MODULE) * ModulesCount);
+        STIVALE2_STRUCT_TAG_MODULES* Modules = BootInfoAllocate(sizeof(STIVALE2_STRUCT_TAG_MODULES) + sizeof(STIVALE2_MODULE) * ModulesCount);
+        CHECK(Modules != NULL);
         Modules->Identifier = STIVALE2_STRUCT_TAG_MODULES_IDENT;
         Modules->ModuleCount = ModulesCount;
-        Epoch->Next = Modules;
+        *Next = Modules;
         Next = &Modules->Next;
 
         UINTN Index = 0;
@@ -229,19 +294,87 @@ EFI_STATUS LoadStivale2Kernel(BOOT_ENTRY* Entry) {
             BOOT_MODULE* Module = BASE_CR(Link, BOOT_MODULE, Link);
             UINTN Start = 0;
             UINTN Size = 0;
-            CHECK_AND_RETHROW(LoadBootModule(Module, &Start, &Size));
+            CHECK_AND_RETHROW(LoadBootModule(Module, Placement, &Start, &Size));
 
             STIVALE2_MODULE* NewModule = &Modules->Modules[Index];
             NewModule->Begin = Start;
             NewModule->End = Start + Size;
             UnicodeStrToAsciiStrS(Module->Tag, NewModule->String, sizeof(NewModule->String));
-            Print(L"    Added %s (%s) -> %p - %p\n", Module->Tag, Module->Path, Start, Start + Size);
+            LOG_INFO("    Added %s (%s) -> %p - %p\n", Module->Tag, Module->Path, Start, Start + Size);
+
+            if (Module->Sha256 != NULL) {
+                STIVALE2_SHA256* Digest = &Digests->Digests[Digests->Count++];
+                Digest->Begin = Start;
+                Digest->End = Start + Size;
+                CopyMem(Digest->Digest, Module->Sha256, SHA256_DIGEST_SIZE);
+            }
         }
     }
 
+    if (Digests != NULL) {
+        LOG_DEBUG("Setting digests\n");
+        *Next = Digests;
+        Next = &Digests->Next;
+    }
+
+    // everything is loaded, so the log is complete
+    UINTN MeasureLogSize = 0;
+    void* MeasureLog = GetMeasureLog(&MeasureLogSize);
+    if (MeasureLog != NULL) {
+        LOG_DEBUG("Setting measurement log\n");
+        STIVALE2_STRUCT_TAG_MEASURE_LOG* Log = BootInfoAllocate(sizeof(STIVALE2_STRUCT_TAG_MEASURE_LOG));
+        CHECK(Log != NULL);
+        Log->Identifier = STIVALE2_STRUCT_TAG_MEASURE_LOG_IDENT;
+        Log->Log = (UINT64)BootInfoCopy(MeasureLogSize, MeasureLog);
+        CHECK(Log->Log != 0);
+        Log->Size = MeasureLogSize;
+        *Next = Log;
+        Next = &Log->Next;
+    }
+
+    // bring up the APs if requested
+    if (SmpHeaderTag != NULL) {
+        LOG_DEBUG("Setting up SMP\n");
+        BOOLEAN X2Apic = (SmpHeaderTag->Flags & STIVALE2_HEADER_TAG_SMP_FLAG_X2APIC) && IsX2ApicSupported();
+        UINT32* ApicIds = NULL;
+        UINTN CpuCount = 0;
+        CHECK_AND_RETHROW(GetProcessorApicIds(&ApicIds, &CpuCount));
+
+        STIVALE2_STRUCT_TAG_SMP* Smp = BootInfoAllocate(sizeof(STIVALE2_STRUCT_TAG_SMP) + sizeof(STIVALE2_SMP_INFO) * CpuCount);
+        CHECK(Smp != NULL);
+        Smp->Identifier = STIVALE2_STRUCT_TAG_SMP_IDENT;
+        Smp->Flags = X2Apic ? STIVALE2_STRUCT_TAG_SMP_FLAG_X2APIC : 0;
+        Smp->BspLapicId = ApicIds[0];
+        for (UINTN i = 0; i < CpuCount; i++) {
+            // can't send IPIs to these without x2apic
+            if (!X2Apic && ApicIds[i] >= 0xFF) {
+                continue;
+            }
+
+            STIVALE2_SMP_INFO* Info = &Smp->SmpInfo[Smp->CpuCount++];
+            Info->ProcessorId = i;
+            Info->LapicId = ApicIds[i];
+        }
+        FreePool(ApicIds);
+        *Next = Smp;
+        Next = &Smp->Next;
+
+        // the APs will park on their own entry
+        SMP_PARK_INFO ParkInfo = {
+            .InfoArray = Smp->SmpInfo,
+            .InfoStride = sizeof(STIVALE2_SMP_INFO),
+            .InfoCount = Smp->CpuCount,
+            .ApicIdOffset = OFFSET_OF(STIVALE2_SMP_INFO, LapicId),
+            .GotoAddressOffset = OFFSET_OF(STIVALE2_SMP_INFO, GotoAddress),
+            .TargetStackOffset = OFFSET_OF(STIVALE2_SMP_INFO, TargetStack),
+        };
+        CHECK_AND_RETHROW(PrepareApTrampoline(&ParkInfo, X2Apic));
+        LOG_DEBUG("    %d processors, x2apic %a\n", Smp->CpuCount, X2Apic ? "enabled" : "disabled");
+    }
+
     // setup the page table correctly
     // first disable write protection so we can modify the table
-    Print(L"Preparing higher half\n");
+    LOG_DEBUG("Preparing higher half\n");
     IA32_CR0 Cr0 = { .UintN = AsmReadCr0() };
     Cr0.Bits.WP = 0;
     AsmWriteCr0(Cr0.UintN);
@@ -255,7 +388,7 @@ EFI_STATUS LoadStivale2Kernel(BOOT_ENTRY* Entry) {
     // allocate pml3 for 0xffffffff80000000
     UINT64* Pml3High = AllocatePages(1);
     SetMem(Pml3High, EFI_PAGE_SIZE, 0);
-    Print(L"Allocated page %p\n", Pml3High);
+    LOG_DEBUG("Allocated page %p\n", Pml3High);
     Pml4[511] = ((UINT64)Pml3High) | 0x3u;
 
     // map first 2 pages to 0xffffffff80000000
@@ -263,7 +396,19 @@ EFI_STATUS LoadStivale2Kernel(BOOT_ENTRY* Entry) {
     Pml3High[510] = Pml3Low[0];
     Pml3High[511] = Pml3Low[1];
 
-    Print(L"Getting memory map\n");
+    LOG_DEBUG("Getting memory map\n");
+
+    // the log ends here, anything after is only written out on failure
+    STIVALE2_STRUCT_TAG_LOG* Log = BootInfoAllocate(sizeof(STIVALE2_STRUCT_TAG_LOG));
+    CHECK(Log != NULL);
+    Log->Identifier = STIVALE2_STRUCT_TAG_LOG_IDENT;
+    Log->Size = LogSize();
+    Log->Log = (UINT64)BootInfoAllocate(Log->Size);
+    CHECK(Log->Log != 0);
+    LogCopy((CHAR8*)Log->Log);
+    *Next = Log;
+    Next = &Log->Next;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
     // No prints from here
     ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -282,11 +427,16 @@ EFI_STATUS LoadStivale2Kernel(BOOT_ENTRY* Entry) {
     EFI_MEMORY_DESCRIPTOR* MemoryMap = AllocatePool(MemoryMapSize);
 
     // allocate all the space we will need (hopefully)
-    STIVALE2_STRUCT_TAG_MEMMAP* Memmap = AllocateZeroPool(sizeof(STIVALE2_STRUCT_TAG_MEMMAP) + (MemoryMapSize / DescriptorSize) * sizeof(STIVALE2_MMAP_ENTRY));
+    STIVALE2_STRUCT_TAG_MEMMAP* Memmap = BootInfoAllocate(sizeof(STIVALE2_STRUCT_TAG_MEMMAP) + (MemoryMapSize / DescriptorSize) * sizeof(STIVALE2_MMAP_ENTRY));
+    CHECK(Memmap != NULL);
     Memmap->Identifier = STIVALE2_STRUCT_TAG_MEMMAP_IDENT;
     STIVALE2_MMAP_ENTRY* StartFrom = Memmap->Memmap;
     *Next = Memmap;
 
+    // that was the last tag, and nothing is read from the disk anymore
+    BootInfoTrim();
+    FileCloseCached();
+
     // call it
     EFI_CHECK(gBS->GetMemoryMap(&MemoryMapSize, MemoryMap, &MapKey, &DescriptorSize, &DescriptorVersion));
     UINTN EntryCount = (MemoryMapSize / DescriptorSize);
@@ -300,7 +450,7 @@ EFI_STATUS LoadStivale2Kernel(BOOT_ENTRY* Entry) {
     UINTN LastEnd = 0xFFFFFFFFFFFF;
     for (int i = 0; i < EntryCount; i++) {
         EFI_MEMORY_DESCRIPTOR* Desc = (EFI_MEMORY_DESCRIPTOR*)((UINTN)MemoryMap + DescriptorSize * i);
-        int Type = EfiTypeToStivaleType[Desc->Type];
+        int Type = GetStivaleType(Desc->Type);
 
         if (LastType == Type && LastEnd == Desc->PhysicalStart) {
             StartFrom[-1].Length += EFI_PAGES_TO_SIZE(Desc->NumberOfPages);
@@ -320,8 +470,76 @@ EFI_STATUS LoadStivale2Kernel(BOOT_ENTRY* Entry) {
     // no interrupts
     DisableInterrupts();
 
+    // the APs take the page table as is, so do this last
+    if (SmpHeaderTag != NULL) {
+        StartAllAps();
+    }
+
     // TODO: pml5
-    JumpToStivale2Kernel(Struct, Header.Stack, (void*)Elf.Entry, FALSE && Level5Supported);
+    JumpToStivale2Kernel(Struct, Header->Stack, (void*)Elf->Entry, FALSE && Level5Supported);
+
+cleanup:
+    return Status;
+}
+
+EFI_STATUS LoadStivale2Kernel(BOOT_ENTRY* Entry) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    STIVALE2_HEADER Header = {0};
+    ELF_INFO Elf = {0};
+    MODULE_PLACEMENT Placement = mModulePlacement;
+
+    // set graphics mode right away
+    EFI_GRAPHICS_OUTPUT_PROTOCOL* gop = SetGraphicsMode();
+
+    // get the header and decide on higher half
+    BOOLEAN HigherHalf = FALSE;
+    UINT64 HeaderAddress = 0;
+    CHECK_AND_RETHROW(LoadStivaleHeader(Entry->Fs, Entry->Path, Entry->Sha256, &Header, &HeaderAddress, &HigherHalf));
+    if (HigherHalf) {
+        Elf.VirtualOffset = 0xffffffff80000000;
+    }
+
+    // randomize the kernel location if it allows it
+    if (Header.Flags & STIVALE2_HEADER_FLAG_KASLR) {
+        Elf.Kaslr = TRUE;
+    }
+
+    // fully-load the kernel
+    Elf.Sha256 = Entry->Sha256;
+    CHECK_AND_RETHROW(LoadElf64(Entry->Fs, Entry->Path, &Elf));
+
+    // the header got relocated with the kernel, take the final values
+    if (Elf.Relocatable && HeaderAddress != 0) {
+        CopyMem(&Header, KernelToPhysical(&Elf, (void*)(HeaderAddress + Elf.Slide)), sizeof(Header));
+    }
+
+    if (Header.EntryPoint != 0) {
+        Elf.Entry = Header.EntryPoint;
+    }
+
+    CHECK_AND_RETHROW(BootKernel(Entry, gop, &Header, &Elf, &Placement));
+
+cleanup:
+    return Status;
+}
+
+EFI_STATUS LoadStivale2Bundle(BOOT_ENTRY* Entry, BUNDLE* Bundle) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    STIVALE2_HEADER Header = {0};
+    ELF_INFO Elf = {0};
+    MODULE_PLACEMENT Placement = mModulePlacement;
+
+    EFI_GRAPHICS_OUTPUT_PROTOCOL* gop = SetGraphicsMode();
+
+    // the builder already took the header from the kernel and decided on
+    // the higher half, the kernel is loaded where it was linked to
+    CHECK_TRACE(Bundle->Header->ProtocolHeaderSize == sizeof(Header), "Invalid stivale2 header in bundle");
+    CopyMem(&Header, Bundle->ProtocolHeader, sizeof(Header));
+    Elf.VirtualOffset = Bundle->Header->VirtualOffset;
+    Elf.Entry = Bundle->Header->Entry;
+
+    CHECK_AND_RETHROW(BundleLoad(Entry, Bundle, &Placement));
+    CHECK_AND_RETHROW(BootKernel(Entry, gop, &Header, &Elf, &Placement));
 
 cleanup:
     return Status;
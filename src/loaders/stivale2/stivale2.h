@@ -119,7 +119,71 @@ typedef struct _STIVALE2_STRUCT_TAG_FIRMWARE {
 #define STIVALE2_STRUCT_TAG_FIRMWARE_FLAG_UEFI BIT0
 } STIVALE2_STRUCT_TAG_FIRMWARE;
 
-// TODO: Smp
+typedef struct _STIVALE2_SMP_INFO {
+    UINT32 ProcessorId;
+    UINT32 LapicId;
+    UINT64 TargetStack;
+    UINT64 GotoAddress;
+    UINT64 ExtraArgument;
+} STIVALE2_SMP_INFO;
+
+#define STIVALE2_STRUCT_TAG_SMP_IDENT 0x34d1d96339647025
+typedef struct _STIVALE2_STRUCT_TAG_SMP {
+    UINT64 Identifier;
+    void* Next;
+    UINT64 Flags;
+#define STIVALE2_STRUCT_TAG_SMP_FLAG_X2APIC BIT0
+    UINT32 BspLapicId;
+    UINT32 Unused;
+    UINT64 CpuCount;
+    STIVALE2_SMP_INFO SmpInfo[];
+} STIVALE2_STRUCT_TAG_SMP;
+
+// TomatBoot extension, the digests of the files that were checked against a
+// SHA256 from the config. Begin and End are the module, or zero for the kernel.
+typedef struct _STIVALE2_SHA256 {
+    UINT64 Begin;
+    UINT64 End;
+    UINT8 Digest[32];
+} STIVALE2_SHA256;
+
+#define STIVALE2_STRUCT_TAG_SHA256_IDENT 0x8d1e6a0c4f2b7359
+typedef struct _STIVALE2_STRUCT_TAG_SHA256 {
+    UINT64 Identifier;
+    void* Next;
+    UINT64 Count;
+    STIVALE2_SHA256 Digests[];
+} STIVALE2_STRUCT_TAG_SHA256;
+
+// TomatBoot extension, the measured boot log, a list of MEASURE_EVENT
+// entries (see util/MeasureUtils.h) with everything the loader measured
+#define STIVALE2_STRUCT_TAG_MEASURE_LOG_IDENT 0x2b9e43d17f0a6c58
+typedef struct _STIVALE2_STRUCT_TAG_MEASURE_LOG {
+    UINT64 Identifier;
+    void* Next;
+    UINT64 Log;
+    UINT64 Size;
+} STIVALE2_STRUCT_TAG_MEASURE_LOG;
+
+// TomatBoot extension, the boot log as text (see util/LogUtils.h),
+// everything logged up to getting the memory map
+#define STIVALE2_STRUCT_TAG_LOG_IDENT 0x7c3a9e5d2f81b046
+typedef struct _STIVALE2_STRUCT_TAG_LOG {
+    UINT64 Identifier;
+    void* Next;
+    UINT64 Log;
+    UINT64 Size;
+} STIVALE2_STRUCT_TAG_LOG;
+
+// TomatBoot extension, the TSC frequency in Hz so the kernel does not have
+// to calibrate it, Flags are the TSC_FLAG_* from util/TscUtils.h
+#define STIVALE2_STRUCT_TAG_TSC_IDENT 0x5e17a0c2b94d638f
+typedef struct _STIVALE2_STRUCT_TAG_TSC {
+    UINT64 Identifier;
+    void* Next;
+    UINT64 Frequency;
+    UINT64 Flags;
+} STIVALE2_STRUCT_TAG_TSC;
 
 #pragma pack()
 
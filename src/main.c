@@ -7,7 +7,11 @@
 #include <Library/UefiRuntimeServicesTableLib.h>
 #include <config/BootEntries.h>
 #include <util/Except.h>
+#include <util/LogUtils.h>
+#include <util/ProfileUtils.h>
+#include <util/fs/Ext4FileSystem.h>
 #include <config/BootConfig.h>
+#include <loaders/Loaders.h>
 #include <menus/Menus.h>
 
 // define all constructors
@@ -21,6 +25,9 @@ extern EFI_STATUS EFIAPI UefiRuntimeServicesTableLibConstructor (IN EFI_HANDLE I
 EFI_STATUS EFIAPI EfiMain(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE *SystemTable) {
     EFI_STATUS Status = EFI_SUCCESS;
 
+    // before anything else, so it can be compared with the kernel entry
+    gLoaderStartTsc = AsmReadTsc();
+
     // Call constructors
     EFI_CHECK(DxeDebugLibConstructor(ImageHandle, SystemTable));
     EFI_CHECK(UefiBootServicesTableLibConstructor(ImageHandle, SystemTable));
@@ -31,12 +38,14 @@ EFI_STATUS EFIAPI EfiMain(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE *System
     CHECK(gBS != NULL);
     CHECK(gRT != NULL);
 
+    // does nothing unless this is a profiling build
+    ProfileInit();
+
     // disable the watchdog timer
     EFI_CHECK(gST->BootServices->SetWatchdogTimer(0, 0, 0, NULL));
 
-    // just a signature that we booted
-    EFI_CHECK(gST->ConOut->ClearScreen(gST->ConOut));
-    Print(L"Hello World!\n\n\n");
+    // linux /boot partitions look like any other volume from here on
+    CHECK_AND_RETHROW(Ext4MountVolumes());
 
     // Load the boot configs and set the default one
     BOOT_CONFIG config;
@@ -44,8 +53,23 @@ EFI_STATUS EFIAPI EfiMain(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE *System
     CHECK_AND_RETHROW(GetBootEntries(&gBootEntries));
     gDefaultEntry = GetBootEntryAt(config.DefaultOS);
 
+    // with no timeout boot right away, without touching the screen, a held
+    // key (or failing to boot) shows the menu instead, without a countdown
+    BOOLEAN AutoBoot = TRUE;
+    if (GetBootDelay(&config) == 0) {
+        EFI_INPUT_KEY Key;
+        if (gST->ConIn->ReadKeyStroke(gST->ConIn, &Key) == EFI_NOT_READY) {
+            LoadKernel(gDefaultEntry);
+        }
+        AutoBoot = FALSE;
+    }
+
+    // just a signature that we booted
+    EFI_CHECK(gST->ConOut->ClearScreen(gST->ConOut));
+    LOG_INFO("Hello World!\n\n\n");
+
     // we are ready to do shit :yay:
-    StartMenus();
+    StartMenus(AutoBoot);
 
 cleanup:
     if (EFI_ERROR(Status)) {
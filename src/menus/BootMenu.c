@@ -27,6 +27,7 @@ static const char* loader_names[] = {
         [BOOT_MB2] = "MultiBoot2",
         [BOOT_STIVALE] = "Stivale",
         [BOOT_STIVALE2] = "Stivale2",
+        [BOOT_BUNDLE] = "Bundle",
 };
 
 MENU EnterBootMenu() {
@@ -99,6 +100,9 @@ MENU EnterBootMenu() {
 
                 // choose an os to start
             }else {
+                // take the menu off the screen, the log goes there now
+                gST->ConOut->ClearScreen(gST->ConOut);
+                gST->ConOut->SetCursorPosition(gST->ConOut, 0, 0);
                 LoadKernel(selectedEntry);
                 while(1) CpuSleep();
             }
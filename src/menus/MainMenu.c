@@ -113,9 +113,15 @@ MENU EnterMainMenu(BOOLEAN first) {
     BOOT_CONFIG config;
     LoadBootConfig(&config);
 
+    // a timeout of zero was already handled by EfiMain, before drawing anything
+    const UINTN BOOT_DELAY = GetBootDelay(&config);
+    if(BOOT_DELAY == 0) {
+        first = FALSE;
+    }
+
     // create the timer event and counter
     const UINTN TIMER_INTERVAL = 250000 /* 1/40 sec */;
-    const UINTN INITIAL_TIMEOUT_COUNTER = ((gBootDelayOverride > 0 ? gBootDelayOverride : config.BootDelay) * 10000000) / TIMER_INTERVAL;
+    const UINTN INITIAL_TIMEOUT_COUNTER = (BOOT_DELAY * 10000000) / TIMER_INTERVAL;
     const UINTN BAR_WIDTH = 80;
 
     UINTN timeout_counter = INITIAL_TIMEOUT_COUNTER;
@@ -175,7 +181,9 @@ MENU EnterMainMenu(BOOLEAN first) {
                 // close the event
                 ASSERT_EFI_ERROR(gBS->CloseEvent(events[1]));
 
-                // call the loader
+                // take the menu off the screen and call the loader
+                gST->ConOut->ClearScreen(gST->ConOut);
+                gST->ConOut->SetCursorPosition(gST->ConOut, 0, 0);
                 LoadKernel(gDefaultEntry);
             } else {
                 // set bar color
@@ -6,9 +6,9 @@ MENU EnterMainMenu(BOOLEAN first);
 MENU EnterSetupMenu();
 MENU EnterBootMenu();
 
-void StartMenus() {
+void StartMenus(BOOLEAN AutoBoot) {
     MENU current_menu = MENU_MAIN_MENU;
-    BOOLEAN first = TRUE;
+    BOOLEAN first = AutoBoot;
 
     while(TRUE) {
         // choose the correct menu to display
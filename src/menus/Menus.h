@@ -10,6 +10,9 @@ typedef enum _MENU {
     MENU_SHUTDOWN,
 } MENU;
 
-void StartMenus();
+/**
+ * Show the menus, AutoBoot starts the countdown to boot the default entry
+ */
+void StartMenus(BOOLEAN AutoBoot);
 
 #endif //__MENUS_MENUS_H__
@@ -0,0 +1,14 @@
+#include "DebugconUtils.h"
+
+#include <Library/PrintLib.h>
+
+void DebugconPrint(CONST CHAR8* Format, ...) {
+    CHAR8 Buffer[256];
+    VA_LIST Marker;
+
+    VA_START(Marker, Format);
+    UINTN Length = AsciiVSPrint(Buffer, sizeof(Buffer), Format, Marker);
+    VA_END(Marker);
+
+    DebugconWrite(Buffer, Length);
+}
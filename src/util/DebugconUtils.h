@@ -0,0 +1,21 @@
+#ifndef __UTIL_DEBUGCONUTILS_H__
+#define __UTIL_DEBUGCONUTILS_H__
+
+#include <Uefi.h>
+
+// the bochs/qemu debug console
+#define DEBUGCON_PORT 0xE9
+
+/**
+ * Write a buffer to the debugcon port, this does not go through the
+ * firmware so it can be used at any point, even after ExitBootServices
+ */
+void DebugconWrite(CONST CHAR8* Buffer, UINTN Size);
+
+/**
+ * Format a string and write it to the debugcon port, the output
+ * is truncated to 256 characters
+ */
+void DebugconPrint(CONST CHAR8* Format, ...);
+
+#endif //__UTIL_DEBUGCONUTILS_H__
@@ -0,0 +1,50 @@
+#include "Except.h"
+
+#include <Library/BaseLib.h>
+
+static volatile BOOLEAN mApsRunning = FALSE;
+static UINT32 mBspApicId = 0;
+
+/**
+ * The initial apic id only has 8 bits, use the x2apic one when we have it
+ * so an AP can never be mistaken for the BSP
+ */
+static UINT32 GetApicId() {
+    UINT32 eax, ebx, edx;
+    AsmCpuid(0x00, &eax, NULL, NULL, NULL);
+    if (eax >= 0x0B) {
+        AsmCpuidEx(0x0B, 0, NULL, &ebx, NULL, &edx);
+        if (ebx != 0) {
+            return edx;
+        }
+    }
+    AsmCpuid(0x01, NULL, &ebx, NULL, NULL);
+    return ebx >> 24u;
+}
+
+BOOLEAN CanPrintErrors() {
+    return !mApsRunning || GetApicId() == mBspApicId;
+}
+
+void SetApsRunning(BOOLEAN Running) {
+    if (Running) {
+        mBspApicId = GetApicId();
+    }
+    mApsRunning = Running;
+}
+
+#ifdef TOMATBOOT_COMPACT_ERRORS
+
+void ExceptFail(EFI_STATUS Status, UINT32 Code) {
+    EXCEPT_PRINT("%r at %08x\n", Status, Code);
+}
+
+void ExceptRethrow(UINT32 Code) {
+    EXCEPT_PRINT("  rethrown at %08x\n", Code);
+}
+
+void ExceptWarn(UINT32 Code) {
+    EXCEPT_LOG(LOG_LEVEL_WARN, "Warning! at %08x\n", Code);
+}
+
+#endif
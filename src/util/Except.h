@@ -4,14 +4,91 @@
 #include <Uefi.h>
 #include <Library/UefiLib.h>
 
+#include "LogUtils.h"
+
+/**
+ * The console is not MP safe, while the APs are running our code (see
+ * SetApsRunning) only the BSP prints errors, the rest are only returned
+ */
+BOOLEAN CanPrintErrors();
+
+/**
+ * Set when the APs start or stop running our code, must be called on the BSP
+ */
+void SetApsRunning(BOOLEAN Running);
+
+#define EXCEPT_LOG(level, fmt, ...) \
+    do { \
+        if (CanPrintErrors()) { \
+            LogPrint(level, fmt, ## __VA_ARGS__); \
+        } \
+    } while(0)
+
+#define EXCEPT_PRINT(fmt, ...) EXCEPT_LOG(LOG_LEVEL_ERROR, fmt, ## __VA_ARGS__)
+
+#ifdef TOMATBOOT_COMPACT_ERRORS
+
+/*
+ * COMPACT_ERRORS=1 leaves the function names, paths and messages out of
+ * the image, every error site is only reported by a code, the id of the
+ * file in bin/errors.txt in the upper 16 bits and the line in the lower.
+ */
+
+// set for every file by the Makefile
+#ifndef TOMATBOOT_FILE_ID
+    #define TOMATBOOT_FILE_ID 0
+#endif
+
+#define EXCEPT_CODE (((UINT32)TOMATBOOT_FILE_ID << 16u) | __LINE__)
+
+void ExceptFail(EFI_STATUS Status, UINT32 Code);
+void ExceptRethrow(UINT32 Code);
+void ExceptWarn(UINT32 Code);
+
+// the message is still type checked, but never part of the image
+#define EXCEPT_UNUSED(fmt, ...) \
+    do { \
+        if (0) { \
+            LogPrint(LOG_LEVEL_ERROR, fmt, ## __VA_ARGS__); \
+        } \
+    } while(0)
+
+#define EXCEPT_TRACE_FAIL(fmt, ...) \
+    do { \
+        ExceptFail(Status, EXCEPT_CODE); \
+        EXCEPT_UNUSED(fmt, ## __VA_ARGS__); \
+    } while(0)
+
+#define EXCEPT_TRACE_RETHROW() ExceptRethrow(EXCEPT_CODE)
+
+#define EXCEPT_TRACE_WARN(fmt, ...) \
+    do { \
+        ExceptWarn(EXCEPT_CODE); \
+        EXCEPT_UNUSED(fmt, ## __VA_ARGS__); \
+    } while(0)
+
+#else
+
+#define EXCEPT_TRACE_FAIL(fmt, ...) \
+    do { \
+        EXCEPT_PRINT("%r at %a (%a:%d)\n", Status, __func__, __FILE__, __LINE__); \
+        if (fmt[0] != '\0') { \
+            EXCEPT_PRINT(fmt "\n", ## __VA_ARGS__); \
+        } \
+    } while(0)
+
+#define EXCEPT_TRACE_RETHROW() EXCEPT_PRINT("  rethrown at %a (%a:%d)\n", __func__, __FILE__, __LINE__)
+
+#define EXCEPT_TRACE_WARN(fmt, ...) \
+    EXCEPT_LOG(LOG_LEVEL_WARN, "Warning! " fmt " at (%a:%d) \n", ## __VA_ARGS__ , __func__, __FILE__, __LINE__)
+
+#endif
+
 #define CHECK_ERROR_LABEL_TRACE(expr, error, label, fmt, ...) \
     do { \
         if (!(expr)) { \
             Status = error; \
-            AsciiPrint("%r at %a (%a:%d)\n", Status, __func__, __FILE__, __LINE__); \
-            if (fmt[0] != '\0') { \
-                AsciiPrint(fmt "\n", ## __VA_ARGS__); \
-            } \
+            EXCEPT_TRACE_FAIL(fmt, ## __VA_ARGS__); \
             goto label; \
         } \
     } while(0)
@@ -28,7 +105,7 @@
     do { \
         Status = status; \
         if (EFI_ERROR(Status)) { \
-            AsciiPrint("%r at %a (%a:%d)\n", Status, __func__, __FILE__, __LINE__); \
+            EXCEPT_TRACE_FAIL(""); \
             goto cleanup; \
         } \
     } while(0)
@@ -37,7 +114,7 @@
     do { \
         Status = error; \
         if (EFI_ERROR(Status)) { \
-            AsciiPrint("  rethrown at %a (%a:%d)\n", __func__, __FILE__, __LINE__); \
+            EXCEPT_TRACE_RETHROW(); \
             goto label; \
         } \
     } while(0)
@@ -47,7 +124,7 @@
 #define WARN(expr, fmt, ...) \
     do { \
         if (!(expr)) { \
-            AsciiPrint("Warning! " fmt " at (%a:%d) \n", ## __VA_ARGS__ , __func__, __FILE__, __LINE__); \
+            EXCEPT_TRACE_WARN(fmt, ## __VA_ARGS__); \
         } \
     } while(0)
 
@@ -1,10 +1,32 @@
 #include "FileUtils.h"
 
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
 #include <Library/FileHandleLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
 
 #include "Except.h"
+#include "fs/BlockRead.h"
 
-static EFI_STATUS FileRead(EFI_FILE_HANDLE Handle, void* Buffer, UINTN Size, UINTN Offset) {
+// how much is read at a time when hashing
+#define HASH_CHUNK_SIZE SIZE_4MB
+
+// how many directories are kept open by FileOpenCached
+#define DIRECTORY_CACHE_SIZE 8
+
+typedef struct _CACHED_DIRECTORY {
+    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs;
+    CHAR16* Path;
+    EFI_FILE_PROTOCOL* Handle;
+} CACHED_DIRECTORY;
+
+static CACHED_DIRECTORY mDirectoryCache[DIRECTORY_CACHE_SIZE];
+
+// the next entry to replace once the cache is full
+static UINTN mDirectoryCacheNext = 0;
+
+EFI_STATUS FileRead(EFI_FILE_HANDLE Handle, void* Buffer, UINTN Size, UINTN Offset) {
     EFI_STATUS Status = EFI_SUCCESS;
     UINTN ReadSize = Size;
 
@@ -15,3 +37,198 @@ static EFI_STATUS FileRead(EFI_FILE_HANDLE Handle, void* Buffer, UINTN Size, UIN
 cleanup:
     return Status;
 }
+
+EFI_STATUS FileReadAsync(EFI_FILE_HANDLE Handle, void* Buffer, UINTN Size, UINTN Offset, FILE_ASYNC_READ* Read) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    CHECK(Read != NULL);
+    CHECK(!Read->Pending);
+    ZeroMem(Read, sizeof(*Read));
+    Read->Size = Size;
+
+    // try to queue it, anything that goes wrong just
+    // means we should do it the normal way
+    if (Handle->Revision >= EFI_FILE_PROTOCOL_REVISION2 && Size != 0) {
+        if (!EFI_ERROR(gBS->CreateEvent(0, TPL_CALLBACK, NULL, NULL, &Read->Token.Event))) {
+            Read->Token.Buffer = Buffer;
+            Read->Token.BufferSize = Size;
+            if (!EFI_ERROR(FileHandleSetPosition(Handle, Offset)) && !EFI_ERROR(Handle->ReadEx(Handle, &Read->Token))) {
+                Read->Pending = TRUE;
+                goto cleanup;
+            }
+            gBS->CloseEvent(Read->Token.Event);
+            Read->Token.Event = NULL;
+        }
+    }
+
+    CHECK_AND_RETHROW(FileRead(Handle, Buffer, Size, Offset));
+
+cleanup:
+    return Status;
+}
+
+BOOLEAN FileReadPoll(FILE_ASYNC_READ* Read) {
+    // checking clears the event, so remember it
+    if (Read->Pending && !Read->Signaled) {
+        Read->Signaled = !EFI_ERROR(gBS->CheckEvent(Read->Token.Event));
+    }
+    return !Read->Pending || Read->Signaled;
+}
+
+EFI_STATUS FileReadWait(FILE_ASYNC_READ* Read) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINTN Index = 0;
+
+    CHECK(Read != NULL);
+    if (!Read->Pending) {
+        goto cleanup;
+    }
+
+    Read->Pending = FALSE;
+    if (!Read->Signaled) {
+        EFI_CHECK(gBS->WaitForEvent(1, &Read->Token.Event, &Index));
+    }
+    EFI_CHECK(Read->Token.Status);
+    CHECK(Read->Token.BufferSize == Read->Size);
+
+cleanup:
+    if (Read != NULL && Read->Token.Event != NULL) {
+        gBS->CloseEvent(Read->Token.Event);
+        Read->Token.Event = NULL;
+    }
+
+    return Status;
+}
+
+EFI_STATUS FileReadHashed(EFI_FILE_HANDLE Handle, void* Buffer, UINTN Size, SHA256_CONTEXT* Hash) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    FILE_ASYNC_READ Read = {0};
+    UINT8* Data = Buffer;
+    UINTN Requested = MIN(Size, HASH_CHUNK_SIZE);
+    UINTN Hashed = 0;
+
+    CHECK_AND_RETHROW(FileReadAsync(Handle, Data, Requested, 0, &Read));
+    while (Hashed < Size) {
+        CHECK_AND_RETHROW(FileReadWait(&Read));
+        UINTN Ready = Requested;
+
+        // start the next part before hashing this one
+        if (Requested < Size) {
+            UINTN Chunk = MIN(Size - Requested, HASH_CHUNK_SIZE);
+            CHECK_AND_RETHROW(FileReadAsync(Handle, Data + Requested, Chunk, Requested, &Read));
+            Requested += Chunk;
+        }
+
+        Sha256Update(Hash, Data + Hashed, Ready - Hashed);
+        Hashed = Ready;
+    }
+
+cleanup:
+    FileReadWait(&Read);
+    return Status;
+}
+
+static void CloseCachedDirectory(CACHED_DIRECTORY* Directory) {
+    if (Directory->Handle != NULL) {
+        FileHandleClose(Directory->Handle);
+    }
+    if (Directory->Path != NULL) {
+        FreePool(Directory->Path);
+    }
+    ZeroMem(Directory, sizeof(*Directory));
+}
+
+/**
+ * Get an open handle of the directory, the path is not null terminated
+ */
+static EFI_STATUS GetCachedDirectory(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs, CHAR16* Path, UINTN Length, EFI_FILE_PROTOCOL** Handle) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_FILE_PROTOCOL* root = NULL;
+    EFI_FILE_PROTOCOL* directory = NULL;
+
+    for (int i = 0; i < DIRECTORY_CACHE_SIZE; i++) {
+        CACHED_DIRECTORY* Cached = &mDirectoryCache[i];
+        if (Cached->Fs == Fs && StrLen(Cached->Path) == Length && StrnCmp(Cached->Path, Path, Length) == 0) {
+            *Handle = Cached->Handle;
+            goto cleanup;
+        }
+    }
+
+    // open it from the root, the root itself is cached as an empty path
+    EFI_CHECK(Fs->OpenVolume(Fs, &root));
+    if (Length == 0) {
+        directory = root;
+        root = NULL;
+    } else {
+        CHAR16* Copy = AllocateCopyPool((Length + 1) * sizeof(CHAR16), Path);
+        CHECK_ERROR(Copy != NULL, EFI_OUT_OF_RESOURCES);
+        Copy[Length] = L'\0';
+        Status = root->Open(root, &directory, Copy, EFI_FILE_MODE_READ, 0);
+        FreePool(Copy);
+        EFI_CHECK(Status);
+    }
+
+    CACHED_DIRECTORY* Cached = &mDirectoryCache[mDirectoryCacheNext];
+    mDirectoryCacheNext = (mDirectoryCacheNext + 1) % DIRECTORY_CACHE_SIZE;
+    CloseCachedDirectory(Cached);
+
+    Cached->Path = AllocateZeroPool((Length + 1) * sizeof(CHAR16));
+    CHECK_ERROR(Cached->Path != NULL, EFI_OUT_OF_RESOURCES);
+    CopyMem(Cached->Path, Path, Length * sizeof(CHAR16));
+    Cached->Fs = Fs;
+    Cached->Handle = directory;
+    directory = NULL;
+
+    *Handle = Cached->Handle;
+
+cleanup:
+    if (root != NULL) {
+        FileHandleClose(root);
+    }
+
+    if (directory != NULL) {
+        FileHandleClose(directory);
+    }
+
+    return Status;
+}
+
+EFI_STATUS FileOpenCached(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs, CHAR16* Path, EFI_FILE_PROTOCOL** File) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_FILE_PROTOCOL* directory = NULL;
+
+    CHECK(Fs != NULL);
+    CHECK(Path != NULL);
+    CHECK(File != NULL);
+
+    // split it to the directory and the name
+    UINTN NameStart = StrLen(Path);
+    while (NameStart > 0 && Path[NameStart - 1] != L'\\' && Path[NameStart - 1] != L'/') {
+        NameStart--;
+    }
+    UINTN DirectoryLength = NameStart;
+    while (DirectoryLength > 0 && (Path[DirectoryLength - 1] == L'\\' || Path[DirectoryLength - 1] == L'/')) {
+        DirectoryLength--;
+    }
+
+    // skip the leading separators, the paths are from the root anyways
+    UINTN DirectoryStart = 0;
+    while (DirectoryStart < DirectoryLength && (Path[DirectoryStart] == L'\\' || Path[DirectoryStart] == L'/')) {
+        DirectoryStart++;
+    }
+
+    CHECK_AND_RETHROW(GetCachedDirectory(Fs, Path + DirectoryStart, DirectoryLength - DirectoryStart, &directory));
+    EFI_CHECK(directory->Open(directory, File, Path + NameStart, EFI_FILE_MODE_READ, 0));
+
+cleanup:
+    return Status;
+}
+
+void FileCloseCached() {
+    for (int i = 0; i < DIRECTORY_CACHE_SIZE; i++) {
+        CloseCachedDirectory(&mDirectoryCache[i]);
+    }
+    mDirectoryCacheNext = 0;
+
+    BlockReadClose();
+}
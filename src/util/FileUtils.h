@@ -4,6 +4,60 @@
 #include <Uefi.h>
 #include <Protocol/SimpleFileSystem.h>
 
+#include "HashUtils.h"
+
 EFI_STATUS FileRead(EFI_FILE_HANDLE Handle, void* Buffer, UINTN Size, UINTN Offset);
 
+/**
+ * A read that may still be in progress, see FileReadAsync
+ */
+typedef struct _FILE_ASYNC_READ {
+    EFI_FILE_IO_TOKEN Token;
+    UINTN Size;
+    BOOLEAN Pending;
+
+    // the event was already seen signaled by FileReadPoll
+    BOOLEAN Signaled;
+} FILE_ASYNC_READ;
+
+/**
+ * Start reading into the buffer. When the file supports it (revision 2
+ * and ReadEx accepts the request) the read is done in the background and
+ * the buffer must not be touched until FileReadWait, otherwise it is done
+ * right away.
+ *
+ * No other read may be done on the handle until this one is waited for.
+ */
+EFI_STATUS FileReadAsync(EFI_FILE_HANDLE Handle, void* Buffer, UINTN Size, UINTN Offset, FILE_ASYNC_READ* Read);
+
+/**
+ * Check if a read started by FileReadAsync is done, it still
+ * needs to be waited for to get its status
+ */
+BOOLEAN FileReadPoll(FILE_ASYNC_READ* Read);
+
+/**
+ * Wait for a read started by FileReadAsync, does nothing if there is none
+ */
+EFI_STATUS FileReadWait(FILE_ASYNC_READ* Read);
+
+/**
+ * Read the first Size bytes of the file and hash them, every part is
+ * hashed while the next one is read
+ */
+EFI_STATUS FileReadHashed(EFI_FILE_HANDLE Handle, void* Buffer, UINTN Size, SHA256_CONTEXT* Hash);
+
+/**
+ * Open a file for reading. The directory it is in is kept open, so the next
+ * files in the same directory of the volume are opened relative to it and
+ * the firmware does not walk the whole path again for each of them.
+ */
+EFI_STATUS FileOpenCached(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs, CHAR16* Path, EFI_FILE_PROTOCOL** File);
+
+/**
+ * Close all the directories kept open by FileOpenCached and forget the
+ * block devices found by BlockReadFile, must be called before ExitBootServices
+ */
+void FileCloseCached();
+
 #endif //__UTIL_FILEUTILS_H__
@@ -0,0 +1,263 @@
+#include "HashUtils.h"
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/UefiLib.h>
+
+#include "Except.h"
+#include "LogUtils.h"
+
+static const UINT32 mSha256K[64] __attribute__((aligned(16))) = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const UINT32 mSha256Init[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// Plain C implementation
+//----------------------------------------------------------------------------------------------------------------------
+
+#define ROTR(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+#define CH(x, y, z)  (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define BSIG0(x)    (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define BSIG1(x)    (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define SSIG0(x)    (ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define SSIG1(x)    (ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+
+static void Sha256BlocksGeneric(UINT32* State, const UINT8* Data, UINTN Blocks) {
+    UINT32 W[64];
+
+    while (Blocks--) {
+        for (int i = 0; i < 16; i++) {
+            W[i] = SwapBytes32(ReadUnaligned32((const UINT32*)(Data + i * 4)));
+        }
+        for (int i = 16; i < 64; i++) {
+            W[i] = SSIG1(W[i - 2]) + W[i - 7] + SSIG0(W[i - 15]) + W[i - 16];
+        }
+
+        UINT32 a = State[0], b = State[1], c = State[2], d = State[3];
+        UINT32 e = State[4], f = State[5], g = State[6], h = State[7];
+        for (int i = 0; i < 64; i++) {
+            UINT32 t1 = h + BSIG1(e) + CH(e, f, g) + mSha256K[i] + W[i];
+            UINT32 t2 = BSIG0(a) + MAJ(a, b, c);
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        State[0] += a; State[1] += b; State[2] += c; State[3] += d;
+        State[4] += e; State[5] += f; State[6] += g; State[7] += h;
+        Data += SHA256_BLOCK_SIZE;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// SHA extensions, written with the compiler builtins since we don't have the intrinsics headers
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef INT32 V4SI __attribute__((vector_size(16)));
+typedef INT8 V16QI __attribute__((vector_size(16)));
+typedef V16QI V16QI_UNALIGNED __attribute__((aligned(1)));
+
+#define SHA_TARGET __attribute__((target("sha,sse4.1")))
+
+// load 4 words of the message, they are big endian
+#define LOAD_MESSAGE(p) \
+    ((V4SI)__builtin_shufflevector(*(const V16QI_UNALIGNED*)(p), *(const V16QI_UNALIGNED*)(p), \
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12))
+
+// the next 4 words of the schedule, from the 4 vectors before it
+#define NEXT_MESSAGE(m0, m1, m2, m3) \
+    __builtin_ia32_sha256msg2( \
+        __builtin_ia32_sha256msg1(m0, m1) + __builtin_shufflevector(m2, m3, 1, 2, 3, 4), m3)
+
+// 4 rounds, each sha256rnds2 does two of them with the low half of the message
+#define ROUNDS(m, i) \
+    do { \
+        V4SI Msg = (m) + *(const V4SI*)&mSha256K[(i) * 4]; \
+        State1 = __builtin_ia32_sha256rnds2(State1, State0, Msg); \
+        Msg = __builtin_shufflevector(Msg, Msg, 2, 3, 0, 0); \
+        State0 = __builtin_ia32_sha256rnds2(State0, State1, Msg); \
+    } while (0)
+
+static SHA_TARGET void Sha256BlocksShaNi(UINT32* State, const UINT8* Data, UINTN Blocks) {
+    // the instructions keep the state as ABEF and CDGH
+    V4SI State0 = { State[5], State[4], State[1], State[0] };
+    V4SI State1 = { State[7], State[6], State[3], State[2] };
+
+    while (Blocks--) {
+        V4SI Save0 = State0;
+        V4SI Save1 = State1;
+
+        V4SI M0 = LOAD_MESSAGE(Data);
+        V4SI M1 = LOAD_MESSAGE(Data + 16);
+        V4SI M2 = LOAD_MESSAGE(Data + 32);
+        V4SI M3 = LOAD_MESSAGE(Data + 48);
+
+        ROUNDS(M0, 0);
+        ROUNDS(M1, 1);
+        ROUNDS(M2, 2);
+        ROUNDS(M3, 3);
+        for (int i = 4; i < 16; i += 4) {
+            M0 = NEXT_MESSAGE(M0, M1, M2, M3);
+            ROUNDS(M0, i);
+            M1 = NEXT_MESSAGE(M1, M2, M3, M0);
+            ROUNDS(M1, i + 1);
+            M2 = NEXT_MESSAGE(M2, M3, M0, M1);
+            ROUNDS(M2, i + 2);
+            M3 = NEXT_MESSAGE(M3, M0, M1, M2);
+            ROUNDS(M3, i + 3);
+        }
+
+        State0 += Save0;
+        State1 += Save1;
+        Data += SHA256_BLOCK_SIZE;
+    }
+
+    State[0] = State0[3]; State[1] = State0[2]; State[4] = State0[1]; State[5] = State0[0];
+    State[2] = State1[3]; State[3] = State1[2]; State[6] = State1[1]; State[7] = State1[0];
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// The actual api
+//----------------------------------------------------------------------------------------------------------------------
+
+static void (*mSha256Blocks)(UINT32* State, const UINT8* Data, UINTN Blocks) = NULL;
+
+static void SelectImplementation() {
+    UINT32 eax, ebx;
+    AsmCpuid(0x00, &eax, NULL, NULL, NULL);
+
+    mSha256Blocks = Sha256BlocksGeneric;
+    if (eax >= 0x07) {
+        AsmCpuidEx(0x07, 0, NULL, &ebx, NULL, NULL);
+        if (ebx & BIT29) {
+            mSha256Blocks = Sha256BlocksShaNi;
+        }
+    }
+}
+
+void Sha256Init(SHA256_CONTEXT* Context) {
+    if (mSha256Blocks == NULL) {
+        SelectImplementation();
+    }
+
+    CopyMem(Context->State, mSha256Init, sizeof(mSha256Init));
+    Context->Length = 0;
+    Context->BlockSize = 0;
+}
+
+void Sha256Update(SHA256_CONTEXT* Context, const void* Data, UINTN Size) {
+    const UINT8* Bytes = Data;
+    Context->Length += Size;
+
+    // finish the partial block first
+    if (Context->BlockSize != 0) {
+        UINTN Chunk = MIN(Size, SHA256_BLOCK_SIZE - Context->BlockSize);
+        CopyMem(Context->Block + Context->BlockSize, Bytes, Chunk);
+        Context->BlockSize += Chunk;
+        Bytes += Chunk;
+        Size -= Chunk;
+
+        if (Context->BlockSize < SHA256_BLOCK_SIZE) {
+            return;
+        }
+        mSha256Blocks(Context->State, Context->Block, 1);
+        Context->BlockSize = 0;
+    }
+
+    // the full blocks are hashed right from the input
+    UINTN Blocks = Size / SHA256_BLOCK_SIZE;
+    if (Blocks != 0) {
+        mSha256Blocks(Context->State, Bytes, Blocks);
+        Bytes += Blocks * SHA256_BLOCK_SIZE;
+        Size -= Blocks * SHA256_BLOCK_SIZE;
+    }
+
+    CopyMem(Context->Block, Bytes, Size);
+    Context->BlockSize = Size;
+}
+
+void Sha256Final(SHA256_CONTEXT* Context, UINT8* Digest) {
+    UINT64 BitLength = Context->Length * 8;
+
+    // pad with a one bit, and zeros until there is space for the length
+    Context->Block[Context->BlockSize++] = 0x80;
+    if (Context->BlockSize > SHA256_BLOCK_SIZE - 8) {
+        ZeroMem(Context->Block + Context->BlockSize, SHA256_BLOCK_SIZE - Context->BlockSize);
+        mSha256Blocks(Context->State, Context->Block, 1);
+        Context->BlockSize = 0;
+    }
+    ZeroMem(Context->Block + Context->BlockSize, SHA256_BLOCK_SIZE - 8 - Context->BlockSize);
+    WriteUnaligned64((UINT64*)(Context->Block + SHA256_BLOCK_SIZE - 8), SwapBytes64(BitLength));
+    mSha256Blocks(Context->State, Context->Block, 1);
+
+    for (int i = 0; i < 8; i++) {
+        WriteUnaligned32((UINT32*)(Digest + i * 4), SwapBytes32(Context->State[i]));
+    }
+}
+
+static void PrintDigest(CHAR16* Name, UINT8* Digest) {
+    LOG_ERROR("    %s: ", Name);
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        LOG_ERROR("%02x", Digest[i]);
+    }
+    LOG_ERROR("\n");
+}
+
+EFI_STATUS Sha256Check(UINT8* Digest, UINT8* Expected, CHAR16* Path) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    if (CompareMem(Digest, Expected, SHA256_DIGEST_SIZE) != 0) {
+        LOG_ERROR("SHA256 mismatch for `%s`\n", Path);
+        PrintDigest(L"expected", Expected);
+        PrintDigest(L"got     ", Digest);
+        CHECK_FAIL_ERROR(EFI_SECURITY_VIOLATION);
+    }
+
+cleanup:
+    return Status;
+}
+
+BOOLEAN ParseSha256(CHAR16* String, UINT8* Digest) {
+    if (StrLen(String) != SHA256_DIGEST_SIZE * 2) {
+        return FALSE;
+    }
+
+    for (int i = 0; i < SHA256_DIGEST_SIZE * 2; i++) {
+        CHAR16 c = String[i];
+        UINT8 Nibble;
+        if (c >= L'0' && c <= L'9') {
+            Nibble = c - L'0';
+        } else if (c >= L'a' && c <= L'f') {
+            Nibble = c - L'a' + 10;
+        } else if (c >= L'A' && c <= L'F') {
+            Nibble = c - L'A' + 10;
+        } else {
+            return FALSE;
+        }
+
+        if (i % 2 == 0) {
+            Digest[i / 2] = Nibble << 4;
+        } else {
+            Digest[i / 2] |= Nibble;
+        }
+    }
+
+    return TRUE;
+}
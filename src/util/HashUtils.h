@@ -0,0 +1,44 @@
+#ifndef __UTIL_HASHUTILS_H__
+#define __UTIL_HASHUTILS_H__
+
+#include <Uefi.h>
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_BLOCK_SIZE 64
+
+typedef struct _SHA256_CONTEXT {
+    UINT32 State[8];
+    UINT64 Length;
+
+    // the part of a block we got so far
+    UINT8 Block[SHA256_BLOCK_SIZE];
+    UINTN BlockSize;
+} SHA256_CONTEXT;
+
+/**
+ * Start a new SHA256 hash
+ */
+void Sha256Init(SHA256_CONTEXT* Context);
+
+/**
+ * Hash more data, will use the SHA extensions if the cpu has them
+ */
+void Sha256Update(SHA256_CONTEXT* Context, const void* Data, UINTN Size);
+
+/**
+ * Finish the hash and get the digest
+ */
+void Sha256Final(SHA256_CONTEXT* Context, UINT8* Digest);
+
+/**
+ * Compare the digest of a file with the expected one, will print both
+ * and fail with EFI_SECURITY_VIOLATION if they are not the same
+ */
+EFI_STATUS Sha256Check(UINT8* Digest, UINT8* Expected, CHAR16* Path);
+
+/**
+ * Parse a digest written as hex (like sha256sum prints it)
+ */
+BOOLEAN ParseSha256(CHAR16* String, UINT8* Digest);
+
+#endif //__UTIL_HASHUTILS_H__
@@ -0,0 +1,116 @@
+#include "LogUtils.h"
+#include "DebugconUtils.h"
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/PrintLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+// a line longer than this is truncated
+#define LOG_LINE_SIZE 256
+
+static CHAR8 mLog[LOG_BUFFER_SIZE];
+
+// both count every byte that was ever logged, so they
+// only need to be masked when indexing the ring
+static UINT64 mLogHead = 0;
+static UINT64 mLogWritten = 0;
+
+static LOG_OUTPUT mOutput = LOG_OUTPUT_NONE;
+static BOOLEAN mAtLineStart = TRUE;
+
+static CHAR8* mLevelPrefix[] = {
+    [LOG_LEVEL_DEBUG] = "[debug] ",
+    [LOG_LEVEL_INFO] = "[info] ",
+    [LOG_LEVEL_WARN] = "[warn] ",
+    [LOG_LEVEL_ERROR] = "[error] ",
+};
+
+static void LogAppend(CONST CHAR8* Data) {
+    for (; *Data != '\0'; Data++) {
+        // PrintLib turns \n into \n\r, keep plain lines
+        if (*Data == '\r') {
+            continue;
+        }
+        mLog[mLogHead++ & (LOG_BUFFER_SIZE - 1)] = *Data;
+        mAtLineStart = *Data == '\n';
+    }
+}
+
+/**
+ * Write everything that was not written yet to the given output
+ */
+static void LogWriteOut(LOG_OUTPUT Output) {
+    // whatever was overwritten is lost
+    if (mLogHead - mLogWritten > LOG_BUFFER_SIZE) {
+        mLogWritten = mLogHead - LOG_BUFFER_SIZE;
+    }
+
+    while (mLogWritten < mLogHead) {
+        if (Output == LOG_OUTPUT_DEBUGCON) {
+            // the ring may wrap, so up to two pieces
+            UINTN Offset = mLogWritten & (LOG_BUFFER_SIZE - 1);
+            UINTN Length = MIN(mLogHead - mLogWritten, LOG_BUFFER_SIZE - Offset);
+            DebugconWrite(&mLog[Offset], Length);
+            mLogWritten += Length;
+        } else {
+            // the console wants ucs2 and \r\n, in chunks
+            CHAR16 Chunk[128];
+            UINTN Length = 0;
+            while (Length < ARRAY_SIZE(Chunk) - 2 && mLogWritten < mLogHead) {
+                CHAR8 c = mLog[mLogWritten++ & (LOG_BUFFER_SIZE - 1)];
+                if (c == '\n') {
+                    Chunk[Length++] = L'\r';
+                }
+                Chunk[Length++] = c;
+            }
+            Chunk[Length] = L'\0';
+            gST->ConOut->OutputString(gST->ConOut, Chunk);
+        }
+    }
+}
+
+void LogPrint(LOG_LEVEL Level, CONST CHAR8* Format, ...) {
+    CHAR8 Line[LOG_LINE_SIZE];
+    VA_LIST Marker;
+
+    VA_START(Marker, Format);
+    AsciiVSPrint(Line, sizeof(Line), Format, Marker);
+    VA_END(Marker);
+
+    // the level only goes at the start of a line, a line can be made of a few prints
+    if (mAtLineStart) {
+        LogAppend(mLevelPrefix[Level]);
+    }
+    LogAppend(Line);
+
+    if (mOutput != LOG_OUTPUT_NONE) {
+        LogWriteOut(mOutput);
+    } else if (Level == LOG_LEVEL_ERROR) {
+        LogWriteOut(LOG_OUTPUT_CONSOLE);
+    }
+}
+
+void LogSetOutput(LOG_OUTPUT Output) {
+    mOutput = Output;
+    if (mOutput != LOG_OUTPUT_NONE) {
+        LogWriteOut(mOutput);
+    }
+}
+
+void LogFlush() {
+    LogWriteOut(mOutput == LOG_OUTPUT_NONE ? LOG_OUTPUT_CONSOLE : mOutput);
+}
+
+UINTN LogSize() {
+    return MIN(mLogHead, LOG_BUFFER_SIZE);
+}
+
+void LogCopy(CHAR8* Buffer) {
+    UINTN Size = LogSize();
+    UINTN Offset = (mLogHead - Size) & (LOG_BUFFER_SIZE - 1);
+    UINTN First = MIN(Size, LOG_BUFFER_SIZE - Offset);
+
+    CopyMem(Buffer, &mLog[Offset], First);
+    CopyMem(Buffer + First, mLog, Size - First);
+}
@@ -0,0 +1,64 @@
+#ifndef __UTIL_LOGUTILS_H__
+#define __UTIL_LOGUTILS_H__
+
+#include <Uefi.h>
+
+// the log is kept in a ring of this size, older lines are overwritten
+#define LOG_BUFFER_SIZE SIZE_64KB
+
+typedef enum _LOG_LEVEL {
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+} LOG_LEVEL;
+
+typedef enum _LOG_OUTPUT {
+    // only kept in memory, written to the console when there is an error
+    LOG_OUTPUT_NONE,
+    // written to the console as it is logged
+    LOG_OUTPUT_CONSOLE,
+    // written to the debugcon port as it is logged
+    LOG_OUTPUT_DEBUGCON,
+} LOG_OUTPUT;
+
+/**
+ * Format a line into the log, the format is ascii but like the
+ * rest of the loader %s takes a CHAR16 string and %a a CHAR8 one.
+ *
+ * Nothing is written out unless there is an output set or the
+ * line is an error, in which case all the log that was not written
+ * yet is written to the console first, to give the error context.
+ */
+void LogPrint(LOG_LEVEL Level, CONST CHAR8* Format, ...);
+
+#define LOG_DEBUG(fmt, ...) LogPrint(LOG_LEVEL_DEBUG, fmt, ## __VA_ARGS__)
+#define LOG_INFO(fmt, ...) LogPrint(LOG_LEVEL_INFO, fmt, ## __VA_ARGS__)
+#define LOG_WARN(fmt, ...) LogPrint(LOG_LEVEL_WARN, fmt, ## __VA_ARGS__)
+#define LOG_ERROR(fmt, ...) LogPrint(LOG_LEVEL_ERROR, fmt, ## __VA_ARGS__)
+
+/**
+ * Set where the log is written as it is made (VERBOSE), anything
+ * logged before that is written right away
+ */
+void LogSetOutput(LOG_OUTPUT Output);
+
+/**
+ * Write everything that was not written yet, to the output or to
+ * the console if there is none
+ */
+void LogFlush();
+
+/**
+ * The size of the log in memory, at most LOG_BUFFER_SIZE
+ */
+UINTN LogSize();
+
+/**
+ * Copy the log to a buffer of LogSize() bytes, oldest line first. It does
+ * not call the firmware, so the kernel can be given the log up to the
+ * moment it is copied.
+ */
+void LogCopy(CHAR8* Buffer);
+
+#endif //__UTIL_LOGUTILS_H__
@@ -0,0 +1,145 @@
+#include "MeasureUtils.h"
+
+#include <Protocol/Tcg2Protocol.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include "Except.h"
+
+BOOLEAN gMeasuredBoot = FALSE;
+
+static BOOLEAN mTcg2Checked = FALSE;
+static EFI_TCG2_PROTOCOL* mTcg2 = NULL;
+
+// our own log, given to the kernel
+static UINT8* mLog = NULL;
+static UINTN mLogSize = 0;
+
+/**
+ * Get the TCG2 protocol, only if it has an actual TPM behind it
+ */
+static EFI_TCG2_PROTOCOL* GetTcg2() {
+    if (!mTcg2Checked) {
+        mTcg2Checked = TRUE;
+
+        EFI_TCG2_PROTOCOL* Tcg2 = NULL;
+        EFI_TCG2_BOOT_SERVICE_CAPABILITY Capability = { .Size = sizeof(EFI_TCG2_BOOT_SERVICE_CAPABILITY) };
+        if (!EFI_ERROR(gBS->LocateProtocol(&gEfiTcg2ProtocolGuid, NULL, (void**)&Tcg2)) &&
+            !EFI_ERROR(Tcg2->GetCapability(Tcg2, &Capability)) &&
+            Capability.TPMPresentFlag) {
+            mTcg2 = Tcg2;
+        }
+    }
+
+    return mTcg2;
+}
+
+BOOLEAN MeasureEnabled() {
+    return gMeasuredBoot || GetTcg2() != NULL;
+}
+
+/**
+ * Log the data and extend the pcr with its hash
+ */
+static EFI_STATUS MeasureEvent(UINT32 Pcr, UINT8* Data, UINTN DataSize) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_TCG2_EVENT* TcgEvent = NULL;
+    SHA256_CONTEXT Hash;
+
+    // add it to our log
+    UINTN EventSize = sizeof(MEASURE_EVENT) + DataSize;
+    UINT8* NewLog = ReallocatePool(mLogSize, mLogSize + EventSize, mLog);
+    CHECK_ERROR(NewLog != NULL, EFI_OUT_OF_RESOURCES);
+    mLog = NewLog;
+
+    MEASURE_EVENT* Event = (MEASURE_EVENT*)(mLog + mLogSize);
+    Event->Size = EventSize;
+    Event->Pcr = Pcr;
+    Event->Type = MEASURE_EV_IPL;
+    CopyMem(Event->Data, Data, DataSize);
+    Sha256Init(&Hash);
+    Sha256Update(&Hash, Data, DataSize);
+    Sha256Final(&Hash, Event->Digest);
+    mLogSize += EventSize;
+
+    // extend the pcr, the firmware adds it to its own log as well
+    EFI_TCG2_PROTOCOL* Tcg2 = GetTcg2();
+    if (Tcg2 != NULL) {
+        UINTN TcgEventSize = OFFSET_OF(EFI_TCG2_EVENT, Event) + DataSize;
+        TcgEvent = AllocateZeroPool(TcgEventSize);
+        CHECK_ERROR(TcgEvent != NULL, EFI_OUT_OF_RESOURCES);
+        TcgEvent->Size = TcgEventSize;
+        TcgEvent->Header.HeaderSize = sizeof(EFI_TCG2_EVENT_HEADER);
+        TcgEvent->Header.HeaderVersion = EFI_TCG2_EVENT_HEADER_VERSION;
+        TcgEvent->Header.PCRIndex = Pcr;
+        TcgEvent->Header.EventType = MEASURE_EV_IPL;
+        CopyMem(TcgEvent->Event, Data, DataSize);
+        EFI_CHECK(Tcg2->HashLogExtendEvent(Tcg2, 0, (EFI_PHYSICAL_ADDRESS)(UINTN)Data, DataSize, TcgEvent));
+    }
+
+cleanup:
+    if (TcgEvent != NULL) {
+        FreePool(TcgEvent);
+    }
+
+    return Status;
+}
+
+EFI_STATUS MeasureFile(UINT32 Pcr, CHAR16* Path, UINT8* Digest) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8* Data = NULL;
+
+    if (!MeasureEnabled()) {
+        goto cleanup;
+    }
+
+    // the digest followed by the path
+    UINTN PathLength = StrLen(Path);
+    Data = AllocatePool(SHA256_DIGEST_SIZE + PathLength);
+    CHECK_ERROR(Data != NULL, EFI_OUT_OF_RESOURCES);
+    CopyMem(Data, Digest, SHA256_DIGEST_SIZE);
+    for (UINTN i = 0; i < PathLength; i++) {
+        Data[SHA256_DIGEST_SIZE + i] = (UINT8)Path[i];
+    }
+
+    CHECK_AND_RETHROW(MeasureEvent(Pcr, Data, SHA256_DIGEST_SIZE + PathLength));
+
+cleanup:
+    if (Data != NULL) {
+        FreePool(Data);
+    }
+
+    return Status;
+}
+
+EFI_STATUS MeasureString(UINT32 Pcr, CHAR16* String) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8* Data = NULL;
+
+    if (!MeasureEnabled()) {
+        goto cleanup;
+    }
+
+    UINTN Length = StrLen(String);
+    Data = AllocatePool(MAX(Length, 1));
+    CHECK_ERROR(Data != NULL, EFI_OUT_OF_RESOURCES);
+    for (UINTN i = 0; i < Length; i++) {
+        Data[i] = (UINT8)String[i];
+    }
+
+    CHECK_AND_RETHROW(MeasureEvent(Pcr, Data, Length));
+
+cleanup:
+    if (Data != NULL) {
+        FreePool(Data);
+    }
+
+    return Status;
+}
+
+void* GetMeasureLog(UINTN* Size) {
+    *Size = mLogSize;
+    return mLog;
+}
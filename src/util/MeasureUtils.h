@@ -0,0 +1,63 @@
+#ifndef __UTIL_MEASUREUTILS_H__
+#define __UTIL_MEASUREUTILS_H__
+
+#include <Uefi.h>
+
+#include "HashUtils.h"
+
+// the same pcrs grub uses, strings (config and cmdline) and files
+#define MEASURE_PCR_STRINGS 8
+#define MEASURE_PCR_FILES   9
+
+// from the TCG PC client spec, used for everything the loader measures
+#define MEASURE_EV_IPL      0x0000000D
+
+/**
+ * An entry of the measurement log given to the kernel, the entries are
+ * packed one after the other.
+ *
+ * The pcr was extended with the Digest, which is the SHA256 of the Data.
+ * For files the data is the SHA256 of the file followed by its path, for
+ * strings it is the string itself, both in ascii and without a terminator.
+ */
+#pragma pack(1)
+typedef struct _MEASURE_EVENT {
+    // the size of the whole entry
+    UINT32 Size;
+    UINT32 Pcr;
+    UINT32 Type;
+    UINT8 Digest[SHA256_DIGEST_SIZE];
+    UINT8 Data[];
+} MEASURE_EVENT;
+#pragma pack()
+
+/**
+ * Keep a measurement log even if there is no TPM (MEASURED_BOOT)
+ */
+extern BOOLEAN gMeasuredBoot;
+
+/**
+ * Check if things should be measured, either because there is
+ * a TPM or because it was asked for in the config
+ */
+BOOLEAN MeasureEnabled();
+
+/**
+ * Measure a file from its digest, the file is hashed by whoever
+ * read it so it does not need to be read again.
+ *
+ * Does nothing if measuring is not enabled.
+ */
+EFI_STATUS MeasureFile(UINT32 Pcr, CHAR16* Path, UINT8* Digest);
+
+/**
+ * Measure a string, does nothing if measuring is not enabled
+ */
+EFI_STATUS MeasureString(UINT32 Pcr, CHAR16* String);
+
+/**
+ * Get the measurement log, NULL if nothing was measured
+ */
+void* GetMeasureLog(UINTN* Size);
+
+#endif //__UTIL_MEASUREUTILS_H__
@@ -0,0 +1,74 @@
+#include "MemUtils.h"
+
+#include <Library/BaseLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include "Except.h"
+
+BOOLEAN IsRangeFree(EFI_PHYSICAL_ADDRESS Base, UINTN Pages) {
+    if (EFI_ERROR(gBS->AllocatePages(AllocateAddress, EfiLoaderData, Pages, &Base))) {
+        return FALSE;
+    }
+    gBS->FreePages(Base, Pages);
+    return TRUE;
+}
+
+EFI_STATUS FindFreeRange(UINTN Pages, UINT64 MinAddress, UINT64 MaxAddress, UINT64 Alignment, BOOLEAN PreferHigh, EFI_PHYSICAL_ADDRESS* Base) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_MEMORY_DESCRIPTOR* MemoryMap = NULL;
+    UINTN MemoryMapSize = 0;
+    UINTN MapKey = 0;
+    UINTN DescriptorSize = 0;
+    UINT32 DescriptorVersion = 0;
+    UINT64 Size = EFI_PAGES_TO_SIZE(Pages);
+    BOOLEAN Found = FALSE;
+
+    CHECK(Base != NULL);
+    CHECK(Pages != 0);
+    CHECK(Alignment != 0 && (Alignment & (Alignment - 1)) == 0);
+
+    // get the memory map, leave some room for the allocation of the buffer itself
+    CHECK(gBS->GetMemoryMap(&MemoryMapSize, NULL, &MapKey, &DescriptorSize, &DescriptorVersion) == EFI_BUFFER_TOO_SMALL);
+    MemoryMapSize += 2 * DescriptorSize;
+    MemoryMap = AllocatePool(MemoryMapSize);
+    CHECK_ERROR(MemoryMap != NULL, EFI_OUT_OF_RESOURCES);
+    EFI_CHECK(gBS->GetMemoryMap(&MemoryMapSize, MemoryMap, &MapKey, &DescriptorSize, &DescriptorVersion));
+
+    for (UINT8* Ptr = (UINT8*)MemoryMap; Ptr < (UINT8*)MemoryMap + MemoryMapSize; Ptr += DescriptorSize) {
+        EFI_MEMORY_DESCRIPTOR* Desc = (EFI_MEMORY_DESCRIPTOR*)Ptr;
+        if (Desc->Type != EfiConventionalMemory) {
+            continue;
+        }
+
+        // clip the descriptor to the limits
+        UINT64 Start = MAX(Desc->PhysicalStart, MinAddress);
+        UINT64 End = MIN(Desc->PhysicalStart + EFI_PAGES_TO_SIZE(Desc->NumberOfPages), MaxAddress);
+        if (Start >= End || End - Start < Size) {
+            continue;
+        }
+
+        // place it as low or as high as we can inside of the descriptor
+        UINT64 Candidate = PreferHigh ? ((End - Size) & ~(Alignment - 1)) : ALIGN_VALUE(Start, Alignment);
+        if (Candidate < Start || Candidate + Size > End) {
+            continue;
+        }
+
+        if (!Found || (PreferHigh ? Candidate > *Base : Candidate < *Base)) {
+            *Base = Candidate;
+            Found = TRUE;
+        }
+    }
+
+    // not an error of its own, callers usually retry with looser limits
+    if (!Found) {
+        Status = EFI_OUT_OF_RESOURCES;
+    }
+
+cleanup:
+    if (MemoryMap != NULL) {
+        FreePool(MemoryMap);
+    }
+
+    return Status;
+}
@@ -0,0 +1,28 @@
+#ifndef __UTIL_MEMUTILS_H__
+#define __UTIL_MEMUTILS_H__
+
+#include <Uefi.h>
+
+/**
+ * Check if the given physical range is free, the range is not
+ * kept allocated after the check
+ */
+BOOLEAN IsRangeFree(EFI_PHYSICAL_ADDRESS Base, UINTN Pages);
+
+/**
+ * Find a free physical range of the given size inside of [MinAddress, MaxAddress),
+ * the base will be aligned to Alignment (which must be a power of two).
+ *
+ * Will take the lowest matching range, or the highest one if PreferHigh is set.
+ * The range is not allocated, EFI_OUT_OF_RESOURCES is returned without
+ * printing anything if none fits.
+ */
+EFI_STATUS FindFreeRange(UINTN Pages, UINT64 MinAddress, UINT64 MaxAddress, UINT64 Alignment, BOOLEAN PreferHigh, EFI_PHYSICAL_ADDRESS* Base);
+
+/**
+ * Zero a buffer using rep stosb, much faster than ZeroMem for big
+ * buffers like the bss of the kernel
+ */
+void FastZeroMem(void* Buffer, UINTN Size);
+
+#endif //__UTIL_MEMUTILS_H__
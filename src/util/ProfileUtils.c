@@ -0,0 +1,853 @@
+#ifdef TOMATBOOT_PROFILE
+
+#include "ProfileUtils.h"
+#include "DebugconUtils.h"
+
+#include <Protocol/BlockIo.h>
+#include <Protocol/BlockIo2.h>
+#include <Protocol/SimpleFileSystem.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiRuntimeServicesTableLib.h>
+
+typedef enum _PROFILE_SERVICE {
+    PROFILE_BS_RAISE_TPL,
+    PROFILE_BS_RESTORE_TPL,
+    PROFILE_BS_ALLOCATE_PAGES,
+    PROFILE_BS_FREE_PAGES,
+    PROFILE_BS_GET_MEMORY_MAP,
+    PROFILE_BS_ALLOCATE_POOL,
+    PROFILE_BS_FREE_POOL,
+    PROFILE_BS_CREATE_EVENT,
+    PROFILE_BS_CREATE_EVENT_EX,
+    PROFILE_BS_SET_TIMER,
+    PROFILE_BS_WAIT_FOR_EVENT,
+    PROFILE_BS_SIGNAL_EVENT,
+    PROFILE_BS_CLOSE_EVENT,
+    PROFILE_BS_CHECK_EVENT,
+    PROFILE_BS_HANDLE_PROTOCOL,
+    PROFILE_BS_OPEN_PROTOCOL,
+    PROFILE_BS_CLOSE_PROTOCOL,
+    PROFILE_BS_LOCATE_HANDLE_BUFFER,
+    PROFILE_BS_LOCATE_PROTOCOL,
+    PROFILE_BS_STALL,
+    PROFILE_BS_SET_WATCHDOG_TIMER,
+
+    PROFILE_RT_GET_TIME,
+    PROFILE_RT_GET_VARIABLE,
+    PROFILE_RT_SET_VARIABLE,
+
+    PROFILE_CON_RESET,
+    PROFILE_CON_OUTPUT_STRING,
+    PROFILE_CON_TEST_STRING,
+    PROFILE_CON_QUERY_MODE,
+    PROFILE_CON_SET_MODE,
+    PROFILE_CON_SET_ATTRIBUTE,
+    PROFILE_CON_CLEAR_SCREEN,
+    PROFILE_CON_SET_CURSOR_POSITION,
+    PROFILE_CON_ENABLE_CURSOR,
+
+    PROFILE_FS_OPEN_VOLUME,
+    PROFILE_FILE_OPEN,
+    PROFILE_FILE_CLOSE,
+    PROFILE_FILE_DELETE,
+    PROFILE_FILE_READ,
+    PROFILE_FILE_WRITE,
+    PROFILE_FILE_GET_POSITION,
+    PROFILE_FILE_SET_POSITION,
+    PROFILE_FILE_GET_INFO,
+    PROFILE_FILE_SET_INFO,
+    PROFILE_FILE_FLUSH,
+    PROFILE_FILE_OPEN_EX,
+    PROFILE_FILE_READ_EX,
+    PROFILE_FILE_WRITE_EX,
+    PROFILE_FILE_FLUSH_EX,
+
+    PROFILE_BLOCK_READ_BLOCKS,
+    PROFILE_BLOCK_READ_BLOCKS_EX,
+
+    PROFILE_SERVICE_COUNT
+} PROFILE_SERVICE;
+
+typedef struct _PROFILE_ENTRY {
+    CHAR8* Name;
+    UINT64 Calls;
+    UINT64 Cycles;
+    UINT64 Bytes;
+} PROFILE_ENTRY;
+
+static PROFILE_ENTRY mEntries[PROFILE_SERVICE_COUNT] = {
+    [PROFILE_BS_RAISE_TPL] = { "gBS->RaiseTPL" },
+    [PROFILE_BS_RESTORE_TPL] = { "gBS->RestoreTPL" },
+    [PROFILE_BS_ALLOCATE_PAGES] = { "gBS->AllocatePages" },
+    [PROFILE_BS_FREE_PAGES] = { "gBS->FreePages" },
+    [PROFILE_BS_GET_MEMORY_MAP] = { "gBS->GetMemoryMap" },
+    [PROFILE_BS_ALLOCATE_POOL] = { "gBS->AllocatePool" },
+    [PROFILE_BS_FREE_POOL] = { "gBS->FreePool" },
+    [PROFILE_BS_CREATE_EVENT] = { "gBS->CreateEvent" },
+    [PROFILE_BS_CREATE_EVENT_EX] = { "gBS->CreateEventEx" },
+    [PROFILE_BS_SET_TIMER] = { "gBS->SetTimer" },
+    [PROFILE_BS_WAIT_FOR_EVENT] = { "gBS->WaitForEvent" },
+    [PROFILE_BS_SIGNAL_EVENT] = { "gBS->SignalEvent" },
+    [PROFILE_BS_CLOSE_EVENT] = { "gBS->CloseEvent" },
+    [PROFILE_BS_CHECK_EVENT] = { "gBS->CheckEvent" },
+    [PROFILE_BS_HANDLE_PROTOCOL] = { "gBS->HandleProtocol" },
+    [PROFILE_BS_OPEN_PROTOCOL] = { "gBS->OpenProtocol" },
+    [PROFILE_BS_CLOSE_PROTOCOL] = { "gBS->CloseProtocol" },
+    [PROFILE_BS_LOCATE_HANDLE_BUFFER] = { "gBS->LocateHandleBuffer" },
+    [PROFILE_BS_LOCATE_PROTOCOL] = { "gBS->LocateProtocol" },
+    [PROFILE_BS_STALL] = { "gBS->Stall" },
+    [PROFILE_BS_SET_WATCHDOG_TIMER] = { "gBS->SetWatchdogTimer" },
+
+    [PROFILE_RT_GET_TIME] = { "gRT->GetTime" },
+    [PROFILE_RT_GET_VARIABLE] = { "gRT->GetVariable" },
+    [PROFILE_RT_SET_VARIABLE] = { "gRT->SetVariable" },
+
+    [PROFILE_CON_RESET] = { "ConOut->Reset" },
+    [PROFILE_CON_OUTPUT_STRING] = { "ConOut->OutputString" },
+    [PROFILE_CON_TEST_STRING] = { "ConOut->TestString" },
+    [PROFILE_CON_QUERY_MODE] = { "ConOut->QueryMode" },
+    [PROFILE_CON_SET_MODE] = { "ConOut->SetMode" },
+    [PROFILE_CON_SET_ATTRIBUTE] = { "ConOut->SetAttribute" },
+    [PROFILE_CON_CLEAR_SCREEN] = { "ConOut->ClearScreen" },
+    [PROFILE_CON_SET_CURSOR_POSITION] = { "ConOut->SetCursorPosition" },
+    [PROFILE_CON_ENABLE_CURSOR] = { "ConOut->EnableCursor" },
+
+    [PROFILE_FS_OPEN_VOLUME] = { "Fs->OpenVolume" },
+    [PROFILE_FILE_OPEN] = { "File->Open" },
+    [PROFILE_FILE_CLOSE] = { "File->Close" },
+    [PROFILE_FILE_DELETE] = { "File->Delete" },
+    [PROFILE_FILE_READ] = { "File->Read" },
+    [PROFILE_FILE_WRITE] = { "File->Write" },
+    [PROFILE_FILE_GET_POSITION] = { "File->GetPosition" },
+    [PROFILE_FILE_SET_POSITION] = { "File->SetPosition" },
+    [PROFILE_FILE_GET_INFO] = { "File->GetInfo" },
+    [PROFILE_FILE_SET_INFO] = { "File->SetInfo" },
+    [PROFILE_FILE_FLUSH] = { "File->Flush" },
+    [PROFILE_FILE_OPEN_EX] = { "File->OpenEx" },
+    [PROFILE_FILE_READ_EX] = { "File->ReadEx" },
+    [PROFILE_FILE_WRITE_EX] = { "File->WriteEx" },
+    [PROFILE_FILE_FLUSH_EX] = { "File->FlushEx" },
+
+    [PROFILE_BLOCK_READ_BLOCKS] = { "BlockIo->ReadBlocks" },
+    [PROFILE_BLOCK_READ_BLOCKS_EX] = { "BlockIo2->ReadBlocksEx" },
+};
+
+// the file systems are wrapped once and the wrapper is kept
+#define PROFILE_MAX_FILE_SYSTEMS 32
+
+typedef struct _PROFILE_FILE_SYSTEM {
+    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL Protocol;
+    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Real;
+} PROFILE_FILE_SYSTEM;
+
+// the files are wrapped on open and freed on close
+typedef struct _PROFILE_FILE {
+    EFI_FILE_PROTOCOL Protocol;
+    EFI_FILE_PROTOCOL* Real;
+} PROFILE_FILE;
+
+#define REAL_FILE(This) (BASE_CR(This, PROFILE_FILE, Protocol)->Real)
+
+// same for the block devices, only the reads are counted
+#define PROFILE_MAX_BLOCK_DEVICES 32
+
+typedef struct _PROFILE_BLOCK_IO {
+    EFI_BLOCK_IO_PROTOCOL Protocol;
+    EFI_BLOCK_IO_PROTOCOL* Real;
+} PROFILE_BLOCK_IO;
+
+typedef struct _PROFILE_BLOCK_IO2 {
+    EFI_BLOCK_IO2_PROTOCOL Protocol;
+    EFI_BLOCK_IO2_PROTOCOL* Real;
+} PROFILE_BLOCK_IO2;
+
+#define REAL_BLOCK_IO(This) (BASE_CR(This, PROFILE_BLOCK_IO, Protocol)->Real)
+#define REAL_BLOCK_IO2(This) (BASE_CR(This, PROFILE_BLOCK_IO2, Protocol)->Real)
+
+// the tables that are given to the loader
+static EFI_BOOT_SERVICES mBootServices;
+static EFI_RUNTIME_SERVICES mRuntimeServices;
+static EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL mConOut;
+
+// the real ones
+static EFI_BOOT_SERVICES* mRealBootServices = NULL;
+static EFI_RUNTIME_SERVICES* mRealRuntimeServices = NULL;
+static EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* mRealConOut = NULL;
+
+static PROFILE_FILE_SYSTEM mFileSystems[PROFILE_MAX_FILE_SYSTEMS];
+static UINTN mFileSystemCount = 0;
+
+static PROFILE_BLOCK_IO mBlockIos[PROFILE_MAX_BLOCK_DEVICES];
+static UINTN mBlockIoCount = 0;
+
+static PROFILE_BLOCK_IO2 mBlockIo2s[PROFILE_MAX_BLOCK_DEVICES];
+static UINTN mBlockIo2Count = 0;
+
+static BOOLEAN mReported = FALSE;
+
+// the width of the histogram bars in the report
+#define PROFILE_BAR_WIDTH 32
+
+static void ProfileRecord(PROFILE_SERVICE Service, UINT64 Start, UINT64 Bytes) {
+    PROFILE_ENTRY* Entry = &mEntries[Service];
+    Entry->Calls++;
+    Entry->Cycles += AsmReadTsc() - Start;
+    Entry->Bytes += Bytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Files
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static EFI_FILE_PROTOCOL* WrapFile(EFI_FILE_PROTOCOL* Real);
+
+static EFI_STATUS EFIAPI ProfileFileOpen(EFI_FILE_PROTOCOL* This, EFI_FILE_PROTOCOL** NewHandle, CHAR16* FileName, UINT64 OpenMode, UINT64 Attributes) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = REAL_FILE(This)->Open(REAL_FILE(This), NewHandle, FileName, OpenMode, Attributes);
+    ProfileRecord(PROFILE_FILE_OPEN, Start, 0);
+    if (!EFI_ERROR(Status)) {
+        *NewHandle = WrapFile(*NewHandle);
+    }
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileFileClose(EFI_FILE_PROTOCOL* This) {
+    EFI_FILE_PROTOCOL* Real = REAL_FILE(This);
+    mRealBootServices->FreePool(BASE_CR(This, PROFILE_FILE, Protocol));
+
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = Real->Close(Real);
+    ProfileRecord(PROFILE_FILE_CLOSE, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileFileDelete(EFI_FILE_PROTOCOL* This) {
+    EFI_FILE_PROTOCOL* Real = REAL_FILE(This);
+    mRealBootServices->FreePool(BASE_CR(This, PROFILE_FILE, Protocol));
+
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = Real->Delete(Real);
+    ProfileRecord(PROFILE_FILE_DELETE, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileFileRead(EFI_FILE_PROTOCOL* This, UINTN* BufferSize, void* Buffer) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = REAL_FILE(This)->Read(REAL_FILE(This), BufferSize, Buffer);
+    ProfileRecord(PROFILE_FILE_READ, Start, EFI_ERROR(Status) ? 0 : *BufferSize);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileFileWrite(EFI_FILE_PROTOCOL* This, UINTN* BufferSize, void* Buffer) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = REAL_FILE(This)->Write(REAL_FILE(This), BufferSize, Buffer);
+    ProfileRecord(PROFILE_FILE_WRITE, Start, EFI_ERROR(Status) ? 0 : *BufferSize);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileFileGetPosition(EFI_FILE_PROTOCOL* This, UINT64* Position) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = REAL_FILE(This)->GetPosition(REAL_FILE(This), Position);
+    ProfileRecord(PROFILE_FILE_GET_POSITION, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileFileSetPosition(EFI_FILE_PROTOCOL* This, UINT64 Position) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = REAL_FILE(This)->SetPosition(REAL_FILE(This), Position);
+    ProfileRecord(PROFILE_FILE_SET_POSITION, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileFileGetInfo(EFI_FILE_PROTOCOL* This, EFI_GUID* InformationType, UINTN* BufferSize, void* Buffer) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = REAL_FILE(This)->GetInfo(REAL_FILE(This), InformationType, BufferSize, Buffer);
+    ProfileRecord(PROFILE_FILE_GET_INFO, Start, EFI_ERROR(Status) ? 0 : *BufferSize);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileFileSetInfo(EFI_FILE_PROTOCOL* This, EFI_GUID* InformationType, UINTN BufferSize, void* Buffer) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = REAL_FILE(This)->SetInfo(REAL_FILE(This), InformationType, BufferSize, Buffer);
+    ProfileRecord(PROFILE_FILE_SET_INFO, Start, BufferSize);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileFileFlush(EFI_FILE_PROTOCOL* This) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = REAL_FILE(This)->Flush(REAL_FILE(This));
+    ProfileRecord(PROFILE_FILE_FLUSH, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileFileOpenEx(EFI_FILE_PROTOCOL* This, EFI_FILE_PROTOCOL** NewHandle, CHAR16* FileName, UINT64 OpenMode, UINT64 Attributes, EFI_FILE_IO_TOKEN* Token) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = REAL_FILE(This)->OpenEx(REAL_FILE(This), NewHandle, FileName, OpenMode, Attributes, Token);
+    ProfileRecord(PROFILE_FILE_OPEN_EX, Start, 0);
+
+    // the handle is only valid once the token is signaled, which we can't
+    // intercept, so only wrap the ones that were opened right away
+    if (!EFI_ERROR(Status) && (Token == NULL || Token->Event == NULL)) {
+        *NewHandle = WrapFile(*NewHandle);
+    }
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileFileReadEx(EFI_FILE_PROTOCOL* This, EFI_FILE_IO_TOKEN* Token) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = REAL_FILE(This)->ReadEx(REAL_FILE(This), Token);
+    ProfileRecord(PROFILE_FILE_READ_EX, Start, EFI_ERROR(Status) ? 0 : Token->BufferSize);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileFileWriteEx(EFI_FILE_PROTOCOL* This, EFI_FILE_IO_TOKEN* Token) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = REAL_FILE(This)->WriteEx(REAL_FILE(This), Token);
+    ProfileRecord(PROFILE_FILE_WRITE_EX, Start, EFI_ERROR(Status) ? 0 : Token->BufferSize);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileFileFlushEx(EFI_FILE_PROTOCOL* This, EFI_FILE_IO_TOKEN* Token) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = REAL_FILE(This)->FlushEx(REAL_FILE(This), Token);
+    ProfileRecord(PROFILE_FILE_FLUSH_EX, Start, 0);
+    return Status;
+}
+
+static EFI_FILE_PROTOCOL* WrapFile(EFI_FILE_PROTOCOL* Real) {
+    PROFILE_FILE* File = NULL;
+
+    // if we can't wrap it just let it through uncounted
+    if (EFI_ERROR(mRealBootServices->AllocatePool(EfiBootServicesData, sizeof(PROFILE_FILE), (void**)&File))) {
+        return Real;
+    }
+
+    File->Real = Real;
+    File->Protocol.Revision = Real->Revision;
+    File->Protocol.Open = ProfileFileOpen;
+    File->Protocol.Close = ProfileFileClose;
+    File->Protocol.Delete = ProfileFileDelete;
+    File->Protocol.Read = ProfileFileRead;
+    File->Protocol.Write = ProfileFileWrite;
+    File->Protocol.GetPosition = ProfileFileGetPosition;
+    File->Protocol.SetPosition = ProfileFileSetPosition;
+    File->Protocol.GetInfo = ProfileFileGetInfo;
+    File->Protocol.SetInfo = ProfileFileSetInfo;
+    File->Protocol.Flush = ProfileFileFlush;
+    File->Protocol.OpenEx = ProfileFileOpenEx;
+    File->Protocol.ReadEx = ProfileFileReadEx;
+    File->Protocol.WriteEx = ProfileFileWriteEx;
+    File->Protocol.FlushEx = ProfileFileFlushEx;
+
+    return &File->Protocol;
+}
+
+static EFI_STATUS EFIAPI ProfileOpenVolume(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* This, EFI_FILE_PROTOCOL** Root) {
+    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Real = BASE_CR(This, PROFILE_FILE_SYSTEM, Protocol)->Real;
+
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = Real->OpenVolume(Real, Root);
+    ProfileRecord(PROFILE_FS_OPEN_VOLUME, Start, 0);
+    if (!EFI_ERROR(Status)) {
+        *Root = WrapFile(*Root);
+    }
+    return Status;
+}
+
+static EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* WrapFileSystem(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Real) {
+    for (UINTN i = 0; i < mFileSystemCount; i++) {
+        if (mFileSystems[i].Real == Real) {
+            return &mFileSystems[i].Protocol;
+        }
+    }
+
+    if (mFileSystemCount == PROFILE_MAX_FILE_SYSTEMS) {
+        return Real;
+    }
+
+    PROFILE_FILE_SYSTEM* FileSystem = &mFileSystems[mFileSystemCount++];
+    FileSystem->Real = Real;
+    FileSystem->Protocol.Revision = Real->Revision;
+    FileSystem->Protocol.OpenVolume = ProfileOpenVolume;
+    return &FileSystem->Protocol;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Block devices
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static EFI_STATUS EFIAPI ProfileBlockReset(EFI_BLOCK_IO_PROTOCOL* This, BOOLEAN ExtendedVerification) {
+    return REAL_BLOCK_IO(This)->Reset(REAL_BLOCK_IO(This), ExtendedVerification);
+}
+
+static EFI_STATUS EFIAPI ProfileReadBlocks(EFI_BLOCK_IO_PROTOCOL* This, UINT32 MediaId, EFI_LBA Lba, UINTN BufferSize, void* Buffer) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = REAL_BLOCK_IO(This)->ReadBlocks(REAL_BLOCK_IO(This), MediaId, Lba, BufferSize, Buffer);
+    ProfileRecord(PROFILE_BLOCK_READ_BLOCKS, Start, EFI_ERROR(Status) ? 0 : BufferSize);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileWriteBlocks(EFI_BLOCK_IO_PROTOCOL* This, UINT32 MediaId, EFI_LBA Lba, UINTN BufferSize, void* Buffer) {
+    return REAL_BLOCK_IO(This)->WriteBlocks(REAL_BLOCK_IO(This), MediaId, Lba, BufferSize, Buffer);
+}
+
+static EFI_STATUS EFIAPI ProfileFlushBlocks(EFI_BLOCK_IO_PROTOCOL* This) {
+    return REAL_BLOCK_IO(This)->FlushBlocks(REAL_BLOCK_IO(This));
+}
+
+static EFI_STATUS EFIAPI ProfileBlockResetEx(EFI_BLOCK_IO2_PROTOCOL* This, BOOLEAN ExtendedVerification) {
+    return REAL_BLOCK_IO2(This)->Reset(REAL_BLOCK_IO2(This), ExtendedVerification);
+}
+
+/**
+ * Only the time to queue the read is counted, the wait is in WaitForEvent
+ */
+static EFI_STATUS EFIAPI ProfileReadBlocksEx(EFI_BLOCK_IO2_PROTOCOL* This, UINT32 MediaId, EFI_LBA Lba, EFI_BLOCK_IO2_TOKEN* Token, UINTN BufferSize, void* Buffer) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = REAL_BLOCK_IO2(This)->ReadBlocksEx(REAL_BLOCK_IO2(This), MediaId, Lba, Token, BufferSize, Buffer);
+    ProfileRecord(PROFILE_BLOCK_READ_BLOCKS_EX, Start, EFI_ERROR(Status) ? 0 : BufferSize);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileWriteBlocksEx(EFI_BLOCK_IO2_PROTOCOL* This, UINT32 MediaId, EFI_LBA Lba, EFI_BLOCK_IO2_TOKEN* Token, UINTN BufferSize, void* Buffer) {
+    return REAL_BLOCK_IO2(This)->WriteBlocksEx(REAL_BLOCK_IO2(This), MediaId, Lba, Token, BufferSize, Buffer);
+}
+
+static EFI_STATUS EFIAPI ProfileFlushBlocksEx(EFI_BLOCK_IO2_PROTOCOL* This, EFI_BLOCK_IO2_TOKEN* Token) {
+    return REAL_BLOCK_IO2(This)->FlushBlocksEx(REAL_BLOCK_IO2(This), Token);
+}
+
+static EFI_BLOCK_IO_PROTOCOL* WrapBlockIo(EFI_BLOCK_IO_PROTOCOL* Real) {
+    for (UINTN i = 0; i < mBlockIoCount; i++) {
+        if (mBlockIos[i].Real == Real) {
+            return &mBlockIos[i].Protocol;
+        }
+    }
+
+    if (mBlockIoCount == PROFILE_MAX_BLOCK_DEVICES) {
+        return Real;
+    }
+
+    // the media is shared with the real one, so it is always current
+    PROFILE_BLOCK_IO* BlockIo = &mBlockIos[mBlockIoCount++];
+    BlockIo->Real = Real;
+    BlockIo->Protocol = *Real;
+    BlockIo->Protocol.Reset = ProfileBlockReset;
+    BlockIo->Protocol.ReadBlocks = ProfileReadBlocks;
+    BlockIo->Protocol.WriteBlocks = ProfileWriteBlocks;
+    BlockIo->Protocol.FlushBlocks = ProfileFlushBlocks;
+    return &BlockIo->Protocol;
+}
+
+static EFI_BLOCK_IO2_PROTOCOL* WrapBlockIo2(EFI_BLOCK_IO2_PROTOCOL* Real) {
+    for (UINTN i = 0; i < mBlockIo2Count; i++) {
+        if (mBlockIo2s[i].Real == Real) {
+            return &mBlockIo2s[i].Protocol;
+        }
+    }
+
+    if (mBlockIo2Count == PROFILE_MAX_BLOCK_DEVICES) {
+        return Real;
+    }
+
+    PROFILE_BLOCK_IO2* BlockIo2 = &mBlockIo2s[mBlockIo2Count++];
+    BlockIo2->Real = Real;
+    BlockIo2->Protocol = *Real;
+    BlockIo2->Protocol.Reset = ProfileBlockResetEx;
+    BlockIo2->Protocol.ReadBlocksEx = ProfileReadBlocksEx;
+    BlockIo2->Protocol.WriteBlocksEx = ProfileWriteBlocksEx;
+    BlockIo2->Protocol.FlushBlocksEx = ProfileFlushBlocksEx;
+    return &BlockIo2->Protocol;
+}
+
+/**
+ * Anything that gets the simple file system or a block device gets our wrapper instead
+ */
+static void MaybeWrapProtocol(EFI_STATUS Status, EFI_GUID* Protocol, void** Interface) {
+    if (EFI_ERROR(Status) || Interface == NULL || *Interface == NULL) {
+        return;
+    }
+
+    if (CompareGuid(Protocol, &gEfiSimpleFileSystemProtocolGuid)) {
+        *Interface = WrapFileSystem(*Interface);
+    } else if (CompareGuid(Protocol, &gEfiBlockIoProtocolGuid)) {
+        *Interface = WrapBlockIo(*Interface);
+    } else if (CompareGuid(Protocol, &gEfiBlockIo2ProtocolGuid)) {
+        *Interface = WrapBlockIo2(*Interface);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Console output
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static EFI_STATUS EFIAPI ProfileConReset(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, BOOLEAN ExtendedVerification) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealConOut->Reset(mRealConOut, ExtendedVerification);
+    ProfileRecord(PROFILE_CON_RESET, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileConOutputString(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, CHAR16* String) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealConOut->OutputString(mRealConOut, String);
+    ProfileRecord(PROFILE_CON_OUTPUT_STRING, Start, StrSize(String) - sizeof(CHAR16));
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileConTestString(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, CHAR16* String) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealConOut->TestString(mRealConOut, String);
+    ProfileRecord(PROFILE_CON_TEST_STRING, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileConQueryMode(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, UINTN ModeNumber, UINTN* Columns, UINTN* Rows) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealConOut->QueryMode(mRealConOut, ModeNumber, Columns, Rows);
+    ProfileRecord(PROFILE_CON_QUERY_MODE, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileConSetMode(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, UINTN ModeNumber) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealConOut->SetMode(mRealConOut, ModeNumber);
+    ProfileRecord(PROFILE_CON_SET_MODE, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileConSetAttribute(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, UINTN Attribute) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealConOut->SetAttribute(mRealConOut, Attribute);
+    ProfileRecord(PROFILE_CON_SET_ATTRIBUTE, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileConClearScreen(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealConOut->ClearScreen(mRealConOut);
+    ProfileRecord(PROFILE_CON_CLEAR_SCREEN, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileConSetCursorPosition(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, UINTN Column, UINTN Row) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealConOut->SetCursorPosition(mRealConOut, Column, Row);
+    ProfileRecord(PROFILE_CON_SET_CURSOR_POSITION, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileConEnableCursor(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, BOOLEAN Visible) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealConOut->EnableCursor(mRealConOut, Visible);
+    ProfileRecord(PROFILE_CON_ENABLE_CURSOR, Start, 0);
+    return Status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Runtime services
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static EFI_STATUS EFIAPI ProfileGetTime(EFI_TIME* Time, EFI_TIME_CAPABILITIES* Capabilities) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealRuntimeServices->GetTime(Time, Capabilities);
+    ProfileRecord(PROFILE_RT_GET_TIME, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileGetVariable(CHAR16* VariableName, EFI_GUID* VendorGuid, UINT32* Attributes, UINTN* DataSize, void* Data) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealRuntimeServices->GetVariable(VariableName, VendorGuid, Attributes, DataSize, Data);
+    ProfileRecord(PROFILE_RT_GET_VARIABLE, Start, EFI_ERROR(Status) ? 0 : *DataSize);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileSetVariable(CHAR16* VariableName, EFI_GUID* VendorGuid, UINT32 Attributes, UINTN DataSize, void* Data) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealRuntimeServices->SetVariable(VariableName, VendorGuid, Attributes, DataSize, Data);
+    ProfileRecord(PROFILE_RT_SET_VARIABLE, Start, DataSize);
+    return Status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Boot services
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static EFI_TPL EFIAPI ProfileRaiseTPL(EFI_TPL NewTpl) {
+    UINT64 Start = AsmReadTsc();
+    EFI_TPL OldTpl = mRealBootServices->RaiseTPL(NewTpl);
+    ProfileRecord(PROFILE_BS_RAISE_TPL, Start, 0);
+    return OldTpl;
+}
+
+static void EFIAPI ProfileRestoreTPL(EFI_TPL OldTpl) {
+    UINT64 Start = AsmReadTsc();
+    mRealBootServices->RestoreTPL(OldTpl);
+    ProfileRecord(PROFILE_BS_RESTORE_TPL, Start, 0);
+}
+
+static EFI_STATUS EFIAPI ProfileAllocatePages(EFI_ALLOCATE_TYPE Type, EFI_MEMORY_TYPE MemoryType, UINTN Pages, EFI_PHYSICAL_ADDRESS* Memory) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealBootServices->AllocatePages(Type, MemoryType, Pages, Memory);
+    ProfileRecord(PROFILE_BS_ALLOCATE_PAGES, Start, EFI_ERROR(Status) ? 0 : EFI_PAGES_TO_SIZE(Pages));
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileFreePages(EFI_PHYSICAL_ADDRESS Memory, UINTN Pages) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealBootServices->FreePages(Memory, Pages);
+    ProfileRecord(PROFILE_BS_FREE_PAGES, Start, EFI_ERROR(Status) ? 0 : EFI_PAGES_TO_SIZE(Pages));
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileGetMemoryMap(UINTN* MemoryMapSize, EFI_MEMORY_DESCRIPTOR* MemoryMap, UINTN* MapKey, UINTN* DescriptorSize, UINT32* DescriptorVersion) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealBootServices->GetMemoryMap(MemoryMapSize, MemoryMap, MapKey, DescriptorSize, DescriptorVersion);
+    ProfileRecord(PROFILE_BS_GET_MEMORY_MAP, Start, EFI_ERROR(Status) ? 0 : *MemoryMapSize);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileAllocatePool(EFI_MEMORY_TYPE PoolType, UINTN Size, void** Buffer) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealBootServices->AllocatePool(PoolType, Size, Buffer);
+    ProfileRecord(PROFILE_BS_ALLOCATE_POOL, Start, EFI_ERROR(Status) ? 0 : Size);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileFreePool(void* Buffer) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealBootServices->FreePool(Buffer);
+    ProfileRecord(PROFILE_BS_FREE_POOL, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileCreateEvent(UINT32 Type, EFI_TPL NotifyTpl, EFI_EVENT_NOTIFY NotifyFunction, void* NotifyContext, EFI_EVENT* Event) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealBootServices->CreateEvent(Type, NotifyTpl, NotifyFunction, NotifyContext, Event);
+    ProfileRecord(PROFILE_BS_CREATE_EVENT, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileCreateEventEx(UINT32 Type, EFI_TPL NotifyTpl, EFI_EVENT_NOTIFY NotifyFunction, CONST void* NotifyContext, CONST EFI_GUID* EventGroup, EFI_EVENT* Event) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealBootServices->CreateEventEx(Type, NotifyTpl, NotifyFunction, NotifyContext, EventGroup, Event);
+    ProfileRecord(PROFILE_BS_CREATE_EVENT_EX, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileSetTimer(EFI_EVENT Event, EFI_TIMER_DELAY Type, UINT64 TriggerTime) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealBootServices->SetTimer(Event, Type, TriggerTime);
+    ProfileRecord(PROFILE_BS_SET_TIMER, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileWaitForEvent(UINTN NumberOfEvents, EFI_EVENT* Event, UINTN* Index) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealBootServices->WaitForEvent(NumberOfEvents, Event, Index);
+    ProfileRecord(PROFILE_BS_WAIT_FOR_EVENT, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileSignalEvent(EFI_EVENT Event) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealBootServices->SignalEvent(Event);
+    ProfileRecord(PROFILE_BS_SIGNAL_EVENT, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileCloseEvent(EFI_EVENT Event) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealBootServices->CloseEvent(Event);
+    ProfileRecord(PROFILE_BS_CLOSE_EVENT, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileCheckEvent(EFI_EVENT Event) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealBootServices->CheckEvent(Event);
+    ProfileRecord(PROFILE_BS_CHECK_EVENT, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileHandleProtocol(EFI_HANDLE Handle, EFI_GUID* Protocol, void** Interface) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealBootServices->HandleProtocol(Handle, Protocol, Interface);
+    ProfileRecord(PROFILE_BS_HANDLE_PROTOCOL, Start, 0);
+    MaybeWrapProtocol(Status, Protocol, Interface);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileOpenProtocol(EFI_HANDLE Handle, EFI_GUID* Protocol, void** Interface, EFI_HANDLE AgentHandle, EFI_HANDLE ControllerHandle, UINT32 Attributes) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealBootServices->OpenProtocol(Handle, Protocol, Interface, AgentHandle, ControllerHandle, Attributes);
+    ProfileRecord(PROFILE_BS_OPEN_PROTOCOL, Start, 0);
+    MaybeWrapProtocol(Status, Protocol, Interface);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileCloseProtocol(EFI_HANDLE Handle, EFI_GUID* Protocol, EFI_HANDLE AgentHandle, EFI_HANDLE ControllerHandle) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealBootServices->CloseProtocol(Handle, Protocol, AgentHandle, ControllerHandle);
+    ProfileRecord(PROFILE_BS_CLOSE_PROTOCOL, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileLocateHandleBuffer(EFI_LOCATE_SEARCH_TYPE SearchType, EFI_GUID* Protocol, void* SearchKey, UINTN* NoHandles, EFI_HANDLE** Buffer) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealBootServices->LocateHandleBuffer(SearchType, Protocol, SearchKey, NoHandles, Buffer);
+    ProfileRecord(PROFILE_BS_LOCATE_HANDLE_BUFFER, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileLocateProtocol(EFI_GUID* Protocol, void* Registration, void** Interface) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealBootServices->LocateProtocol(Protocol, Registration, Interface);
+    ProfileRecord(PROFILE_BS_LOCATE_PROTOCOL, Start, 0);
+    MaybeWrapProtocol(Status, Protocol, Interface);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileStall(UINTN Microseconds) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealBootServices->Stall(Microseconds);
+    ProfileRecord(PROFILE_BS_STALL, Start, 0);
+    return Status;
+}
+
+static EFI_STATUS EFIAPI ProfileSetWatchdogTimer(UINTN Timeout, UINT64 WatchdogCode, UINTN DataSize, CHAR16* WatchdogData) {
+    UINT64 Start = AsmReadTsc();
+    EFI_STATUS Status = mRealBootServices->SetWatchdogTimer(Timeout, WatchdogCode, DataSize, WatchdogData);
+    ProfileRecord(PROFILE_BS_SET_WATCHDOG_TIMER, Start, 0);
+    return Status;
+}
+
+/**
+ * Point the system table at the given services, the crc of the table covers
+ * the pointers so it is computed again
+ */
+static void SetSystemTable(EFI_BOOT_SERVICES* BootServices, EFI_RUNTIME_SERVICES* RuntimeServices, EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* ConOut) {
+    gST->BootServices = BootServices;
+    gST->RuntimeServices = RuntimeServices;
+    gST->ConOut = ConOut;
+    gST->Hdr.CRC32 = 0;
+    gST->Hdr.CRC32 = CalculateCrc32(gST, gST->Hdr.HeaderSize);
+    gBS = BootServices;
+    gRT = RuntimeServices;
+}
+
+static EFI_STATUS EFIAPI ProfileExitBootServices(EFI_HANDLE ImageHandle, UINTN MapKey) {
+    // nothing here may call the firmware or the map key will change
+    if (!mReported) {
+        ProfileReport();
+        mReported = TRUE;
+    }
+
+    // the kernel gets the tables it would have without us, they are put back
+    // before the exit since the firmware updates the table when it succeeds
+    SetSystemTable(mRealBootServices, mRealRuntimeServices, mRealConOut);
+    EFI_STATUS Status = mRealBootServices->ExitBootServices(ImageHandle, MapKey);
+    if (EFI_ERROR(Status)) {
+        // the loader is going to try again with a new map
+        SetSystemTable(&mBootServices, &mRuntimeServices, &mConOut);
+    }
+
+    return Status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Setup and report
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ProfileInit() {
+    // the rest is passed through as is
+    mRealBootServices = gBS;
+    CopyMem(&mBootServices, gBS, sizeof(mBootServices));
+    mBootServices.RaiseTPL = ProfileRaiseTPL;
+    mBootServices.RestoreTPL = ProfileRestoreTPL;
+    mBootServices.AllocatePages = ProfileAllocatePages;
+    mBootServices.FreePages = ProfileFreePages;
+    mBootServices.GetMemoryMap = ProfileGetMemoryMap;
+    mBootServices.AllocatePool = ProfileAllocatePool;
+    mBootServices.FreePool = ProfileFreePool;
+    mBootServices.CreateEvent = ProfileCreateEvent;
+    mBootServices.CreateEventEx = ProfileCreateEventEx;
+    mBootServices.SetTimer = ProfileSetTimer;
+    mBootServices.WaitForEvent = ProfileWaitForEvent;
+    mBootServices.SignalEvent = ProfileSignalEvent;
+    mBootServices.CloseEvent = ProfileCloseEvent;
+    mBootServices.CheckEvent = ProfileCheckEvent;
+    mBootServices.HandleProtocol = ProfileHandleProtocol;
+    mBootServices.OpenProtocol = ProfileOpenProtocol;
+    mBootServices.CloseProtocol = ProfileCloseProtocol;
+    mBootServices.LocateHandleBuffer = ProfileLocateHandleBuffer;
+    mBootServices.LocateProtocol = ProfileLocateProtocol;
+    mBootServices.Stall = ProfileStall;
+    mBootServices.SetWatchdogTimer = ProfileSetWatchdogTimer;
+    mBootServices.ExitBootServices = ProfileExitBootServices;
+
+    mRealRuntimeServices = gRT;
+    CopyMem(&mRuntimeServices, gRT, sizeof(mRuntimeServices));
+    mRuntimeServices.GetTime = ProfileGetTime;
+    mRuntimeServices.GetVariable = ProfileGetVariable;
+    mRuntimeServices.SetVariable = ProfileSetVariable;
+
+    // every function takes This, so all of them are wrapped
+    mRealConOut = gST->ConOut;
+    mConOut.Reset = ProfileConReset;
+    mConOut.OutputString = ProfileConOutputString;
+    mConOut.TestString = ProfileConTestString;
+    mConOut.QueryMode = ProfileConQueryMode;
+    mConOut.SetMode = ProfileConSetMode;
+    mConOut.SetAttribute = ProfileConSetAttribute;
+    mConOut.ClearScreen = ProfileConClearScreen;
+    mConOut.SetCursorPosition = ProfileConSetCursorPosition;
+    mConOut.EnableCursor = ProfileConEnableCursor;
+    mConOut.Mode = mRealConOut->Mode;
+
+    SetSystemTable(&mBootServices, &mRuntimeServices, &mConOut);
+}
+
+void ProfileReport() {
+    UINTN Order[PROFILE_SERVICE_COUNT];
+    UINTN Count = 0;
+    UINT64 TotalCalls = 0;
+    UINT64 TotalCycles = 0;
+    UINT64 TotalBytes = 0;
+
+    // sort the used services by the time spent in them
+    for (UINTN i = 0; i < PROFILE_SERVICE_COUNT; i++) {
+        if (mEntries[i].Calls == 0) {
+            continue;
+        }
+
+        UINTN j = Count++;
+        while (j > 0 && mEntries[Order[j - 1]].Cycles < mEntries[i].Cycles) {
+            Order[j] = Order[j - 1];
+            j--;
+        }
+        Order[j] = i;
+
+        TotalCalls += mEntries[i].Calls;
+        TotalCycles += mEntries[i].Cycles;
+        TotalBytes += mEntries[i].Bytes;
+    }
+
+    DebugconPrint("\nFirmware calls:\n");
+    DebugconPrint("%-28a %10a %16a %12a\n", "service", "calls", "cycles", "bytes");
+    for (UINTN i = 0; i < Count; i++) {
+        PROFILE_ENTRY* Entry = &mEntries[Order[i]];
+
+        CHAR8 Bar[PROFILE_BAR_WIDTH + 1];
+        UINTN Width = TotalCycles == 0 ? 0 : DivU64x64Remainder(MultU64x32(Entry->Cycles, PROFILE_BAR_WIDTH), TotalCycles, NULL);
+        SetMem(Bar, Width, '#');
+        Bar[Width] = '\0';
+
+        DebugconPrint("%-28a %10ld %16ld %12ld %a\n", Entry->Name, Entry->Calls, Entry->Cycles, Entry->Bytes, Bar);
+    }
+    DebugconPrint("%-28a %10ld %16ld %12ld\n\n", "total", TotalCalls, TotalCycles, TotalBytes);
+}
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef __UTIL_PROFILEUTILS_H__
+#define __UTIL_PROFILEUTILS_H__
+
+#include <Uefi.h>
+
+#ifdef TOMATBOOT_PROFILE
+
+/**
+ * Put counting wrappers between the loader and the firmware, on the boot
+ * services, runtime services, console output and every file system and
+ * file that is opened after it.
+ *
+ * The histogram of the calls is written to the debugcon right before
+ * ExitBootServices, at which point the original tables are restored.
+ */
+void ProfileInit();
+
+/**
+ * Write the histogram of the firmware calls so far to the debugcon
+ */
+void ProfileReport();
+
+#else
+
+#define ProfileInit()
+#define ProfileReport()
+
+#endif
+
+#endif //__UTIL_PROFILEUTILS_H__
@@ -0,0 +1,24 @@
+#include "RandUtils.h"
+
+#include <Library/BaseLib.h>
+
+// Intel recommends retrying 10 times before giving up
+#define RDRAND_RETRIES 10
+
+BOOLEAN GetRandom64(UINT64* Rand) {
+    UINT32 eax, ebx, ecx, edx;
+    AsmCpuid(0x01, &eax, &ebx, &ecx, &edx);
+
+    if (ecx & BIT30) {
+        for (int i = 0; i < RDRAND_RETRIES; i++) {
+            if (AsmRdRand64(Rand)) {
+                return TRUE;
+            }
+        }
+    }
+
+    // not great, but better than nothing
+    UINT64 Tsc = AsmReadTsc();
+    *Rand = Tsc ^ LRotU64(Tsc, 29) ^ (Tsc * 0x9E3779B97F4A7C15ull);
+    return FALSE;
+}
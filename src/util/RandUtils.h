@@ -0,0 +1,14 @@
+#ifndef __UTIL_RANDUTILS_H__
+#define __UTIL_RANDUTILS_H__
+
+#include <Uefi.h>
+
+/**
+ * Get a random 64bit number, will use RDRAND if the cpu has it and
+ * fallback to the TSC otherwise.
+ *
+ * Returns FALSE if the number did not come from RDRAND
+ */
+BOOLEAN GetRandom64(UINT64* Rand);
+
+#endif //__UTIL_RANDUTILS_H__
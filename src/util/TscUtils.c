@@ -0,0 +1,90 @@
+#include "TscUtils.h"
+#include "LogUtils.h"
+
+#include <Library/BaseLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+// how long to measure against the stall service, the error
+// is about the overhead of one stall call over this
+#define TSC_CALIBRATION_US 5000
+
+// how far the base frequency can be from the measured one (1/100), above
+// that it is not the frequency of the TSC on this processor
+#define TSC_BASE_TOLERANCE 100
+
+static UINT64 mTscFrequency = 0;
+static UINT32 mTscFlags = 0;
+
+static UINT64 GetCpuidTscFrequency() {
+    UINT32 MaxLeaf, eax, ebx, ecx;
+    AsmCpuid(0x00, &MaxLeaf, NULL, NULL, NULL);
+
+    // the TSC/crystal ratio and the crystal frequency, if it is known
+    if (MaxLeaf >= 0x15) {
+        AsmCpuid(0x15, &eax, &ebx, &ecx, NULL);
+        if (eax != 0 && ebx != 0 && ecx != 0) {
+            return DivU64x32(MultU64x32(ecx, ebx), eax);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * The base frequency in MHz, close to the TSC frequency on most processors
+ * that have this leaf, but it can be a few MHz off or more
+ */
+static UINT64 GetCpuidBaseFrequency() {
+    UINT32 MaxLeaf, eax;
+    AsmCpuid(0x00, &MaxLeaf, NULL, NULL, NULL);
+
+    if (MaxLeaf >= 0x16) {
+        AsmCpuid(0x16, &eax, NULL, NULL, NULL);
+        return MultU64x32(eax & 0xFFFFu, 1000000);
+    }
+
+    return 0;
+}
+
+static UINT64 MeasureTscFrequency() {
+    UINT64 Start = AsmReadTsc();
+    gBS->Stall(TSC_CALIBRATION_US);
+    return DivU64x32(MultU64x32(AsmReadTsc() - Start, 1000000), TSC_CALIBRATION_US);
+}
+
+UINT64 GetTscFrequency(UINT32* Flags) {
+    if (mTscFrequency == 0) {
+        UINT32 MaxLeaf, edx;
+        AsmCpuid(0x80000000, &MaxLeaf, NULL, NULL, NULL);
+        if (MaxLeaf >= 0x80000007) {
+            AsmCpuid(0x80000007, NULL, NULL, NULL, &edx);
+            if (edx & BIT8) {
+                mTscFlags |= TSC_FLAG_INVARIANT;
+            }
+        }
+
+        mTscFrequency = GetCpuidTscFrequency();
+        if (mTscFrequency != 0) {
+            mTscFlags |= TSC_FLAG_EXACT;
+        } else {
+            mTscFrequency = MeasureTscFrequency();
+
+            // the base frequency is a rounder number than what we measure,
+            // but only take it if the measurement agrees with it
+            UINT64 Base = GetCpuidBaseFrequency();
+            UINT64 Tolerance = DivU64x32(mTscFrequency, TSC_BASE_TOLERANCE);
+            if (Base != 0 && Base + Tolerance >= mTscFrequency && Base <= mTscFrequency + Tolerance) {
+                mTscFrequency = Base;
+            }
+        }
+
+        LOG_DEBUG("TSC at %ld Hz (%a%a)\n", mTscFrequency,
+                  mTscFlags & TSC_FLAG_EXACT ? "exact" : "approximate",
+                  mTscFlags & TSC_FLAG_INVARIANT ? ", invariant" : "");
+    }
+
+    if (Flags != NULL) {
+        *Flags = mTscFlags;
+    }
+    return mTscFrequency;
+}
@@ -0,0 +1,22 @@
+#ifndef __UTIL_TSCUTILS_H__
+#define __UTIL_TSCUTILS_H__
+
+#include <Uefi.h>
+
+// the frequency is exact, it came from the crystal clock in CPUID 0x15
+#define TSC_FLAG_EXACT      BIT0
+// the TSC runs at the same rate in every P/C-state (CPUID 0x80000007)
+#define TSC_FLAG_INVARIANT  BIT1
+
+/**
+ * Get the frequency of the TSC in Hz, from CPUID leaf 0x15 when the processor
+ * reports it, otherwise measured once against the stall service, so the first
+ * call must be before ExitBootServices. A measured frequency is replaced by
+ * the base frequency of CPUID leaf 0x16 when they are within 1%, it is still
+ * approximate then.
+ *
+ * Flags gets the TSC_FLAG_* of the result, it can be NULL
+ */
+UINT64 GetTscFrequency(UINT32* Flags);
+
+#endif //__UTIL_TSCUTILS_H__
@@ -0,0 +1,300 @@
+#include "Decompress.h"
+
+#include <util/Except.h>
+#include <util/LogUtils.h>
+#include <util/FileUtils.h>
+#include <util/MeasureUtils.h>
+#include <util/fs/BlockRead.h>
+
+#include <Guid/FileInfo.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/FileHandleLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+
+/**
+ * A decompressed file, shared by all the handles opened on it
+ */
+typedef struct _MEMORY_IMAGE {
+    UINTN RefCount;
+
+    // what it was opened from, for the cache
+    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs;
+    CHAR16* Path;
+
+    UINT8* Buffer;
+    UINTN Size;
+
+    // the digest of the file, if it was hashed
+    BOOLEAN Hashed;
+    UINT8 Sha256[SHA256_DIGEST_SIZE];
+} MEMORY_IMAGE;
+
+/**
+ * A read only file protocol on top of a memory image, the
+ * protocol must be first so we can cast the This pointer
+ */
+typedef struct _MEMORY_FILE {
+    EFI_FILE_PROTOCOL Protocol;
+    MEMORY_IMAGE* Image;
+    UINT64 Position;
+} MEMORY_FILE;
+
+// the last file we decompressed, the kernel is opened more than once (to
+// parse its header and to load it), this way we only decompress it once
+static MEMORY_IMAGE* mCachedImage = NULL;
+
+static void ReleaseImage(MEMORY_IMAGE* Image) {
+    if (--Image->RefCount != 0) {
+        return;
+    }
+
+    gBS->FreePages((EFI_PHYSICAL_ADDRESS)Image->Buffer, EFI_SIZE_TO_PAGES(MAX(Image->Size, 1)));
+    FreePool(Image->Path);
+    FreePool(Image);
+}
+
+static EFI_STATUS EFIAPI MemoryFileOpen(EFI_FILE_PROTOCOL* This, EFI_FILE_PROTOCOL** NewHandle, CHAR16* FileName, UINT64 OpenMode, UINT64 Attributes) {
+    return EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS EFIAPI MemoryFileClose(EFI_FILE_PROTOCOL* This) {
+    MEMORY_FILE* File = (MEMORY_FILE*)This;
+    ReleaseImage(File->Image);
+    FreePool(File);
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MemoryFileDelete(EFI_FILE_PROTOCOL* This) {
+    MemoryFileClose(This);
+    return EFI_WARN_DELETE_FAILURE;
+}
+
+static EFI_STATUS EFIAPI MemoryFileRead(EFI_FILE_PROTOCOL* This, UINTN* BufferSize, void* Buffer) {
+    MEMORY_FILE* File = (MEMORY_FILE*)This;
+    MEMORY_IMAGE* Image = File->Image;
+
+    if (File->Position > Image->Size) {
+        return EFI_DEVICE_ERROR;
+    }
+
+    *BufferSize = MIN(*BufferSize, Image->Size - File->Position);
+    CopyMem(Buffer, Image->Buffer + File->Position, *BufferSize);
+    File->Position += *BufferSize;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MemoryFileWrite(EFI_FILE_PROTOCOL* This, UINTN* BufferSize, void* Buffer) {
+    return EFI_WRITE_PROTECTED;
+}
+
+static EFI_STATUS EFIAPI MemoryFileGetPosition(EFI_FILE_PROTOCOL* This, UINT64* Position) {
+    *Position = ((MEMORY_FILE*)This)->Position;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MemoryFileSetPosition(EFI_FILE_PROTOCOL* This, UINT64 Position) {
+    MEMORY_FILE* File = (MEMORY_FILE*)This;
+
+    // all ones means the end of the file
+    File->Position = Position == MAX_UINT64 ? File->Image->Size : Position;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MemoryFileGetInfo(EFI_FILE_PROTOCOL* This, EFI_GUID* InformationType, UINTN* BufferSize, void* Buffer) {
+    MEMORY_FILE* File = (MEMORY_FILE*)This;
+
+    if (!CompareGuid(InformationType, &gEfiFileInfoGuid)) {
+        return EFI_UNSUPPORTED;
+    }
+
+    // we don't keep the name, so it is always empty
+    if (*BufferSize < sizeof(EFI_FILE_INFO)) {
+        *BufferSize = sizeof(EFI_FILE_INFO);
+        return EFI_BUFFER_TOO_SMALL;
+    }
+
+    EFI_FILE_INFO* Info = Buffer;
+    ZeroMem(Info, sizeof(EFI_FILE_INFO));
+    Info->Size = sizeof(EFI_FILE_INFO);
+    Info->FileSize = File->Image->Size;
+    Info->PhysicalSize = File->Image->Size;
+    Info->Attribute = EFI_FILE_READ_ONLY;
+    *BufferSize = sizeof(EFI_FILE_INFO);
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI MemoryFileSetInfo(EFI_FILE_PROTOCOL* This, EFI_GUID* InformationType, UINTN BufferSize, void* Buffer) {
+    return EFI_WRITE_PROTECTED;
+}
+
+static EFI_STATUS EFIAPI MemoryFileFlush(EFI_FILE_PROTOCOL* This) {
+    return EFI_SUCCESS;
+}
+
+static EFI_FILE_PROTOCOL mMemoryFileProtocol = {
+    .Revision = EFI_FILE_PROTOCOL_REVISION,
+    .Open = MemoryFileOpen,
+    .Close = MemoryFileClose,
+    .Delete = MemoryFileDelete,
+    .Read = MemoryFileRead,
+    .Write = MemoryFileWrite,
+    .GetPosition = MemoryFileGetPosition,
+    .SetPosition = MemoryFileSetPosition,
+    .GetInfo = MemoryFileGetInfo,
+    .SetInfo = MemoryFileSetInfo,
+    .Flush = MemoryFileFlush,
+};
+
+/**
+ * Decompress the file into a new memory image, or just read it if it is
+ * not compressed and only needs to be verified or measured
+ */
+static EFI_STATUS CreateImage(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs, CHAR16* Path, EFI_FILE_PROTOCOL* Source, COMPRESSION_FORMAT Format, UINT8* Sha256, MEMORY_IMAGE** Out) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    MEMORY_IMAGE* Image = NULL;
+    SHA256_CONTEXT Hash;
+    BOOLEAN NeedHash = Sha256 != NULL || MeasureEnabled();
+
+    Image = AllocateZeroPool(sizeof(MEMORY_IMAGE));
+    CHECK_ERROR(Image != NULL, EFI_OUT_OF_RESOURCES);
+    Image->Path = AllocateCopyPool(StrSize(Path), Path);
+    CHECK_ERROR(Image->Path != NULL, EFI_OUT_OF_RESOURCES);
+    Image->Fs = Fs;
+
+    if (NeedHash) {
+        Sha256Init(&Hash);
+    }
+
+    // this is only a staging buffer, put it as high as possible
+    // so it does not take the place the kernel wants to load at
+    UINTN Base = 0;
+    if (Format == COMPRESSION_NONE) {
+        EFI_CHECK(FileHandleGetSize(Source, &Image->Size));
+        Base = MAX_ADDRESS;
+        EFI_CHECK(gBS->AllocatePages(AllocateMaxAddress, EfiLoaderData, EFI_SIZE_TO_PAGES(MAX(Image->Size, 1)), &Base));
+        Image->Buffer = (UINT8*)Base;
+
+        // straight from the disk if we can
+        Status = BlockReadFile(Fs, Path, Image->Buffer, Image->Size);
+        if (Status == EFI_UNSUPPORTED) {
+            if (NeedHash) {
+                CHECK_AND_RETHROW(FileReadHashed(Source, Image->Buffer, Image->Size, &Hash));
+            } else {
+                CHECK_AND_RETHROW(FileRead(Source, Image->Buffer, Image->Size, 0));
+            }
+        } else {
+            CHECK_AND_RETHROW(Status);
+            if (NeedHash) {
+                Sha256Update(&Hash, Image->Buffer, Image->Size);
+            }
+        }
+    } else {
+        LOG_INFO("Decompressing `%s` (%s)\n", Path, CompressionName(Format));
+        DECOMPRESS_OUTPUT Pages = { .MemoryType = EfiLoaderData, .MaxAddress = MAX_ADDRESS };
+        CHECK_AND_RETHROW(DecompressFile(Source, Format, &Pages, &Base, &Image->Size, NeedHash ? &Hash : NULL));
+        Image->Buffer = (UINT8*)Base;
+    }
+
+    if (NeedHash) {
+        Sha256Final(&Hash, Image->Sha256);
+        Image->Hashed = TRUE;
+        if (Sha256 != NULL) {
+            CHECK_AND_RETHROW(Sha256Check(Image->Sha256, Sha256, Path));
+        }
+        CHECK_AND_RETHROW(MeasureFile(MEASURE_PCR_FILES, Path, Image->Sha256));
+    }
+
+    Image->RefCount = 1;
+    *Out = Image;
+    Image = NULL;
+
+cleanup:
+    if (Image != NULL) {
+        if (Image->Buffer != NULL) {
+            gBS->FreePages((EFI_PHYSICAL_ADDRESS)Image->Buffer, EFI_SIZE_TO_PAGES(MAX(Image->Size, 1)));
+        }
+        if (Image->Path != NULL) {
+            FreePool(Image->Path);
+        }
+        FreePool(Image);
+    }
+
+    return Status;
+}
+
+/**
+ * Check if the cached image can be used for this open
+ */
+static BOOLEAN IsCached(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs, CHAR16* Path, UINT8* Sha256) {
+    if (mCachedImage == NULL || mCachedImage->Fs != Fs || StrCmp(mCachedImage->Path, Path) != 0) {
+        return FALSE;
+    }
+
+    // it must have been hashed if we need the digest
+    if ((Sha256 != NULL || MeasureEnabled()) && !mCachedImage->Hashed) {
+        return FALSE;
+    }
+
+    return Sha256 == NULL || CompareMem(mCachedImage->Sha256, Sha256, SHA256_DIGEST_SIZE) == 0;
+}
+
+BOOLEAN IsMemoryFile(EFI_FILE_PROTOCOL* File) {
+    return File->Read == MemoryFileRead;
+}
+
+EFI_STATUS OpenMaybeCompressed(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs, CHAR16* Path, UINT8* Sha256, EFI_FILE_PROTOCOL** File) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_FILE_PROTOCOL* image = NULL;
+    MEMORY_FILE* memoryFile = NULL;
+
+    CHECK(Fs != NULL);
+    CHECK(Path != NULL);
+    CHECK(File != NULL);
+
+    // only open and decompress if we did not do it already
+    if (!IsCached(Fs, Path, Sha256)) {
+        CHECK_AND_RETHROW(FileOpenCached(Fs, Path, &image));
+
+        // check the magic, small files can't be compressed
+        UINT64 fileSize = 0;
+        UINT8 magic[COMPRESSION_MAGIC_SIZE] = {0};
+        EFI_CHECK(FileHandleGetSize(image, &fileSize));
+        if (fileSize >= sizeof(magic)) {
+            CHECK_AND_RETHROW(FileRead(image, magic, sizeof(magic), 0));
+        }
+
+        // not compressed and nothing to check or measure, just give the real file
+        COMPRESSION_FORMAT format = DetectCompression(magic, MIN(fileSize, sizeof(magic)));
+        if (format == COMPRESSION_NONE && Sha256 == NULL && !MeasureEnabled()) {
+            *File = image;
+            image = NULL;
+            goto cleanup;
+        }
+
+        // replace the cached image
+        MEMORY_IMAGE* newImage = NULL;
+        CHECK_AND_RETHROW(CreateImage(Fs, Path, image, format, Sha256, &newImage));
+        if (mCachedImage != NULL) {
+            ReleaseImage(mCachedImage);
+        }
+        mCachedImage = newImage;
+    }
+
+    memoryFile = AllocateZeroPool(sizeof(MEMORY_FILE));
+    CHECK_ERROR(memoryFile != NULL, EFI_OUT_OF_RESOURCES);
+    memoryFile->Protocol = mMemoryFileProtocol;
+    memoryFile->Image = mCachedImage;
+    mCachedImage->RefCount++;
+
+    *File = &memoryFile->Protocol;
+
+cleanup:
+    if (image != NULL) {
+        FileHandleClose(image);
+    }
+
+    return Status;
+}
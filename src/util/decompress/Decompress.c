@@ -0,0 +1,366 @@
+#include "DecompressInternal.h"
+
+#include <util/Except.h>
+#include <util/FileUtils.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/FileHandleLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+// how much we read from the disk at a time
+#define STREAM_CHUNK_SIZE       SIZE_1MB
+
+// the biggest block each format can have, plus some space for the headers
+#define LZ4_MAX_BLOCK           (SIZE_4MB + SIZE_64KB)
+#define LZ4_LEGACY_MAX_BLOCK    (SIZE_8MB + SIZE_64KB)
+
+// the biggest frame headers, used to get the content size
+#define LZ4_MAX_HEADER          19
+#define ZSTD_MAX_HEADER         18
+
+// the output guess for formats that don't have the size in their header
+#define DEFAULT_RATIO           4
+
+/**
+ * Start reading the next chunk of the file, if there is any
+ */
+static EFI_STATUS StreamStartPrefetch(INPUT_STREAM* Stream) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    Stream->PrefetchSize = MIN(Stream->PrefetchCapacity, Stream->FileSize - Stream->FileOffset);
+    Stream->PrefetchPosition = 0;
+    if (Stream->PrefetchSize != 0) {
+        CHECK_AND_RETHROW(FileReadAsync(Stream->File, Stream->Prefetch, Stream->PrefetchSize, Stream->FileOffset, &Stream->PrefetchRead));
+        Stream->FileOffset += Stream->PrefetchSize;
+    }
+
+cleanup:
+    return Status;
+}
+
+EFI_STATUS StreamPeek(INPUT_STREAM* Stream, UINTN Size, UINT8** Data) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    if (Stream->Size - Stream->Position < Size) {
+        // memory streams can't be refilled
+        CHECK_ERROR(Stream->File != NULL, EFI_END_OF_FILE);
+        CHECK_ERROR_TRACE(Size <= Stream->Capacity, EFI_BAD_BUFFER_SIZE, "Block is too big (%d bytes)", Size);
+
+        // move what is left to the start, and fill the rest
+        UINTN Left = Stream->Size - Stream->Position;
+        CopyMem(Stream->Buffer, Stream->Buffer + Stream->Position, Left);
+        Stream->Position = 0;
+        Stream->Size = Left;
+
+        while (TRUE) {
+            // take as much as we can from the read ahead, it is
+            // hashed once when we first get to it
+            CHECK_AND_RETHROW(FileReadWait(&Stream->PrefetchRead));
+            if (Stream->Hash != NULL && Stream->PrefetchPosition == 0) {
+                Sha256Update(Stream->Hash, Stream->Prefetch, Stream->PrefetchSize);
+            }
+            UINTN Chunk = MIN(Stream->PrefetchSize - Stream->PrefetchPosition, Stream->Capacity - Stream->Size);
+            CopyMem(Stream->Buffer + Stream->Size, Stream->Prefetch + Stream->PrefetchPosition, Chunk);
+            Stream->PrefetchPosition += Chunk;
+            Stream->Size += Chunk;
+
+            // once it is used up start reading the next one, it is
+            // going to be read while the decoder uses this one
+            if (Stream->PrefetchPosition == Stream->PrefetchSize) {
+                CHECK_AND_RETHROW(StreamStartPrefetch(Stream));
+            }
+
+            if (Stream->Size >= Size) {
+                break;
+            }
+            CHECK_ERROR(Stream->PrefetchSize != 0, EFI_END_OF_FILE);
+        }
+    }
+
+    *Data = Stream->Buffer + Stream->Position;
+
+cleanup:
+    return Status;
+}
+
+EFI_STATUS StreamRead(INPUT_STREAM* Stream, UINTN Size, UINT8** Data) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    CHECK_AND_RETHROW(StreamPeek(Stream, Size, Data));
+    Stream->Position += Size;
+
+cleanup:
+    return Status;
+}
+
+EFI_STATUS StreamReadByte(INPUT_STREAM* Stream, UINT8* Byte) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8* Data = NULL;
+
+    // fast path
+    if (Stream->Position < Stream->Size) {
+        *Byte = Stream->Buffer[Stream->Position++];
+        goto cleanup;
+    }
+
+    CHECK_AND_RETHROW(StreamRead(Stream, 1, &Data));
+    *Byte = *Data;
+
+cleanup:
+    return Status;
+}
+
+UINTN StreamRemaining(INPUT_STREAM* Stream) {
+    UINTN Remaining = Stream->Size - Stream->Position;
+    if (Stream->File != NULL) {
+        Remaining += Stream->PrefetchSize - Stream->PrefetchPosition;
+        Remaining += Stream->FileSize - Stream->FileOffset;
+    }
+    return Remaining;
+}
+
+void StreamClose(INPUT_STREAM* Stream) {
+    FileReadWait(&Stream->PrefetchRead);
+}
+
+EFI_STATUS StreamHashRemaining(INPUT_STREAM* Stream) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    // the chunk that is read ahead, if we did not get to it
+    CHECK_AND_RETHROW(FileReadWait(&Stream->PrefetchRead));
+    if (Stream->PrefetchPosition == 0) {
+        Sha256Update(Stream->Hash, Stream->Prefetch, Stream->PrefetchSize);
+    }
+    Stream->PrefetchPosition = Stream->PrefetchSize;
+
+    // and whatever was not requested yet
+    while (Stream->FileOffset < Stream->FileSize) {
+        UINTN Chunk = MIN(Stream->PrefetchCapacity, Stream->FileSize - Stream->FileOffset);
+        CHECK_AND_RETHROW(FileRead(Stream->File, Stream->Prefetch, Chunk, Stream->FileOffset));
+        Sha256Update(Stream->Hash, Stream->Prefetch, Chunk);
+        Stream->FileOffset += Chunk;
+    }
+
+cleanup:
+    return Status;
+}
+
+EFI_STATUS OutputAllocatePages(DECOMPRESS_OUTPUT* Pages, UINTN Count, EFI_PHYSICAL_ADDRESS* Base) {
+    if (Pages->Allocate != NULL) {
+        return Pages->Allocate(Pages->Context, Count, Base);
+    }
+
+    *Base = Pages->MaxAddress;
+    return gBS->AllocatePages(AllocateMaxAddress, Pages->MemoryType, Count, Base);
+}
+
+EFI_STATUS OutputReserve(OUTPUT_BUFFER* Output, UINTN Size) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_PHYSICAL_ADDRESS NewBuffer = 0;
+
+    // fast path
+    if (Output->Capacity - Output->Size >= Size) {
+        goto cleanup;
+    }
+
+    CHECK_ERROR_TRACE(Output->CanGrow, EFI_BUFFER_TOO_SMALL, "Decompressed data is bigger than expected");
+
+    // double it, copy and free the old one
+    UINTN NewCapacity = ALIGN_VALUE(MAX(Output->Capacity * 2, Output->Size + Size), EFI_PAGE_SIZE);
+    EFI_CHECK(OutputAllocatePages(Output->Pages, EFI_SIZE_TO_PAGES(NewCapacity), &NewBuffer));
+    CopyMem((void*)NewBuffer, Output->Buffer, Output->Size);
+    gBS->FreePages((EFI_PHYSICAL_ADDRESS)Output->Buffer, EFI_SIZE_TO_PAGES(Output->Capacity));
+
+    Output->Buffer = (UINT8*)NewBuffer;
+    Output->Capacity = NewCapacity;
+
+cleanup:
+    return Status;
+}
+
+void OutputCopyMatch(OUTPUT_BUFFER* Output, UINTN Offset, UINTN Length) {
+    UINT8* Dst = Output->Buffer + Output->Size;
+    UINT8* Src = Dst - Offset;
+    Output->Size += Length;
+
+    if (Offset >= Length) {
+        CopyMem(Dst, Src, Length);
+        return;
+    }
+
+    // overlapping, this repeats the last Offset bytes
+    while (Length--) {
+        *Dst++ = *Src++;
+    }
+}
+
+COMPRESSION_FORMAT DetectCompression(UINT8* Magic, UINTN Size) {
+    if (Size >= 2 && Magic[0] == 0x1F && Magic[1] == 0x8B) {
+        return COMPRESSION_GZIP;
+    }
+
+    if (Size >= 4) {
+        switch (*(UINT32*)Magic) {
+            case 0x184D2204: return COMPRESSION_LZ4;
+            case 0x184C2102: return COMPRESSION_LZ4_LEGACY;
+            case 0xFD2FB528: return COMPRESSION_ZSTD;
+            default: break;
+        }
+    }
+
+    return COMPRESSION_NONE;
+}
+
+CHAR16* CompressionName(COMPRESSION_FORMAT Format) {
+    switch (Format) {
+        case COMPRESSION_NONE: return L"none";
+        case COMPRESSION_GZIP: return L"gzip";
+        case COMPRESSION_LZ4: return L"lz4";
+        case COMPRESSION_LZ4_LEGACY: return L"lz4 (legacy)";
+        case COMPRESSION_ZSTD: return L"zstd";
+        default: return L"unknown";
+    }
+}
+
+UINTN DecompressWorkspaceSize(COMPRESSION_FORMAT Format) {
+    switch (Format) {
+        case COMPRESSION_GZIP: return GzipWorkspaceSize();
+        case COMPRESSION_ZSTD: return ZstdWorkspaceSize();
+        default: return 0;
+    }
+}
+
+EFI_STATUS DecompressStream(COMPRESSION_FORMAT Format, INPUT_STREAM* Input, OUTPUT_BUFFER* Output, void* Workspace) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    switch (Format) {
+        case COMPRESSION_GZIP: CHECK_AND_RETHROW(GzipDecompress(Input, Output, Workspace)); break;
+        case COMPRESSION_LZ4: CHECK_AND_RETHROW(Lz4Decompress(Input, Output)); break;
+        case COMPRESSION_LZ4_LEGACY: CHECK_AND_RETHROW(Lz4LegacyDecompress(Input, Output)); break;
+        case COMPRESSION_ZSTD: CHECK_AND_RETHROW(ZstdDecompress(Input, Output, Workspace)); break;
+        default: CHECK_FAIL_TRACE("Unknown compression format %d", Format);
+    }
+
+cleanup:
+    return Status;
+}
+
+EFI_STATUS DecompressFile(EFI_FILE_PROTOCOL* File, COMPRESSION_FORMAT Format, DECOMPRESS_OUTPUT* Pages,
+                          UINTN* Base, UINTN* Size, SHA256_CONTEXT* Hash) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    INPUT_STREAM Input = { .File = File, .Hash = Hash };
+    OUTPUT_BUFFER Output = { .Pages = Pages, .CanGrow = TRUE };
+    UINT8* Header = NULL;
+    UINT64 ContentSize = 0;
+    BOOLEAN SizeKnown = FALSE;
+    void* Workspace = NULL;
+
+    CHECK(File != NULL);
+    CHECK(Pages != NULL);
+    CHECK(Base != NULL);
+    CHECK(Size != NULL);
+
+    // try to use all the processors first
+    if (gParallelDecompress) {
+        Status = DecompressFileParallel(File, Format, Pages, Base, Size, Hash);
+        if (Status != EFI_UNSUPPORTED) {
+            goto cleanup;
+        }
+        Status = EFI_SUCCESS;
+
+        // it may have hashed part of the file before giving up
+        if (Hash != NULL) {
+            Sha256Init(Hash);
+        }
+    }
+
+    EFI_CHECK(FileHandleGetSize(File, &Input.FileSize));
+
+    // the buffer must fit the biggest block of the format
+    switch (Format) {
+        case COMPRESSION_LZ4: Input.Capacity = LZ4_MAX_BLOCK; break;
+        case COMPRESSION_LZ4_LEGACY: Input.Capacity = LZ4_LEGACY_MAX_BLOCK; break;
+        default: Input.Capacity = STREAM_CHUNK_SIZE; break;
+    }
+    Input.Buffer = AllocatePool(Input.Capacity);
+    CHECK_ERROR(Input.Buffer != NULL, EFI_OUT_OF_RESOURCES);
+    Input.PrefetchCapacity = STREAM_CHUNK_SIZE;
+    Input.Prefetch = AllocatePool(Input.PrefetchCapacity);
+    CHECK_ERROR(Input.Prefetch != NULL, EFI_OUT_OF_RESOURCES);
+
+    if (DecompressWorkspaceSize(Format) != 0) {
+        Workspace = AllocatePool(DecompressWorkspaceSize(Format));
+        CHECK_ERROR(Workspace != NULL, EFI_OUT_OF_RESOURCES);
+    }
+
+    // try to get the real size from the header
+    switch (Format) {
+        case COMPRESSION_GZIP: {
+            // the size is at the end of the file (mod 4GB)
+            UINT32 GzipSize = 0;
+            CHECK(Input.FileSize >= 18);
+            CHECK_AND_RETHROW(FileRead(File, &GzipSize, sizeof(GzipSize), Input.FileSize - sizeof(GzipSize)));
+            ContentSize = GzipSize;
+            SizeKnown = TRUE;
+        } break;
+
+        case COMPRESSION_LZ4:
+            CHECK_AND_RETHROW(StreamPeek(&Input, MIN(LZ4_MAX_HEADER, Input.FileSize), &Header));
+            SizeKnown = Lz4GetContentSize(Header, MIN(LZ4_MAX_HEADER, Input.FileSize), &ContentSize);
+            break;
+
+        case COMPRESSION_ZSTD:
+            CHECK_AND_RETHROW(StreamPeek(&Input, MIN(ZSTD_MAX_HEADER, Input.FileSize), &Header));
+            SizeKnown = ZstdGetContentSize(Header, MIN(ZSTD_MAX_HEADER, Input.FileSize), &ContentSize);
+            break;
+
+        default:
+            break;
+    }
+
+    // allocate the output, even if the size is known we still let it grow in
+    // case there are more frames after the first one
+    Output.Capacity = ALIGN_VALUE(MAX(SizeKnown ? ContentSize : Input.FileSize * DEFAULT_RATIO, EFI_PAGE_SIZE), EFI_PAGE_SIZE);
+    EFI_PHYSICAL_ADDRESS OutputBase = 0;
+    EFI_CHECK(OutputAllocatePages(Pages, EFI_SIZE_TO_PAGES(Output.Capacity), &OutputBase));
+    Output.Buffer = (UINT8*)OutputBase;
+
+    CHECK_AND_RETHROW(DecompressStream(Format, &Input, &Output, Workspace));
+    if (Hash != NULL) {
+        CHECK_AND_RETHROW(StreamHashRemaining(&Input));
+    }
+
+    // give back the pages we did not use
+    UINTN UsedPages = MAX(EFI_SIZE_TO_PAGES(Output.Size), 1);
+    UINTN AllocatedPages = EFI_SIZE_TO_PAGES(Output.Capacity);
+    if (UsedPages < AllocatedPages) {
+        gBS->FreePages((EFI_PHYSICAL_ADDRESS)Output.Buffer + EFI_PAGES_TO_SIZE(UsedPages), AllocatedPages - UsedPages);
+        Output.Capacity = EFI_PAGES_TO_SIZE(UsedPages);
+    }
+
+    *Base = (UINTN)Output.Buffer;
+    *Size = Output.Size;
+
+cleanup:
+    StreamClose(&Input);
+
+    if (Input.Buffer != NULL) {
+        FreePool(Input.Buffer);
+    }
+
+    if (Input.Prefetch != NULL) {
+        FreePool(Input.Prefetch);
+    }
+
+    if (Workspace != NULL) {
+        FreePool(Workspace);
+    }
+
+    if (EFI_ERROR(Status) && Output.Buffer != NULL) {
+        gBS->FreePages((EFI_PHYSICAL_ADDRESS)Output.Buffer, EFI_SIZE_TO_PAGES(Output.Capacity));
+    }
+
+    return Status;
+}
@@ -0,0 +1,84 @@
+#ifndef __UTIL_DECOMPRESS_DECOMPRESS_H__
+#define __UTIL_DECOMPRESS_DECOMPRESS_H__
+
+#include <Uefi.h>
+#include <Protocol/SimpleFileSystem.h>
+
+#include <util/HashUtils.h>
+
+typedef enum _COMPRESSION_FORMAT {
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_LZ4,
+    COMPRESSION_LZ4_LEGACY,
+    COMPRESSION_ZSTD,
+} COMPRESSION_FORMAT;
+
+// enough bytes to detect the format of a file
+#define COMPRESSION_MAGIC_SIZE 4
+
+/**
+ * Decode on all the processors when the input allows it (PARALLEL_DECOMPRESS)
+ */
+extern BOOLEAN gParallelDecompress;
+
+/**
+ * Detect the compression format from the first bytes of a file
+ */
+COMPRESSION_FORMAT DetectCompression(UINT8* Magic, UINTN Size);
+
+/**
+ * Get the name of the format for printing
+ */
+CHAR16* CompressionName(COMPRESSION_FORMAT Format);
+
+/**
+ * Where the decompressed data goes. The pages are allocated with the given
+ * type below MaxAddress, unless Allocate is set, then it allocates them, so
+ * the caller can place the output where it is going to stay.
+ *
+ * Allocate is called for the first buffer and again for a bigger one if the
+ * output has to grow, the old one is freed with FreePages after the copy.
+ */
+typedef struct _DECOMPRESS_OUTPUT {
+    EFI_MEMORY_TYPE MemoryType;
+    EFI_PHYSICAL_ADDRESS MaxAddress;
+
+    EFI_STATUS (*Allocate)(void* Context, UINTN Pages, EFI_PHYSICAL_ADDRESS* Base);
+    void* Context;
+} DECOMPRESS_OUTPUT;
+
+/**
+ * Decompress a whole file, the compressed data is streamed from the file
+ * and decoded straight into the output pages.
+ *
+ * The output is sized from the frame header when the format has one, and
+ * grown as needed otherwise. The pages that are not used are freed, the
+ * rest are owned by the caller.
+ *
+ * If Hash is not NULL the compressed file is hashed as it is read.
+ */
+EFI_STATUS DecompressFile(EFI_FILE_PROTOCOL* File, COMPRESSION_FORMAT Format, DECOMPRESS_OUTPUT* Pages,
+                          UINTN* Base, UINTN* Size, SHA256_CONTEXT* Hash);
+
+/**
+ * Open a file that may be compressed. Compressed files are decompressed into
+ * memory, and a read only handle on that memory is returned instead, so the
+ * caller can read it like any other file.
+ *
+ * The last decompressed file is kept, so opening it again is free.
+ *
+ * If Sha256 is not NULL the file must have that digest. The file is then read
+ * into memory and checked before anything is returned, even if it is not
+ * compressed, so nothing is parsed before it is verified. The same is done
+ * when measured boot is enabled, and the file is measured when it is read.
+ */
+EFI_STATUS OpenMaybeCompressed(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs, CHAR16* Path, UINT8* Sha256, EFI_FILE_PROTOCOL** File);
+
+/**
+ * Check if a handle from OpenMaybeCompressed is on memory, if it is not then
+ * it is the real file and its parts can be read straight from the disk
+ */
+BOOLEAN IsMemoryFile(EFI_FILE_PROTOCOL* File);
+
+#endif //__UTIL_DECOMPRESS_DECOMPRESS_H__
@@ -0,0 +1,206 @@
+#ifndef __UTIL_DECOMPRESS_DECOMPRESSINTERNAL_H__
+#define __UTIL_DECOMPRESS_DECOMPRESSINTERNAL_H__
+
+#include "Decompress.h"
+
+#include <util/FileUtils.h>
+
+/**
+ * The compressed input, either streamed from a file in chunks or a
+ * buffer that is fully in memory (File is NULL).
+ *
+ * The decoders ask for contiguous ranges of the input, so the buffer
+ * must be big enough for the biggest block of the format.
+ *
+ * When streaming, the next chunk of the file is read into the prefetch
+ * buffer in the background while the decoder works on the current one.
+ * If Hash is set every chunk is hashed as it arrives.
+ */
+typedef struct _INPUT_STREAM {
+    UINT8* Buffer;
+    UINTN Capacity;
+
+    // the valid data in the buffer and how much of it we used
+    UINTN Size;
+    UINTN Position;
+
+    // the file we refill from, and how much of it was requested
+    EFI_FILE_PROTOCOL* File;
+    UINTN FileOffset;
+    UINTN FileSize;
+
+    // the chunk that is read ahead, and how much of it we moved to the buffer
+    UINT8* Prefetch;
+    UINTN PrefetchCapacity;
+    UINTN PrefetchSize;
+    UINTN PrefetchPosition;
+    FILE_ASYNC_READ PrefetchRead;
+
+    SHA256_CONTEXT* Hash;
+} INPUT_STREAM;
+
+/**
+ * The decompressed output, a single flat buffer so back references
+ * can point anywhere in the already decoded data.
+ *
+ * If CanGrow is set the pages are reallocated when the buffer is full.
+ */
+typedef struct _OUTPUT_BUFFER {
+    UINT8* Buffer;
+    UINTN Size;
+    UINTN Capacity;
+
+    BOOLEAN CanGrow;
+    DECOMPRESS_OUTPUT* Pages;
+} OUTPUT_BUFFER;
+
+/**
+ * Make sure at least Size contiguous bytes of input are buffered, and
+ * return a pointer to them without consuming them
+ */
+EFI_STATUS StreamPeek(INPUT_STREAM* Stream, UINTN Size, UINT8** Data);
+
+/**
+ * Same as peek, but consumes the bytes
+ */
+EFI_STATUS StreamRead(INPUT_STREAM* Stream, UINTN Size, UINT8** Data);
+
+/**
+ * Get the next byte of the input
+ */
+EFI_STATUS StreamReadByte(INPUT_STREAM* Stream, UINT8* Byte);
+
+/**
+ * The amount of input that is left, both buffered and in the file
+ */
+UINTN StreamRemaining(INPUT_STREAM* Stream);
+
+/**
+ * Wait for the read ahead, must be done before the buffers are freed
+ */
+void StreamClose(INPUT_STREAM* Stream);
+
+/**
+ * Hash the rest of the file, the decoders may stop before the end of it
+ */
+EFI_STATUS StreamHashRemaining(INPUT_STREAM* Stream);
+
+/**
+ * Allocate output pages the way the caller asked for
+ */
+EFI_STATUS OutputAllocatePages(DECOMPRESS_OUTPUT* Pages, UINTN Count, EFI_PHYSICAL_ADDRESS* Base);
+
+/**
+ * Make sure there is space for Size more bytes in the output
+ */
+EFI_STATUS OutputReserve(OUTPUT_BUFFER* Output, UINTN Size);
+
+/**
+ * Copy a back reference inside of the output, the ranges may overlap in
+ * which case the pattern is repeated. The space must be reserved.
+ */
+void OutputCopyMatch(OUTPUT_BUFFER* Output, UINTN Offset, UINTN Length);
+
+//----------------------------------------------------------------------------------------------------------------------
+// The decoders, each one decodes all the frames until the end of the input
+//----------------------------------------------------------------------------------------------------------------------
+
+/**
+ * The decoders that need scratch memory take it from the caller, so they can
+ * run on the APs where we can't allocate
+ */
+UINTN GzipWorkspaceSize();
+UINTN ZstdWorkspaceSize();
+
+EFI_STATUS GzipDecompress(INPUT_STREAM* Input, OUTPUT_BUFFER* Output, void* Workspace);
+EFI_STATUS Lz4Decompress(INPUT_STREAM* Input, OUTPUT_BUFFER* Output);
+EFI_STATUS Lz4LegacyDecompress(INPUT_STREAM* Input, OUTPUT_BUFFER* Output);
+EFI_STATUS ZstdDecompress(INPUT_STREAM* Input, OUTPUT_BUFFER* Output, void* Workspace);
+
+/**
+ * Get the workspace size of a format, and run its decoder
+ */
+UINTN DecompressWorkspaceSize(COMPRESSION_FORMAT Format);
+EFI_STATUS DecompressStream(COMPRESSION_FORMAT Format, INPUT_STREAM* Input, OUTPUT_BUFFER* Output, void* Workspace);
+
+/**
+ * Decode a single lz4 block that is fully in memory
+ */
+EFI_STATUS Lz4DecodeBlock(UINT8* In, UINTN InSize, OUTPUT_BUFFER* Output);
+
+/**
+ * Get the decompressed size from the header of the first frame, returns
+ * FALSE if the frame does not have it
+ */
+BOOLEAN Lz4GetContentSize(UINT8* Header, UINTN Size, UINT64* ContentSize);
+BOOLEAN ZstdGetContentSize(UINT8* Header, UINTN Size, UINT64* ContentSize);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Splitting the input into units that can be decoded on their own, for decoding on all the processors
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef enum _DECOMPRESS_UNIT_KIND {
+    // only headers, there is nothing to decode
+    UNIT_SKIP,
+
+    // a whole frame, given to the normal decoder of the format
+    UNIT_FRAME,
+
+    // a single lz4 block
+    UNIT_LZ4_BLOCK,
+
+    // data that is stored as is
+    UNIT_STORED,
+
+    // the rest of the input is padding
+    UNIT_END,
+} DECOMPRESS_UNIT_KIND;
+
+typedef struct _DECOMPRESS_UNIT {
+    DECOMPRESS_UNIT_KIND Kind;
+
+    // the part of the input the unit takes, with its headers
+    UINTN InputOffset;
+    UINTN InputSize;
+
+    // the part the decoder needs, relative to the input offset
+    UINTN DataOffset;
+    UINTN DataSize;
+
+    // where the decoded data goes
+    UINTN OutputOffset;
+    UINTN OutputSize;
+} DECOMPRESS_UNIT;
+
+typedef struct _UNIT_SPLITTER {
+    // set once all the input is available
+    BOOLEAN AtEnd;
+
+    // the lz4 frame whose blocks we are splitting
+    BOOLEAN InFrame;
+    UINT8 FrameFlags;
+    UINTN MaxBlockSize;
+} UNIT_SPLITTER;
+
+/**
+ * Find the unit at the start of Data, only the kind and the sizes are set.
+ *
+ * Returns EFI_BUFFER_TOO_SMALL when Data does not have all of the unit yet,
+ * and EFI_UNSUPPORTED when the decoded size can't be known without decoding
+ * it, in which case the input can only be decoded serially.
+ */
+EFI_STATUS Lz4NextUnit(UNIT_SPLITTER* Splitter, UINT8* Data, UINTN Size, DECOMPRESS_UNIT* Unit);
+EFI_STATUS Lz4LegacyNextUnit(UNIT_SPLITTER* Splitter, UINT8* Data, UINTN Size, DECOMPRESS_UNIT* Unit);
+EFI_STATUS ZstdNextUnit(UNIT_SPLITTER* Splitter, UINT8* Data, UINTN Size, DECOMPRESS_UNIT* Unit);
+
+/**
+ * Same as DecompressFile but the units are decoded on all the processors while
+ * the BSP reads the rest of the file.
+ *
+ * Returns EFI_UNSUPPORTED without printing anything if the input or the
+ * platform does not allow it, the caller should decode it serially.
+ */
+EFI_STATUS DecompressFileParallel(EFI_FILE_PROTOCOL* File, COMPRESSION_FORMAT Format, DECOMPRESS_OUTPUT* Pages,
+                                  UINTN* Base, UINTN* Size, SHA256_CONTEXT* Hash);
+
+#endif //__UTIL_DECOMPRESS_DECOMPRESSINTERNAL_H__
@@ -0,0 +1,464 @@
+#include "DecompressInternal.h"
+
+#include <util/Except.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#define GZIP_ID1                0x1F
+#define GZIP_ID2                0x8B
+#define GZIP_CM_DEFLATE         8
+
+#define GZIP_FLG_FHCRC          BIT1
+#define GZIP_FLG_FEXTRA         BIT2
+#define GZIP_FLG_FNAME          BIT3
+#define GZIP_FLG_FCOMMENT       BIT4
+
+#define INFLATE_MAX_BITS        15
+#define INFLATE_MAX_LIT_CODES   288
+#define INFLATE_MAX_DIST_CODES  30
+#define INFLATE_END_OF_BLOCK    256
+
+// codes up to this length are decoded with a single table lookup
+#define INFLATE_FAST_BITS       10
+
+typedef struct _HUFFMAN {
+    UINT16 Count[INFLATE_MAX_BITS + 1];
+    UINT16 Symbol[INFLATE_MAX_LIT_CODES];
+
+    // (symbol << 4) | length, zero if the code is longer than the fast bits
+    UINT16 Fast[1u << INFLATE_FAST_BITS];
+} HUFFMAN;
+
+typedef struct _INFLATE_STATE {
+    INPUT_STREAM* Input;
+    OUTPUT_BUFFER* Output;
+
+    // bits are consumed from the bottom
+    UINT64 BitBuffer;
+    UINTN BitCount;
+
+    HUFFMAN LitCodes;
+    HUFFMAN DistCodes;
+} INFLATE_STATE;
+
+static const UINT16 mLengthBase[] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const UINT8 mLengthExtra[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const UINT16 mDistBase[] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+
+static const UINT8 mDistExtra[] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static const UINT8 mCodeLengthOrder[] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/**
+ * Make sure we have at least Count bits buffered
+ */
+static EFI_STATUS NeedBits(INFLATE_STATE* State, UINTN Count) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8 Byte = 0;
+
+    while (State->BitCount < Count) {
+        CHECK_AND_RETHROW(StreamReadByte(State->Input, &Byte));
+        State->BitBuffer |= (UINT64)Byte << State->BitCount;
+        State->BitCount += 8;
+    }
+
+cleanup:
+    return Status;
+}
+
+static EFI_STATUS GetBits(INFLATE_STATE* State, UINTN Count, UINT32* Value) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    CHECK_AND_RETHROW(NeedBits(State, Count));
+    *Value = (UINT32)(State->BitBuffer & ((1ull << Count) - 1));
+    State->BitBuffer >>= Count;
+    State->BitCount -= Count;
+
+cleanup:
+    return Status;
+}
+
+/**
+ * Build the decoding tables from the code lengths, incomplete codes are
+ * allowed since the format uses them for a single distance code
+ */
+static EFI_STATUS BuildHuffman(HUFFMAN* Huffman, UINT8* Lengths, UINTN Count) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT16 Offsets[INFLATE_MAX_BITS + 2];
+
+    ZeroMem(Huffman->Count, sizeof(Huffman->Count));
+    for (UINTN Sym = 0; Sym < Count; Sym++) {
+        Huffman->Count[Lengths[Sym]]++;
+    }
+    Huffman->Count[0] = 0;
+
+    // make sure the code is not over subscribed
+    INTN Left = 1;
+    for (UINTN Len = 1; Len <= INFLATE_MAX_BITS; Len++) {
+        Left <<= 1;
+        Left -= Huffman->Count[Len];
+        CHECK_TRACE(Left >= 0, "Invalid deflate code lengths");
+    }
+
+    // sort the symbols by length
+    Offsets[1] = 0;
+    for (UINTN Len = 1; Len <= INFLATE_MAX_BITS; Len++) {
+        Offsets[Len + 1] = Offsets[Len] + Huffman->Count[Len];
+    }
+    for (UINTN Sym = 0; Sym < Count; Sym++) {
+        if (Lengths[Sym] != 0) {
+            Huffman->Symbol[Offsets[Lengths[Sym]]++] = Sym;
+        }
+    }
+
+    // fill the fast table, the codes are stored reversed in the stream
+    ZeroMem(Huffman->Fast, sizeof(Huffman->Fast));
+    UINT32 Code = 0;
+    UINTN Index = 0;
+    for (UINTN Len = 1; Len <= INFLATE_FAST_BITS; Len++) {
+        for (UINTN i = 0; i < Huffman->Count[Len]; i++, Code++) {
+            UINT32 Reversed = 0;
+            for (UINTN Bit = 0; Bit < Len; Bit++) {
+                Reversed |= ((Code >> Bit) & 1u) << (Len - 1 - Bit);
+            }
+
+            UINT16 Entry = (Huffman->Symbol[Index++] << 4u) | Len;
+            for (UINT32 Fill = Reversed; Fill < (1u << INFLATE_FAST_BITS); Fill += 1u << Len) {
+                Huffman->Fast[Fill] = Entry;
+            }
+        }
+        Code <<= 1u;
+    }
+
+cleanup:
+    return Status;
+}
+
+static EFI_STATUS Decode(INFLATE_STATE* State, HUFFMAN* Huffman, UINT32* Symbol) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8 Byte = 0;
+
+    // get as many bits as we can for the fast path, the end of the
+    // stream may not have enough of them
+    while (State->BitCount < INFLATE_FAST_BITS && StreamRemaining(State->Input) != 0) {
+        CHECK_AND_RETHROW(StreamReadByte(State->Input, &Byte));
+        State->BitBuffer |= (UINT64)Byte << State->BitCount;
+        State->BitCount += 8;
+    }
+
+    UINT16 Entry = Huffman->Fast[State->BitBuffer & ((1u << INFLATE_FAST_BITS) - 1)];
+    if (Entry != 0 && (Entry & 0xF) <= State->BitCount) {
+        State->BitBuffer >>= Entry & 0xF;
+        State->BitCount -= Entry & 0xF;
+        *Symbol = Entry >> 4u;
+        goto cleanup;
+    }
+
+    // slow path, walk the code bit by bit
+    INT32 Code = 0;
+    INT32 First = 0;
+    INT32 Index = 0;
+    for (UINTN Len = 1; Len <= INFLATE_MAX_BITS; Len++) {
+        UINT32 Bit = 0;
+        CHECK_AND_RETHROW(GetBits(State, 1, &Bit));
+        Code |= Bit;
+
+        INT32 Count = Huffman->Count[Len];
+        if (Code - Count < First) {
+            *Symbol = Huffman->Symbol[Index + (Code - First)];
+            goto cleanup;
+        }
+
+        Index += Count;
+        First += Count;
+        First <<= 1;
+        Code <<= 1;
+    }
+
+    CHECK_FAIL_TRACE("Invalid deflate code");
+
+cleanup:
+    return Status;
+}
+
+static EFI_STATUS InflateStored(INFLATE_STATE* State) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT32 Length = 0;
+    UINT32 NLength = 0;
+    UINT32 Byte = 0;
+    UINT8* Data = NULL;
+
+    // go to a byte boundary
+    State->BitBuffer >>= State->BitCount % 8;
+    State->BitCount -= State->BitCount % 8;
+
+    CHECK_AND_RETHROW(GetBits(State, 16, &Length));
+    CHECK_AND_RETHROW(GetBits(State, 16, &NLength));
+    CHECK_TRACE(Length == (~NLength & 0xFFFF), "Invalid stored block length");
+    CHECK_AND_RETHROW(OutputReserve(State->Output, Length));
+
+    // take the bytes we already buffered first
+    while (Length != 0 && State->BitCount != 0) {
+        CHECK_AND_RETHROW(GetBits(State, 8, &Byte));
+        State->Output->Buffer[State->Output->Size++] = Byte;
+        Length--;
+    }
+
+    CHECK_AND_RETHROW(StreamRead(State->Input, Length, &Data));
+    CopyMem(State->Output->Buffer + State->Output->Size, Data, Length);
+    State->Output->Size += Length;
+
+cleanup:
+    return Status;
+}
+
+static EFI_STATUS InflateCodes(INFLATE_STATE* State) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    OUTPUT_BUFFER* Output = State->Output;
+    UINT32 Symbol = 0;
+    UINT32 Extra = 0;
+
+    while (TRUE) {
+        CHECK_AND_RETHROW(Decode(State, &State->LitCodes, &Symbol));
+
+        if (Symbol < INFLATE_END_OF_BLOCK) {
+            CHECK_AND_RETHROW(OutputReserve(Output, 1));
+            Output->Buffer[Output->Size++] = Symbol;
+            continue;
+        }
+
+        if (Symbol == INFLATE_END_OF_BLOCK) {
+            break;
+        }
+
+        // get the length
+        Symbol -= INFLATE_END_OF_BLOCK + 1;
+        CHECK(Symbol < ARRAY_SIZE(mLengthBase));
+        CHECK_AND_RETHROW(GetBits(State, mLengthExtra[Symbol], &Extra));
+        UINTN Length = mLengthBase[Symbol] + Extra;
+
+        // get the distance
+        CHECK_AND_RETHROW(Decode(State, &State->DistCodes, &Symbol));
+        CHECK(Symbol < ARRAY_SIZE(mDistBase));
+        CHECK_AND_RETHROW(GetBits(State, mDistExtra[Symbol], &Extra));
+        UINTN Distance = mDistBase[Symbol] + Extra;
+        CHECK_TRACE(Distance <= Output->Size, "Invalid deflate distance %d", Distance);
+
+        CHECK_AND_RETHROW(OutputReserve(Output, Length));
+        OutputCopyMatch(Output, Distance, Length);
+    }
+
+cleanup:
+    return Status;
+}
+
+static EFI_STATUS InflateFixed(INFLATE_STATE* State) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8 Lengths[INFLATE_MAX_LIT_CODES];
+
+    UINTN Sym = 0;
+    for (; Sym < 144; Sym++) Lengths[Sym] = 8;
+    for (; Sym < 256; Sym++) Lengths[Sym] = 9;
+    for (; Sym < 280; Sym++) Lengths[Sym] = 7;
+    for (; Sym < INFLATE_MAX_LIT_CODES; Sym++) Lengths[Sym] = 8;
+    CHECK_AND_RETHROW(BuildHuffman(&State->LitCodes, Lengths, INFLATE_MAX_LIT_CODES));
+
+    SetMem(Lengths, INFLATE_MAX_DIST_CODES, 5);
+    CHECK_AND_RETHROW(BuildHuffman(&State->DistCodes, Lengths, INFLATE_MAX_DIST_CODES));
+
+    CHECK_AND_RETHROW(InflateCodes(State));
+
+cleanup:
+    return Status;
+}
+
+static EFI_STATUS InflateDynamic(INFLATE_STATE* State) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8 Lengths[INFLATE_MAX_LIT_CODES + INFLATE_MAX_DIST_CODES];
+    UINT32 LitCount = 0;
+    UINT32 DistCount = 0;
+    UINT32 CodeCount = 0;
+    UINT32 Value = 0;
+
+    CHECK_AND_RETHROW(GetBits(State, 5, &LitCount));
+    CHECK_AND_RETHROW(GetBits(State, 5, &DistCount));
+    CHECK_AND_RETHROW(GetBits(State, 4, &CodeCount));
+    LitCount += 257;
+    DistCount += 1;
+    CodeCount += 4;
+    CHECK(LitCount <= INFLATE_MAX_LIT_CODES && DistCount <= INFLATE_MAX_DIST_CODES);
+
+    // the code length code, the lit table is used for it temporarily
+    ZeroMem(Lengths, sizeof(Lengths));
+    for (UINTN i = 0; i < CodeCount; i++) {
+        CHECK_AND_RETHROW(GetBits(State, 3, &Value));
+        Lengths[mCodeLengthOrder[i]] = Value;
+    }
+    CHECK_AND_RETHROW(BuildHuffman(&State->LitCodes, Lengths, ARRAY_SIZE(mCodeLengthOrder)));
+
+    // read the lengths of both codes
+    UINTN Index = 0;
+    while (Index < LitCount + DistCount) {
+        UINT32 Symbol = 0;
+        CHECK_AND_RETHROW(Decode(State, &State->LitCodes, &Symbol));
+
+        if (Symbol < 16) {
+            Lengths[Index++] = Symbol;
+            continue;
+        }
+
+        UINT8 Repeat = 0;
+        UINTN Times = 0;
+        if (Symbol == 16) {
+            CHECK(Index != 0);
+            Repeat = Lengths[Index - 1];
+            CHECK_AND_RETHROW(GetBits(State, 2, &Value));
+            Times = 3 + Value;
+        } else if (Symbol == 17) {
+            CHECK_AND_RETHROW(GetBits(State, 3, &Value));
+            Times = 3 + Value;
+        } else {
+            CHECK_AND_RETHROW(GetBits(State, 7, &Value));
+            Times = 11 + Value;
+        }
+
+        CHECK(Index + Times <= LitCount + DistCount);
+        SetMem(&Lengths[Index], Times, Repeat);
+        Index += Times;
+    }
+
+    CHECK_TRACE(Lengths[INFLATE_END_OF_BLOCK] != 0, "Missing end of block code");
+    CHECK_AND_RETHROW(BuildHuffman(&State->LitCodes, Lengths, LitCount));
+    CHECK_AND_RETHROW(BuildHuffman(&State->DistCodes, Lengths + LitCount, DistCount));
+
+    CHECK_AND_RETHROW(InflateCodes(State));
+
+cleanup:
+    return Status;
+}
+
+static EFI_STATUS Inflate(INFLATE_STATE* State) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT32 Last = 0;
+    UINT32 Type = 0;
+
+    do {
+        CHECK_AND_RETHROW(GetBits(State, 1, &Last));
+        CHECK_AND_RETHROW(GetBits(State, 2, &Type));
+
+        switch (Type) {
+            case 0: CHECK_AND_RETHROW(InflateStored(State)); break;
+            case 1: CHECK_AND_RETHROW(InflateFixed(State)); break;
+            case 2: CHECK_AND_RETHROW(InflateDynamic(State)); break;
+            default: CHECK_FAIL_TRACE("Invalid deflate block type");
+        }
+    } while (!Last);
+
+cleanup:
+    return Status;
+}
+
+static EFI_STATUS GetLE32(INFLATE_STATE* State, UINT32* Value) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT32 Low = 0;
+    UINT32 High = 0;
+
+    CHECK_AND_RETHROW(GetBits(State, 16, &Low));
+    CHECK_AND_RETHROW(GetBits(State, 16, &High));
+    *Value = Low | (High << 16u);
+
+cleanup:
+    return Status;
+}
+
+UINTN GzipWorkspaceSize() {
+    return sizeof(INFLATE_STATE);
+}
+
+EFI_STATUS GzipDecompress(INPUT_STREAM* Input, OUTPUT_BUFFER* Output, void* Workspace) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    INFLATE_STATE* State = Workspace;
+    UINT32 Value = 0;
+
+    ZeroMem(State, sizeof(INFLATE_STATE));
+    State->Input = Input;
+    State->Output = Output;
+
+    // there can be multiple members one after the other
+    do {
+        UINTN MemberStart = Output->Size;
+
+        // the header, everything here is byte aligned
+        UINT32 Id1 = 0, Id2 = 0, Method = 0, Flags = 0;
+        CHECK_AND_RETHROW(GetBits(State, 8, &Id1));
+
+        // allow padding after the last member
+        if (Id1 != GZIP_ID1 && MemberStart != 0) {
+            break;
+        }
+
+        CHECK_AND_RETHROW(GetBits(State, 8, &Id2));
+        CHECK_AND_RETHROW(GetBits(State, 8, &Method));
+        CHECK_AND_RETHROW(GetBits(State, 8, &Flags));
+        CHECK_TRACE(Id1 == GZIP_ID1 && Id2 == GZIP_ID2, "Invalid gzip magic");
+        CHECK_TRACE(Method == GZIP_CM_DEFLATE, "Unsupported gzip method %d", Method);
+
+        // mtime, xfl and os
+        CHECK_AND_RETHROW(GetLE32(State, &Value));
+        CHECK_AND_RETHROW(GetBits(State, 16, &Value));
+
+        if (Flags & GZIP_FLG_FEXTRA) {
+            UINT32 ExtraLength = 0;
+            CHECK_AND_RETHROW(GetBits(State, 16, &ExtraLength));
+            while (ExtraLength--) {
+                CHECK_AND_RETHROW(GetBits(State, 8, &Value));
+            }
+        }
+
+        if (Flags & GZIP_FLG_FNAME) {
+            do {
+                CHECK_AND_RETHROW(GetBits(State, 8, &Value));
+            } while (Value != 0);
+        }
+
+        if (Flags & GZIP_FLG_FCOMMENT) {
+            do {
+                CHECK_AND_RETHROW(GetBits(State, 8, &Value));
+            } while (Value != 0);
+        }
+
+        if (Flags & GZIP_FLG_FHCRC) {
+            CHECK_AND_RETHROW(GetBits(State, 16, &Value));
+        }
+
+        CHECK_AND_RETHROW(Inflate(State));
+
+        // the trailer is byte aligned, we skip the crc but the size is
+        // cheap to check
+        State->BitBuffer >>= State->BitCount % 8;
+        State->BitCount -= State->BitCount % 8;
+        CHECK_AND_RETHROW(GetLE32(State, &Value));
+        CHECK_AND_RETHROW(GetLE32(State, &Value));
+        CHECK_TRACE(Value == (UINT32)(Output->Size - MemberStart), "gzip size mismatch");
+    } while (State->BitCount != 0 || StreamRemaining(Input) != 0);
+
+cleanup:
+    return Status;
+}
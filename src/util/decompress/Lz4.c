@@ -0,0 +1,432 @@
+#include "DecompressInternal.h"
+
+#include <util/Except.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#define LZ4_MAGIC                   0x184D2204
+#define LZ4_LEGACY_MAGIC            0x184C2102
+#define LZ4_SKIPPABLE_MAGIC         0x184D2A50
+#define LZ4_SKIPPABLE_MASK          0xFFFFFFF0
+
+#define LZ4_FLG_VERSION(flg)        ((flg) >> 6)
+#define LZ4_FLG_BLOCK_INDEPENDENT   BIT5
+#define LZ4_FLG_BLOCK_CHECKSUM      BIT4
+#define LZ4_FLG_CONTENT_SIZE        BIT3
+#define LZ4_FLG_CONTENT_CHECKSUM    BIT2
+#define LZ4_FLG_DICT_ID             BIT0
+#define LZ4_BD_BLOCK_MAX(bd)        (((bd) >> 4) & 7)
+
+#define LZ4_BLOCK_UNCOMPRESSED      BIT31
+
+#define LZ4_MIN_MATCH               4
+
+// the legacy format always uses 8MB blocks, and the compressed block can be a bit bigger
+#define LZ4_LEGACY_BLOCK_SIZE       SIZE_8MB
+#define LZ4_LEGACY_MAX_COMPRESSED   (LZ4_LEGACY_BLOCK_SIZE + LZ4_LEGACY_BLOCK_SIZE / 255 + 16)
+
+/**
+ * Read an lz4 length, the extra bytes are added as long as they are 255
+ */
+static EFI_STATUS Lz4ReadLength(UINT8** In, UINT8* End, UINTN* Length) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8 Byte = 0;
+
+    do {
+        CHECK(*In < End);
+        Byte = *(*In)++;
+        *Length += Byte;
+    } while (Byte == 255);
+
+cleanup:
+    return Status;
+}
+
+EFI_STATUS Lz4DecodeBlock(UINT8* In, UINTN InSize, OUTPUT_BUFFER* Output) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8* End = In + InSize;
+
+    while (In < End) {
+        UINT8 Token = *In++;
+
+        // copy the literals
+        UINTN Length = Token >> 4;
+        if (Length == 15) {
+            CHECK_AND_RETHROW(Lz4ReadLength(&In, End, &Length));
+        }
+        CHECK(Length <= End - In);
+        CHECK_AND_RETHROW(OutputReserve(Output, Length));
+        CopyMem(Output->Buffer + Output->Size, In, Length);
+        Output->Size += Length;
+        In += Length;
+
+        // the last sequence only has literals
+        if (In == End) {
+            break;
+        }
+
+        // copy the match
+        CHECK(End - In >= 2);
+        UINTN Offset = In[0] | (In[1] << 8u);
+        In += 2;
+        CHECK_TRACE(Offset != 0 && Offset <= Output->Size, "Invalid match offset %d", Offset);
+
+        Length = Token & 0xF;
+        if (Length == 15) {
+            CHECK_AND_RETHROW(Lz4ReadLength(&In, End, &Length));
+        }
+        Length += LZ4_MIN_MATCH;
+        CHECK_AND_RETHROW(OutputReserve(Output, Length));
+        OutputCopyMatch(Output, Offset, Length);
+    }
+
+cleanup:
+    return Status;
+}
+
+/**
+ * Get the decoded size of a block by only walking its sequences
+ */
+static EFI_STATUS Lz4BlockDecodedSize(UINT8* In, UINTN InSize, UINTN* Size) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8* End = In + InSize;
+
+    *Size = 0;
+    while (In < End) {
+        UINT8 Token = *In++;
+
+        UINTN Length = Token >> 4;
+        if (Length == 15) {
+            CHECK_AND_RETHROW(Lz4ReadLength(&In, End, &Length));
+        }
+        CHECK(Length <= End - In);
+        In += Length;
+        *Size += Length;
+
+        if (In == End) {
+            break;
+        }
+
+        CHECK(End - In >= 2);
+        In += 2;
+
+        Length = Token & 0xF;
+        if (Length == 15) {
+            CHECK_AND_RETHROW(Lz4ReadLength(&In, End, &Length));
+        }
+        *Size += Length + LZ4_MIN_MATCH;
+    }
+
+cleanup:
+    return Status;
+}
+
+/**
+ * Skip data that may be bigger than the stream buffer
+ */
+static EFI_STATUS Lz4Skip(INPUT_STREAM* Input, UINTN Size) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8* Data = NULL;
+
+    while (Size != 0) {
+        UINTN Chunk = MIN(Size, Input->Capacity);
+        CHECK_AND_RETHROW(StreamRead(Input, Chunk, &Data));
+        Size -= Chunk;
+    }
+
+cleanup:
+    return Status;
+}
+
+BOOLEAN Lz4GetContentSize(UINT8* Header, UINTN Size, UINT64* ContentSize) {
+    if (Size < 14 || *(UINT32*)Header != LZ4_MAGIC || !(Header[4] & LZ4_FLG_CONTENT_SIZE)) {
+        return FALSE;
+    }
+
+    *ContentSize = *(UINT64*)&Header[6];
+    return TRUE;
+}
+
+EFI_STATUS Lz4Decompress(INPUT_STREAM* Input, OUTPUT_BUFFER* Output) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8* Data = NULL;
+
+    // there can be multiple frames one after the other
+    while (StreamRemaining(Input) != 0) {
+        CHECK_AND_RETHROW(StreamRead(Input, 4, &Data));
+        UINT32 Magic = *(UINT32*)Data;
+
+        if ((Magic & LZ4_SKIPPABLE_MASK) == LZ4_SKIPPABLE_MAGIC) {
+            CHECK_AND_RETHROW(StreamRead(Input, 4, &Data));
+            CHECK_AND_RETHROW(Lz4Skip(Input, *(UINT32*)Data));
+            continue;
+        }
+        CHECK_TRACE(Magic == LZ4_MAGIC, "Invalid lz4 frame magic %x", Magic);
+
+        // parse the frame descriptor
+        CHECK_AND_RETHROW(StreamRead(Input, 2, &Data));
+        UINT8 Flg = Data[0];
+        UINT8 Bd = Data[1];
+        CHECK_TRACE(LZ4_FLG_VERSION(Flg) == 1, "Unsupported lz4 frame version");
+        CHECK_TRACE(!(Flg & LZ4_FLG_DICT_ID), "lz4 dictionaries are not supported");
+        CHECK(LZ4_BD_BLOCK_MAX(Bd) >= 4);
+        UINTN MaxBlockSize = 1ull << (2 * LZ4_BD_BLOCK_MAX(Bd) + 8);
+
+        // skip the content size and header checksum
+        CHECK_AND_RETHROW(StreamRead(Input, ((Flg & LZ4_FLG_CONTENT_SIZE) ? 8 : 0) + 1, &Data));
+
+        // decode all the blocks, we don't check the checksums since
+        // that would cost more than the decoding itself
+        while (TRUE) {
+            CHECK_AND_RETHROW(StreamRead(Input, 4, &Data));
+            UINT32 BlockSize = *(UINT32*)Data;
+
+            // end mark
+            if (BlockSize == 0) {
+                break;
+            }
+
+            BOOLEAN Uncompressed = (BlockSize & LZ4_BLOCK_UNCOMPRESSED) != 0;
+            BlockSize &= ~LZ4_BLOCK_UNCOMPRESSED;
+            CHECK_TRACE(BlockSize <= MaxBlockSize, "lz4 block is too big (%d bytes)", BlockSize);
+
+            CHECK_AND_RETHROW(StreamRead(Input, BlockSize, &Data));
+            if (Uncompressed) {
+                CHECK_AND_RETHROW(OutputReserve(Output, BlockSize));
+                CopyMem(Output->Buffer + Output->Size, Data, BlockSize);
+                Output->Size += BlockSize;
+            } else {
+                CHECK_AND_RETHROW(Lz4DecodeBlock(Data, BlockSize, Output));
+            }
+
+            if (Flg & LZ4_FLG_BLOCK_CHECKSUM) {
+                CHECK_AND_RETHROW(StreamRead(Input, 4, &Data));
+            }
+        }
+
+        if (Flg & LZ4_FLG_CONTENT_CHECKSUM) {
+            CHECK_AND_RETHROW(StreamRead(Input, 4, &Data));
+        }
+    }
+
+cleanup:
+    return Status;
+}
+
+/**
+ * Make a unit out of a single block, the size is right before it
+ */
+static EFI_STATUS Lz4BlockUnit(UINT8* Data, UINTN Size, UINTN MaxBlockSize, UINTN Trailer, DECOMPRESS_UNIT* Unit) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    UINT32 BlockSize = *(UINT32*)Data;
+    BOOLEAN Uncompressed = (BlockSize & LZ4_BLOCK_UNCOMPRESSED) != 0;
+    BlockSize &= ~LZ4_BLOCK_UNCOMPRESSED;
+    CHECK_TRACE(BlockSize <= MaxBlockSize, "lz4 block is too big (%d bytes)", BlockSize);
+
+    Unit->InputSize = 4 + BlockSize + Trailer;
+    if (Unit->InputSize > Size) {
+        Status = EFI_BUFFER_TOO_SMALL;
+        goto cleanup;
+    }
+
+    Unit->DataOffset = 4;
+    Unit->DataSize = BlockSize;
+    if (Uncompressed) {
+        Unit->Kind = UNIT_STORED;
+        Unit->OutputSize = BlockSize;
+    } else {
+        Unit->Kind = UNIT_LZ4_BLOCK;
+        CHECK_AND_RETHROW(Lz4BlockDecodedSize(Data + 4, BlockSize, &Unit->OutputSize));
+    }
+
+cleanup:
+    return Status;
+}
+
+EFI_STATUS Lz4NextUnit(UNIT_SPLITTER* Splitter, UINT8* Data, UINTN Size, DECOMPRESS_UNIT* Unit) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    ZeroMem(Unit, sizeof(*Unit));
+
+    // a block or the end mark of the frame we are in
+    if (Splitter->InFrame) {
+        if (Size < 4) {
+            Status = EFI_BUFFER_TOO_SMALL;
+            goto cleanup;
+        }
+
+        if (*(UINT32*)Data == 0) {
+            Unit->Kind = UNIT_SKIP;
+            Unit->InputSize = 4 + ((Splitter->FrameFlags & LZ4_FLG_CONTENT_CHECKSUM) ? 4 : 0);
+            if (Unit->InputSize > Size) {
+                Status = EFI_BUFFER_TOO_SMALL;
+                goto cleanup;
+            }
+            Splitter->InFrame = FALSE;
+        } else {
+            UINTN Trailer = (Splitter->FrameFlags & LZ4_FLG_BLOCK_CHECKSUM) ? 4 : 0;
+            Status = Lz4BlockUnit(Data, Size, Splitter->MaxBlockSize, Trailer, Unit);
+        }
+        goto cleanup;
+    }
+
+    if (Size < 8) {
+        Status = EFI_BUFFER_TOO_SMALL;
+        goto cleanup;
+    }
+
+    UINT32 Magic = *(UINT32*)Data;
+    if ((Magic & LZ4_SKIPPABLE_MASK) == LZ4_SKIPPABLE_MAGIC) {
+        Unit->Kind = UNIT_SKIP;
+        Unit->InputSize = 8 + (UINTN)*(UINT32*)&Data[4];
+        if (Unit->InputSize > Size) {
+            Status = EFI_BUFFER_TOO_SMALL;
+        }
+        goto cleanup;
+    }
+    CHECK_TRACE(Magic == LZ4_MAGIC, "Invalid lz4 frame magic %x", Magic);
+
+    UINT8 Flg = Data[4];
+    UINT8 Bd = Data[5];
+    CHECK_TRACE(LZ4_FLG_VERSION(Flg) == 1, "Unsupported lz4 frame version");
+    CHECK(LZ4_BD_BLOCK_MAX(Bd) >= 4);
+
+    // let the serial decoder complain about it
+    if (Flg & LZ4_FLG_DICT_ID) {
+        Status = EFI_UNSUPPORTED;
+        goto cleanup;
+    }
+
+    UINTN HeaderSize = 4 + 2 + ((Flg & LZ4_FLG_CONTENT_SIZE) ? 8 : 0) + 1;
+    if (HeaderSize > Size) {
+        Status = EFI_BUFFER_TOO_SMALL;
+        goto cleanup;
+    }
+
+    // the blocks are independent, each one of them is a unit
+    if (Flg & LZ4_FLG_BLOCK_INDEPENDENT) {
+        Unit->Kind = UNIT_SKIP;
+        Unit->InputSize = HeaderSize;
+        Splitter->InFrame = TRUE;
+        Splitter->FrameFlags = Flg;
+        Splitter->MaxBlockSize = 1ull << (2 * LZ4_BD_BLOCK_MAX(Bd) + 8);
+        goto cleanup;
+    }
+
+    // the blocks reference each other, so the whole frame is a single
+    // unit, and we can only place it if we know its size
+    UINT64 ContentSize = 0;
+    if (!Lz4GetContentSize(Data, Size, &ContentSize)) {
+        Status = EFI_UNSUPPORTED;
+        goto cleanup;
+    }
+
+    UINTN Offset = HeaderSize;
+    UINTN Trailer = (Flg & LZ4_FLG_BLOCK_CHECKSUM) ? 4 : 0;
+    while (TRUE) {
+        if (Offset + 4 > Size) {
+            Status = EFI_BUFFER_TOO_SMALL;
+            goto cleanup;
+        }
+
+        UINT32 BlockSize = *(UINT32*)&Data[Offset];
+        Offset += 4;
+        if (BlockSize == 0) {
+            break;
+        }
+        Offset += (BlockSize & ~LZ4_BLOCK_UNCOMPRESSED) + Trailer;
+    }
+    Offset += (Flg & LZ4_FLG_CONTENT_CHECKSUM) ? 4 : 0;
+
+    Unit->Kind = UNIT_FRAME;
+    Unit->InputSize = Offset;
+    Unit->DataSize = Offset;
+    Unit->OutputSize = ContentSize;
+    if (Unit->InputSize > Size) {
+        Status = EFI_BUFFER_TOO_SMALL;
+    }
+
+cleanup:
+    return Status;
+}
+
+EFI_STATUS Lz4LegacyNextUnit(UNIT_SPLITTER* Splitter, UINT8* Data, UINTN Size, DECOMPRESS_UNIT* Unit) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    ZeroMem(Unit, sizeof(*Unit));
+
+    // same as the serial decoder, anything shorter than a block size is ignored
+    if (Size < 4) {
+        if (Splitter->AtEnd) {
+            Unit->Kind = UNIT_END;
+        } else {
+            Status = EFI_BUFFER_TOO_SMALL;
+        }
+        goto cleanup;
+    }
+
+    // the first magic
+    if (!Splitter->InFrame) {
+        CHECK_TRACE(*(UINT32*)Data == LZ4_LEGACY_MAGIC, "Invalid lz4 legacy magic");
+        Unit->Kind = UNIT_SKIP;
+        Unit->InputSize = 4;
+        Splitter->InFrame = TRUE;
+        goto cleanup;
+    }
+
+    UINT32 BlockSize = *(UINT32*)Data;
+    if (BlockSize == LZ4_LEGACY_MAGIC) {
+        Unit->Kind = UNIT_SKIP;
+        Unit->InputSize = 4;
+    } else if (BlockSize == 0) {
+        Unit->Kind = UNIT_END;
+    } else {
+        CHECK_TRACE(BlockSize <= LZ4_LEGACY_MAX_COMPRESSED, "lz4 block is too big (%d bytes)", BlockSize);
+        Unit->InputSize = 4 + BlockSize;
+        if (Unit->InputSize > Size) {
+            Status = EFI_BUFFER_TOO_SMALL;
+            goto cleanup;
+        }
+
+        Unit->Kind = UNIT_LZ4_BLOCK;
+        Unit->DataOffset = 4;
+        Unit->DataSize = BlockSize;
+        CHECK_AND_RETHROW(Lz4BlockDecodedSize(Data + 4, BlockSize, &Unit->OutputSize));
+    }
+
+cleanup:
+    return Status;
+}
+
+EFI_STATUS Lz4LegacyDecompress(INPUT_STREAM* Input, OUTPUT_BUFFER* Output) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8* Data = NULL;
+
+    CHECK_AND_RETHROW(StreamRead(Input, 4, &Data));
+    CHECK_TRACE(*(UINT32*)Data == LZ4_LEGACY_MAGIC, "Invalid lz4 legacy magic");
+
+    // the legacy format has no end mark, it just goes until the end of the
+    // file, a new magic can appear in the middle when files are concatenated
+    while (StreamRemaining(Input) >= 4) {
+        CHECK_AND_RETHROW(StreamRead(Input, 4, &Data));
+        UINT32 BlockSize = *(UINT32*)Data;
+
+        if (BlockSize == LZ4_LEGACY_MAGIC) {
+            continue;
+        }
+
+        // padding after the data
+        if (BlockSize == 0) {
+            break;
+        }
+
+        CHECK_TRACE(BlockSize <= LZ4_LEGACY_MAX_COMPRESSED, "lz4 block is too big (%d bytes)", BlockSize);
+        CHECK_AND_RETHROW(StreamRead(Input, BlockSize, &Data));
+        CHECK_AND_RETHROW(Lz4DecodeBlock(Data, BlockSize, Output));
+    }
+
+cleanup:
+    return Status;
+}
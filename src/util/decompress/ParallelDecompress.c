@@ -0,0 +1,393 @@
+#include "DecompressInternal.h"
+
+#include <util/Except.h>
+#include <util/FileUtils.h>
+
+#include <Protocol/MpService.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/FileHandleLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/SynchronizationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+// how much we read from the disk at a time
+#define READ_CHUNK_SIZE     SIZE_4MB
+
+// the amount of units that can wait for a worker, the reader
+// helps decoding when the queue is full
+#define QUEUE_SIZE          256
+
+// the output guess, same as the serial decoder
+#define DEFAULT_RATIO       4
+
+BOOLEAN gParallelDecompress = FALSE;
+
+/**
+ * The state shared by the reader (the BSP) and the workers (the APs, and the
+ * BSP whenever it has nothing to read).
+ *
+ * The queue is a ring with a single producer and many consumers:
+ *  - the reader waits for the slot at Tail to be free, fills it, marks it
+ *    busy and then moves Tail
+ *  - a worker claims the unit at Head by moving Head with a compare exchange,
+ *    and takes a copy of it
+ *  - a worker frees the slot of its unit once the unit is decoded, and
+ *    increments Completed. The units finish out of order, so the reader
+ *    looks at the slot and not at Completed before it reuses it
+ */
+typedef struct _PARALLEL_CONTEXT {
+    DECOMPRESS_UNIT Queue[QUEUE_SIZE];
+    volatile BOOLEAN Busy[QUEUE_SIZE];
+    volatile UINT32 Head;
+    volatile UINT32 Tail;
+    volatile UINT32 Completed;
+
+    // set once no more units are going to be queued
+    volatile BOOLEAN Done;
+
+    // the first unit that failed, the rest are skipped
+    volatile UINT32 Failed;
+    DECOMPRESS_UNIT FailedUnit;
+
+    COMPRESSION_FORMAT Format;
+    UINT8* Input;
+
+    // only changes while no unit is being decoded
+    UINT8* volatile Output;
+
+    // a workspace for each processor
+    UINT8* Workspaces;
+    UINTN WorkspaceSize;
+    UINTN WorkspaceCount;
+    volatile UINT32 NextWorkspace;
+} PARALLEL_CONTEXT;
+
+static EFI_STATUS DecodeUnit(PARALLEL_CONTEXT* Ctx, DECOMPRESS_UNIT* Unit, void* Workspace) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8* Data = Ctx->Input + Unit->InputOffset + Unit->DataOffset;
+    OUTPUT_BUFFER Output = {
+        .Buffer = Ctx->Output + Unit->OutputOffset,
+        .Capacity = Unit->OutputSize,
+        .CanGrow = FALSE
+    };
+
+    switch (Unit->Kind) {
+        case UNIT_STORED:
+            CHECK(Unit->DataSize == Unit->OutputSize);
+            CopyMem(Output.Buffer, Data, Unit->DataSize);
+            Output.Size = Unit->DataSize;
+            break;
+
+        case UNIT_LZ4_BLOCK:
+            CHECK_AND_RETHROW(Lz4DecodeBlock(Data, Unit->DataSize, &Output));
+            break;
+
+        case UNIT_FRAME: {
+            INPUT_STREAM Input = { .Buffer = Data, .Capacity = Unit->DataSize, .Size = Unit->DataSize };
+            CHECK_AND_RETHROW(DecompressStream(Ctx->Format, &Input, &Output, Workspace));
+        } break;
+
+        default:
+            CHECK_FAIL_TRACE("Invalid unit kind %d", Unit->Kind);
+    }
+
+    CHECK_TRACE(Output.Size == Unit->OutputSize, "Unit decoded to %d bytes instead of %d", Output.Size, Unit->OutputSize);
+
+cleanup:
+    return Status;
+}
+
+static void* ClaimWorkspace(PARALLEL_CONTEXT* Ctx) {
+    UINT32 Index = InterlockedIncrement(&Ctx->NextWorkspace) - 1;
+    if (Ctx->Workspaces == NULL) {
+        return NULL;
+    }
+    return Ctx->Workspaces + Index * Ctx->WorkspaceSize;
+}
+
+/**
+ * Decode the next unit in the queue, returns FALSE if the queue is empty
+ */
+static BOOLEAN DecodeNextUnit(PARALLEL_CONTEXT* Ctx, void* Workspace) {
+    UINT32 Head = Ctx->Head;
+    if (Head == Ctx->Tail) {
+        return FALSE;
+    }
+
+    // someone else got it, but there might be more
+    if (InterlockedCompareExchange32(&Ctx->Head, Head, Head + 1) != Head) {
+        return TRUE;
+    }
+
+    DECOMPRESS_UNIT Unit = Ctx->Queue[Head % QUEUE_SIZE];
+    if (Ctx->Failed == 0 && EFI_ERROR(DecodeUnit(Ctx, &Unit, Workspace))) {
+        if (InterlockedCompareExchange32(&Ctx->Failed, 0, 1) == 0) {
+            Ctx->FailedUnit = Unit;
+        }
+    }
+
+    // the output is written before anyone sees the unit as done
+    MemoryFence();
+    Ctx->Busy[Head % QUEUE_SIZE] = FALSE;
+    InterlockedIncrement(&Ctx->Completed);
+    return TRUE;
+}
+
+/**
+ * The AP procedure, decodes until the reader is done and the queue is empty
+ */
+static void EFIAPI DecodeWorker(void* Arg) {
+    PARALLEL_CONTEXT* Ctx = Arg;
+    void* Workspace = ClaimWorkspace(Ctx);
+
+    while (TRUE) {
+        // check done first, the last unit is queued before it is set
+        BOOLEAN Done = Ctx->Done;
+        if (!DecodeNextUnit(Ctx, Workspace)) {
+            if (Done) {
+                break;
+            }
+            CpuPause();
+        }
+    }
+}
+
+/**
+ * Help the workers until everything that was queued is decoded
+ */
+static void WaitForQueue(PARALLEL_CONTEXT* Ctx, void* Workspace) {
+    while (Ctx->Completed != Ctx->Tail) {
+        if (!DecodeNextUnit(Ctx, Workspace)) {
+            CpuPause();
+        }
+    }
+}
+
+static void QueueUnit(PARALLEL_CONTEXT* Ctx, DECOMPRESS_UNIT* Unit, void* Workspace) {
+    // wait for the unit that had the slot to be decoded, helping with the queue
+    UINT32 Slot = Ctx->Tail % QUEUE_SIZE;
+    while (Ctx->Busy[Slot]) {
+        if (!DecodeNextUnit(Ctx, Workspace)) {
+            CpuPause();
+        }
+    }
+    MemoryFence();
+
+    // the unit must be visible before the tail is
+    Ctx->Queue[Slot] = *Unit;
+    Ctx->Busy[Slot] = TRUE;
+    MemoryFence();
+    Ctx->Tail++;
+}
+
+EFI_STATUS DecompressFileParallel(EFI_FILE_PROTOCOL* File, COMPRESSION_FORMAT Format, DECOMPRESS_OUTPUT* Pages,
+                                  UINTN* Base, UINTN* Size, SHA256_CONTEXT* Hash) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_MP_SERVICES_PROTOCOL* MpServices = NULL;
+    PARALLEL_CONTEXT* Ctx = NULL;
+    EFI_EVENT ApsDone = NULL;
+    BOOLEAN ApsRunning = FALSE;
+    void* Workspace = NULL;
+    FILE_ASYNC_READ Read = {0};
+    UINTN FileSize = 0;
+    UINTN RequestedSize = 0;
+    UINTN InputPages = 0;
+    UINTN OutputCapacity = 0;
+    UINTN OutputSize = 0;
+    UINTN NumberOfProcessors = 0;
+    UINTN NumberOfEnabledProcessors = 0;
+
+    // only formats that can be split, gzip members don't say how big they are
+    EFI_STATUS (*NextUnit)(UNIT_SPLITTER*, UINT8*, UINTN, DECOMPRESS_UNIT*) = NULL;
+    switch (Format) {
+        case COMPRESSION_LZ4: NextUnit = Lz4NextUnit; break;
+        case COMPRESSION_LZ4_LEGACY: NextUnit = Lz4LegacyNextUnit; break;
+        case COMPRESSION_ZSTD: NextUnit = ZstdNextUnit; break;
+        default: return EFI_UNSUPPORTED;
+    }
+
+    // we need at least one AP for this to make sense
+    if (EFI_ERROR(gBS->LocateProtocol(&gEfiMpServiceProtocolGuid, NULL, (void**)&MpServices)) ||
+        EFI_ERROR(MpServices->GetNumberOfProcessors(MpServices, &NumberOfProcessors, &NumberOfEnabledProcessors)) ||
+        NumberOfEnabledProcessors < 2) {
+        return EFI_UNSUPPORTED;
+    }
+
+    EFI_CHECK(FileHandleGetSize(File, &FileSize));
+
+    Ctx = AllocateZeroPool(sizeof(PARALLEL_CONTEXT));
+    CHECK_ERROR(Ctx != NULL, EFI_OUT_OF_RESOURCES);
+    Ctx->Format = Format;
+
+    // the workers can't allocate, give each one its own workspace
+    Ctx->WorkspaceSize = ALIGN_VALUE(DecompressWorkspaceSize(Format), 64);
+    Ctx->WorkspaceCount = NumberOfEnabledProcessors;
+    if (Ctx->WorkspaceSize != 0) {
+        Ctx->Workspaces = AllocatePool(Ctx->WorkspaceSize * Ctx->WorkspaceCount);
+        CHECK_ERROR(Ctx->Workspaces != NULL, EFI_OUT_OF_RESOURCES);
+    }
+    Workspace = ClaimWorkspace(Ctx);
+
+    // the units point into the input, so the whole file is kept in memory
+    EFI_PHYSICAL_ADDRESS InputBase = 0;
+    InputPages = EFI_SIZE_TO_PAGES(MAX(FileSize, 1));
+    EFI_CHECK(gBS->AllocatePages(AllocateAnyPages, EfiLoaderData, InputPages, &InputBase));
+    Ctx->Input = (UINT8*)InputBase;
+
+    EFI_PHYSICAL_ADDRESS OutputBase = 0;
+    OutputCapacity = ALIGN_VALUE(MAX(FileSize * DEFAULT_RATIO, EFI_PAGE_SIZE), EFI_PAGE_SIZE);
+    EFI_CHECK(OutputAllocatePages(Pages, EFI_SIZE_TO_PAGES(OutputCapacity), &OutputBase));
+    Ctx->Output = (UINT8*)OutputBase;
+
+    // start the workers without waiting for them, if the
+    // firmware can't do that then just do it serially
+    EFI_CHECK(gBS->CreateEvent(0, TPL_CALLBACK, NULL, NULL, &ApsDone));
+    SetApsRunning(TRUE);
+    if (EFI_ERROR(MpServices->StartupAllAPs(MpServices, DecodeWorker, FALSE, ApsDone, 0, Ctx, NULL))) {
+        SetApsRunning(FALSE);
+        Status = EFI_UNSUPPORTED;
+        goto cleanup;
+    }
+    ApsRunning = TRUE;
+
+    // read the file and queue the units as they become available, the
+    // next chunk is always read while the current one is split
+    UNIT_SPLITTER Splitter = {0};
+    UINTN ReadSize = 0;
+    UINTN Parsed = 0;
+    while (Ctx->Failed == 0) {
+        Splitter.AtEnd = ReadSize == FileSize;
+        if (Splitter.AtEnd && Parsed == ReadSize) {
+            break;
+        }
+
+        DECOMPRESS_UNIT Unit = {0};
+        Status = NextUnit(&Splitter, Ctx->Input + Parsed, ReadSize - Parsed, &Unit);
+        if (Status == EFI_BUFFER_TOO_SMALL) {
+            CHECK_ERROR_TRACE(!Splitter.AtEnd, EFI_END_OF_FILE, "Compressed data is truncated");
+
+            // help the workers until the chunk arrives
+            while (!FileReadPoll(&Read)) {
+                if (!DecodeNextUnit(Ctx, Workspace)) {
+                    CpuPause();
+                }
+            }
+            CHECK_AND_RETHROW(FileReadWait(&Read));
+            UINTN NewData = ReadSize;
+            ReadSize = RequestedSize;
+
+            if (RequestedSize < FileSize) {
+                UINTN Chunk = MIN(READ_CHUNK_SIZE, FileSize - RequestedSize);
+                CHECK_AND_RETHROW(FileReadAsync(File, Ctx->Input + RequestedSize, Chunk, RequestedSize, &Read));
+                RequestedSize += Chunk;
+            }
+
+            // hash what just arrived while the next chunk is read
+            if (Hash != NULL) {
+                Sha256Update(Hash, Ctx->Input + NewData, ReadSize - NewData);
+            }
+            continue;
+        } else if (Status == EFI_UNSUPPORTED) {
+            goto cleanup;
+        }
+        CHECK_AND_RETHROW(Status);
+
+        if (Unit.Kind == UNIT_END) {
+            break;
+        }
+
+        Unit.InputOffset = Parsed;
+        Parsed += Unit.InputSize;
+        if (Unit.Kind == UNIT_SKIP || Unit.OutputSize == 0) {
+            continue;
+        }
+
+        Unit.OutputOffset = OutputSize;
+        OutputSize += Unit.OutputSize;
+
+        // grow the output, everything that is in flight must
+        // be done first since it points to the old buffer
+        if (OutputSize > OutputCapacity) {
+            WaitForQueue(Ctx, Workspace);
+
+            UINTN NewCapacity = ALIGN_VALUE(MAX(OutputCapacity * 2, OutputSize), EFI_PAGE_SIZE);
+            EFI_PHYSICAL_ADDRESS NewBuffer = 0;
+            EFI_CHECK(OutputAllocatePages(Pages, EFI_SIZE_TO_PAGES(NewCapacity), &NewBuffer));
+            CopyMem((void*)NewBuffer, Ctx->Output, Unit.OutputOffset);
+            gBS->FreePages((EFI_PHYSICAL_ADDRESS)Ctx->Output, EFI_SIZE_TO_PAGES(OutputCapacity));
+
+            Ctx->Output = (UINT8*)NewBuffer;
+            OutputCapacity = NewCapacity;
+        }
+
+        QueueUnit(Ctx, &Unit, Workspace);
+    }
+
+    // the digest is of the whole file, so hash whatever the splitter did not need
+    if (Hash != NULL && Ctx->Failed == 0) {
+        CHECK_AND_RETHROW(FileReadWait(&Read));
+        if (RequestedSize < FileSize) {
+            CHECK_AND_RETHROW(FileRead(File, Ctx->Input + RequestedSize, FileSize - RequestedSize, RequestedSize));
+        }
+        Sha256Update(Hash, Ctx->Input + ReadSize, FileSize - ReadSize);
+    }
+
+cleanup:
+    FileReadWait(&Read);
+
+    // let the workers finish, nothing can be freed before that
+    if (ApsRunning) {
+        // on error skip whatever is left
+        if (EFI_ERROR(Status)) {
+            Ctx->Failed = 1;
+        }
+        MemoryFence();
+        Ctx->Done = TRUE;
+        WaitForQueue(Ctx, Workspace);
+        while (gBS->CheckEvent(ApsDone) == EFI_NOT_READY) {
+            CpuPause();
+        }
+        SetApsRunning(FALSE);
+    }
+
+    if (ApsDone != NULL) {
+        gBS->CloseEvent(ApsDone);
+    }
+
+    // the workers can't print, so decode the failed unit again to show why
+    if (!EFI_ERROR(Status) && Ctx != NULL && Ctx->Failed != 0) {
+        Status = DecodeUnit(Ctx, &Ctx->FailedUnit, Workspace);
+        if (!EFI_ERROR(Status)) {
+            Status = EFI_DEVICE_ERROR;
+        }
+    }
+
+    if (!EFI_ERROR(Status)) {
+        // give back the pages we did not use
+        UINTN UsedPages = MAX(EFI_SIZE_TO_PAGES(OutputSize), 1);
+        UINTN AllocatedPages = EFI_SIZE_TO_PAGES(OutputCapacity);
+        if (UsedPages < AllocatedPages) {
+            gBS->FreePages((EFI_PHYSICAL_ADDRESS)Ctx->Output + EFI_PAGES_TO_SIZE(UsedPages), AllocatedPages - UsedPages);
+        }
+
+        *Base = (UINTN)Ctx->Output;
+        *Size = OutputSize;
+    } else if (Ctx != NULL && Ctx->Output != NULL) {
+        gBS->FreePages((EFI_PHYSICAL_ADDRESS)Ctx->Output, EFI_SIZE_TO_PAGES(OutputCapacity));
+    }
+
+    if (Ctx != NULL) {
+        if (Ctx->Input != NULL) {
+            gBS->FreePages((EFI_PHYSICAL_ADDRESS)Ctx->Input, InputPages);
+        }
+
+        if (Ctx->Workspaces != NULL) {
+            FreePool(Ctx->Workspaces);
+        }
+
+        FreePool(Ctx);
+    }
+
+    return Status;
+}
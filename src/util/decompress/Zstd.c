@@ -0,0 +1,927 @@
+#include "DecompressInternal.h"
+
+#include <util/Except.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#define ZSTD_MAGIC                  0xFD2FB528
+#define ZSTD_SKIPPABLE_MAGIC        0x184D2A50
+#define ZSTD_SKIPPABLE_MASK         0xFFFFFFF0
+
+#define ZSTD_BLOCK_MAX              SIZE_128KB
+
+#define ZSTD_BLOCK_RAW              0
+#define ZSTD_BLOCK_RLE              1
+#define ZSTD_BLOCK_COMPRESSED       2
+
+#define ZSTD_LITERALS_RAW           0
+#define ZSTD_LITERALS_RLE           1
+#define ZSTD_LITERALS_COMPRESSED    2
+#define ZSTD_LITERALS_TREELESS      3
+
+#define ZSTD_MODE_PREDEFINED        0
+#define ZSTD_MODE_RLE               1
+#define ZSTD_MODE_FSE               2
+#define ZSTD_MODE_REPEAT            3
+
+#define ZSTD_LL_MAX_LOG             9
+#define ZSTD_ML_MAX_LOG             9
+#define ZSTD_OF_MAX_LOG             8
+#define ZSTD_HUF_WEIGHTS_MAX_LOG    6
+#define ZSTD_HUF_MAX_BITS           11
+
+#define ZSTD_LL_MAX_SYMBOL          35
+#define ZSTD_ML_MAX_SYMBOL          52
+#define ZSTD_OF_MAX_SYMBOL          31
+#define ZSTD_HUF_MAX_SYMBOLS        256
+
+typedef struct _FSE_ENTRY {
+    UINT16 NewState;
+    UINT8 Symbol;
+    UINT8 Bits;
+} FSE_ENTRY;
+
+typedef struct _FSE_TABLE {
+    FSE_ENTRY Entries[1u << ZSTD_LL_MAX_LOG];
+    UINTN Log;
+    BOOLEAN Valid;
+} FSE_TABLE;
+
+typedef struct _HUF_ENTRY {
+    UINT8 Symbol;
+    UINT8 Bits;
+} HUF_ENTRY;
+
+typedef struct _ZSTD_CONTEXT {
+    FSE_TABLE LlTable;
+    FSE_TABLE OfTable;
+    FSE_TABLE MlTable;
+
+    // used while reading the huffman weights
+    FSE_TABLE WeightsTable;
+
+    HUF_ENTRY HufTable[1u << ZSTD_HUF_MAX_BITS];
+    UINTN HufLog;
+    BOOLEAN HufValid;
+
+    // the repeat offsets
+    UINT32 Rep[3];
+
+    UINT8 Literals[ZSTD_BLOCK_MAX];
+} ZSTD_CONTEXT;
+
+/**
+ * A bitstream that is read backwards, from the last bit to the first
+ */
+typedef struct _BACKWARD_BITS {
+    UINT8* Start;
+    UINTN Size;
+
+    // the amount of bits that are left, goes negative on overflow
+    INTN BitPos;
+} BACKWARD_BITS;
+
+static const INT16 mLlDefaultCounts[] = {
+    4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+    -1, -1, -1, -1
+};
+
+static const INT16 mMlDefaultCounts[] = {
+    1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+    -1, -1, -1, -1, -1
+};
+
+static const INT16 mOfDefaultCounts[] = {
+    1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1
+};
+
+static const UINT32 mLlBase[] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512, 1024, 2048, 4096,
+    8192, 16384, 32768, 65536
+};
+
+static const UINT8 mLlBits[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11, 12,
+    13, 14, 15, 16
+};
+
+static const UINT32 mMlBase[] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+    19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+    35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515, 1027, 2051,
+    4099, 8195, 16387, 32771, 65539
+};
+
+static const UINT8 mMlBits[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11,
+    12, 13, 14, 15, 16
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// Bitstreams
+//----------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Peek bits of a little endian stream that is read forward, used for the table headers
+ */
+static UINT32 PeekForward(UINT8* In, UINTN Size, UINTN BitPos, UINTN Count) {
+    UINT32 Value = 0;
+    UINTN Byte = BitPos >> 3u;
+    for (UINTN i = 0; i < 4 && Byte + i < Size; i++) {
+        Value |= (UINT32)In[Byte + i] << (i * 8);
+    }
+    return (Value >> (BitPos & 7u)) & ((1u << Count) - 1);
+}
+
+static EFI_STATUS BitsInit(BACKWARD_BITS* Bits, UINT8* Start, UINTN Size) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    // the last byte has a marker bit on top of the data
+    CHECK(Size != 0);
+    CHECK_TRACE(Start[Size - 1] != 0, "Missing zstd bitstream marker");
+    Bits->Start = Start;
+    Bits->Size = Size;
+    Bits->BitPos = (Size - 1) * 8 + HighBitSet32(Start[Size - 1]);
+
+cleanup:
+    return Status;
+}
+
+/**
+ * Get the next Count bits (up to 56) without consuming them, reading
+ * before the start of the stream gives zeros
+ */
+static UINT64 BitsPeek(BACKWARD_BITS* Bits, UINTN Count) {
+    INTN Low = Bits->BitPos - (INTN)Count;
+
+    // fast path, a single load
+    if (Low >= 0 && (UINTN)(Low >> 3) + 8 <= Bits->Size) {
+        UINT64 Value = *(UINT64*)(Bits->Start + (Low >> 3));
+        return (Value >> (Low & 7)) & ((1ull << Count) - 1);
+    }
+
+    UINT64 Value = 0;
+    for (INTN Bit = Bits->BitPos - 1; Bit >= Low; Bit--) {
+        Value <<= 1u;
+        if (Bit >= 0) {
+            Value |= (Bits->Start[Bit >> 3] >> (Bit & 7)) & 1u;
+        }
+    }
+    return Value;
+}
+
+static UINT64 BitsRead(BACKWARD_BITS* Bits, UINTN Count) {
+    if (Count == 0) {
+        return 0;
+    }
+
+    UINT64 Value = BitsPeek(Bits, Count);
+    Bits->BitPos -= Count;
+    return Value;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// FSE tables
+//----------------------------------------------------------------------------------------------------------------------
+
+static EFI_STATUS FseReadCounts(UINT8* In, UINTN InSize, INT16* Counts, UINTN MaxSymbols, UINTN MaxLog,
+                                UINTN* Log, UINTN* SymbolCount, UINTN* Used) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINTN BitPos = 0;
+    UINTN Symbol = 0;
+
+    CHECK(InSize != 0);
+    *Log = PeekForward(In, InSize, BitPos, 4) + 5;
+    BitPos += 4;
+    CHECK_TRACE(*Log <= MaxLog, "FSE accuracy log too big (%d)", *Log);
+
+    INT32 Remaining = (1 << *Log) + 1;
+    INT32 Threshold = 1 << *Log;
+    UINTN NbBits = *Log + 1;
+
+    while (Remaining > 1) {
+        CHECK(Symbol < MaxSymbols);
+
+        // small values use one bit less
+        INT32 Max = (2 * Threshold - 1) - Remaining;
+        INT32 Count = 0;
+        UINT32 Value = PeekForward(In, InSize, BitPos, NbBits);
+        if ((INT32)(Value & (Threshold - 1)) < Max) {
+            Count = Value & (Threshold - 1);
+            BitPos += NbBits - 1;
+        } else {
+            Count = Value & (2 * Threshold - 1);
+            if (Count >= Threshold) {
+                Count -= Max;
+            }
+            BitPos += NbBits;
+        }
+
+        // zero means less than one
+        Count--;
+        Remaining -= Count < 0 ? -Count : Count;
+        Counts[Symbol++] = Count;
+
+        // zeros are followed by a repeat count
+        if (Count == 0) {
+            UINT32 Repeat = 0;
+            do {
+                Repeat = PeekForward(In, InSize, BitPos, 2);
+                BitPos += 2;
+                CHECK(Symbol + Repeat <= MaxSymbols);
+                for (UINT32 i = 0; i < Repeat; i++) {
+                    Counts[Symbol++] = 0;
+                }
+            } while (Repeat == 3);
+        }
+
+        while (Remaining < Threshold) {
+            NbBits--;
+            Threshold >>= 1;
+        }
+    }
+
+    CHECK_TRACE(Remaining == 1, "Invalid FSE distribution");
+    *SymbolCount = Symbol;
+    *Used = (BitPos + 7) / 8;
+    CHECK(*Used <= InSize);
+
+cleanup:
+    return Status;
+}
+
+static EFI_STATUS FseBuildTable(FSE_TABLE* Table, const INT16* Counts, UINTN SymbolCount, UINTN Log) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT16 SymbolNext[ZSTD_HUF_MAX_SYMBOLS];
+    UINTN Size = 1u << Log;
+    UINTN High = Size - 1;
+
+    CHECK(Size <= ARRAY_SIZE(Table->Entries));
+    CHECK(SymbolCount <= ARRAY_SIZE(SymbolNext));
+
+    // the less than one symbols go to the end
+    for (UINTN Symbol = 0; Symbol < SymbolCount; Symbol++) {
+        CHECK(Counts[Symbol] >= -1);
+        if (Counts[Symbol] == -1) {
+            Table->Entries[High--].Symbol = Symbol;
+            SymbolNext[Symbol] = 1;
+        } else {
+            SymbolNext[Symbol] = Counts[Symbol];
+        }
+    }
+
+    // spread the rest
+    UINTN Step = (Size >> 1u) + (Size >> 3u) + 3;
+    UINTN Position = 0;
+    for (UINTN Symbol = 0; Symbol < SymbolCount; Symbol++) {
+        for (INT16 i = 0; i < Counts[Symbol]; i++) {
+            Table->Entries[Position].Symbol = Symbol;
+            do {
+                Position = (Position + Step) & (Size - 1);
+            } while (Position > High);
+        }
+    }
+    CHECK_TRACE(Position == 0, "Invalid FSE distribution");
+
+    // and the state transitions
+    for (UINTN State = 0; State < Size; State++) {
+        UINT16 Next = SymbolNext[Table->Entries[State].Symbol]++;
+        UINT8 Bits = Log - HighBitSet32(Next);
+        Table->Entries[State].Bits = Bits;
+        Table->Entries[State].NewState = (Next << Bits) - Size;
+    }
+
+    Table->Log = Log;
+    Table->Valid = TRUE;
+
+cleanup:
+    return Status;
+}
+
+static EFI_STATUS FseReadTable(FSE_TABLE* Table, UINT8 Mode, UINT8* In, UINTN InSize, UINTN* Used,
+                               const INT16* DefaultCounts, UINTN DefaultCount, UINTN DefaultLog,
+                               UINTN MaxSymbol, UINTN MaxLog) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    INT16 Counts[ZSTD_ML_MAX_SYMBOL + 1];
+    UINTN Log = 0;
+    UINTN SymbolCount = 0;
+
+    *Used = 0;
+    switch (Mode) {
+        case ZSTD_MODE_PREDEFINED:
+            CHECK_AND_RETHROW(FseBuildTable(Table, DefaultCounts, DefaultCount, DefaultLog));
+            break;
+
+        case ZSTD_MODE_RLE:
+            CHECK(InSize >= 1);
+            CHECK(In[0] <= MaxSymbol);
+            Table->Entries[0].Symbol = In[0];
+            Table->Entries[0].Bits = 0;
+            Table->Entries[0].NewState = 0;
+            Table->Log = 0;
+            Table->Valid = TRUE;
+            *Used = 1;
+            break;
+
+        case ZSTD_MODE_FSE:
+            CHECK_AND_RETHROW(FseReadCounts(In, InSize, Counts, MaxSymbol + 1, MaxLog, &Log, &SymbolCount, Used));
+            CHECK_AND_RETHROW(FseBuildTable(Table, Counts, SymbolCount, Log));
+            break;
+
+        case ZSTD_MODE_REPEAT:
+            CHECK_TRACE(Table->Valid, "Repeat mode without a previous table");
+            break;
+
+        default:
+            CHECK_FAIL();
+    }
+
+cleanup:
+    return Status;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Literals
+//----------------------------------------------------------------------------------------------------------------------
+
+static EFI_STATUS HufReadTable(ZSTD_CONTEXT* Ctx, UINT8* In, UINTN InSize, UINTN* Used) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8 Weights[ZSTD_HUF_MAX_SYMBOLS];
+    UINTN WeightCount = 0;
+
+    CHECK(InSize >= 1);
+    UINT8 Header = In[0];
+
+    if (Header >= 128) {
+        // direct representation, 4 bits per weight
+        WeightCount = Header - 127;
+        UINTN Bytes = (WeightCount + 1) / 2;
+        CHECK(1 + Bytes <= InSize);
+        for (UINTN i = 0; i < WeightCount; i++) {
+            Weights[i] = (In[1 + i / 2] >> ((i % 2) ? 0 : 4)) & 0xF;
+        }
+        *Used = 1 + Bytes;
+    } else {
+        // fse compressed with two interleaved states
+        FSE_TABLE* Table = &Ctx->WeightsTable;
+        INT16 Counts[ZSTD_HUF_MAX_SYMBOLS];
+        UINTN Log = 0;
+        UINTN SymbolCount = 0;
+        UINTN HeaderSize = 0;
+        BACKWARD_BITS Bits;
+
+        CHECK(1 + Header <= InSize);
+        CHECK_AND_RETHROW(FseReadCounts(In + 1, Header, Counts, ZSTD_HUF_MAX_SYMBOLS, ZSTD_HUF_WEIGHTS_MAX_LOG, &Log, &SymbolCount, &HeaderSize));
+        CHECK_AND_RETHROW(FseBuildTable(Table, Counts, SymbolCount, Log));
+
+        CHECK_AND_RETHROW(BitsInit(&Bits, In + 1 + HeaderSize, Header - HeaderSize));
+        UINTN State1 = BitsRead(&Bits, Log);
+        UINTN State2 = BitsRead(&Bits, Log);
+
+        while (TRUE) {
+            CHECK(WeightCount + 2 <= ZSTD_HUF_MAX_SYMBOLS);
+            Weights[WeightCount++] = Table->Entries[State1].Symbol;
+            State1 = Table->Entries[State1].NewState + BitsRead(&Bits, Table->Entries[State1].Bits);
+            if (Bits.BitPos < 0) {
+                Weights[WeightCount++] = Table->Entries[State2].Symbol;
+                break;
+            }
+
+            Weights[WeightCount++] = Table->Entries[State2].Symbol;
+            State2 = Table->Entries[State2].NewState + BitsRead(&Bits, Table->Entries[State2].Bits);
+            if (Bits.BitPos < 0) {
+                Weights[WeightCount++] = Table->Entries[State1].Symbol;
+                break;
+            }
+        }
+
+        *Used = 1 + Header;
+    }
+
+    // the weight of the last symbol is implied
+    UINT32 Total = 0;
+    CHECK(WeightCount < ZSTD_HUF_MAX_SYMBOLS);
+    for (UINTN i = 0; i < WeightCount; i++) {
+        CHECK(Weights[i] <= ZSTD_HUF_MAX_BITS);
+        Total += Weights[i] ? (1u << (Weights[i] - 1)) : 0;
+    }
+    CHECK(Total != 0);
+
+    UINTN MaxBits = HighBitSet32(Total) + 1;
+    CHECK(MaxBits <= ZSTD_HUF_MAX_BITS);
+    UINT32 Rest = (1u << MaxBits) - Total;
+    CHECK_TRACE((Rest & (Rest - 1)) == 0, "Invalid huffman weights");
+    Weights[WeightCount++] = HighBitSet32(Rest) + 1;
+
+    // get where each weight starts in the table, longer codes first
+    UINT32 RankStart[ZSTD_HUF_MAX_BITS + 2] = {0};
+    for (UINTN i = 0; i < WeightCount; i++) {
+        RankStart[Weights[i]]++;
+    }
+    UINT32 Next = 0;
+    for (UINTN Weight = 1; Weight <= MaxBits; Weight++) {
+        UINT32 Current = Next;
+        Next += RankStart[Weight] << (Weight - 1);
+        RankStart[Weight] = Current;
+    }
+
+    for (UINTN Symbol = 0; Symbol < WeightCount; Symbol++) {
+        UINT8 Weight = Weights[Symbol];
+        if (Weight == 0) {
+            continue;
+        }
+
+        UINT32 Length = (1u << Weight) >> 1u;
+        for (UINT32 i = RankStart[Weight]; i < RankStart[Weight] + Length; i++) {
+            Ctx->HufTable[i].Symbol = Symbol;
+            Ctx->HufTable[i].Bits = MaxBits + 1 - Weight;
+        }
+        RankStart[Weight] += Length;
+    }
+
+    Ctx->HufLog = MaxBits;
+    Ctx->HufValid = TRUE;
+
+cleanup:
+    return Status;
+}
+
+static EFI_STATUS HufDecodeStream(ZSTD_CONTEXT* Ctx, UINT8* In, UINTN InSize, UINT8* Out, UINTN OutSize) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    BACKWARD_BITS Bits;
+
+    CHECK_AND_RETHROW(BitsInit(&Bits, In, InSize));
+
+    for (UINTN i = 0; i < OutSize; i++) {
+        HUF_ENTRY* Entry = &Ctx->HufTable[BitsPeek(&Bits, Ctx->HufLog)];
+        Out[i] = Entry->Symbol;
+        Bits.BitPos -= Entry->Bits;
+    }
+
+    CHECK_TRACE(Bits.BitPos == 0, "Invalid huffman stream");
+
+cleanup:
+    return Status;
+}
+
+static EFI_STATUS DecodeLiterals(ZSTD_CONTEXT* Ctx, UINT8* In, UINTN InSize, UINTN* Used, UINT8** Literals, UINTN* LiteralsSize) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINTN HeaderSize = 0;
+    UINTN Regenerated = 0;
+    UINTN Compressed = 0;
+    UINTN Streams = 1;
+
+    CHECK(InSize >= 1);
+    UINT8 Type = In[0] & 3u;
+    UINT8 SizeFormat = (In[0] >> 2u) & 3u;
+
+    if (Type == ZSTD_LITERALS_RAW || Type == ZSTD_LITERALS_RLE) {
+        switch (SizeFormat) {
+            case 1:
+                HeaderSize = 2;
+                CHECK(InSize >= HeaderSize);
+                Regenerated = (In[0] >> 4u) | (In[1] << 4u);
+                break;
+
+            case 3:
+                HeaderSize = 3;
+                CHECK(InSize >= HeaderSize);
+                Regenerated = (In[0] >> 4u) | (In[1] << 4u) | (In[2] << 12u);
+                break;
+
+            default:
+                HeaderSize = 1;
+                Regenerated = In[0] >> 3u;
+                break;
+        }
+        CHECK(Regenerated <= ZSTD_BLOCK_MAX);
+
+        if (Type == ZSTD_LITERALS_RAW) {
+            // no need to copy those
+            CHECK(HeaderSize + Regenerated <= InSize);
+            *Literals = In + HeaderSize;
+            *Used = HeaderSize + Regenerated;
+        } else {
+            CHECK(HeaderSize + 1 <= InSize);
+            SetMem(Ctx->Literals, Regenerated, In[HeaderSize]);
+            *Literals = Ctx->Literals;
+            *Used = HeaderSize + 1;
+        }
+        *LiteralsSize = Regenerated;
+        goto cleanup;
+    }
+
+    // huffman compressed
+    UINT64 Header = 0;
+    switch (SizeFormat) {
+        case 0:
+        case 1:
+            HeaderSize = 3;
+            CHECK(InSize >= HeaderSize);
+            Header = In[0] | (In[1] << 8u) | (In[2] << 16u);
+            Regenerated = (Header >> 4u) & 0x3FF;
+            Compressed = (Header >> 14u) & 0x3FF;
+            Streams = SizeFormat == 0 ? 1 : 4;
+            break;
+
+        case 2:
+            HeaderSize = 4;
+            CHECK(InSize >= HeaderSize);
+            Header = *(UINT32*)In;
+            Regenerated = (Header >> 4u) & 0x3FFF;
+            Compressed = (Header >> 18u) & 0x3FFF;
+            Streams = 4;
+            break;
+
+        case 3:
+            HeaderSize = 5;
+            CHECK(InSize >= HeaderSize);
+            Header = *(UINT32*)In | ((UINT64)In[4] << 32u);
+            Regenerated = (Header >> 4u) & 0x3FFFF;
+            Compressed = (Header >> 22u) & 0x3FFFF;
+            Streams = 4;
+            break;
+    }
+    CHECK(Regenerated <= ZSTD_BLOCK_MAX);
+    CHECK(HeaderSize + Compressed <= InSize);
+
+    UINT8* Data = In + HeaderSize;
+    UINTN DataSize = Compressed;
+
+    if (Type == ZSTD_LITERALS_COMPRESSED) {
+        UINTN TreeSize = 0;
+        CHECK_AND_RETHROW(HufReadTable(Ctx, Data, DataSize, &TreeSize));
+        Data += TreeSize;
+        DataSize -= TreeSize;
+    } else {
+        CHECK_TRACE(Ctx->HufValid, "Treeless literals without a previous table");
+    }
+
+    if (Streams == 1) {
+        CHECK_AND_RETHROW(HufDecodeStream(Ctx, Data, DataSize, Ctx->Literals, Regenerated));
+    } else {
+        // the jump table has the sizes of the first 3 streams
+        CHECK(DataSize >= 6);
+        UINTN Sizes[4];
+        Sizes[0] = Data[0] | (Data[1] << 8u);
+        Sizes[1] = Data[2] | (Data[3] << 8u);
+        Sizes[2] = Data[4] | (Data[5] << 8u);
+        CHECK(Sizes[0] + Sizes[1] + Sizes[2] <= DataSize - 6);
+        Sizes[3] = DataSize - 6 - Sizes[0] - Sizes[1] - Sizes[2];
+        Data += 6;
+
+        UINTN Each = (Regenerated + 3) / 4;
+        CHECK(Each * 3 <= Regenerated);
+        for (UINTN i = 0; i < 4; i++) {
+            UINTN OutSize = i == 3 ? Regenerated - Each * 3 : Each;
+            CHECK_AND_RETHROW(HufDecodeStream(Ctx, Data, Sizes[i], Ctx->Literals + Each * i, OutSize));
+            Data += Sizes[i];
+        }
+    }
+
+    *Literals = Ctx->Literals;
+    *LiteralsSize = Regenerated;
+    *Used = HeaderSize + Compressed;
+
+cleanup:
+    return Status;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Sequences
+//----------------------------------------------------------------------------------------------------------------------
+
+static EFI_STATUS DecodeSequences(ZSTD_CONTEXT* Ctx, UINT8* In, UINTN InSize, UINT8* Literals, UINTN LiteralsSize, OUTPUT_BUFFER* Output) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8* LiteralsEnd = Literals + LiteralsSize;
+    UINTN Position = 0;
+    UINTN Used = 0;
+    UINTN Count = 0;
+    BACKWARD_BITS Bits;
+
+    CHECK(InSize >= 1);
+    if (In[0] < 128) {
+        Count = In[0];
+        Position = 1;
+    } else if (In[0] < 255) {
+        CHECK(InSize >= 2);
+        Count = ((In[0] - 128) << 8u) + In[1];
+        Position = 2;
+    } else {
+        CHECK(InSize >= 3);
+        Count = In[1] + (In[2] << 8u) + 0x7F00;
+        Position = 3;
+    }
+
+    if (Count != 0) {
+        CHECK(InSize > Position);
+        UINT8 Modes = In[Position++];
+        CHECK_TRACE((Modes & 3u) == 0, "Reserved bits set in sequence modes");
+
+        CHECK_AND_RETHROW(FseReadTable(&Ctx->LlTable, Modes >> 6u, In + Position, InSize - Position, &Used,
+                                       mLlDefaultCounts, ARRAY_SIZE(mLlDefaultCounts), 6, ZSTD_LL_MAX_SYMBOL, ZSTD_LL_MAX_LOG));
+        Position += Used;
+        CHECK_AND_RETHROW(FseReadTable(&Ctx->OfTable, (Modes >> 4u) & 3u, In + Position, InSize - Position, &Used,
+                                       mOfDefaultCounts, ARRAY_SIZE(mOfDefaultCounts), 5, ZSTD_OF_MAX_SYMBOL, ZSTD_OF_MAX_LOG));
+        Position += Used;
+        CHECK_AND_RETHROW(FseReadTable(&Ctx->MlTable, (Modes >> 2u) & 3u, In + Position, InSize - Position, &Used,
+                                       mMlDefaultCounts, ARRAY_SIZE(mMlDefaultCounts), 6, ZSTD_ML_MAX_SYMBOL, ZSTD_ML_MAX_LOG));
+        Position += Used;
+
+        CHECK(InSize > Position);
+        CHECK_AND_RETHROW(BitsInit(&Bits, In + Position, InSize - Position));
+        UINTN LlState = BitsRead(&Bits, Ctx->LlTable.Log);
+        UINTN OfState = BitsRead(&Bits, Ctx->OfTable.Log);
+        UINTN MlState = BitsRead(&Bits, Ctx->MlTable.Log);
+
+        for (UINTN i = 0; i < Count; i++) {
+            FSE_ENTRY* Ll = &Ctx->LlTable.Entries[LlState];
+            FSE_ENTRY* Of = &Ctx->OfTable.Entries[OfState];
+            FSE_ENTRY* Ml = &Ctx->MlTable.Entries[MlState];
+            CHECK(Ll->Symbol <= ZSTD_LL_MAX_SYMBOL && Ml->Symbol <= ZSTD_ML_MAX_SYMBOL && Of->Symbol <= ZSTD_OF_MAX_SYMBOL);
+
+            // the extra bits are read offset first
+            UINT64 OffsetValue = (1ull << Of->Symbol) + BitsRead(&Bits, Of->Symbol);
+            UINTN MatchLength = mMlBase[Ml->Symbol] + BitsRead(&Bits, mMlBits[Ml->Symbol]);
+            UINTN LiteralLength = mLlBase[Ll->Symbol] + BitsRead(&Bits, mLlBits[Ll->Symbol]);
+
+            // resolve the repeat offsets
+            UINT64 Offset = 0;
+            if (OffsetValue > 3) {
+                Offset = OffsetValue - 3;
+                Ctx->Rep[2] = Ctx->Rep[1];
+                Ctx->Rep[1] = Ctx->Rep[0];
+                Ctx->Rep[0] = Offset;
+            } else {
+                UINTN Index = OffsetValue - 1 + (LiteralLength == 0 ? 1 : 0);
+                if (Index == 0) {
+                    Offset = Ctx->Rep[0];
+                } else {
+                    Offset = Index == 3 ? Ctx->Rep[0] - 1 : Ctx->Rep[Index];
+                    if (Index != 1) {
+                        Ctx->Rep[2] = Ctx->Rep[1];
+                    }
+                    Ctx->Rep[1] = Ctx->Rep[0];
+                    Ctx->Rep[0] = Offset;
+                }
+            }
+
+            // update the states, not needed for the last one
+            if (i != Count - 1) {
+                LlState = Ll->NewState + BitsRead(&Bits, Ll->Bits);
+                MlState = Ml->NewState + BitsRead(&Bits, Ml->Bits);
+                OfState = Of->NewState + BitsRead(&Bits, Of->Bits);
+            }
+            CHECK_TRACE(Bits.BitPos >= 0, "zstd sequences overflow");
+
+            // execute it
+            CHECK(LiteralLength <= LiteralsEnd - Literals);
+            CHECK_AND_RETHROW(OutputReserve(Output, LiteralLength + MatchLength));
+            CopyMem(Output->Buffer + Output->Size, Literals, LiteralLength);
+            Output->Size += LiteralLength;
+            Literals += LiteralLength;
+
+            CHECK_TRACE(Offset != 0 && Offset <= Output->Size, "Invalid match offset %ld", Offset);
+            OutputCopyMatch(Output, Offset, MatchLength);
+        }
+
+        CHECK_TRACE(Bits.BitPos == 0, "zstd sequences bitstream not fully consumed");
+    }
+
+    // whatever is left of the literals
+    CHECK_AND_RETHROW(OutputReserve(Output, LiteralsEnd - Literals));
+    CopyMem(Output->Buffer + Output->Size, Literals, LiteralsEnd - Literals);
+    Output->Size += LiteralsEnd - Literals;
+
+cleanup:
+    return Status;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Frames
+//----------------------------------------------------------------------------------------------------------------------
+
+static EFI_STATUS DecodeFrame(ZSTD_CONTEXT* Ctx, INPUT_STREAM* Input, OUTPUT_BUFFER* Output) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8* Data = NULL;
+
+    CHECK_AND_RETHROW(StreamRead(Input, 1, &Data));
+    UINT8 Descriptor = Data[0];
+    UINT8 FcsFlag = Descriptor >> 6u;
+    BOOLEAN SingleSegment = (Descriptor >> 5u) & 1u;
+    BOOLEAN HasChecksum = (Descriptor >> 2u) & 1u;
+    UINT8 DictFlag = Descriptor & 3u;
+    CHECK_TRACE(!(Descriptor & BIT3), "Reserved bit set in zstd frame");
+
+    // the window size does not matter to us, we have the whole output
+    if (!SingleSegment) {
+        CHECK_AND_RETHROW(StreamRead(Input, 1, &Data));
+    }
+
+    if (DictFlag != 0) {
+        UINTN DictSize = DictFlag == 3 ? 4 : DictFlag;
+        UINT32 DictId = 0;
+        CHECK_AND_RETHROW(StreamRead(Input, DictSize, &Data));
+        CopyMem(&DictId, Data, DictSize);
+        CHECK_TRACE(DictId == 0, "zstd dictionaries are not supported");
+    }
+
+    // the content size was already used to size the output
+    UINTN FcsSize = FcsFlag == 0 ? (SingleSegment ? 1 : 0) : (1u << FcsFlag);
+    if (FcsSize != 0) {
+        CHECK_AND_RETHROW(StreamRead(Input, FcsSize, &Data));
+    }
+
+    // reset the frame state
+    Ctx->Rep[0] = 1;
+    Ctx->Rep[1] = 4;
+    Ctx->Rep[2] = 8;
+    Ctx->HufValid = FALSE;
+    Ctx->LlTable.Valid = FALSE;
+    Ctx->OfTable.Valid = FALSE;
+    Ctx->MlTable.Valid = FALSE;
+
+    BOOLEAN Last = FALSE;
+    while (!Last) {
+        CHECK_AND_RETHROW(StreamRead(Input, 3, &Data));
+        UINT32 BlockHeader = Data[0] | (Data[1] << 8u) | (Data[2] << 16u);
+        Last = BlockHeader & 1u;
+        UINT8 Type = (BlockHeader >> 1u) & 3u;
+        UINTN Size = BlockHeader >> 3u;
+        CHECK_TRACE(Size <= ZSTD_BLOCK_MAX, "zstd block is too big (%d bytes)", Size);
+
+        switch (Type) {
+            case ZSTD_BLOCK_RAW:
+                CHECK_AND_RETHROW(StreamRead(Input, Size, &Data));
+                CHECK_AND_RETHROW(OutputReserve(Output, Size));
+                CopyMem(Output->Buffer + Output->Size, Data, Size);
+                Output->Size += Size;
+                break;
+
+            case ZSTD_BLOCK_RLE:
+                CHECK_AND_RETHROW(StreamRead(Input, 1, &Data));
+                CHECK_AND_RETHROW(OutputReserve(Output, Size));
+                SetMem(Output->Buffer + Output->Size, Size, Data[0]);
+                Output->Size += Size;
+                break;
+
+            case ZSTD_BLOCK_COMPRESSED: {
+                UINT8* Literals = NULL;
+                UINTN LiteralsSize = 0;
+                UINTN Used = 0;
+                CHECK_AND_RETHROW(StreamRead(Input, Size, &Data));
+                CHECK_AND_RETHROW(DecodeLiterals(Ctx, Data, Size, &Used, &Literals, &LiteralsSize));
+                CHECK_AND_RETHROW(DecodeSequences(Ctx, Data + Used, Size - Used, Literals, LiteralsSize, Output));
+            } break;
+
+            default:
+                CHECK_FAIL_TRACE("Invalid zstd block type");
+        }
+    }
+
+    // we don't check the checksum, it would cost more than the decoding itself
+    if (HasChecksum) {
+        CHECK_AND_RETHROW(StreamRead(Input, 4, &Data));
+    }
+
+cleanup:
+    return Status;
+}
+
+BOOLEAN ZstdGetContentSize(UINT8* Header, UINTN Size, UINT64* ContentSize) {
+    if (Size < 5 || *(UINT32*)Header != ZSTD_MAGIC) {
+        return FALSE;
+    }
+
+    UINT8 Descriptor = Header[4];
+    UINT8 FcsFlag = Descriptor >> 6u;
+    BOOLEAN SingleSegment = (Descriptor >> 5u) & 1u;
+    UINT8 DictFlag = Descriptor & 3u;
+
+    UINTN Offset = 5 + (SingleSegment ? 0 : 1) + (DictFlag == 3 ? 4 : DictFlag);
+    UINTN FcsSize = FcsFlag == 0 ? (SingleSegment ? 1 : 0) : (1u << FcsFlag);
+    if (FcsSize == 0 || Offset + FcsSize > Size) {
+        return FALSE;
+    }
+
+    *ContentSize = 0;
+    CopyMem(ContentSize, Header + Offset, FcsSize);
+    if (FcsSize == 2) {
+        *ContentSize += 256;
+    }
+    return TRUE;
+}
+
+EFI_STATUS ZstdNextUnit(UNIT_SPLITTER* Splitter, UINT8* Data, UINTN Size, DECOMPRESS_UNIT* Unit) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    ZeroMem(Unit, sizeof(*Unit));
+
+    if (Size < 8) {
+        Status = EFI_BUFFER_TOO_SMALL;
+        goto cleanup;
+    }
+
+    UINT32 Magic = *(UINT32*)Data;
+    if ((Magic & ZSTD_SKIPPABLE_MASK) == ZSTD_SKIPPABLE_MAGIC) {
+        Unit->Kind = UNIT_SKIP;
+        Unit->InputSize = 8 + (UINTN)*(UINT32*)&Data[4];
+        if (Unit->InputSize > Size) {
+            Status = EFI_BUFFER_TOO_SMALL;
+        }
+        goto cleanup;
+    }
+    CHECK_TRACE(Magic == ZSTD_MAGIC, "Invalid zstd frame magic %x", Magic);
+
+    // the frames are placed by their content size, dictionaries are
+    // left for the serial decoder to complain about
+    UINT8 Descriptor = Data[4];
+    UINT8 FcsFlag = Descriptor >> 6u;
+    BOOLEAN SingleSegment = (Descriptor >> 5u) & 1u;
+    BOOLEAN HasChecksum = (Descriptor >> 2u) & 1u;
+    UINT8 DictFlag = Descriptor & 3u;
+    UINTN FcsSize = FcsFlag == 0 ? (SingleSegment ? 1 : 0) : (1u << FcsFlag);
+    if (FcsSize == 0 || DictFlag != 0) {
+        Status = EFI_UNSUPPORTED;
+        goto cleanup;
+    }
+
+    UINTN Offset = 5 + (SingleSegment ? 0 : 1) + FcsSize;
+    if (Offset > Size) {
+        Status = EFI_BUFFER_TOO_SMALL;
+        goto cleanup;
+    }
+
+    UINT64 ContentSize = 0;
+    CHECK(ZstdGetContentSize(Data, Size, &ContentSize));
+
+    // walk the block headers to find the end of the frame
+    BOOLEAN Last = FALSE;
+    while (!Last) {
+        if (Offset + 3 > Size) {
+            Status = EFI_BUFFER_TOO_SMALL;
+            goto cleanup;
+        }
+
+        UINT32 Header = Data[Offset] | (Data[Offset + 1] << 8u) | (Data[Offset + 2] << 16u);
+        Last = Header & 1u;
+        UINT8 Type = (Header >> 1u) & 3u;
+        UINT32 BlockSize = Header >> 3u;
+        CHECK_TRACE(Type <= ZSTD_BLOCK_COMPRESSED, "Invalid zstd block type");
+        Offset += 3 + (Type == ZSTD_BLOCK_RLE ? 1 : BlockSize);
+    }
+    Offset += HasChecksum ? 4 : 0;
+
+    Unit->Kind = UNIT_FRAME;
+    Unit->InputSize = Offset;
+    Unit->DataSize = Offset;
+    Unit->OutputSize = ContentSize;
+    if (Unit->InputSize > Size) {
+        Status = EFI_BUFFER_TOO_SMALL;
+    }
+
+cleanup:
+    return Status;
+}
+
+UINTN ZstdWorkspaceSize() {
+    return sizeof(ZSTD_CONTEXT);
+}
+
+EFI_STATUS ZstdDecompress(INPUT_STREAM* Input, OUTPUT_BUFFER* Output, void* Workspace) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    ZSTD_CONTEXT* Ctx = Workspace;
+    UINT8* Data = NULL;
+
+    // there can be multiple frames one after the other
+    while (StreamRemaining(Input) != 0) {
+        CHECK_AND_RETHROW(StreamRead(Input, 4, &Data));
+        UINT32 Magic = *(UINT32*)Data;
+
+        if ((Magic & ZSTD_SKIPPABLE_MASK) == ZSTD_SKIPPABLE_MAGIC) {
+            CHECK_AND_RETHROW(StreamRead(Input, 4, &Data));
+            UINT32 Size = *(UINT32*)Data;
+            while (Size != 0) {
+                UINTN Chunk = MIN(Size, Input->Capacity);
+                CHECK_AND_RETHROW(StreamRead(Input, Chunk, &Data));
+                Size -= Chunk;
+            }
+            continue;
+        }
+
+        CHECK_TRACE(Magic == ZSTD_MAGIC, "Invalid zstd frame magic %x", Magic);
+        CHECK_AND_RETHROW(DecodeFrame(Ctx, Input, Output));
+    }
+
+cleanup:
+    return Status;
+}
@@ -0,0 +1,263 @@
+#include "FsInternal.h"
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include <util/Except.h>
+
+// the edges of a read and buffers the device can't take go through this
+#define BOUNCE_SIZE SIZE_64KB
+
+// drivers split the big ones themselves, but some time out on them
+#define MAX_REQUEST_SIZE SIZE_16MB
+
+// how many requests are in flight at once with the block io 2 protocol
+#define MAX_QUEUED_REQUESTS 8
+
+typedef struct _QUEUED_REQUEST {
+    EFI_BLOCK_IO2_TOKEN Token;
+    BOOLEAN Pending;
+} QUEUED_REQUEST;
+
+EFI_STATUS BlockDeviceOpen(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs, BLOCK_DEVICE* Device) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_HANDLE* Handles = NULL;
+    UINTN HandleCount = 0;
+
+    ZeroMem(Device, sizeof(*Device));
+
+    // we only have the interface, so find the handle it is on
+    EFI_HANDLE FsHandle = NULL;
+    EFI_CHECK(gBS->LocateHandleBuffer(ByProtocol, &gEfiSimpleFileSystemProtocolGuid, NULL, &HandleCount, &Handles));
+    for (UINTN i = 0; i < HandleCount && FsHandle == NULL; i++) {
+        EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Interface = NULL;
+        if (!EFI_ERROR(gBS->HandleProtocol(Handles[i], &gEfiSimpleFileSystemProtocolGuid, (void**)&Interface)) && Interface == Fs) {
+            FsHandle = Handles[i];
+        }
+    }
+
+    // nothing here is an error, the file protocol is used instead
+    if (FsHandle == NULL) {
+        Status = EFI_UNSUPPORTED;
+        goto cleanup;
+    }
+    Status = BlockDeviceOpenHandle(FsHandle, Device);
+
+cleanup:
+    if (Handles != NULL) {
+        FreePool(Handles);
+    }
+
+    return Status;
+}
+
+EFI_STATUS BlockDeviceOpenHandle(EFI_HANDLE Handle, BLOCK_DEVICE* Device) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    ZeroMem(Device, sizeof(*Device));
+
+    // nothing here is an error either
+    if (EFI_ERROR(gBS->HandleProtocol(Handle, &gEfiBlockIoProtocolGuid, (void**)&Device->BlockIo))) {
+        Status = EFI_UNSUPPORTED;
+        goto cleanup;
+    }
+    if (EFI_ERROR(gBS->HandleProtocol(Handle, &gEfiBlockIo2ProtocolGuid, (void**)&Device->BlockIo2))) {
+        Device->BlockIo2 = NULL;
+    }
+
+    EFI_BLOCK_IO_MEDIA* Media = Device->BlockIo->Media;
+    if (Media == NULL || !Media->MediaPresent || Media->BlockSize == 0 ||
+        (Media->BlockSize & (Media->BlockSize - 1)) != 0 || Media->BlockSize > BOUNCE_SIZE ||
+        Media->IoAlign > EFI_PAGE_SIZE) {
+        Status = EFI_UNSUPPORTED;
+        goto cleanup;
+    }
+    Device->MediaId = Media->MediaId;
+    Device->BlockSize = Media->BlockSize;
+    Device->IoAlign = MAX(Media->IoAlign, 1);
+    Device->Size = MultU64x32(Media->LastBlock + 1, Media->BlockSize);
+
+    Device->Bounce = AllocatePages(EFI_SIZE_TO_PAGES(BOUNCE_SIZE));
+    CHECK_ERROR(Device->Bounce != NULL, EFI_OUT_OF_RESOURCES);
+
+cleanup:
+    if (EFI_ERROR(Status)) {
+        ZeroMem(Device, sizeof(*Device));
+    }
+
+    return Status;
+}
+
+void BlockDeviceClose(BLOCK_DEVICE* Device) {
+    if (Device->Bounce != NULL) {
+        FreePages(Device->Bounce, EFI_SIZE_TO_PAGES(BOUNCE_SIZE));
+    }
+    ZeroMem(Device, sizeof(*Device));
+}
+
+/**
+ * The size of the request that can be made for the start of the range
+ * straight into the buffer, 0 if it has to go through the bounce buffer
+ */
+static UINTN DirectReadSize(BLOCK_DEVICE* Device, UINT64 Offset, void* Buffer, UINTN Size) {
+    if ((Offset & (Device->BlockSize - 1)) != 0 || ((UINTN)Buffer & (Device->IoAlign - 1)) != 0) {
+        return 0;
+    }
+    return MIN(Size, MAX_REQUEST_SIZE) & ~((UINTN)Device->BlockSize - 1);
+}
+
+/**
+ * Read the start of the range through the bounce buffer, returns how much was read
+ */
+static EFI_STATUS BounceRead(BLOCK_DEVICE* Device, UINT64 Offset, UINT8* Buffer, UINTN Size, UINTN* Read) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    UINTN InBlock = Offset & (Device->BlockSize - 1);
+    UINTN ReadSize = MIN(ALIGN_VALUE(InBlock + Size, Device->BlockSize), BOUNCE_SIZE);
+    EFI_CHECK(Device->BlockIo->ReadBlocks(Device->BlockIo, Device->MediaId, DivU64x32(Offset, Device->BlockSize), ReadSize, Device->Bounce));
+
+    *Read = MIN(ReadSize - InBlock, Size);
+    CopyMem(Buffer, Device->Bounce + InBlock, *Read);
+
+cleanup:
+    return Status;
+}
+
+EFI_STATUS BlockDeviceRead(BLOCK_DEVICE* Device, UINT64 Offset, void* Buffer, UINTN Size) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8* Current = Buffer;
+
+    CHECK(Offset <= Device->Size && Size <= Device->Size - Offset);
+
+    while (Size > 0) {
+        UINTN Read = DirectReadSize(Device, Offset, Current, Size);
+        if (Read != 0) {
+            EFI_CHECK(Device->BlockIo->ReadBlocks(Device->BlockIo, Device->MediaId, DivU64x32(Offset, Device->BlockSize), Read, Current));
+        } else {
+            CHECK_AND_RETHROW(BounceRead(Device, Offset, Current, Size, &Read));
+        }
+
+        Offset += Read;
+        Current += Read;
+        Size -= Read;
+    }
+
+cleanup:
+    return Status;
+}
+
+/**
+ * Wait for a queued request and check how it went
+ */
+static EFI_STATUS WaitRequest(QUEUED_REQUEST* Request) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINTN Index = 0;
+
+    if (!Request->Pending) {
+        goto cleanup;
+    }
+    Request->Pending = FALSE;
+
+    EFI_CHECK(gBS->WaitForEvent(1, &Request->Token.Event, &Index));
+    EFI_CHECK(Request->Token.TransactionStatus);
+
+cleanup:
+    return Status;
+}
+
+EFI_STATUS BlockDeviceReadExtents(BLOCK_DEVICE* Device, FILE_EXTENT* Extents, UINTN Count, UINT64 Offset, UINT8* Buffer, UINTN Size) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    QUEUED_REQUEST Requests[MAX_QUEUED_REQUESTS] = { 0 };
+    UINTN NextRequest = 0;
+    UINT64 End = Offset + Size;
+    UINT64 Done = Offset;
+
+    for (UINTN i = 0; i < Count; i++) {
+        // only the part that is in the range
+        UINT64 ExtentStart = MAX(Extents[i].FileOffset, Offset);
+        UINT64 ExtentEnd = MIN(Extents[i].FileOffset + Extents[i].Length, End);
+        if (ExtentStart >= ExtentEnd) {
+            continue;
+        }
+
+        // holes read as zeros
+        CHECK(ExtentStart >= Done);
+        ZeroMem(Buffer + (Done - Offset), ExtentStart - Done);
+        Done = ExtentEnd;
+
+        UINT64 DeviceOffset = Extents[i].DeviceOffset + (ExtentStart - Extents[i].FileOffset);
+        UINT8* Current = Buffer + (ExtentStart - Offset);
+        UINTN Left = (UINTN)(ExtentEnd - ExtentStart);
+        CHECK(DeviceOffset <= Device->Size && Left <= Device->Size - DeviceOffset);
+
+        while (Left > 0) {
+            UINTN Read = DirectReadSize(Device, DeviceOffset, Current, Left);
+            QUEUED_REQUEST* Request = &Requests[NextRequest];
+            if (Read == 0) {
+                CHECK_AND_RETHROW(BounceRead(Device, DeviceOffset, Current, Left, &Read));
+            } else if (Device->BlockIo2 != NULL && (Request->Token.Event != NULL ||
+                       !EFI_ERROR(gBS->CreateEvent(0, TPL_CALLBACK, NULL, NULL, &Request->Token.Event)))) {
+                // reuse the oldest request once they are all in flight
+                NextRequest = (NextRequest + 1) % ARRAY_SIZE(Requests);
+                CHECK_AND_RETHROW(WaitRequest(Request));
+
+                Request->Token.TransactionStatus = EFI_SUCCESS;
+                EFI_CHECK(Device->BlockIo2->ReadBlocksEx(Device->BlockIo2, Device->MediaId, DivU64x32(DeviceOffset, Device->BlockSize), &Request->Token, Read, Current));
+                Request->Pending = TRUE;
+            } else {
+                EFI_CHECK(Device->BlockIo->ReadBlocks(Device->BlockIo, Device->MediaId, DivU64x32(DeviceOffset, Device->BlockSize), Read, Current));
+            }
+
+            DeviceOffset += Read;
+            Current += Read;
+            Left -= Read;
+        }
+    }
+    ZeroMem(Buffer + (Done - Offset), End - Done);
+
+    for (UINTN i = 0; i < ARRAY_SIZE(Requests); i++) {
+        CHECK_AND_RETHROW(WaitRequest(&Requests[i]));
+    }
+
+cleanup:
+    // nothing may still be writing to the buffer once we return
+    for (UINTN i = 0; i < ARRAY_SIZE(Requests); i++) {
+        WaitRequest(&Requests[i]);
+        if (Requests[i].Token.Event != NULL) {
+            gBS->CloseEvent(Requests[i].Token.Event);
+        }
+    }
+
+    return Status;
+}
+
+EFI_STATUS AddFileExtent(FILE_EXTENT** Extents, UINTN* Count, UINTN* Capacity, UINT64 FileOffset, UINT64 DeviceOffset, UINT64 Length) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    // merge it with the last one if it continues it, on the disk and in the file
+    if (*Count != 0) {
+        FILE_EXTENT* Last = &(*Extents)[*Count - 1];
+        if (Last->FileOffset + Last->Length == FileOffset && Last->DeviceOffset + Last->Length == DeviceOffset) {
+            Last->Length += Length;
+            goto cleanup;
+        }
+    }
+
+    if (*Count == *Capacity) {
+        UINTN NewCapacity = MAX(*Capacity * 2, 16);
+        FILE_EXTENT* New = ReallocatePool(*Capacity * sizeof(FILE_EXTENT), NewCapacity * sizeof(FILE_EXTENT), *Extents);
+        CHECK_ERROR(New != NULL, EFI_OUT_OF_RESOURCES);
+        *Extents = New;
+        *Capacity = NewCapacity;
+    }
+
+    (*Extents)[*Count].FileOffset = FileOffset;
+    (*Extents)[*Count].DeviceOffset = DeviceOffset;
+    (*Extents)[*Count].Length = Length;
+    (*Count)++;
+
+cleanup:
+    return Status;
+}
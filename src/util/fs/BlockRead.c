@@ -0,0 +1,119 @@
+#include "FsInternal.h"
+
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+
+#include <util/Except.h>
+#include <util/LogUtils.h>
+
+// how many file systems are remembered, the rest use the file protocol
+#define MAX_VOLUMES 8
+
+typedef struct _BLOCK_VOLUME {
+    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs;
+    BLOCK_DEVICE Device;
+
+    // both NULL if we can't read this file system ourselves
+    FAT_VOLUME* Fat;
+    EXT4_VOLUME* Ext4;
+} BLOCK_VOLUME;
+
+static BLOCK_VOLUME mVolumes[MAX_VOLUMES];
+
+BOOLEAN gBlockReads = TRUE;
+
+/**
+ * Find out once if the file system is on a block device we can read
+ */
+static BLOCK_VOLUME* GetVolume(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs) {
+    if (!gBlockReads) {
+        return NULL;
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(mVolumes); i++) {
+        BLOCK_VOLUME* Volume = &mVolumes[i];
+        if (Volume->Fs == Fs) {
+            return Volume->Fat != NULL || Volume->Ext4 != NULL ? Volume : NULL;
+        }
+
+        if (Volume->Fs == NULL) {
+            Volume->Fs = Fs;
+            if (!EFI_ERROR(BlockDeviceOpen(Fs, &Volume->Device))) {
+                if (EFI_ERROR(FatOpen(&Volume->Device, &Volume->Fat)) &&
+                    EFI_ERROR(Ext4Open(&Volume->Device, &Volume->Ext4))) {
+                    BlockDeviceClose(&Volume->Device);
+                }
+            }
+            return Volume->Fat != NULL || Volume->Ext4 != NULL ? Volume : NULL;
+        }
+    }
+
+    return NULL;
+}
+
+BOOLEAN BlockReadSupported(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs) {
+    return GetVolume(Fs) != NULL;
+}
+
+EFI_STATUS BlockReadFile(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs, CHAR16* Path, void* Buffer, UINTN Size) {
+    BLOCK_READ_RANGE Range = { .Offset = 0, .Buffer = Buffer, .Size = Size };
+    return BlockReadFileRanges(Fs, Path, &Range, 1);
+}
+
+EFI_STATUS BlockReadFileRanges(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs, CHAR16* Path, BLOCK_READ_RANGE* Ranges, UINTN RangeCount) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    FILE_EXTENT* Extents = NULL;
+    UINTN Count = 0;
+    UINT64 FileSize = 0;
+
+    BLOCK_VOLUME* Volume = GetVolume(Fs);
+    if (Volume == NULL) {
+        Status = EFI_UNSUPPORTED;
+        goto cleanup;
+    }
+
+    // the file protocol found it, if we don't then we don't understand
+    // the file system as well as we thought
+    if (Volume->Fat != NULL) {
+        Status = FatGetExtents(Volume->Fat, Path, &Extents, &Count, &FileSize);
+    } else {
+        Status = Ext4GetExtents(Volume->Ext4, Path, &Extents, &Count, &FileSize);
+    }
+    if (Status == EFI_NOT_FOUND) {
+        Status = EFI_UNSUPPORTED;
+        goto cleanup;
+    }
+    CHECK_AND_RETHROW(Status);
+
+    for (UINTN i = 0; i < RangeCount; i++) {
+        if (Ranges[i].Offset > FileSize || Ranges[i].Size > FileSize - Ranges[i].Offset) {
+            Status = EFI_UNSUPPORTED;
+            goto cleanup;
+        }
+    }
+
+    LOG_DEBUG("Reading `%s` from the disk in %d runs\n", Path, Count);
+    for (UINTN i = 0; i < RangeCount; i++) {
+        CHECK_AND_RETHROW(BlockDeviceReadExtents(&Volume->Device, Extents, Count, Ranges[i].Offset, Ranges[i].Buffer, Ranges[i].Size));
+    }
+
+cleanup:
+    if (Extents != NULL) {
+        FreePool(Extents);
+    }
+
+    return Status;
+}
+
+void BlockReadClose() {
+    for (int i = 0; i < ARRAY_SIZE(mVolumes); i++) {
+        if (mVolumes[i].Fat != NULL) {
+            FatClose(mVolumes[i].Fat);
+        }
+        if (mVolumes[i].Ext4 != NULL) {
+            Ext4Close(mVolumes[i].Ext4);
+        }
+        BlockDeviceClose(&mVolumes[i].Device);
+    }
+    ZeroMem(mVolumes, sizeof(mVolumes));
+}
@@ -0,0 +1,49 @@
+#ifndef __UTIL_FS_BLOCKREAD_H__
+#define __UTIL_FS_BLOCKREAD_H__
+
+#include <Uefi.h>
+#include <Protocol/SimpleFileSystem.h>
+
+/**
+ * Read the files from the block device when we can (BLOCK_READS)
+ */
+extern BOOLEAN gBlockReads;
+
+/**
+ * Read the first Size bytes of a file straight from the block device the file
+ * system is on, bypassing the file protocol. The extents of the file are found
+ * once and every contiguous run is read with as few and as big requests as the
+ * device takes.
+ *
+ * Returns EFI_UNSUPPORTED when there is no block device under the file system
+ * or the file system is not one we understand, the file must be read with the
+ * file protocol then.
+ */
+EFI_STATUS BlockReadFile(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs, CHAR16* Path, void* Buffer, UINTN Size);
+
+/**
+ * A part of a file and the buffer it is read to
+ */
+typedef struct _BLOCK_READ_RANGE {
+    UINT64 Offset;
+    void* Buffer;
+    UINTN Size;
+} BLOCK_READ_RANGE;
+
+/**
+ * Like BlockReadFile, but reads parts of the file into buffers of their
+ * own, the extents of the file are only found once for all of them.
+ */
+EFI_STATUS BlockReadFileRanges(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs, CHAR16* Path, BLOCK_READ_RANGE* Ranges, UINTN RangeCount);
+
+/**
+ * Check if BlockReadFile can be used for files of the file system
+ */
+BOOLEAN BlockReadSupported(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs);
+
+/**
+ * Forget the file systems and free what was kept for reading them
+ */
+void BlockReadClose();
+
+#endif //__UTIL_FS_BLOCKREAD_H__
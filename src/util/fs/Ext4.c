@@ -0,0 +1,1195 @@
+#include "FsInternal.h"
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+
+#include <util/Except.h>
+#include <util/LogUtils.h>
+
+/**
+ * Implementation References
+ * - https://www.kernel.org/doc/html/latest/filesystems/ext4/
+ * - linux fs/ext4/namei.c and fs/ext4/hash.c for the htree
+ */
+
+#define EXT4_SUPERBLOCK_OFFSET 1024
+#define EXT4_MAGIC 0xEF53
+
+#define EXT4_FEATURE_INCOMPAT_FILETYPE 0x0002
+#define EXT4_FEATURE_INCOMPAT_RECOVER 0x0004
+#define EXT4_FEATURE_INCOMPAT_EXTENTS 0x0040
+#define EXT4_FEATURE_INCOMPAT_64BIT 0x0080
+#define EXT4_FEATURE_INCOMPAT_MMP 0x0100
+#define EXT4_FEATURE_INCOMPAT_FLEX_BG 0x0200
+#define EXT4_FEATURE_INCOMPAT_EA_INODE 0x0400
+#define EXT4_FEATURE_INCOMPAT_CSUM_SEED 0x2000
+#define EXT4_FEATURE_INCOMPAT_LARGEDIR 0x4000
+#define EXT4_FEATURE_INCOMPAT_INLINE_DATA 0x8000
+#define EXT4_FEATURE_INCOMPAT_ENCRYPT 0x10000
+#define EXT4_FEATURE_INCOMPAT_CASEFOLD 0x20000
+
+// none of these change where the data of a file is, the files they do
+// change (inline data, encrypted) are refused one by one
+#define EXT4_SUPPORTED_INCOMPAT (EXT4_FEATURE_INCOMPAT_FILETYPE | EXT4_FEATURE_INCOMPAT_RECOVER | \
+                                 EXT4_FEATURE_INCOMPAT_EXTENTS | EXT4_FEATURE_INCOMPAT_64BIT | \
+                                 EXT4_FEATURE_INCOMPAT_MMP | EXT4_FEATURE_INCOMPAT_FLEX_BG | \
+                                 EXT4_FEATURE_INCOMPAT_EA_INODE | EXT4_FEATURE_INCOMPAT_CSUM_SEED | \
+                                 EXT4_FEATURE_INCOMPAT_LARGEDIR | EXT4_FEATURE_INCOMPAT_INLINE_DATA | \
+                                 EXT4_FEATURE_INCOMPAT_ENCRYPT | EXT4_FEATURE_INCOMPAT_CASEFOLD)
+
+#define EXT4_FLAGS_UNSIGNED_HASH 0x2
+
+#define EXT4_ENCRYPT_FL 0x800
+#define EXT4_INDEX_FL 0x1000
+#define EXT4_EXTENTS_FL 0x80000
+#define EXT4_INLINE_DATA_FL 0x10000000
+#define EXT4_CASEFOLD_FL 0x40000000
+
+#define EXT4_EXTENT_MAGIC 0xF30A
+#define EXT4_EXTENT_MAX_DEPTH 5
+#define EXT4_EXTENT_MAX_LENGTH 32768
+
+#define EXT4_DIRECT_BLOCKS 12
+
+#define EXT4_HASH_LEGACY 0
+#define EXT4_HASH_HALF_MD4 1
+#define EXT4_HASH_TEA 2
+#define EXT4_HASH_LEGACY_UNSIGNED 3
+#define EXT4_HASH_HALF_MD4_UNSIGNED 4
+#define EXT4_HASH_TEA_UNSIGNED 5
+
+#define EXT4_HTREE_MAX_LEVELS 3
+#define EXT4_HTREE_EOF 0x7FFFFFFF
+
+// like linux, to catch symlink loops
+#define EXT4_MAX_SYMLINKS 8
+#define EXT4_MAX_SYMLINK_SIZE 4096
+
+#pragma pack(1)
+
+typedef struct _EXT4_SUPERBLOCK {
+    UINT32 InodesCount;
+    UINT32 BlocksCountLo;
+    UINT32 ReservedBlocksCountLo;
+    UINT32 FreeBlocksCountLo;
+    UINT32 FreeInodesCount;
+    UINT32 FirstDataBlock;
+    UINT32 LogBlockSize;
+    UINT32 LogClusterSize;
+    UINT32 BlocksPerGroup;
+    UINT32 ClustersPerGroup;
+    UINT32 InodesPerGroup;
+    UINT32 MountTime;
+    UINT32 WriteTime;
+    UINT16 MountCount;
+    UINT16 MaxMountCount;
+    UINT16 Magic;
+    UINT16 State;
+    UINT16 Errors;
+    UINT16 MinorRevLevel;
+    UINT32 LastCheck;
+    UINT32 CheckInterval;
+    UINT32 CreatorOs;
+    UINT32 RevLevel;
+    UINT16 DefResUid;
+    UINT16 DefResGid;
+    UINT32 FirstIno;
+    UINT16 InodeSize;
+    UINT16 BlockGroupNr;
+    UINT32 FeatureCompat;
+    UINT32 FeatureIncompat;
+    UINT32 FeatureRoCompat;
+    UINT8 Uuid[16];
+    CHAR8 VolumeName[16];
+    CHAR8 LastMounted[64];
+    UINT32 AlgorithmUsageBitmap;
+    UINT8 PreallocBlocks;
+    UINT8 PreallocDirBlocks;
+    UINT16 ReservedGdtBlocks;
+    UINT8 JournalUuid[16];
+    UINT32 JournalInum;
+    UINT32 JournalDev;
+    UINT32 LastOrphan;
+    UINT32 HashSeed[4];
+    UINT8 DefHashVersion;
+    UINT8 JournalBackupType;
+    UINT16 DescSize;
+    UINT32 DefaultMountOpts;
+    UINT32 FirstMetaBg;
+    UINT32 MkfsTime;
+    UINT32 JournalBlocks[17];
+    UINT32 BlocksCountHi;
+    UINT32 ReservedBlocksCountHi;
+    UINT32 FreeBlocksCountHi;
+    UINT16 MinExtraInodeSize;
+    UINT16 WantExtraInodeSize;
+    UINT32 Flags;
+} EXT4_SUPERBLOCK;
+
+typedef struct _EXT4_GROUP_DESC {
+    UINT32 BlockBitmapLo;
+    UINT32 InodeBitmapLo;
+    UINT32 InodeTableLo;
+    UINT16 FreeBlocksCountLo;
+    UINT16 FreeInodesCountLo;
+    UINT16 UsedDirsCountLo;
+    UINT16 Flags;
+    UINT32 ExcludeBitmapLo;
+    UINT16 BlockBitmapCsumLo;
+    UINT16 InodeBitmapCsumLo;
+    UINT16 ItableUnusedLo;
+    UINT16 Checksum;
+
+    // only with the 64bit feature
+    UINT32 BlockBitmapHi;
+    UINT32 InodeBitmapHi;
+    UINT32 InodeTableHi;
+} EXT4_GROUP_DESC;
+
+typedef struct _EXT4_INODE {
+    UINT16 Mode;
+    UINT16 Uid;
+    UINT32 SizeLo;
+    UINT32 AccessTime;
+    UINT32 ChangeTime;
+    UINT32 ModificationTime;
+    UINT32 DeletionTime;
+    UINT16 Gid;
+    UINT16 LinksCount;
+    UINT32 BlocksLo;
+    UINT32 Flags;
+    UINT32 Osd1;
+    UINT8 Block[60];
+    UINT32 Generation;
+    UINT32 FileAclLo;
+    UINT32 SizeHigh;
+    UINT32 ObsoleteFragmentAddress;
+    UINT8 Osd2[12];
+} EXT4_INODE;
+
+typedef struct _EXT4_EXTENT_HEADER {
+    UINT16 Magic;
+    UINT16 Entries;
+    UINT16 Max;
+    UINT16 Depth;
+    UINT32 Generation;
+} EXT4_EXTENT_HEADER;
+
+typedef struct _EXT4_EXTENT {
+    UINT32 Block;
+    UINT16 Length;
+    UINT16 StartHi;
+    UINT32 StartLo;
+} EXT4_EXTENT;
+
+typedef struct _EXT4_EXTENT_INDEX {
+    UINT32 Block;
+    UINT32 LeafLo;
+    UINT16 LeafHi;
+    UINT16 Unused;
+} EXT4_EXTENT_INDEX;
+
+typedef struct _EXT4_DIRENT {
+    UINT32 Inode;
+    UINT16 RecordLength;
+    UINT8 NameLength;
+    UINT8 FileType;
+    CHAR8 Name[];
+} EXT4_DIRENT;
+
+typedef struct _EXT4_DX_ROOT_INFO {
+    UINT32 ReservedZero;
+    UINT8 HashVersion;
+    UINT8 InfoLength;
+    UINT8 IndirectLevels;
+    UINT8 UnusedFlags;
+} EXT4_DX_ROOT_INFO;
+
+typedef struct _EXT4_DX_COUNT_LIMIT {
+    UINT16 Limit;
+    UINT16 Count;
+} EXT4_DX_COUNT_LIMIT;
+
+typedef struct _EXT4_DX_ENTRY {
+    UINT32 Hash;
+    UINT32 Block;
+} EXT4_DX_ENTRY;
+
+#pragma pack()
+
+struct _EXT4_VOLUME {
+    BLOCK_DEVICE* Device;
+
+    UINT32 BlockSize;
+    UINT64 BlocksCount;
+    UINT64 FreeBlocksCount;
+    UINT32 InodesCount;
+    UINT32 InodesPerGroup;
+    UINT32 InodeSize;
+    UINT32 DescSize;
+    UINT64 DescOffset;
+
+    // where the inode table of every group is, 0 until it is needed
+    UINT64* InodeTables;
+    UINT32 Incompat;
+    UINT32 HashSeed[4];
+    BOOLEAN UnsignedHash;
+    CHAR8 VolumeName[17];
+
+    // the last directory block that was read
+    UINT8* DirBlock;
+    UINT32 DirBlockInode;
+    UINT64 DirBlockIndex;
+};
+
+EFI_STATUS Ext4Open(BLOCK_DEVICE* Device, EXT4_VOLUME** Volume) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EXT4_VOLUME* New = NULL;
+    EXT4_SUPERBLOCK Sb;
+
+    *Volume = NULL;
+
+    if (Device->Size < EXT4_SUPERBLOCK_OFFSET + sizeof(Sb)) {
+        Status = EFI_UNSUPPORTED;
+        goto cleanup;
+    }
+    CHECK_AND_RETHROW(BlockDeviceRead(Device, EXT4_SUPERBLOCK_OFFSET, &Sb, sizeof(Sb)));
+
+    // anything that does not look like ext is for someone else
+    if (Sb.Magic != EXT4_MAGIC || Sb.LogBlockSize > 6 || Sb.BlocksPerGroup == 0 ||
+        Sb.InodesPerGroup == 0 || Sb.InodesCount == 0) {
+        Status = EFI_UNSUPPORTED;
+        goto cleanup;
+    }
+
+    // meta_bg moves the group descriptors around, and the rest we don't know at all
+    if (Sb.FeatureIncompat & ~EXT4_SUPPORTED_INCOMPAT) {
+        LOG_DEBUG("Not reading ext4 volume with incompatible features %x\n", Sb.FeatureIncompat & ~EXT4_SUPPORTED_INCOMPAT);
+        Status = EFI_UNSUPPORTED;
+        goto cleanup;
+    }
+
+    New = AllocateZeroPool(sizeof(EXT4_VOLUME));
+    CHECK_ERROR(New != NULL, EFI_OUT_OF_RESOURCES);
+    New->Device = Device;
+    New->BlockSize = SIZE_1KB << Sb.LogBlockSize;
+    New->Incompat = Sb.FeatureIncompat;
+    New->InodesCount = Sb.InodesCount;
+    New->InodesPerGroup = Sb.InodesPerGroup;
+    New->InodeSize = Sb.RevLevel == 0 ? sizeof(EXT4_INODE) : Sb.InodeSize;
+    New->BlocksCount = Sb.BlocksCountLo;
+    New->FreeBlocksCount = Sb.FreeBlocksCountLo;
+    New->DescSize = 32;
+    if (New->Incompat & EXT4_FEATURE_INCOMPAT_64BIT) {
+        New->BlocksCount |= LShiftU64(Sb.BlocksCountHi, 32);
+        New->FreeBlocksCount |= LShiftU64(Sb.FreeBlocksCountHi, 32);
+        New->DescSize = Sb.DescSize;
+    }
+    New->DescOffset = MultU64x32(Sb.FirstDataBlock + 1, New->BlockSize);
+    CopyMem(New->HashSeed, Sb.HashSeed, sizeof(New->HashSeed));
+    New->UnsignedHash = (Sb.Flags & EXT4_FLAGS_UNSIGNED_HASH) != 0;
+    CopyMem(New->VolumeName, Sb.VolumeName, sizeof(Sb.VolumeName));
+
+    UINT64 Groups = DivU64x32(New->BlocksCount - Sb.FirstDataBlock + Sb.BlocksPerGroup - 1, Sb.BlocksPerGroup);
+    if (New->InodeSize < sizeof(EXT4_INODE) || New->InodeSize > New->BlockSize || (New->InodeSize & (New->InodeSize - 1)) != 0 ||
+        New->DescSize < 32 || New->DescSize > New->BlockSize || (New->DescSize & (New->DescSize - 1)) != 0 ||
+        Sb.FirstDataBlock >= New->BlocksCount || MultU64x32(New->BlocksCount, New->BlockSize) > Device->Size ||
+        New->InodesCount > MultU64x32(Groups, New->InodesPerGroup)) {
+        Status = EFI_UNSUPPORTED;
+        goto cleanup;
+    }
+
+    UINTN InodeGroups = (UINTN)DivU64x32((UINT64)New->InodesCount + New->InodesPerGroup - 1, New->InodesPerGroup);
+    New->InodeTables = AllocateZeroPool(InodeGroups * sizeof(UINT64));
+    CHECK_ERROR(New->InodeTables != NULL, EFI_OUT_OF_RESOURCES);
+
+    if (New->Incompat & EXT4_FEATURE_INCOMPAT_RECOVER) {
+        LOG_WARN("The ext4 volume `%a` needs recovery, the journal is not replayed\n", New->VolumeName);
+    }
+
+    New->DirBlock = AllocatePool(New->BlockSize);
+    CHECK_ERROR(New->DirBlock != NULL, EFI_OUT_OF_RESOURCES);
+    New->DirBlockIndex = MAX_UINT64;
+
+    *Volume = New;
+    New = NULL;
+
+cleanup:
+    if (New != NULL) {
+        Ext4Close(New);
+    }
+
+    return Status;
+}
+
+void Ext4Close(EXT4_VOLUME* Volume) {
+    if (Volume->InodeTables != NULL) {
+        FreePool(Volume->InodeTables);
+    }
+    if (Volume->DirBlock != NULL) {
+        FreePool(Volume->DirBlock);
+    }
+    FreePool(Volume);
+}
+
+void Ext4GetVolumeInfo(EXT4_VOLUME* Volume, UINT64* VolumeSize, UINT64* FreeSpace, UINT32* BlockSize, CHAR16* Label, UINTN LabelSize) {
+    *VolumeSize = MultU64x32(Volume->BlocksCount, Volume->BlockSize);
+    *FreeSpace = MultU64x32(Volume->FreeBlocksCount, Volume->BlockSize);
+    *BlockSize = Volume->BlockSize;
+    Ext4NameToUnicode(Volume->VolumeName, MIN(AsciiStrLen(Volume->VolumeName), LabelSize / sizeof(CHAR16) - 1), Label);
+}
+
+EFI_STATUS Ext4GetNode(EXT4_VOLUME* Volume, UINT32 Number, EXT4_NODE* Node) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EXT4_GROUP_DESC Desc = { 0 };
+    EXT4_INODE Inode;
+
+    ZeroMem(Node, sizeof(*Node));
+
+    CHECK_ERROR_TRACE(Number >= 1 && Number <= Volume->InodesCount, EFI_VOLUME_CORRUPTED, "Inode %d is out of range", Number);
+
+    UINT32 Group = (Number - 1) / Volume->InodesPerGroup;
+    UINT32 Index = (Number - 1) % Volume->InodesPerGroup;
+    UINT64 InodeTable = Volume->InodeTables[Group];
+    if (InodeTable == 0) {
+        UINT64 DescOffset = Volume->DescOffset + MultU64x32(Group, Volume->DescSize);
+        CHECK_AND_RETHROW(BlockDeviceRead(Volume->Device, DescOffset, &Desc, MIN(Volume->DescSize, sizeof(Desc))));
+
+        InodeTable = Desc.InodeTableLo;
+        if (Volume->Incompat & EXT4_FEATURE_INCOMPAT_64BIT) {
+            InodeTable |= LShiftU64(Desc.InodeTableHi, 32);
+        }
+        CHECK_ERROR_TRACE(InodeTable != 0 && InodeTable < Volume->BlocksCount, EFI_VOLUME_CORRUPTED, "The inode table of group %d is out of range", Group);
+        Volume->InodeTables[Group] = InodeTable;
+    }
+
+    UINT64 Offset = MultU64x32(InodeTable, Volume->BlockSize) + MultU64x32(Index, Volume->InodeSize);
+    CHECK_AND_RETHROW(BlockDeviceRead(Volume->Device, Offset, &Inode, sizeof(Inode)));
+    CHECK_ERROR_TRACE(Inode.Mode != 0, EFI_VOLUME_CORRUPTED, "Inode %d is not in use", Number);
+
+    Node->Number = Number;
+    Node->Mode = Inode.Mode;
+    Node->Flags = Inode.Flags;
+    Node->Size = Inode.SizeLo | LShiftU64(Inode.SizeHigh, 32);
+    Node->AccessTime = Inode.AccessTime;
+    Node->ChangeTime = Inode.ChangeTime;
+    Node->ModificationTime = Inode.ModificationTime;
+    CopyMem(Node->Block, Inode.Block, sizeof(Node->Block));
+
+cleanup:
+    return Status;
+}
+
+void Ext4FreeNode(EXT4_NODE* Node) {
+    if (Node->Extents != NULL) {
+        FreePool(Node->Extents);
+    }
+    Node->Extents = NULL;
+    Node->Count = 0;
+    Node->Mapped = FALSE;
+}
+
+/**
+ * A fast symlink keeps the target in place of the block map
+ */
+static BOOLEAN IsFastSymlink(EXT4_NODE* Node) {
+    return (Node->Mode & EXT4_S_IFMT) == EXT4_S_IFLNK && !(Node->Flags & (EXT4_EXTENTS_FL | EXT4_INLINE_DATA_FL)) &&
+           Node->Size < sizeof(Node->Block);
+}
+
+static EFI_STATUS AddBlocks(EXT4_VOLUME* Volume, EXT4_NODE* Node, UINTN* Capacity, UINT64 Logical, UINT64 Physical, UINT64 Count) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    CHECK_ERROR_TRACE(Physical < Volume->BlocksCount && Count <= Volume->BlocksCount - Physical, EFI_VOLUME_CORRUPTED,
+                      "Block %ld of inode %d is out of range", Physical, Node->Number);
+    CHECK_AND_RETHROW(AddFileExtent(&Node->Extents, &Node->Count, Capacity,
+                                    MultU64x32(Logical, Volume->BlockSize),
+                                    MultU64x32(Physical, Volume->BlockSize),
+                                    MultU64x32(Count, Volume->BlockSize)));
+
+cleanup:
+    return Status;
+}
+
+/**
+ * Map a node of the extent tree, the tree is sorted so the extents come out sorted
+ */
+static EFI_STATUS MapExtentNode(EXT4_VOLUME* Volume, EXT4_NODE* Node, UINTN* Capacity, UINT8* Data, UINTN Size, UINT16 Depth) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8* Child = NULL;
+
+    EXT4_EXTENT_HEADER* Header = (EXT4_EXTENT_HEADER*)Data;
+    CHECK_ERROR_TRACE(Header->Magic == EXT4_EXTENT_MAGIC && Header->Depth == Depth &&
+                      sizeof(EXT4_EXTENT_HEADER) + Header->Entries * sizeof(EXT4_EXTENT) <= Size,
+                      EFI_VOLUME_CORRUPTED, "The extent tree of inode %d is corrupted", Node->Number);
+
+    if (Depth == 0) {
+        EXT4_EXTENT* Extents = (EXT4_EXTENT*)(Header + 1);
+        for (UINTN i = 0; i < Header->Entries; i++) {
+            // unwritten extents read as zeros, so they are holes to us
+            if (Extents[i].Length > EXT4_EXTENT_MAX_LENGTH) {
+                continue;
+            }
+            UINT64 Start = Extents[i].StartLo | LShiftU64(Extents[i].StartHi, 32);
+            CHECK_AND_RETHROW(AddBlocks(Volume, Node, Capacity, Extents[i].Block, Start, Extents[i].Length));
+        }
+        goto cleanup;
+    }
+
+    Child = AllocatePool(Volume->BlockSize);
+    CHECK_ERROR(Child != NULL, EFI_OUT_OF_RESOURCES);
+
+    EXT4_EXTENT_INDEX* Indexes = (EXT4_EXTENT_INDEX*)(Header + 1);
+    for (UINTN i = 0; i < Header->Entries; i++) {
+        UINT64 Leaf = Indexes[i].LeafLo | LShiftU64(Indexes[i].LeafHi, 32);
+        CHECK_ERROR_TRACE(Leaf < Volume->BlocksCount, EFI_VOLUME_CORRUPTED, "The extent tree of inode %d is corrupted", Node->Number);
+        CHECK_AND_RETHROW(BlockDeviceRead(Volume->Device, MultU64x32(Leaf, Volume->BlockSize), Child, Volume->BlockSize));
+        CHECK_AND_RETHROW(MapExtentNode(Volume, Node, Capacity, Child, Volume->BlockSize, Depth - 1));
+    }
+
+cleanup:
+    if (Child != NULL) {
+        FreePool(Child);
+    }
+
+    return Status;
+}
+
+/**
+ * Map a block of the old style block map, Level is how many levels of
+ * indirection are left under it
+ */
+static EFI_STATUS MapIndirect(EXT4_VOLUME* Volume, EXT4_NODE* Node, UINTN* Capacity, UINT32 Block, UINTN Level, UINT64* Logical, UINT64 Blocks) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT32* Entries = NULL;
+    UINT32 PerBlock = Volume->BlockSize / sizeof(UINT32);
+
+    // a hole as big as everything under it
+    if (Block == 0) {
+        UINT64 Span = 1;
+        for (UINTN i = 0; i < Level; i++) {
+            Span = MultU64x32(Span, PerBlock);
+        }
+        *Logical += Span;
+        goto cleanup;
+    }
+
+    CHECK_ERROR_TRACE(Block < Volume->BlocksCount, EFI_VOLUME_CORRUPTED, "The block map of inode %d is corrupted", Node->Number);
+    Entries = AllocatePool(Volume->BlockSize);
+    CHECK_ERROR(Entries != NULL, EFI_OUT_OF_RESOURCES);
+    CHECK_AND_RETHROW(BlockDeviceRead(Volume->Device, MultU64x32(Block, Volume->BlockSize), Entries, Volume->BlockSize));
+
+    for (UINT32 i = 0; i < PerBlock && *Logical < Blocks; i++) {
+        if (Level == 1) {
+            if (Entries[i] != 0) {
+                CHECK_AND_RETHROW(AddBlocks(Volume, Node, Capacity, *Logical, Entries[i], 1));
+            }
+            (*Logical)++;
+        } else {
+            CHECK_AND_RETHROW(MapIndirect(Volume, Node, Capacity, Entries[i], Level - 1, Logical, Blocks));
+        }
+    }
+
+cleanup:
+    if (Entries != NULL) {
+        FreePool(Entries);
+    }
+
+    return Status;
+}
+
+/**
+ * Turn the extent tree or block map of the node into extents, only once
+ */
+static EFI_STATUS MapNode(EXT4_VOLUME* Volume, EXT4_NODE* Node) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINTN Capacity = 0;
+
+    if (Node->Mapped) {
+        goto cleanup;
+    }
+
+    CHECK_ERROR_TRACE(!(Node->Flags & EXT4_INLINE_DATA_FL), EFI_UNSUPPORTED, "Inode %d has inline data", Node->Number);
+    CHECK_ERROR_TRACE(!(Node->Flags & EXT4_ENCRYPT_FL), EFI_UNSUPPORTED, "Inode %d is encrypted", Node->Number);
+    CHECK(!IsFastSymlink(Node));
+
+    UINT64 Blocks = DivU64x32(Node->Size + Volume->BlockSize - 1, Volume->BlockSize);
+    if (Node->Flags & EXT4_EXTENTS_FL) {
+        UINT16 Depth = ((EXT4_EXTENT_HEADER*)Node->Block)->Depth;
+        CHECK_ERROR_TRACE(Depth <= EXT4_EXTENT_MAX_DEPTH, EFI_VOLUME_CORRUPTED, "The extent tree of inode %d is too deep", Node->Number);
+        CHECK_AND_RETHROW(MapExtentNode(Volume, Node, &Capacity, Node->Block, sizeof(Node->Block), Depth));
+    } else {
+        UINT32* Map = (UINT32*)Node->Block;
+        UINT64 Logical = 0;
+        for (; Logical < EXT4_DIRECT_BLOCKS && Logical < Blocks; Logical++) {
+            if (Map[Logical] != 0) {
+                CHECK_AND_RETHROW(AddBlocks(Volume, Node, &Capacity, Logical, Map[Logical], 1));
+            }
+        }
+        for (UINTN Level = 1; Level <= 3 && Logical < Blocks; Level++) {
+            CHECK_AND_RETHROW(MapIndirect(Volume, Node, &Capacity, Map[EXT4_DIRECT_BLOCKS + Level - 1], Level, &Logical, Blocks));
+        }
+    }
+
+    // blocks past the end may be allocated, they are not part of the file
+    while (Node->Count > 0 && Node->Extents[Node->Count - 1].FileOffset >= Node->Size) {
+        Node->Count--;
+    }
+    if (Node->Count > 0) {
+        FILE_EXTENT* Last = &Node->Extents[Node->Count - 1];
+        Last->Length = MIN(Last->Length, Node->Size - Last->FileOffset);
+    }
+    Node->Mapped = TRUE;
+
+cleanup:
+    if (EFI_ERROR(Status)) {
+        Ext4FreeNode(Node);
+    }
+
+    return Status;
+}
+
+EFI_STATUS Ext4ReadNode(EXT4_VOLUME* Volume, EXT4_NODE* Node, UINT64 Offset, void* Buffer, UINTN Size) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    if (IsFastSymlink(Node)) {
+        ZeroMem(Buffer, Size);
+        if (Offset < Node->Size) {
+            CopyMem(Buffer, Node->Block + Offset, (UINTN)MIN(Size, Node->Size - Offset));
+        }
+        goto cleanup;
+    }
+
+    CHECK_AND_RETHROW(MapNode(Volume, Node));
+    CHECK_AND_RETHROW(BlockDeviceReadExtents(Volume->Device, Node->Extents, Node->Count, Offset, Buffer, Size));
+
+cleanup:
+    return Status;
+}
+
+/**
+ * Read a single block of a node, without queueing it on the device like the
+ * reads of whole files
+ */
+static EFI_STATUS ReadNodeBlock(EXT4_VOLUME* Volume, EXT4_NODE* Node, UINT64 Index, void* Buffer) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    CHECK_AND_RETHROW(MapNode(Volume, Node));
+
+    // the last extent that starts at or before the block
+    UINT64 Offset = MultU64x32(Index, Volume->BlockSize);
+    UINTN Low = 0;
+    UINTN High = Node->Count;
+    while (Low < High) {
+        UINTN Middle = Low + (High - Low) / 2;
+        if (Node->Extents[Middle].FileOffset > Offset) {
+            High = Middle;
+        } else {
+            Low = Middle + 1;
+        }
+    }
+
+    ZeroMem(Buffer, Volume->BlockSize);
+    FILE_EXTENT* Extent = Low > 0 ? &Node->Extents[Low - 1] : NULL;
+    if (Extent != NULL && Offset < Extent->FileOffset + Extent->Length) {
+        UINT64 InExtent = Offset - Extent->FileOffset;
+        UINTN Size = (UINTN)MIN(Volume->BlockSize, Extent->Length - InExtent);
+        CHECK_AND_RETHROW(BlockDeviceRead(Volume->Device, Extent->DeviceOffset + InExtent, Buffer, Size));
+    }
+
+cleanup:
+    return Status;
+}
+
+/**
+ * Read the entry at the position as it is, including unused entries
+ */
+static EFI_STATUS ReadRawDirEntry(EXT4_VOLUME* Volume, EXT4_NODE* Directory, UINT64* Position, EXT4_DIR_ENTRY* Entry) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    if (*Position >= Directory->Size) {
+        Status = EFI_NOT_FOUND;
+        goto cleanup;
+    }
+
+    UINT64 Index = DivU64x32(*Position, Volume->BlockSize);
+    UINTN InBlock = (UINTN)(*Position - MultU64x32(Index, Volume->BlockSize));
+    if (Volume->DirBlockInode != Directory->Number || Volume->DirBlockIndex != Index) {
+        Volume->DirBlockIndex = MAX_UINT64;
+        CHECK_AND_RETHROW(ReadNodeBlock(Volume, Directory, Index, Volume->DirBlock));
+        Volume->DirBlockInode = Directory->Number;
+        Volume->DirBlockIndex = Index;
+    }
+
+    // entries never cross a block
+    EXT4_DIRENT* Dirent = (EXT4_DIRENT*)(Volume->DirBlock + InBlock);
+    UINTN Left = Volume->BlockSize - InBlock;
+    UINTN Length = 0;
+    if (Left >= sizeof(EXT4_DIRENT)) {
+        Length = Dirent->RecordLength;
+        if (Volume->BlockSize == SIZE_64KB && (Length == 0 || Length == MAX_UINT16)) {
+            Length = SIZE_64KB;
+        }
+    }
+    CHECK_ERROR_TRACE(Length >= sizeof(EXT4_DIRENT) + Dirent->NameLength && Length <= Left && (Length & 3) == 0,
+                      EFI_VOLUME_CORRUPTED, "Bad directory entry in inode %d at %ld", Directory->Number, *Position);
+
+    Entry->Inode = Dirent->Inode;
+    Entry->NameLength = Dirent->NameLength;
+    CopyMem(Entry->Name, Dirent->Name, Dirent->NameLength);
+    Entry->Name[Entry->NameLength] = '\0';
+    *Position += Length;
+
+cleanup:
+    return Status;
+}
+
+EFI_STATUS Ext4ReadDirEntry(EXT4_VOLUME* Volume, EXT4_NODE* Directory, UINT64* Position, EXT4_DIR_ENTRY* Entry) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    // inode 0 is a deleted entry, the htree nodes and the checksum tail look like that too
+    do {
+        Status = ReadRawDirEntry(Volume, Directory, Position, Entry);
+        if (Status == EFI_NOT_FOUND) {
+            goto cleanup;
+        }
+        CHECK_AND_RETHROW(Status);
+    } while (Entry->Inode == 0);
+
+cleanup:
+    return Status;
+}
+
+static BOOLEAN EntryMatches(EXT4_DIR_ENTRY* Entry, CHAR8* Name, UINTN Length) {
+    return Entry->Inode != 0 && Entry->NameLength == Length && CompareMem(Entry->Name, Name, Length) == 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Directory hashes, from linux
+//----------------------------------------------------------------------------------------------------------------------
+
+#define HASH_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define HASH_G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define HASH_H(x, y, z) ((x) ^ (y) ^ (z))
+#define HASH_ROUND(f, a, b, c, d, x, s) (a += f(b, c, d) + (x), a = (a << (s)) | (a >> (32 - (s))))
+#define HASH_K2 013240474631U
+#define HASH_K3 015666365641U
+
+static void HalfMd4Transform(UINT32 Buffer[4], UINT32 In[8]) {
+    UINT32 a = Buffer[0], b = Buffer[1], c = Buffer[2], d = Buffer[3];
+
+    HASH_ROUND(HASH_F, a, b, c, d, In[0], 3);
+    HASH_ROUND(HASH_F, d, a, b, c, In[1], 7);
+    HASH_ROUND(HASH_F, c, d, a, b, In[2], 11);
+    HASH_ROUND(HASH_F, b, c, d, a, In[3], 19);
+    HASH_ROUND(HASH_F, a, b, c, d, In[4], 3);
+    HASH_ROUND(HASH_F, d, a, b, c, In[5], 7);
+    HASH_ROUND(HASH_F, c, d, a, b, In[6], 11);
+    HASH_ROUND(HASH_F, b, c, d, a, In[7], 19);
+
+    HASH_ROUND(HASH_G, a, b, c, d, In[1] + HASH_K2, 3);
+    HASH_ROUND(HASH_G, d, a, b, c, In[3] + HASH_K2, 5);
+    HASH_ROUND(HASH_G, c, d, a, b, In[5] + HASH_K2, 9);
+    HASH_ROUND(HASH_G, b, c, d, a, In[7] + HASH_K2, 13);
+    HASH_ROUND(HASH_G, a, b, c, d, In[0] + HASH_K2, 3);
+    HASH_ROUND(HASH_G, d, a, b, c, In[2] + HASH_K2, 5);
+    HASH_ROUND(HASH_G, c, d, a, b, In[4] + HASH_K2, 9);
+    HASH_ROUND(HASH_G, b, c, d, a, In[6] + HASH_K2, 13);
+
+    HASH_ROUND(HASH_H, a, b, c, d, In[3] + HASH_K3, 3);
+    HASH_ROUND(HASH_H, d, a, b, c, In[7] + HASH_K3, 9);
+    HASH_ROUND(HASH_H, c, d, a, b, In[2] + HASH_K3, 11);
+    HASH_ROUND(HASH_H, b, c, d, a, In[6] + HASH_K3, 15);
+    HASH_ROUND(HASH_H, a, b, c, d, In[1] + HASH_K3, 3);
+    HASH_ROUND(HASH_H, d, a, b, c, In[5] + HASH_K3, 9);
+    HASH_ROUND(HASH_H, c, d, a, b, In[0] + HASH_K3, 11);
+    HASH_ROUND(HASH_H, b, c, d, a, In[4] + HASH_K3, 15);
+
+    Buffer[0] += a;
+    Buffer[1] += b;
+    Buffer[2] += c;
+    Buffer[3] += d;
+}
+
+static void TeaTransform(UINT32 Buffer[4], UINT32 In[4]) {
+    UINT32 Sum = 0;
+    UINT32 b0 = Buffer[0], b1 = Buffer[1];
+
+    for (int i = 0; i < 16; i++) {
+        Sum += 0x9E3779B9;
+        b0 += ((b1 << 4) + In[0]) ^ (b1 + Sum) ^ ((b1 >> 5) + In[1]);
+        b1 += ((b0 << 4) + In[2]) ^ (b0 + Sum) ^ ((b0 >> 5) + In[3]);
+    }
+
+    Buffer[0] += b0;
+    Buffer[1] += b1;
+}
+
+/**
+ * Chars are signed or unsigned depending on how the volume was made
+ */
+static INT32 HashChar(CHAR8* Name, UINTN Index, BOOLEAN Unsigned) {
+    return Unsigned ? (INT32)(UINT8)Name[Index] : (INT32)(INT8)Name[Index];
+}
+
+static UINT32 LegacyHash(CHAR8* Name, UINTN Length, BOOLEAN Unsigned) {
+    UINT32 Hash0 = 0x12A3FE2D;
+    UINT32 Hash1 = 0x37ABE8F9;
+
+    for (UINTN i = 0; i < Length; i++) {
+        UINT32 Hash = Hash1 + (Hash0 ^ ((UINT32)HashChar(Name, i, Unsigned) * 7152373));
+        if (Hash & 0x80000000) {
+            Hash -= 0x7FFFFFFF;
+        }
+        Hash1 = Hash0;
+        Hash0 = Hash;
+    }
+
+    return Hash0 << 1;
+}
+
+static void NameToHashBuffer(CHAR8* Name, UINTN Length, UINT32* Buffer, UINTN Words, BOOLEAN Unsigned) {
+    UINT32 Pad = (UINT32)Length | ((UINT32)Length << 8);
+    Pad |= Pad << 16;
+
+    UINT32 Value = Pad;
+    Length = MIN(Length, Words * 4);
+    for (UINTN i = 0; i < Length; i++) {
+        Value = (UINT32)HashChar(Name, i, Unsigned) + (Value << 8);
+        if ((i % 4) == 3) {
+            *Buffer++ = Value;
+            Value = Pad;
+            Words--;
+        }
+    }
+
+    if (Words > 0) {
+        *Buffer++ = Value;
+        Words--;
+    }
+    while (Words-- > 0) {
+        *Buffer++ = Pad;
+    }
+}
+
+/**
+ * The major hash of a name, as used by the htree
+ */
+static UINT32 DirectoryHash(EXT4_VOLUME* Volume, UINT8 Version, CHAR8* Name, UINTN Length) {
+    UINT32 Buffer[4] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476 };
+    UINT32 In[8];
+    UINT32 Hash = 0;
+
+    if (Volume->HashSeed[0] != 0 || Volume->HashSeed[1] != 0 || Volume->HashSeed[2] != 0 || Volume->HashSeed[3] != 0) {
+        CopyMem(Buffer, Volume->HashSeed, sizeof(Buffer));
+    }
+
+    BOOLEAN Unsigned = Version >= EXT4_HASH_LEGACY_UNSIGNED;
+    switch (Version) {
+        case EXT4_HASH_LEGACY:
+        case EXT4_HASH_LEGACY_UNSIGNED:
+            Hash = LegacyHash(Name, Length, Unsigned);
+            break;
+
+        case EXT4_HASH_HALF_MD4:
+        case EXT4_HASH_HALF_MD4_UNSIGNED:
+            for (INTN Left = Length; Left > 0; Left -= 32, Name += 32) {
+                NameToHashBuffer(Name, Left, In, 8, Unsigned);
+                HalfMd4Transform(Buffer, In);
+            }
+            Hash = Buffer[1];
+            break;
+
+        case EXT4_HASH_TEA:
+        case EXT4_HASH_TEA_UNSIGNED:
+            for (INTN Left = Length; Left > 0; Left -= 16, Name += 16) {
+                NameToHashBuffer(Name, Left, In, 4, Unsigned);
+                TeaTransform(Buffer, In);
+            }
+            Hash = Buffer[0];
+            break;
+    }
+
+    Hash &= ~1;
+    if (Hash == (EXT4_HTREE_EOF << 1)) {
+        Hash = (EXT4_HTREE_EOF - 1) << 1;
+    }
+    return Hash;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Lookups
+//----------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Look for the name in a single block of the directory
+ */
+static EFI_STATUS SearchBlock(EXT4_VOLUME* Volume, EXT4_NODE* Directory, UINT64 Block, CHAR8* Name, UINTN Length, UINT32* Inode) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EXT4_DIR_ENTRY Entry;
+
+    UINT64 Position = MultU64x32(Block, Volume->BlockSize);
+    UINT64 End = Position + Volume->BlockSize;
+    CHECK_ERROR_TRACE(End <= Directory->Size, EFI_VOLUME_CORRUPTED, "The htree of inode %d points past its end", Directory->Number);
+
+    while (Position < End) {
+        CHECK_AND_RETHROW(ReadRawDirEntry(Volume, Directory, &Position, &Entry));
+        if (EntryMatches(&Entry, Name, Length)) {
+            *Inode = Entry.Inode;
+            goto cleanup;
+        }
+    }
+    Status = EFI_NOT_FOUND;
+
+cleanup:
+    return Status;
+}
+
+typedef struct _HTREE_LEVEL {
+    UINT8* Block;
+    EXT4_DX_ENTRY* Entries;
+    UINT16 Count;
+    UINT16 Index;
+} HTREE_LEVEL;
+
+/**
+ * Get the entries of an index block, the first entry has the count and
+ * limit in place of the hash
+ */
+static EFI_STATUS ParseIndex(EXT4_VOLUME* Volume, EXT4_NODE* Directory, HTREE_LEVEL* Level, UINTN Offset) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    EXT4_DX_COUNT_LIMIT* CountLimit = (EXT4_DX_COUNT_LIMIT*)(Level->Block + Offset);
+    CHECK_ERROR_TRACE(CountLimit->Count != 0 && CountLimit->Count <= CountLimit->Limit &&
+                      Offset + CountLimit->Limit * sizeof(EXT4_DX_ENTRY) <= Volume->BlockSize,
+                      EFI_VOLUME_CORRUPTED, "The htree of inode %d is corrupted", Directory->Number);
+
+    Level->Entries = (EXT4_DX_ENTRY*)CountLimit;
+    Level->Count = CountLimit->Count;
+    Level->Index = 0;
+
+cleanup:
+    return Status;
+}
+
+/**
+ * Go down from the entry the level is at to the leftmost leaf under it
+ */
+static EFI_STATUS DescendIndex(EXT4_VOLUME* Volume, EXT4_NODE* Directory, HTREE_LEVEL* Levels, UINTN From, UINTN Depth, UINT32 Hash, UINT64* Leaf) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    for (UINTN i = From; ; i++) {
+        HTREE_LEVEL* Level = &Levels[i];
+
+        // the last entry with a hash not bigger than ours, the first entry has an implied hash of 0
+        if (Hash != MAX_UINT32) {
+            UINT16 Low = 1;
+            UINT16 High = Level->Count;
+            while (Low < High) {
+                UINT16 Middle = Low + (High - Low) / 2;
+                if (Level->Entries[Middle].Hash > Hash) {
+                    High = Middle;
+                } else {
+                    Low = Middle + 1;
+                }
+            }
+            Level->Index = Low - 1;
+        }
+
+        UINT32 Block = Level->Entries[Level->Index].Block & 0x0FFFFFFF;
+        if (i == Depth) {
+            *Leaf = Block;
+            break;
+        }
+
+        CHECK_ERROR_TRACE(MultU64x32(Block + 1, Volume->BlockSize) <= Directory->Size, EFI_VOLUME_CORRUPTED,
+                          "The htree of inode %d points past its end", Directory->Number);
+        CHECK_AND_RETHROW(ReadNodeBlock(Volume, Directory, Block, Levels[i + 1].Block));
+
+        // an empty fake entry that covers the whole block
+        CHECK_AND_RETHROW(ParseIndex(Volume, Directory, &Levels[i + 1], 8));
+    }
+
+cleanup:
+    return Status;
+}
+
+/**
+ * Look the name up with the hash index, EFI_UNSUPPORTED if the index
+ * is of a kind we can't use
+ */
+static EFI_STATUS HtreeFind(EXT4_VOLUME* Volume, EXT4_NODE* Directory, CHAR8* Name, UINTN Length, UINT32* Inode) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    HTREE_LEVEL Levels[EXT4_HTREE_MAX_LEVELS] = { 0 };
+    UINT64 Leaf = 0;
+
+    for (int i = 0; i < ARRAY_SIZE(Levels); i++) {
+        Levels[i].Block = AllocatePool(Volume->BlockSize);
+        CHECK_ERROR(Levels[i].Block != NULL, EFI_OUT_OF_RESOURCES);
+    }
+    CHECK_AND_RETHROW(ReadNodeBlock(Volume, Directory, 0, Levels[0].Block));
+
+    // the root comes after the fake `.` and `..` entries
+    EXT4_DX_ROOT_INFO* Info = (EXT4_DX_ROOT_INFO*)(Levels[0].Block + 24);
+    UINT8 Version = Info->HashVersion;
+    if (Version <= EXT4_HASH_TEA && Volume->UnsignedHash) {
+        Version += EXT4_HASH_LEGACY_UNSIGNED;
+    }
+    UINTN MaxLevels = (Volume->Incompat & EXT4_FEATURE_INCOMPAT_LARGEDIR) ? 3 : 2;
+    if (Info->ReservedZero != 0 || Info->InfoLength != sizeof(EXT4_DX_ROOT_INFO) || Version > EXT4_HASH_TEA_UNSIGNED ||
+        Info->IndirectLevels >= MaxLevels) {
+        Status = EFI_UNSUPPORTED;
+        goto cleanup;
+    }
+    UINTN Depth = Info->IndirectLevels;
+    CHECK_AND_RETHROW(ParseIndex(Volume, Directory, &Levels[0], 24 + Info->InfoLength));
+
+    UINT32 Hash = DirectoryHash(Volume, Version, Name, Length);
+    CHECK_AND_RETHROW(DescendIndex(Volume, Directory, Levels, 0, Depth, Hash, &Leaf));
+
+    while (TRUE) {
+        Status = SearchBlock(Volume, Directory, Leaf, Name, Length, Inode);
+        if (Status != EFI_NOT_FOUND) {
+            CHECK_AND_RETHROW(Status);
+            goto cleanup;
+        }
+        Status = EFI_SUCCESS;
+
+        // names with the same hash can go on in the next leaf, which then
+        // starts with the hash with the lowest bit set
+        INTN i = Depth;
+        while (i >= 0 && Levels[i].Index + 1 >= Levels[i].Count) {
+            i--;
+        }
+        if (i < 0) {
+            break;
+        }
+        Levels[i].Index++;
+        UINT32 NextHash = Levels[i].Entries[Levels[i].Index].Hash;
+        if (!(NextHash & 1) || (NextHash & ~1) != Hash) {
+            break;
+        }
+        CHECK_AND_RETHROW(DescendIndex(Volume, Directory, Levels, i, Depth, MAX_UINT32, &Leaf));
+    }
+    Status = EFI_NOT_FOUND;
+
+cleanup:
+    for (int i = 0; i < ARRAY_SIZE(Levels); i++) {
+        if (Levels[i].Block != NULL) {
+            FreePool(Levels[i].Block);
+        }
+    }
+
+    return Status;
+}
+
+static EFI_STATUS FindEntry(EXT4_VOLUME* Volume, EXT4_NODE* Directory, CHAR8* Name, UINTN Length, UINT32* Inode) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EXT4_DIR_ENTRY Entry;
+
+    // casefolded and encrypted names hash differently, those are scanned
+    if ((Directory->Flags & EXT4_INDEX_FL) && !(Directory->Flags & (EXT4_CASEFOLD_FL | EXT4_ENCRYPT_FL))) {
+        Status = HtreeFind(Volume, Directory, Name, Length, Inode);
+        if (Status != EFI_UNSUPPORTED) {
+            goto cleanup;
+        }
+    }
+
+    // the htree blocks look like empty entries, so this works for indexed directories as well
+    UINT64 Position = 0;
+    while (TRUE) {
+        Status = Ext4ReadDirEntry(Volume, Directory, &Position, &Entry);
+        if (Status == EFI_NOT_FOUND) {
+            goto cleanup;
+        }
+        CHECK_AND_RETHROW(Status);
+
+        if (EntryMatches(&Entry, Name, Length)) {
+            *Inode = Entry.Inode;
+            goto cleanup;
+        }
+    }
+
+cleanup:
+    return Status;
+}
+
+/**
+ * The names are utf-8 on the disk, anything that can't be encoded
+ * can't be on the disk either
+ */
+static BOOLEAN NameToUtf8(CHAR16* Name, UINTN Length, CHAR8* Buffer, UINTN* Utf8Length) {
+    UINTN Size = 0;
+    for (UINTN i = 0; i < Length; i++) {
+        UINT32 Char = Name[i];
+        if (Char >= 0xD800 && Char < 0xDC00 && i + 1 < Length && Name[i + 1] >= 0xDC00 && Name[i + 1] < 0xE000) {
+            Char = 0x10000 + ((Char - 0xD800) << 10) + (Name[++i] - 0xDC00);
+        }
+
+        UINTN Bytes = Char < 0x80 ? 1 : (Char < 0x800 ? 2 : (Char < 0x10000 ? 3 : 4));
+        if (Size + Bytes > 255) {
+            return FALSE;
+        }
+        if (Bytes == 1) {
+            Buffer[Size++] = (CHAR8)Char;
+        } else {
+            Buffer[Size++] = (CHAR8)((0xF00 >> Bytes) | (Char >> (6 * (Bytes - 1))));
+            for (UINTN j = Bytes - 1; j > 0; j--) {
+                Buffer[Size++] = (CHAR8)(0x80 | ((Char >> (6 * (j - 1))) & 0x3F));
+            }
+        }
+    }
+    *Utf8Length = Size;
+    return TRUE;
+}
+
+UINTN Ext4NameToUnicode(CHAR8* Name, UINTN Length, CHAR16* Buffer) {
+    UINTN Size = 0;
+    for (UINTN i = 0; i < Length; ) {
+        UINT8 Lead = (UINT8)Name[i];
+        UINTN Bytes = Lead < 0x80 ? 1 : ((Lead & 0xE0) == 0xC0 ? 2 : ((Lead & 0xF0) == 0xE0 ? 3 : ((Lead & 0xF8) == 0xF0 ? 4 : 0)));
+        UINT32 Char = Bytes == 1 ? Lead : (Lead & (0x7F >> Bytes));
+
+        BOOLEAN Valid = Bytes != 0 && i + Bytes <= Length;
+        for (UINTN j = 1; Valid && j < Bytes; j++) {
+            Valid = ((UINT8)Name[i + j] & 0xC0) == 0x80;
+            Char = (Char << 6) | ((UINT8)Name[i + j] & 0x3F);
+        }
+
+        // a bad sequence is taken a byte at a time
+        if (!Valid) {
+            Buffer[Size++] = 0xFFFD;
+            i++;
+            continue;
+        }
+        if (Char >= 0x10000) {
+            Buffer[Size++] = (CHAR16)(0xD800 + ((Char - 0x10000) >> 10));
+            Buffer[Size++] = (CHAR16)(0xDC00 + ((Char - 0x10000) & 0x3FF));
+        } else {
+            Buffer[Size++] = (CHAR16)Char;
+        }
+        i += Bytes;
+    }
+    Buffer[Size] = L'\0';
+    return Size;
+}
+
+static EFI_STATUS LookupPath(EXT4_VOLUME* Volume, UINT32 Directory, CHAR16* Path, UINTN Links, EXT4_NODE* Node) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EXT4_NODE Current = { 0 };
+    CHAR8 Name[256];
+    UINTN NameLength = 0;
+    CHAR8* Target = NULL;
+    CHAR16* TargetPath = NULL;
+
+    CHAR16* FullPath = Path;
+    if (*Path == L'\\' || *Path == L'/') {
+        Directory = EXT4_ROOT_INODE;
+    }
+    CHECK_AND_RETHROW(Ext4GetNode(Volume, Directory, &Current));
+
+    while (*Path != L'\0') {
+        CHAR16* Component = Path;
+        while (*Path != L'\0' && *Path != L'\\' && *Path != L'/') {
+            Path++;
+        }
+        UINTN ComponentLength = Path - Component;
+        if (*Path != L'\0') {
+            Path++;
+        }
+        if (ComponentLength == 0 || (ComponentLength == 1 && Component[0] == L'.')) {
+            continue;
+        }
+
+        // not found is not worth a trace, the caller decides
+        UINT32 Inode = 0;
+        if ((Current.Mode & EXT4_S_IFMT) != EXT4_S_IFDIR || !NameToUtf8(Component, ComponentLength, Name, &NameLength)) {
+            Status = EFI_NOT_FOUND;
+            goto cleanup;
+        }
+        Status = FindEntry(Volume, &Current, Name, NameLength, &Inode);
+        if (Status == EFI_NOT_FOUND) {
+            goto cleanup;
+        }
+        CHECK_AND_RETHROW(Status);
+
+        UINT32 Parent = Current.Number;
+        Ext4FreeNode(&Current);
+        CHECK_AND_RETHROW(Ext4GetNode(Volume, Inode, &Current));
+
+        if ((Current.Mode & EXT4_S_IFMT) == EXT4_S_IFLNK) {
+            CHECK_ERROR_TRACE(Links < EXT4_MAX_SYMLINKS, EFI_NOT_FOUND, "Too many levels of symlinks in `%s`", FullPath);
+            CHECK_ERROR_TRACE(Current.Size < EXT4_MAX_SYMLINK_SIZE, EFI_VOLUME_CORRUPTED, "The symlink %d is too long", Current.Number);
+
+            Target = AllocatePool((UINTN)Current.Size + 1);
+            TargetPath = AllocatePool(((UINTN)Current.Size + 1) * sizeof(CHAR16));
+            CHECK_ERROR(Target != NULL && TargetPath != NULL, EFI_OUT_OF_RESOURCES);
+            CHECK_AND_RETHROW(Ext4ReadNode(Volume, &Current, 0, Target, (UINTN)Current.Size));
+            Ext4NameToUnicode(Target, (UINTN)Current.Size, TargetPath);
+
+            // relative targets are from the directory the link is in
+            Ext4FreeNode(&Current);
+            Status = LookupPath(Volume, Parent, TargetPath, Links + 1, &Current);
+            if (Status == EFI_NOT_FOUND) {
+                goto cleanup;
+            }
+            CHECK_AND_RETHROW(Status);
+
+            FreePool(Target);
+            FreePool(TargetPath);
+            Target = NULL;
+            TargetPath = NULL;
+        }
+    }
+
+    *Node = Current;
+    ZeroMem(&Current, sizeof(Current));
+
+cleanup:
+    Ext4FreeNode(&Current);
+
+    if (Target != NULL) {
+        FreePool(Target);
+    }
+    if (TargetPath != NULL) {
+        FreePool(TargetPath);
+    }
+
+    return Status;
+}
+
+EFI_STATUS Ext4Lookup(EXT4_VOLUME* Volume, UINT32 Directory, CHAR16* Path, EXT4_NODE* Node) {
+    return LookupPath(Volume, Directory, Path, 0, Node);
+}
+
+EFI_STATUS Ext4GetExtents(EXT4_VOLUME* Volume, CHAR16* Path, FILE_EXTENT** Extents, UINTN* Count, UINT64* FileSize) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EXT4_NODE Node = { 0 };
+
+    *Extents = NULL;
+    *Count = 0;
+
+    Status = Ext4Lookup(Volume, EXT4_ROOT_INODE, Path, &Node);
+    if (Status == EFI_NOT_FOUND) {
+        goto cleanup;
+    }
+    CHECK_AND_RETHROW(Status);
+
+    // anything we can't map is left to the file protocol
+    if ((Node.Mode & EXT4_S_IFMT) != EXT4_S_IFREG || (Node.Flags & (EXT4_INLINE_DATA_FL | EXT4_ENCRYPT_FL))) {
+        Status = EFI_NOT_FOUND;
+        goto cleanup;
+    }
+    CHECK_AND_RETHROW(MapNode(Volume, &Node));
+
+    *FileSize = Node.Size;
+    *Extents = Node.Extents;
+    *Count = Node.Count;
+    Node.Extents = NULL;
+
+cleanup:
+    Ext4FreeNode(&Node);
+
+    return Status;
+}
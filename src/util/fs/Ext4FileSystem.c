@@ -0,0 +1,386 @@
+#include "Ext4FileSystem.h"
+#include "FsInternal.h"
+
+#include <Guid/FileInfo.h>
+#include <Guid/FileSystemInfo.h>
+#include <Guid/FileSystemVolumeLabelInfo.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include <util/Except.h>
+#include <util/LogUtils.h>
+
+typedef struct _EXT4_FILE_SYSTEM {
+    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL Protocol;
+    BLOCK_DEVICE Device;
+    EXT4_VOLUME* Volume;
+} EXT4_FILE_SYSTEM;
+
+typedef struct _EXT4_FILE {
+    EFI_FILE_PROTOCOL Protocol;
+    EXT4_FILE_SYSTEM* FileSystem;
+    EXT4_NODE Node;
+
+    // the last component of the path it was opened with
+    CHAR16* Name;
+
+    // a byte offset for files, the offset of the next entry for directories
+    UINT64 Position;
+} EXT4_FILE;
+
+static EFI_FILE_PROTOCOL mFileTemplate;
+
+static BOOLEAN IsDirectory(EXT4_FILE* File) {
+    return (File->Node.Mode & EXT4_S_IFMT) == EXT4_S_IFDIR;
+}
+
+/**
+ * Seconds since the epoch to an EFI_TIME
+ */
+static void EpochToTime(INT64 Seconds, EFI_TIME* Time) {
+    ZeroMem(Time, sizeof(EFI_TIME));
+
+    INT64 Days = Seconds / 86400;
+    INT64 Rest = Seconds % 86400;
+    Time->Hour = (UINT8)(Rest / 3600);
+    Time->Minute = (UINT8)((Rest % 3600) / 60);
+    Time->Second = (UINT8)(Rest % 60);
+
+    // days to a civil date
+    Days += 719468;
+    INT64 Era = Days / 146097;
+    INT64 DayOfEra = Days - Era * 146097;
+    INT64 YearOfEra = (DayOfEra - DayOfEra / 1460 + DayOfEra / 36524 - DayOfEra / 146096) / 365;
+    INT64 DayOfYear = DayOfEra - (365 * YearOfEra + YearOfEra / 4 - YearOfEra / 100);
+    INT64 MonthIndex = (5 * DayOfYear + 2) / 153;
+    Time->Day = (UINT8)(DayOfYear - (153 * MonthIndex + 2) / 5 + 1);
+    Time->Month = (UINT8)(MonthIndex < 10 ? MonthIndex + 3 : MonthIndex - 9);
+    Time->Year = (UINT16)(YearOfEra + Era * 400 + (Time->Month <= 2));
+    Time->TimeZone = EFI_UNSPECIFIED_TIMEZONE;
+}
+
+static EFI_STATUS FillFileInfo(EXT4_NODE* Node, CHAR16* Name, UINTN* BufferSize, void* Buffer) {
+    UINTN Needed = SIZE_OF_EFI_FILE_INFO + StrSize(Name);
+    if (*BufferSize < Needed || Buffer == NULL) {
+        *BufferSize = Needed;
+        return EFI_BUFFER_TOO_SMALL;
+    }
+
+    BOOLEAN Directory = (Node->Mode & EXT4_S_IFMT) == EXT4_S_IFDIR;
+    EFI_FILE_INFO* Info = Buffer;
+    ZeroMem(Info, Needed);
+    Info->Size = Needed;
+    Info->FileSize = Directory ? 0 : Node->Size;
+    Info->PhysicalSize = Directory ? 0 : ALIGN_VALUE(Node->Size, 512);
+    EpochToTime(Node->ChangeTime, &Info->CreateTime);
+    EpochToTime(Node->AccessTime, &Info->LastAccessTime);
+    EpochToTime(Node->ModificationTime, &Info->ModificationTime);
+    Info->Attribute = EFI_FILE_READ_ONLY | (Directory ? EFI_FILE_DIRECTORY : 0);
+    StrCpyS(Info->FileName, StrLen(Name) + 1, Name);
+
+    *BufferSize = Needed;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS CreateFile(EXT4_FILE_SYSTEM* FileSystem, UINT32 Directory, CHAR16* Path, EXT4_FILE** File) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EXT4_FILE* New = NULL;
+
+    New = AllocateZeroPool(sizeof(EXT4_FILE));
+    CHECK_ERROR(New != NULL, EFI_OUT_OF_RESOURCES);
+    CopyMem(&New->Protocol, &mFileTemplate, sizeof(EFI_FILE_PROTOCOL));
+    New->FileSystem = FileSystem;
+
+    Status = Ext4Lookup(FileSystem->Volume, Directory, Path, &New->Node);
+    if (Status == EFI_NOT_FOUND) {
+        goto cleanup;
+    }
+    CHECK_AND_RETHROW(Status);
+
+    // the name is whatever is after the last separator
+    CHAR16* Name = Path + StrLen(Path);
+    while (Name > Path && Name[-1] != L'\\' && Name[-1] != L'/') {
+        Name--;
+    }
+    New->Name = AllocateCopyPool(StrSize(Name), Name);
+    CHECK_ERROR(New->Name != NULL, EFI_OUT_OF_RESOURCES);
+
+    *File = New;
+    New = NULL;
+
+cleanup:
+    if (New != NULL) {
+        Ext4FreeNode(&New->Node);
+        FreePool(New);
+    }
+
+    return Status;
+}
+
+static EFI_STATUS EFIAPI Ext4FileOpen(EFI_FILE_PROTOCOL* This, EFI_FILE_PROTOCOL** NewHandle, CHAR16* FileName, UINT64 OpenMode, UINT64 Attributes) {
+    EXT4_FILE* Parent = BASE_CR(This, EXT4_FILE, Protocol);
+    EXT4_FILE* File = NULL;
+
+    if (NewHandle == NULL || FileName == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if (OpenMode != EFI_FILE_MODE_READ) {
+        return EFI_WRITE_PROTECTED;
+    }
+
+    EFI_STATUS Status = CreateFile(Parent->FileSystem, Parent->Node.Number, FileName, &File);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    *NewHandle = &File->Protocol;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI Ext4FileClose(EFI_FILE_PROTOCOL* This) {
+    EXT4_FILE* File = BASE_CR(This, EXT4_FILE, Protocol);
+
+    Ext4FreeNode(&File->Node);
+    FreePool(File->Name);
+    FreePool(File);
+
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI Ext4FileDelete(EFI_FILE_PROTOCOL* This) {
+    Ext4FileClose(This);
+    return EFI_WARN_DELETE_FAILURE;
+}
+
+static EFI_STATUS ReadDirectory(EXT4_FILE* File, UINTN* BufferSize, void* Buffer) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EXT4_VOLUME* Volume = File->FileSystem->Volume;
+    EXT4_DIR_ENTRY Entry;
+    EXT4_NODE Node = { 0 };
+    CHAR16 Name[256];
+
+    UINT64 Position = File->Position;
+    Status = Ext4ReadDirEntry(Volume, &File->Node, &Position, &Entry);
+    if (Status == EFI_NOT_FOUND) {
+        *BufferSize = 0;
+        Status = EFI_SUCCESS;
+        goto cleanup;
+    }
+    CHECK_AND_RETHROW(Status);
+    CHECK_AND_RETHROW(Ext4GetNode(Volume, Entry.Inode, &Node));
+
+    // the entry stays for the next read if it does not fit
+    Ext4NameToUnicode(Entry.Name, Entry.NameLength, Name);
+    Status = FillFileInfo(&Node, Name, BufferSize, Buffer);
+    if (!EFI_ERROR(Status)) {
+        File->Position = Position;
+    }
+
+cleanup:
+    Ext4FreeNode(&Node);
+
+    return Status;
+}
+
+static EFI_STATUS EFIAPI Ext4FileRead(EFI_FILE_PROTOCOL* This, UINTN* BufferSize, void* Buffer) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EXT4_FILE* File = BASE_CR(This, EXT4_FILE, Protocol);
+
+    if (BufferSize == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if (IsDirectory(File)) {
+        return ReadDirectory(File, BufferSize, Buffer);
+    }
+
+    if (File->Position >= File->Node.Size) {
+        *BufferSize = 0;
+        return File->Position > File->Node.Size ? EFI_DEVICE_ERROR : EFI_SUCCESS;
+    }
+
+    UINTN Size = (UINTN)MIN(*BufferSize, File->Node.Size - File->Position);
+    CHECK_AND_RETHROW(Ext4ReadNode(File->FileSystem->Volume, &File->Node, File->Position, Buffer, Size));
+    File->Position += Size;
+    *BufferSize = Size;
+
+cleanup:
+    return Status;
+}
+
+static EFI_STATUS EFIAPI Ext4FileWrite(EFI_FILE_PROTOCOL* This, UINTN* BufferSize, void* Buffer) {
+    return EFI_WRITE_PROTECTED;
+}
+
+static EFI_STATUS EFIAPI Ext4FileGetPosition(EFI_FILE_PROTOCOL* This, UINT64* Position) {
+    EXT4_FILE* File = BASE_CR(This, EXT4_FILE, Protocol);
+
+    if (IsDirectory(File)) {
+        return EFI_UNSUPPORTED;
+    }
+
+    *Position = File->Position;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI Ext4FileSetPosition(EFI_FILE_PROTOCOL* This, UINT64 Position) {
+    EXT4_FILE* File = BASE_CR(This, EXT4_FILE, Protocol);
+
+    // directories can only be rewound
+    if (IsDirectory(File) && Position != 0) {
+        return EFI_UNSUPPORTED;
+    }
+
+    File->Position = Position == MAX_UINT64 ? File->Node.Size : Position;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI Ext4FileGetInfo(EFI_FILE_PROTOCOL* This, EFI_GUID* InformationType, UINTN* BufferSize, void* Buffer) {
+    EXT4_FILE* File = BASE_CR(This, EXT4_FILE, Protocol);
+    UINT64 VolumeSize = 0;
+    UINT64 FreeSpace = 0;
+    UINT32 BlockSize = 0;
+    CHAR16 Label[17];
+
+    if (InformationType == NULL || BufferSize == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if (CompareGuid(InformationType, &gEfiFileInfoGuid)) {
+        return FillFileInfo(&File->Node, File->Name, BufferSize, Buffer);
+    }
+
+    Ext4GetVolumeInfo(File->FileSystem->Volume, &VolumeSize, &FreeSpace, &BlockSize, Label, sizeof(Label));
+
+    if (CompareGuid(InformationType, &gEfiFileSystemInfoGuid)) {
+        UINTN Needed = SIZE_OF_EFI_FILE_SYSTEM_INFO + StrSize(Label);
+        if (*BufferSize < Needed || Buffer == NULL) {
+            *BufferSize = Needed;
+            return EFI_BUFFER_TOO_SMALL;
+        }
+
+        EFI_FILE_SYSTEM_INFO* Info = Buffer;
+        ZeroMem(Info, Needed);
+        Info->Size = Needed;
+        Info->ReadOnly = TRUE;
+        Info->VolumeSize = VolumeSize;
+        Info->FreeSpace = FreeSpace;
+        Info->BlockSize = BlockSize;
+        StrCpyS(Info->VolumeLabel, ARRAY_SIZE(Label), Label);
+        *BufferSize = Needed;
+        return EFI_SUCCESS;
+    }
+
+    if (CompareGuid(InformationType, &gEfiFileSystemVolumeLabelInfoIdGuid)) {
+        UINTN Needed = StrSize(Label);
+        if (*BufferSize < Needed || Buffer == NULL) {
+            *BufferSize = Needed;
+            return EFI_BUFFER_TOO_SMALL;
+        }
+
+        CopyMem(Buffer, Label, Needed);
+        *BufferSize = Needed;
+        return EFI_SUCCESS;
+    }
+
+    return EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS EFIAPI Ext4FileSetInfo(EFI_FILE_PROTOCOL* This, EFI_GUID* InformationType, UINTN BufferSize, void* Buffer) {
+    return EFI_WRITE_PROTECTED;
+}
+
+static EFI_STATUS EFIAPI Ext4FileFlush(EFI_FILE_PROTOCOL* This) {
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI Ext4OpenVolume(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* This, EFI_FILE_PROTOCOL** Root) {
+    EXT4_FILE_SYSTEM* FileSystem = BASE_CR(This, EXT4_FILE_SYSTEM, Protocol);
+    EXT4_FILE* File = NULL;
+
+    EFI_STATUS Status = CreateFile(FileSystem, EXT4_ROOT_INODE, L"", &File);
+    if (EFI_ERROR(Status)) {
+        return EFI_DEVICE_ERROR;
+    }
+
+    *Root = &File->Protocol;
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS Ext4MountVolumes() {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_HANDLE* Handles = NULL;
+    UINTN HandleCount = 0;
+    EXT4_FILE_SYSTEM* FileSystem = NULL;
+
+    // the files are read only, so there is no revision 2 async io
+    mFileTemplate.Revision = EFI_FILE_PROTOCOL_REVISION;
+    mFileTemplate.Open = Ext4FileOpen;
+    mFileTemplate.Close = Ext4FileClose;
+    mFileTemplate.Delete = Ext4FileDelete;
+    mFileTemplate.Read = Ext4FileRead;
+    mFileTemplate.Write = Ext4FileWrite;
+    mFileTemplate.GetPosition = Ext4FileGetPosition;
+    mFileTemplate.SetPosition = Ext4FileSetPosition;
+    mFileTemplate.GetInfo = Ext4FileGetInfo;
+    mFileTemplate.SetInfo = Ext4FileSetInfo;
+    mFileTemplate.Flush = Ext4FileFlush;
+
+    Status = gBS->LocateHandleBuffer(ByProtocol, &gEfiBlockIoProtocolGuid, NULL, &HandleCount, &Handles);
+    if (Status == EFI_NOT_FOUND) {
+        Status = EFI_SUCCESS;
+        goto cleanup;
+    }
+    EFI_CHECK(Status);
+
+    for (UINTN i = 0; i < HandleCount; i++) {
+        // the firmware already reads this one
+        void* Interface = NULL;
+        if (!EFI_ERROR(gBS->HandleProtocol(Handles[i], &gEfiSimpleFileSystemProtocolGuid, &Interface))) {
+            continue;
+        }
+
+        FileSystem = AllocateZeroPool(sizeof(EXT4_FILE_SYSTEM));
+        CHECK_ERROR(FileSystem != NULL, EFI_OUT_OF_RESOURCES);
+        FileSystem->Protocol.Revision = EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_REVISION;
+        FileSystem->Protocol.OpenVolume = Ext4OpenVolume;
+
+        // anything else on the handle is none of our business
+        if (EFI_ERROR(BlockDeviceOpenHandle(Handles[i], &FileSystem->Device)) ||
+            EFI_ERROR(Ext4Open(&FileSystem->Device, &FileSystem->Volume))) {
+            BlockDeviceClose(&FileSystem->Device);
+            FreePool(FileSystem);
+            FileSystem = NULL;
+            continue;
+        }
+
+        UINT64 VolumeSize = 0;
+        UINT64 FreeSpace = 0;
+        UINT32 BlockSize = 0;
+        CHAR16 Label[17];
+        Ext4GetVolumeInfo(FileSystem->Volume, &VolumeSize, &FreeSpace, &BlockSize, Label, sizeof(Label));
+        LOG_DEBUG("Found ext4 volume `%s` (%ld bytes, %d byte blocks)\n", Label, VolumeSize, BlockSize);
+
+        EFI_HANDLE Handle = Handles[i];
+        EFI_CHECK(gBS->InstallProtocolInterface(&Handle, &gEfiSimpleFileSystemProtocolGuid, EFI_NATIVE_INTERFACE, &FileSystem->Protocol));
+        FileSystem = NULL;
+    }
+
+cleanup:
+    if (FileSystem != NULL) {
+        if (FileSystem->Volume != NULL) {
+            Ext4Close(FileSystem->Volume);
+        }
+        BlockDeviceClose(&FileSystem->Device);
+        FreePool(FileSystem);
+    }
+
+    if (Handles != NULL) {
+        FreePool(Handles);
+    }
+
+    return Status;
+}
@@ -0,0 +1,16 @@
+#ifndef __UTIL_FS_EXT4FILESYSTEM_H__
+#define __UTIL_FS_EXT4FILESYSTEM_H__
+
+#include <Uefi.h>
+
+/**
+ * Install a read only simple file system protocol on every block device
+ * that has an ext2/3/4 file system and no file system protocol yet, so
+ * configs, kernels and modules can be on a linux /boot partition.
+ *
+ * The journal is not replayed, so a volume that was not unmounted cleanly
+ * may look older than it is.
+ */
+EFI_STATUS Ext4MountVolumes();
+
+#endif //__UTIL_FS_EXT4FILESYSTEM_H__
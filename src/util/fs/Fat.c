@@ -0,0 +1,496 @@
+#include "FsInternal.h"
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+
+#include <util/Except.h>
+
+/**
+ * Implementation References
+ * - Microsoft FAT Specification (fatgen103)
+ */
+
+// how much of the fat is kept around while following chains
+#define FAT_WINDOW_SIZE SIZE_64KB
+
+#define FAT_ATTR_VOLUME_ID 0x08
+#define FAT_ATTR_DIRECTORY 0x10
+#define FAT_ATTR_LONG_NAME 0x0F
+
+#define FAT_ENTRY_FREE 0xE5
+#define FAT_ENTRY_END 0x00
+
+#define FAT_LFN_LAST 0x40
+#define FAT_LFN_CHARS 13
+#define FAT_LFN_MAX_ENTRIES 20
+
+#pragma pack(1)
+
+typedef struct _FAT_BPB {
+    UINT8 Jump[3];
+    CHAR8 OemName[8];
+    UINT16 BytesPerSector;
+    UINT8 SectorsPerCluster;
+    UINT16 ReservedSectors;
+    UINT8 NumberOfFats;
+    UINT16 RootEntries;
+    UINT16 TotalSectors16;
+    UINT8 Media;
+    UINT16 FatSize16;
+    UINT16 SectorsPerTrack;
+    UINT16 NumberOfHeads;
+    UINT32 HiddenSectors;
+    UINT32 TotalSectors32;
+
+    // only valid on fat32
+    UINT32 FatSize32;
+    UINT16 ExtendedFlags;
+    UINT16 Version;
+    UINT32 RootCluster;
+} FAT_BPB;
+
+typedef struct _FAT_DIR_ENTRY {
+    CHAR8 Name[11];
+    UINT8 Attributes;
+    UINT8 NtReserved;
+    UINT8 CreateTimeTenth;
+    UINT16 CreateTime;
+    UINT16 CreateDate;
+    UINT16 AccessDate;
+    UINT16 FirstClusterHigh;
+    UINT16 WriteTime;
+    UINT16 WriteDate;
+    UINT16 FirstClusterLow;
+    UINT32 FileSize;
+} FAT_DIR_ENTRY;
+
+typedef struct _FAT_LFN_ENTRY {
+    UINT8 Order;
+    CHAR16 Name1[5];
+    UINT8 Attributes;
+    UINT8 Type;
+    UINT8 Checksum;
+    CHAR16 Name2[6];
+    UINT16 FirstClusterLow;
+    CHAR16 Name3[2];
+} FAT_LFN_ENTRY;
+
+#pragma pack()
+
+typedef enum _FAT_TYPE {
+    FAT12,
+    FAT16,
+    FAT32,
+} FAT_TYPE;
+
+struct _FAT_VOLUME {
+    BLOCK_DEVICE* Device;
+    FAT_TYPE Type;
+
+    UINT32 ClusterSize;
+    UINT32 ClusterCount;
+    UINT64 FatOffset;
+    UINT64 FatSize;
+    UINT64 DataOffset;
+
+    // the root is either a fixed region (fat12/16) or a chain (fat32)
+    UINT64 RootOffset;
+    UINT64 RootSize;
+    UINT32 RootCluster;
+
+    // the part of the fat that was read last
+    UINT8* Window;
+    UINT64 WindowStart;
+    UINTN WindowSize;
+
+    // a cluster of a directory
+    UINT8* DirBuffer;
+};
+
+/**
+ * What we need of a directory entry
+ */
+typedef struct _FAT_FILE {
+    UINT8 Attributes;
+    UINT32 FirstCluster;
+    UINT32 Size;
+} FAT_FILE;
+
+EFI_STATUS FatOpen(BLOCK_DEVICE* Device, FAT_VOLUME** Volume) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    FAT_VOLUME* New = NULL;
+    UINT8 Sector[512];
+
+    *Volume = NULL;
+
+    CHECK_AND_RETHROW(BlockDeviceRead(Device, 0, Sector, sizeof(Sector)));
+    FAT_BPB* Bpb = (FAT_BPB*)Sector;
+
+    // anything that does not look like fat is for the file protocol
+    UINT32 BytesPerSector = Bpb->BytesPerSector;
+    UINT32 SectorsPerCluster = Bpb->SectorsPerCluster;
+    UINT32 FatSectors = Bpb->FatSize16 != 0 ? Bpb->FatSize16 : Bpb->FatSize32;
+    UINT32 TotalSectors = Bpb->TotalSectors16 != 0 ? Bpb->TotalSectors16 : Bpb->TotalSectors32;
+    if (Sector[510] != 0x55 || Sector[511] != 0xAA ||
+        BytesPerSector < 512 || BytesPerSector > SIZE_4KB || (BytesPerSector & (BytesPerSector - 1)) != 0 ||
+        SectorsPerCluster == 0 || (SectorsPerCluster & (SectorsPerCluster - 1)) != 0 ||
+        Bpb->ReservedSectors == 0 || Bpb->NumberOfFats == 0 || FatSectors == 0) {
+        Status = EFI_UNSUPPORTED;
+        goto cleanup;
+    }
+
+    UINT32 RootSectors = ((Bpb->RootEntries * sizeof(FAT_DIR_ENTRY)) + BytesPerSector - 1) / BytesPerSector;
+    UINT64 DataSector = Bpb->ReservedSectors + (UINT64)Bpb->NumberOfFats * FatSectors + RootSectors;
+    if (DataSector >= TotalSectors || MultU64x32(TotalSectors, BytesPerSector) > Device->Size) {
+        Status = EFI_UNSUPPORTED;
+        goto cleanup;
+    }
+
+    New = AllocateZeroPool(sizeof(FAT_VOLUME));
+    CHECK_ERROR(New != NULL, EFI_OUT_OF_RESOURCES);
+    New->Device = Device;
+    New->ClusterSize = BytesPerSector * SectorsPerCluster;
+    New->ClusterCount = (UINT32)((TotalSectors - DataSector) / SectorsPerCluster);
+    New->FatOffset = MultU64x32(Bpb->ReservedSectors, BytesPerSector);
+    New->FatSize = MultU64x32(FatSectors, BytesPerSector);
+    New->RootOffset = New->FatOffset + MultU64x32(New->FatSize, Bpb->NumberOfFats);
+    New->DataOffset = MultU64x32(DataSector, BytesPerSector);
+
+    // the type only depends on the cluster count
+    if (New->ClusterCount < 4085) {
+        New->Type = FAT12;
+    } else if (New->ClusterCount < 65525) {
+        New->Type = FAT16;
+    } else {
+        New->Type = FAT32;
+    }
+
+    if (New->Type == FAT32) {
+        New->RootCluster = Bpb->RootCluster;
+        if (Bpb->FatSize16 != 0 || Bpb->RootEntries != 0 ||
+            New->RootCluster < 2 || New->RootCluster > New->ClusterCount + 1) {
+            Status = EFI_UNSUPPORTED;
+            goto cleanup;
+        }
+    } else {
+        New->RootSize = Bpb->RootEntries * sizeof(FAT_DIR_ENTRY);
+    }
+
+    // every cluster must have an entry
+    UINT64 EntryBits = New->Type == FAT12 ? 12 : (New->Type == FAT16 ? 16 : 32);
+    if (DivU64x32(MultU64x32(EntryBits, New->ClusterCount + 2) + 7, 8) > New->FatSize) {
+        Status = EFI_UNSUPPORTED;
+        goto cleanup;
+    }
+
+    New->Window = AllocatePages(EFI_SIZE_TO_PAGES(FAT_WINDOW_SIZE));
+    CHECK_ERROR(New->Window != NULL, EFI_OUT_OF_RESOURCES);
+    New->DirBuffer = AllocatePages(EFI_SIZE_TO_PAGES(New->ClusterSize));
+    CHECK_ERROR(New->DirBuffer != NULL, EFI_OUT_OF_RESOURCES);
+
+    *Volume = New;
+    New = NULL;
+
+cleanup:
+    if (New != NULL) {
+        FatClose(New);
+    }
+
+    return Status;
+}
+
+void FatClose(FAT_VOLUME* Volume) {
+    if (Volume->Window != NULL) {
+        FreePages(Volume->Window, EFI_SIZE_TO_PAGES(FAT_WINDOW_SIZE));
+    }
+    if (Volume->DirBuffer != NULL) {
+        FreePages(Volume->DirBuffer, EFI_SIZE_TO_PAGES(Volume->ClusterSize));
+    }
+    FreePool(Volume);
+}
+
+static BOOLEAN IsDataCluster(FAT_VOLUME* Volume, UINT32 Cluster) {
+    return Cluster >= 2 && Cluster <= Volume->ClusterCount + 1;
+}
+
+static UINT64 ClusterOffset(FAT_VOLUME* Volume, UINT32 Cluster) {
+    return Volume->DataOffset + MultU64x32(Cluster - 2, Volume->ClusterSize);
+}
+
+/**
+ * Get the fat entry of a cluster, the end of a chain is returned as 0
+ */
+static EFI_STATUS FatNextCluster(FAT_VOLUME* Volume, UINT32 Cluster, UINT32* Next) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    CHECK(IsDataCluster(Volume, Cluster));
+
+    UINT64 Offset = 0;
+    switch (Volume->Type) {
+        case FAT12: Offset = Cluster + Cluster / 2; break;
+        case FAT16: Offset = Cluster * 2; break;
+        case FAT32: Offset = Cluster * 4; break;
+    }
+
+    // move the window so the whole entry is in it
+    UINTN EntrySize = Volume->Type == FAT32 ? 4 : 2;
+    if (Volume->WindowSize == 0 || Offset < Volume->WindowStart || Offset + EntrySize > Volume->WindowStart + Volume->WindowSize) {
+        Volume->WindowSize = 0;
+        Volume->WindowStart = Offset & ~((UINT64)EFI_PAGE_SIZE - 1);
+        UINTN Size = (UINTN)MIN(FAT_WINDOW_SIZE, Volume->FatSize - Volume->WindowStart);
+        CHECK_AND_RETHROW(BlockDeviceRead(Volume->Device, Volume->FatOffset + Volume->WindowStart, Volume->Window, Size));
+        Volume->WindowSize = Size;
+    }
+
+    UINT8* Entry = Volume->Window + (Offset - Volume->WindowStart);
+    switch (Volume->Type) {
+        case FAT12:
+            // the last entry of a fat12 may be the last byte of it
+            *Next = Entry[0] | ((Offset + 1 < Volume->FatSize ? Entry[1] : 0) << 8);
+            *Next = (Cluster & 1) ? (*Next >> 4) : (*Next & 0xFFF);
+            if (*Next >= 0xFF8) {
+                *Next = 0;
+            }
+            break;
+
+        case FAT16:
+            *Next = ReadUnaligned16((UINT16*)Entry);
+            if (*Next >= 0xFFF8) {
+                *Next = 0;
+            }
+            break;
+
+        case FAT32:
+            *Next = ReadUnaligned32((UINT32*)Entry) & 0x0FFFFFFF;
+            if (*Next >= 0x0FFFFFF8) {
+                *Next = 0;
+            }
+            break;
+    }
+
+    CHECK_ERROR_TRACE(*Next == 0 || IsDataCluster(Volume, *Next), EFI_VOLUME_CORRUPTED, "Cluster %d points to %x", Cluster, *Next);
+
+cleanup:
+    return Status;
+}
+
+static UINT8 ShortNameChecksum(CHAR8* Name) {
+    UINT8 Sum = 0;
+    for (int i = 0; i < 11; i++) {
+        Sum = (UINT8)(((Sum & 1) << 7) + (Sum >> 1) + (UINT8)Name[i]);
+    }
+    return Sum;
+}
+
+static BOOLEAN NameMatches(CHAR16* Name, UINTN Length, CHAR16* Other, UINTN OtherLength) {
+    if (Length != OtherLength) {
+        return FALSE;
+    }
+    for (UINTN i = 0; i < Length; i++) {
+        if (CharToUpper(Name[i]) != CharToUpper(Other[i])) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * Turn `KERNEL  ELF` into `KERNEL.ELF`
+ */
+static UINTN FormatShortName(CHAR8* Raw, CHAR16* Name) {
+    UINTN Length = 0;
+    for (int i = 0; i < 8 && Raw[i] != ' '; i++) {
+        // a name starting with 0xE5 is stored as 0x05
+        Name[Length++] = (i == 0 && (UINT8)Raw[i] == 0x05) ? 0xE5 : (UINT8)Raw[i];
+    }
+    if (Raw[8] != ' ') {
+        Name[Length++] = L'.';
+        for (int i = 8; i < 11 && Raw[i] != ' '; i++) {
+            Name[Length++] = (UINT8)Raw[i];
+        }
+    }
+    return Length;
+}
+
+/**
+ * Look for a name in a directory, both the long name and the short name
+ * of an entry are matched, cluster 0 is the root directory
+ */
+static EFI_STATUS FatFindEntry(FAT_VOLUME* Volume, UINT32 Directory, CHAR16* Name, UINTN NameLength, FAT_FILE* File) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    CHAR16 LongName[FAT_LFN_MAX_ENTRIES * FAT_LFN_CHARS];
+    UINTN LongNameLength = 0;
+    UINT8 LongNameChecksum = 0;
+    UINT8 LongNameOrder = 0;
+    CHAR16 ShortName[12];
+
+    BOOLEAN FixedRoot = Directory == 0 && Volume->Type != FAT32;
+    UINT32 Cluster = Directory == 0 ? Volume->RootCluster : Directory;
+    UINT64 RootDone = 0;
+
+    // a loop in the chain can't be longer than the disk
+    for (UINT32 Step = 0; ; Step++) {
+        UINTN Size = Volume->ClusterSize;
+        if (FixedRoot) {
+            if (RootDone == Volume->RootSize) {
+                break;
+            }
+            Size = (UINTN)MIN(Size, Volume->RootSize - RootDone);
+            CHECK_AND_RETHROW(BlockDeviceRead(Volume->Device, Volume->RootOffset + RootDone, Volume->DirBuffer, Size));
+            RootDone += Size;
+        } else {
+            if (Cluster == 0) {
+                break;
+            }
+            CHECK_ERROR_TRACE(Step <= Volume->ClusterCount, EFI_VOLUME_CORRUPTED, "Directory at cluster %d loops", Directory);
+            CHECK_AND_RETHROW(BlockDeviceRead(Volume->Device, ClusterOffset(Volume, Cluster), Volume->DirBuffer, Size));
+        }
+
+        for (UINTN Offset = 0; Offset + sizeof(FAT_DIR_ENTRY) <= Size; Offset += sizeof(FAT_DIR_ENTRY)) {
+            FAT_DIR_ENTRY* Entry = (FAT_DIR_ENTRY*)(Volume->DirBuffer + Offset);
+
+            if ((UINT8)Entry->Name[0] == FAT_ENTRY_END) {
+                goto not_found;
+            }
+
+            if ((UINT8)Entry->Name[0] == FAT_ENTRY_FREE) {
+                LongNameOrder = 0;
+                continue;
+            }
+
+            // the long name is stored backwards before the short entry
+            if ((Entry->Attributes & 0x3F) == FAT_ATTR_LONG_NAME) {
+                FAT_LFN_ENTRY* Lfn = (FAT_LFN_ENTRY*)Entry;
+                UINT8 Order = Lfn->Order & ~FAT_LFN_LAST;
+                if (Lfn->Order & FAT_LFN_LAST) {
+                    LongNameChecksum = Lfn->Checksum;
+                    LongNameLength = Order * FAT_LFN_CHARS;
+                } else if (LongNameOrder != Order + 1 || LongNameChecksum != Lfn->Checksum) {
+                    Order = 0;
+                }
+                if (Order == 0 || Order > FAT_LFN_MAX_ENTRIES) {
+                    LongNameOrder = 0;
+                    continue;
+                }
+                LongNameOrder = Order;
+
+                CHAR16* Part = LongName + (Order - 1) * FAT_LFN_CHARS;
+                CopyMem(Part, Lfn->Name1, sizeof(Lfn->Name1));
+                CopyMem(Part + 5, Lfn->Name2, sizeof(Lfn->Name2));
+                CopyMem(Part + 11, Lfn->Name3, sizeof(Lfn->Name3));
+                continue;
+            }
+
+            if (Entry->Attributes & FAT_ATTR_VOLUME_ID) {
+                LongNameOrder = 0;
+                continue;
+            }
+
+            BOOLEAN Found = NameMatches(Name, NameLength, ShortName, FormatShortName(Entry->Name, ShortName));
+            if (!Found && LongNameOrder == 1 && LongNameChecksum == ShortNameChecksum(Entry->Name)) {
+                UINTN Length = 0;
+                while (Length < LongNameLength && LongName[Length] != L'\0') {
+                    Length++;
+                }
+                Found = NameMatches(Name, NameLength, LongName, Length);
+            }
+            LongNameOrder = 0;
+
+            if (Found) {
+                File->Attributes = Entry->Attributes;
+                File->FirstCluster = ((UINT32)Entry->FirstClusterHigh << 16) | Entry->FirstClusterLow;
+                File->Size = Entry->FileSize;
+                goto cleanup;
+            }
+        }
+
+        if (!FixedRoot) {
+            CHECK_AND_RETHROW(FatNextCluster(Volume, Cluster, &Cluster));
+        }
+    }
+
+not_found:
+    Status = EFI_NOT_FOUND;
+
+cleanup:
+    return Status;
+}
+
+EFI_STATUS FatGetExtents(FAT_VOLUME* Volume, CHAR16* Path, FILE_EXTENT** Extents, UINTN* Count, UINT64* FileSize) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    FILE_EXTENT* List = NULL;
+    UINTN Capacity = 0;
+
+    *Extents = NULL;
+    *Count = 0;
+
+    // walk the path from the root
+    CHAR16* FullPath = Path;
+    FAT_FILE File = { .Attributes = FAT_ATTR_DIRECTORY, .FirstCluster = 0 };
+    while (*Path != L'\0') {
+        CHAR16* Name = Path;
+        while (*Path != L'\0' && *Path != L'\\' && *Path != L'/') {
+            Path++;
+        }
+        UINTN NameLength = Path - Name;
+        if (*Path != L'\0') {
+            Path++;
+        }
+        if (NameLength == 0 || (NameLength == 1 && Name[0] == L'.')) {
+            continue;
+        }
+
+        if (!(File.Attributes & FAT_ATTR_DIRECTORY)) {
+            Status = EFI_NOT_FOUND;
+            goto cleanup;
+        }
+
+        // not found is not worth a trace, the caller falls back
+        Status = FatFindEntry(Volume, File.FirstCluster, Name, NameLength, &File);
+        if (Status == EFI_NOT_FOUND) {
+            goto cleanup;
+        }
+        CHECK_AND_RETHROW(Status);
+    }
+
+    if (File.Attributes & FAT_ATTR_DIRECTORY) {
+        Status = EFI_NOT_FOUND;
+        goto cleanup;
+    }
+    *FileSize = File.Size;
+
+    // follow the chain for as many clusters as the file has, merging
+    // the clusters that follow each other
+    UINT32 Cluster = File.FirstCluster;
+    UINT32 Clusters = (UINT32)((File.Size + Volume->ClusterSize - 1) / Volume->ClusterSize);
+    for (UINT32 i = 0; i < Clusters; i++) {
+        CHECK_ERROR_TRACE(IsDataCluster(Volume, Cluster), EFI_VOLUME_CORRUPTED, "The cluster chain of `%s` ends early", FullPath);
+
+        CHECK_AND_RETHROW(AddFileExtent(&List, Count, &Capacity, MultU64x32(i, Volume->ClusterSize), ClusterOffset(Volume, Cluster), Volume->ClusterSize));
+
+        if (i + 1 < Clusters) {
+            CHECK_AND_RETHROW(FatNextCluster(Volume, Cluster, &Cluster));
+        }
+    }
+
+    // the last cluster is only partly the file
+    if (*Count != 0) {
+        FILE_EXTENT* Last = &List[*Count - 1];
+        Last->Length = File.Size - Last->FileOffset;
+    }
+
+    *Extents = List;
+    List = NULL;
+
+cleanup:
+    if (List != NULL) {
+        FreePool(List);
+    }
+
+    if (EFI_ERROR(Status)) {
+        *Count = 0;
+    }
+
+    return Status;
+}
@@ -0,0 +1,161 @@
+#ifndef __UTIL_FS_FSINTERNAL_H__
+#define __UTIL_FS_FSINTERNAL_H__
+
+#include "BlockRead.h"
+
+#include <Protocol/BlockIo.h>
+#include <Protocol/BlockIo2.h>
+
+/**
+ * A block device that can be read at any byte offset, the unaligned
+ * edges of a read go through a bounce buffer
+ */
+typedef struct _BLOCK_DEVICE {
+    EFI_BLOCK_IO_PROTOCOL* BlockIo;
+
+    // NULL if the device only has the blocking protocol
+    EFI_BLOCK_IO2_PROTOCOL* BlockIo2;
+
+    UINT32 MediaId;
+    UINT32 BlockSize;
+    UINT32 IoAlign;
+    UINT64 Size;
+
+    // a page aligned buffer for the edges and for buffers the device can't take
+    UINT8* Bounce;
+} BLOCK_DEVICE;
+
+/**
+ * Get the block device the file system is on
+ */
+EFI_STATUS BlockDeviceOpen(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs, BLOCK_DEVICE* Device);
+
+/**
+ * Same as BlockDeviceOpen, for a handle that has the block io protocol
+ */
+EFI_STATUS BlockDeviceOpenHandle(EFI_HANDLE Handle, BLOCK_DEVICE* Device);
+
+void BlockDeviceClose(BLOCK_DEVICE* Device);
+
+/**
+ * Read bytes at any offset into any buffer
+ */
+EFI_STATUS BlockDeviceRead(BLOCK_DEVICE* Device, UINT64 Offset, void* Buffer, UINTN Size);
+
+/**
+ * A contiguous part of a file on the device, in bytes
+ */
+typedef struct _FILE_EXTENT {
+    UINT64 FileOffset;
+    UINT64 DeviceOffset;
+    UINT64 Length;
+} FILE_EXTENT;
+
+/**
+ * Read Size bytes of a file from Offset into the buffer, the reads are queued
+ * on the device when it supports it. The extents must be sorted, anything
+ * they don't cover (holes) reads as zeros.
+ */
+EFI_STATUS BlockDeviceReadExtents(BLOCK_DEVICE* Device, FILE_EXTENT* Extents, UINTN Count, UINT64 Offset, UINT8* Buffer, UINTN Size);
+
+/**
+ * Add an extent to a pool allocated array, it is merged with the last one
+ * when it continues it
+ */
+EFI_STATUS AddFileExtent(FILE_EXTENT** Extents, UINTN* Count, UINTN* Capacity, UINT64 FileOffset, UINT64 DeviceOffset, UINT64 Length);
+
+typedef struct _FAT_VOLUME FAT_VOLUME;
+
+/**
+ * Check if the device has a FAT file system, EFI_UNSUPPORTED if not
+ */
+EFI_STATUS FatOpen(BLOCK_DEVICE* Device, FAT_VOLUME** Volume);
+
+void FatClose(FAT_VOLUME* Volume);
+
+/**
+ * Find the file and map its clusters to extents, the array is allocated
+ * from the pool and must be freed by the caller
+ */
+EFI_STATUS FatGetExtents(FAT_VOLUME* Volume, CHAR16* Path, FILE_EXTENT** Extents, UINTN* Count, UINT64* FileSize);
+
+typedef struct _EXT4_VOLUME EXT4_VOLUME;
+
+#define EXT4_ROOT_INODE 2
+
+#define EXT4_S_IFMT 0xF000
+#define EXT4_S_IFDIR 0x4000
+#define EXT4_S_IFREG 0x8000
+#define EXT4_S_IFLNK 0xA000
+
+/**
+ * An inode, with its data mapped to extents on the first read
+ */
+typedef struct _EXT4_NODE {
+    UINT32 Number;
+    UINT16 Mode;
+    UINT32 Flags;
+    UINT64 Size;
+    UINT32 AccessTime;
+    UINT32 ChangeTime;
+    UINT32 ModificationTime;
+
+    // the raw block map, extent tree root or symlink target
+    UINT8 Block[60];
+
+    FILE_EXTENT* Extents;
+    UINTN Count;
+    BOOLEAN Mapped;
+} EXT4_NODE;
+
+typedef struct _EXT4_DIR_ENTRY {
+    UINT32 Inode;
+    UINT8 NameLength;
+    CHAR8 Name[256];
+} EXT4_DIR_ENTRY;
+
+/**
+ * Decode a utf-8 name, the buffer must have room for Length + 1 chars
+ */
+UINTN Ext4NameToUnicode(CHAR8* Name, UINTN Length, CHAR16* Buffer);
+
+/**
+ * Check if the device has an ext2/3/4 file system we can read, EFI_UNSUPPORTED if not
+ */
+EFI_STATUS Ext4Open(BLOCK_DEVICE* Device, EXT4_VOLUME** Volume);
+
+void Ext4Close(EXT4_VOLUME* Volume);
+
+/**
+ * The size of the volume, how much of it is free and its label
+ */
+void Ext4GetVolumeInfo(EXT4_VOLUME* Volume, UINT64* VolumeSize, UINT64* FreeSpace, UINT32* BlockSize, CHAR16* Label, UINTN LabelSize);
+
+EFI_STATUS Ext4GetNode(EXT4_VOLUME* Volume, UINT32 Number, EXT4_NODE* Node);
+
+void Ext4FreeNode(EXT4_NODE* Node);
+
+/**
+ * Read part of a file, holes and anything past the end read as zeros
+ */
+EFI_STATUS Ext4ReadNode(EXT4_VOLUME* Volume, EXT4_NODE* Node, UINT64 Offset, void* Buffer, UINTN Size);
+
+/**
+ * Read the directory entry at the position and move past it, EFI_NOT_FOUND
+ * at the end of the directory
+ */
+EFI_STATUS Ext4ReadDirEntry(EXT4_VOLUME* Volume, EXT4_NODE* Directory, UINT64* Position, EXT4_DIR_ENTRY* Entry);
+
+/**
+ * Find a path relative to a directory (or the root if it starts with a
+ * separator), symlinks are followed. EFI_NOT_FOUND is returned quietly.
+ */
+EFI_STATUS Ext4Lookup(EXT4_VOLUME* Volume, UINT32 Directory, CHAR16* Path, EXT4_NODE* Node);
+
+/**
+ * Find the file from the root and map it to extents, the array is
+ * allocated from the pool and must be freed by the caller
+ */
+EFI_STATUS Ext4GetExtents(EXT4_VOLUME* Volume, CHAR16* Path, FILE_EXTENT** Extents, UINTN* Count, UINT64* FileSize);
+
+#endif //__UTIL_FS_FSINTERNAL_H__